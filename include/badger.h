@@ -20,11 +20,38 @@
 #ifndef BADGER_H
 #define BADGER_H
 
+#include <stddef.h>
+#include <time.h>
+
 /*!
   Return a string describing \c err.
 */
 const char* bdgr_error_string( int err );
 
+/*!
+  Routes every allocation of Badger through \c malloc_fn, \c realloc_fn
+  and \c free_fn, along with those of jansson and, when built with it, GMP.
+  libcurl gets them once Badger initializes it.  LibTomCrypt allocates
+  with the allocator it was built with.
+  \note Must be called before anything else, the allocator being fixed once
+  Badger has initialized.  jansson and GMP keep the hooks for the whole
+  process.
+  \param[in] malloc_fn   allocates memory
+  \param[in] realloc_fn  resizes memory from \c malloc_fn
+  \param[in] free_fn     frees memory from \c malloc_fn or \c realloc_fn
+*/
+int bdgr_set_allocator(
+    void* (*malloc_fn)( size_t size ),
+    void* (*realloc_fn)( void* ptr, size_t size ),
+    void (*free_fn)( void* ptr )
+);
+
+/*!
+  Frees memory Badger handed over, with the allocator set by
+  bdgr_set_allocator() or free() by default.
+*/
+void bdgr_free( void* ptr );
+
 /*!
    \struct bdgr_badge
    \brief The badge data structure.
@@ -61,6 +88,13 @@ struct bdgr_badge {
        The size in bytes of bdgr_badge::signature
     */
     const unsigned long int signature_len;
+
+    /*!
+       \var bdgr_badge::kid
+       A null-terminated key id naming the key of the record the badge was
+       signed with, or NULL to use the record's "dsa" key.
+    */
+    const char*             kid;
     
 };
 typedef struct bdgr_badge bdgr_badge;
@@ -139,7 +173,7 @@ int bdgr_key_export_private(
 
 /*!
   Export public \c key to base64 encoded character data.
-  \note \c string must be freed by user with free().
+  \note \c string must be freed by user with bdgr_free().
   \param[in]  key     key to encode
   \param[out] string  base64 character string
 */
@@ -150,7 +184,7 @@ int bdgr_key_encode_public(
 
 /*!
   Export private \c key to base64 encoded character data.
-  \note String must be freed by user with free().
+  \note String must be freed by user with bdgr_free().
   \param[in]  key
   \param[in]  key     key to encode
   \param[out] string  base64 character string
@@ -168,9 +202,70 @@ void bdgr_key_free(
     bdgr_key* key
 );
 
+/*!
+  \struct bdgr_key_set
+  \brief
+  A compact, append only store of public keys for keeping many identities
+  resident.  Domain parameters are interned and shared by every key using
+  them, so each key costs little more than its y.
+  \note Adding keys needs exclusive access, getting them doesn't.
+ */
+typedef struct bdgr_key_set bdgr_key_set;
+
+/*!
+  Creates an empty key set.
+  \note Use bdgr_key_set_free() to release resources.
+  \param[out] set  key set to create
+*/
+int bdgr_key_set_new(
+    bdgr_key_set** set
+);
+
+/*!
+  Adds the public part of \c key to \c set.
+  \param[in]  set    key set to add to
+  \param[in]  key    key to add, which the set doesn't keep
+  \param[out] index  index to get the key back with
+*/
+int bdgr_key_set_add(
+    bdgr_key_set* set,
+    const bdgr_key* key,
+    unsigned long int* index
+);
+
+/*!
+  Initializes \c key, ready to verify with, from the key at \c index.
+  \note Use bdgr_key_free() to release resources.
+  \param[in]  set    key set holding the key
+  \param[in]  index  index returned by bdgr_key_set_add()
+  \param[out] key    public key to initialize
+*/
+int bdgr_key_set_get(
+    const bdgr_key_set* set,
+    unsigned long int index,
+    bdgr_key* key
+);
+
+/*!
+  Returns the number of keys in \c set.
+*/
+unsigned long int bdgr_key_set_count(
+    const bdgr_key_set* set
+);
+
+/*!
+  Frees \c set and the keys it holds, along with domain parameters no
+  other set has keys in.
+*/
+void bdgr_key_set_free(
+    bdgr_key_set* set
+);
+
 /*!
   Signs \c token using a private DSA key.  The signature is written to
-  \c signature of initial length \c signature_len.
+  \c signature of initial length \c signature_len.  The nonce is derived
+  from the key and \c token as in RFC 6979, so signing needs no entropy
+  and the same token always gets the same signature.
   \param[in]     token          token to sign
   \param[in]     token_len      length of token buffer
   \param[in]     key            key to use when signing
@@ -204,8 +299,32 @@ int bdgr_badge_make(
     bdgr_badge* badge
 );
 
+/*!
+  Copies all data into a badge struct naming the key it was signed with.
+  Key ids are 1 to 32 letters, digits, dots, dashes or underscores.
+  \note Use bdgr_badge_free() to release resources.
+  \param[in]  id             identity url character string
+  \param[in]  kid            key id, or NULL for none
+  \param[in]  token          raw token data
+  \param[in]  token_len      length of token buffer
+  \param[in]  signature      raw signature data
+  \param[in]  signature_len  length of signature buffer
+  \param[out] badge          badge to initialize
+*/
+int bdgr_badge_make_kid(
+    const char* id,
+    const char* kid,
+    const unsigned char* token,
+    const unsigned long int token_len,
+    const unsigned char* signature,
+    const unsigned long signature_len,
+    bdgr_badge* badge
+);
+
 /*!
   Verify \c badge. The \c verified flag will be set accordingly.
+  \note Safe to call from several threads at once.  Concurrent calls for the
+  same Identity URL share a single record fetch.
   \param[in]  badge     badge to verify
   \param[out] verified  pointer to flag that will be set to 1 if verified
 */
@@ -214,6 +333,111 @@ int bdgr_badge_verify(
     int* verified
 );
 
+/*!
+  Verify \c badge, giving up once \c deadline has passed.  Every stage of the
+  verification checks the deadline, and record fetches are bounded by the
+  time remaining.  Returns a timeout error if the deadline is exceeded.
+  \param[in]  badge     badge to verify
+  \param[in]  deadline  absolute CLOCK_MONOTONIC deadline, or NULL for none
+  \param[out] verified  pointer to flag that will be set to 1 if verified
+*/
+int bdgr_badge_verify_deadline(
+    const bdgr_badge* badge,
+    const struct timespec* deadline,
+    int* verified
+);
+
+/*!
+  Returns the milliseconds left before the deadline of the verification
+  running on the calling thread, 0 if it has passed, or -1 if there is no
+  deadline.  Scheme handlers use this to bound their lookups.
+*/
+long int bdgr_deadline_remaining_ms();
+
+/*!
+  \struct bdgr_verify
+  \brief A verification running on an event loop.
+ */
+typedef struct bdgr_verify bdgr_verify;
+
+/*!
+  Called with the outcome of a verification started with
+  bdgr_verify_start().  \c verify is released once this returns.
+*/
+typedef void (*bdgr_verify_done)(
+    bdgr_verify* verify,
+    int err,
+    int verified,
+    void* ctx
+);
+
+/*!
+  Starts verifying \c badge without blocking.  The badge is copied.  Its
+  outcome is passed to \c done from within bdgr_verify_process(), on the
+  thread running the event loop, which must be the only thread calling the
+  bdgr_verify_*() functions.  Verifications of the same Identity URL share a
+  record fetch.
+  \note Handlers added with bdgr_scheme_handler_add(), and the nmc: and id:
+  schemes, block the loop unless workers were started with
+  bdgr_verify_workers().
+  \param[in]  badge     badge to verify
+  \param[in]  deadline  absolute CLOCK_MONOTONIC deadline, or NULL for none
+  \param[in]  done      called with the outcome
+  \param[in]  ctx       passed to \c done
+  \param[out] verify    handle to cancel the verification with
+*/
+int bdgr_verify_start(
+    const bdgr_badge* badge,
+    const struct timespec* deadline,
+    bdgr_verify_done done,
+    void* ctx,
+    bdgr_verify** verify
+);
+
+/*!
+  Returns the file descriptor the event loop should watch for reading on
+  behalf of the running verifications, or -1 on error.  Record fetches over
+  http: and https: run on a thread of their own and are announced through
+  it, along with anything else that finishes off the loop.
+  \note Badger drives curl itself rather than through curl's multi socket
+  interface, so the sockets and timers of the fetches are not handed to the
+  loop; this one descriptor and bdgr_verify_timeout() are all it watches.
+*/
+int bdgr_verify_fd();
+
+/*!
+  Returns the milliseconds the event loop may wait before calling
+  bdgr_verify_process() to time out a verification, or -1 if none has a
+  deadline.
+*/
+long int bdgr_verify_timeout();
+
+/*!
+  Moves the running verifications along and calls \c done for those that
+  finished or timed out.  Call it when bdgr_verify_fd() is readable and
+  when the time from bdgr_verify_timeout() has passed.
+  \param[in] fd      descriptor that became ready, or -1 on a timeout
+  \param[in] events  events seen on \c fd, unused as only reading is
+                     watched for
+*/
+int bdgr_verify_process( int fd, int events );
+
+/*!
+  Cancels \c verify, whose \c done will not be called.  A record fetch it
+  started goes on for the other verifications of its Identity URL.  If
+  there are none it is cancelled through its scheme handler, as http: and
+  https: fetches are, or otherwise left to finish and cache the key.
+*/
+void bdgr_verify_cancel( bdgr_verify* verify );
+
+/*!
+  Starts \c workers threads, if fewer are running, that check signatures
+  and run blocking scheme handlers for bdgr_verify_start().  Without workers
+  everything runs on the event loop.
+  \param[in] workers  number of worker threads
+*/
+int bdgr_verify_workers( unsigned long int workers );
+
 /*!
   Verify a token was signed by public DSA \c key.
   \param[in]  token          raw token data
@@ -233,7 +457,127 @@ int bdgr_signature_verify(
 );
 
 /*!
-  Parses out the DSA public \c key in \c record.
+  Adds a server key for session tickets, which issues tickets from then on.
+  The three keys added before it still check the tickets they issued.
+  Servers sharing a key accept each other's tickets.
+  \param[in] key      AES key
+  \param[in] key_len  16, 24 or 32
+*/
+int bdgr_session_ticket_key_add(
+    const unsigned char* key,
+    unsigned long int key_len
+);
+
+/*!
+  Adds a random server key for session tickets, as if by
+  bdgr_session_ticket_key_add().  Call it periodically to rotate keys.  A
+  random key is added on the first ticket issued if none was.
+*/
+int bdgr_session_ticket_rotate();
+
+/*!
+  Issues a session ticket for the Identity URL \c id, normally that of a
+  badge bdgr_badge_verify() just verified.  The ticket is encrypted and
+  authenticated with the current server key.
+  \param[in]     id          Identity URL the ticket is for
+  \param[in]     lifetime    seconds the ticket stays valid
+  \param[out]    ticket      buffer to write the ticket into
+  \param[in,out] ticket_len  initial size of ticket / written length, or
+                              the size needed if it is too small
+*/
+int bdgr_session_ticket_issue(
+    const char* id,
+    unsigned long int lifetime,
+    unsigned char* ticket,
+    unsigned long int* ticket_len
+);
+
+/*!
+  Checks a ticket issued by bdgr_session_ticket_issue(), without any
+  lookup.  Fails if it was tampered with, has expired, or its key was
+  rotated out.
+  \note You must call bdgr_free() on \c id when done.
+  \param[in]  ticket      ticket to check
+  \param[in]  ticket_len  length of \c ticket
+  \param[out] id          Identity URL the ticket was issued for
+*/
+int bdgr_session_ticket_check(
+    const unsigned char* ticket,
+    unsigned long int ticket_len,
+    char** id
+);
+
+/*!
+  Adds a server key for server tokens, which makes tokens from then on.
+  The three keys added before it still check the tokens they made.
+  Servers sharing a key accept each other's tokens.
+  \param[in] key      HMAC key
+  \param[in] key_len  16 to 64
+*/
+int bdgr_server_token_key_add(
+    const unsigned char* key,
+    unsigned long int key_len
+);
+
+/*!
+  Adds a random server key for server tokens, as if by
+  bdgr_server_token_key_add().  Call it periodically to rotate keys.  A
+  random key is added on the first token made if none was.
+*/
+int bdgr_server_token_rotate();
+
+/*!
+  Makes a token to hand a client for signing.  It carries a random nonce,
+  the time it was made and \c audience, authenticated with an HMAC under
+  the current server key, so that it can be checked later without having
+  been stored.
+  \param[in]     audience   service the token is for, or NULL
+  \param[out]    token      buffer to write the token into
+  \param[in,out] token_len  initial size of token / written length, or
+                             the size needed if it is too small
+*/
+int bdgr_server_token_make(
+    const char* audience,
+    unsigned char* token,
+    unsigned long int* token_len
+);
+
+/*!
+  Checks a token made by bdgr_server_token_make() with one of the server
+  keys, without any lookup.  Fails if it was tampered with, was made for
+  another audience, or is \c max_age seconds old or more.
+  \param[in] token      token to check
+  \param[in] token_len  length of \c token
+  \param[in] max_age    seconds the token stays fresh, or 0 for no limit
+  \param[in] audience   audience the token must be for, or NULL for any
+*/
+int bdgr_server_token_check(
+    const unsigned char* token,
+    unsigned long int token_len,
+    unsigned long int max_age,
+    const char* audience
+);
+
+/*!
+  Makes bdgr_badge_verify() and bdgr_verify_start() accept only badges
+  whose token passes bdgr_server_token_check() with \c max_age and
+  \c audience.  The check comes before any fetch or signature check, so
+  forged and stale tokens cost next to nothing.
+  \param[in] max_age   seconds a token stays fresh, or 0 to stop requiring
+                        server tokens
+  \param[in] audience  audience tokens must be for, or NULL for any
+*/
+int bdgr_server_token_require(
+    unsigned long int max_age,
+    const char* audience
+);
+
+/*!
+  Parses out the DSA public \c key in \c record, which is refused if it
+  repeats a member of any object.  The key must pass the checks of the key
+  spec: p and q prime, q dividing p - 1, and g and y of order q.  The
+  domain parameters of a group are checked only the first time a key in it
+  is seen.
   \param[in]   record  JSON-encoded record containing "dsa" attribute.
   \param[out]  key     DSA key container.
 */
@@ -242,6 +586,25 @@ int bdgr_record_import(
     bdgr_key* key
 );
 
+/*!
+  Parses out the DSA public \c key named \c kid in \c record, checked like
+  bdgr_record_import() does.  A record lists its keys in a "keys" array of
+  objects, each with a "kid", a "dsa" key and optionally "nbf" and "exp",
+  the times in seconds since the epoch from which and until which the key
+  may be used.  A record may keep a "dsa" attribute besides, for badges
+  without a key id.  bdgr_badge_verify() picks the key named by the badge
+  this way, so a record can hold the keys of several devices or of a key
+  rotation at the cost of a single signature check.
+  \param[in]   record  JSON-encoded record
+  \param[in]   kid     key id, or NULL for the "dsa" attribute
+  \param[out]  key     DSA key container.
+*/
+int bdgr_record_import_kid(
+    const char* record,
+    const char* kid,
+    bdgr_key* key
+);
+
 /*!
   Import a badge from JSON.
   \param[in]  json_string  JSON string to import
@@ -254,7 +617,7 @@ int bdgr_badge_import(
 
 /*!
   Export a badge to JSON.
-  \note You must call free() on \c json_string when done.
+  \note You must call bdgr_free() on \c json_string when done.
   \param[in]  badge        badge to export to JSON
   \param[out] json_string  JSON string of badge
 */
@@ -271,11 +634,331 @@ void bdgr_badge_free(
 );
 
 /*!
-  Add a scheme handler to bdgr_badge_verify().
+  Add a blocking scheme handler to bdgr_badge_verify(), replacing any
+  handler added earlier for \c scheme.  \c handle_url is called on the
+  verifying thread and its \c record is copied before it returns.
+  \param[in]  scheme      scheme to handle, e.g. "https:"
+  \param[in]  handle_url  handler called with the Identity URL
 */
 int bdgr_scheme_handler_add(
     char* scheme,
     int (*handle_url)( const char* url, const char** record )
 );
 
+/*!
+  \struct bdgr_lookup
+  \brief
+  A single Identity URL lookup handed to an asynchronous scheme handler.
+  The handler writes the record with bdgr_lookup_write() and finishes with
+  bdgr_lookup_complete().
+ */
+typedef struct bdgr_lookup bdgr_lookup;
+
+/*!
+  Add an asynchronous scheme handler to bdgr_badge_verify(), replacing any
+  handler added earlier for \c scheme.  \c start is called for every lookup
+  and returns 0 once the lookup is under way, in which case the handler must
+  call bdgr_lookup_complete() on it exactly once, from any thread and
+  possibly before \c start returns.  Returning nonzero means the lookup was
+  not started and must not be completed.  When the verification deadline
+  passes first \c cancel, if not NULL, is called; the lookup stays valid
+  until it is completed, which may already have happened.
+  \param[in]  scheme  scheme to handle, e.g. "https:"
+  \param[in]  start   starts a lookup
+  \param[in]  cancel  asks a started lookup to complete early, or NULL
+  \param[in]  ctx     passed to \c start and \c cancel
+*/
+int bdgr_scheme_handler_add_async(
+    const char* scheme,
+    int (*start)( bdgr_lookup* lookup, void* ctx ),
+    void (*cancel)( bdgr_lookup* lookup, void* ctx ),
+    void* ctx
+);
+
+/*!
+  Returns the Identity URL \c lookup is for.
+*/
+const char* bdgr_lookup_url( const bdgr_lookup* lookup );
+
+/*!
+  Returns the absolute CLOCK_MONOTONIC deadline of \c lookup, or NULL if
+  it has none.
+*/
+const struct timespec* bdgr_lookup_deadline( const bdgr_lookup* lookup );
+
+/*!
+  Appends \c size bytes of \c data to the record of \c lookup.  The record
+  is scanned as it is written and only its dsa attribute is kept, so the
+  handler needn't keep \c data around.  Once the record has been read to
+  its end further writes are ignored.  A record with more than one dsa
+  attribute, or over the limit set with bdgr_record_limit(), fails the
+  lookup.
+  \param[in]  lookup  lookup being answered
+  \param[in]  data    part of the record
+  \param[in]  size    size of \c data in bytes
+*/
+int bdgr_lookup_write(
+    bdgr_lookup* lookup,
+    const char* data,
+    unsigned long int size
+);
+
+/*!
+  Completes \c lookup with the record written so far, or fails it with the
+  error \c err if nonzero.  \c lookup must not be used afterwards.
+  \param[in]  lookup  lookup being answered
+  \param[in]  err     0 on success, otherwise a badger error code
+*/
+void bdgr_lookup_complete( bdgr_lookup* lookup, int err );
+
+/*!
+  Limits the size of a record.  Record fetches over http: and https: are
+  aborted as soon as the record has been read or the limit is exceeded.  The
+  default is 64 KiB.
+  \param[in] max_size  bytes a record may take, or 0 for no limit
+*/
+int bdgr_record_limit( unsigned long int max_size );
+
+/*!
+  Limits the size of badges.  bdgr_badge_import() refuses a badge over
+  \c max_size before parsing it and a token or signature over its limit
+  before decoding it, and bdgr_badge_verify() refuses them before any
+  fetch.  The defaults are 16 KiB, 4096 and 512 bytes.
+  \param[in] max_size           bytes an exported badge may take
+  \param[in] max_token_len      bytes a raw token may take
+  \param[in] max_signature_len  bytes a raw signature may take
+  \note A limit of 0 means none.
+*/
+int bdgr_badge_limit(
+    unsigned long int max_size,
+    unsigned long int max_token_len,
+    unsigned long int max_signature_len
+);
+
+/*!
+  Limits the modulus of keys read from records.  Oversized keys are turned
+  away by the length of their encoding before they are decoded, and by the
+  size of p before their domain parameters are checked.  The default is
+  4096 bits.
+  \param[in] max_bits  bits the modulus may take, or 0 for no limit
+*/
+int bdgr_key_limit( unsigned long int max_bits );
+
+/*!
+  Rate limits key fetches for each Identity URL with a token bucket of
+  \c burst tokens, refilled one every \c interval_ms milliseconds.  A badge
+  whose key isn't cached is refused before the fetch if the bucket of its
+  Identity URL is empty.  Badges whose key is cached don't count and are
+  never refused, so forged badges can't lock an identity out.  Past 65536
+  identities with fetches in hand, the rest share one bucket.  Off by
+  default.
+  \param[in] burst        fetches allowed at once, or 0 for no limit
+  \param[in] interval_ms  milliseconds to earn another one
+*/
+int bdgr_rate_limit_identity(
+    unsigned long int burst,
+    unsigned long int interval_ms
+);
+
+/*!
+  Rate limits record fetches for \c scheme with a token bucket of \c burst
+  tokens, refilled one every \c interval_ms milliseconds.  Keys found in
+  the cache don't count.  Off by default.
+  \param[in] scheme       scheme, with or without its colon
+  \param[in] burst        fetches allowed at once, or 0 for no limit
+  \param[in] interval_ms  milliseconds to earn another one
+*/
+int bdgr_rate_limit_scheme(
+    const char* scheme,
+    unsigned long int burst,
+    unsigned long int interval_ms
+);
+
+/*!
+  Sets the key shared by all nodes that authenticates peer requests and
+  answers, as set out at bdgr_peers_set().  Peer fill stays off until it
+  is set.
+  \param[in] key      shared secret, the same on every node
+  \param[in] key_len  length of \c key, 16 to 64 bytes
+*/
+int bdgr_peer_key_set(
+    const unsigned char* key,
+    unsigned long int key_len
+);
+
+/*!
+  Sets the schemes whose records this node fetches when a peer asks for
+  them.  A peer asking for another scheme is sent to its own handler.  The
+  default is http: and https:.
+  \param[in] schemes  schemes, with or without their colon
+  \param[in] count    number of \c schemes, at most 8
+*/
+int bdgr_peer_schemes(
+    const char* const* schemes,
+    unsigned long int count
+);
+
+/*!
+  Answers the lookups of peers on \c address from a thread of its own.
+  Each answer comes from the key cache, or from a fetch of the record
+  shared with any already under way.  Only Identity URLs this node owns,
+  in the schemes set with bdgr_peer_schemes(), are answered, and a
+  request without a good tag is hung up on.  Fails unless the peer key
+  was set with bdgr_peer_key_set().
+  \param[in] address  host:port to listen on, which may be a wildcard; the
+                       other nodes reach it at the entry named \c self
+                       in bdgr_peers_set()
+*/
+int bdgr_peer_listen( const char* address );
+
+/*!
+  Turns on peer fill: each Identity URL is owned by one of \c peers by
+  consistent hashing, and a key missing from the cache is asked of its
+  owner before the authority, so the authority sees about one fetch per
+  record whatever the number of nodes.  An owner that doesn't accept the
+  connection within 250 ms, or doesn't answer within the deadline or five
+  seconds, is passed over.  URLs owned by \c peers[self] are this node's
+  and fetched as usual; a node that isn't one of \c peers asks for all of
+  them.  The entry is named rather than matched against the address
+  listened on, which may be spelled another way or be a wildcard such as
+  0.0.0.0.
+
+  Trust: requests and answers carry an HMAC under the key set with
+  bdgr_peer_key_set(), bound to a nonce of the request, so that nobody
+  without the key can ask a node to fetch for them or pass an answer off,
+  and an answer can't be replayed for another request.  Every node holding
+  the key is trusted as much as the authority for the URLs it owns: the
+  key it answers with is cached and checked against like a fetched one.
+  The key doesn't encrypt anything, and who learns it can vouch for any
+  key, so keep it and the peer network private, and rotate it on every
+  node when a node is retired.
+  \param[in] peers  host:port of every node, the same list on all of them
+  \param[in] count  number of \c peers, or 0 to turn peer fill off
+  \param[in] self   index of this node in \c peers, or -1 if it isn't one
+*/
+int bdgr_peers_set(
+    const char* const* peers,
+    unsigned long int count,
+    long int self
+);
+
+/*!
+  Sets how many record fetches from one host share a connection.  Fetches
+  over https: are multiplexed over HTTP/2 up to \c streams at a time per
+  connection, and hosts without HTTP/2 are fetched from over HTTP/1.1.  The
+  default is 100.
+  \param[in] streams  concurrent streams per connection, or 0 to fetch every
+                      record over its own HTTP/1.1 transfer
+*/
+int bdgr_http_streams( unsigned long int streams );
+
+/*!
+  Chooses the bignum backend: "gmp", "ltm" or "tfm" if LibTomCrypt was built
+  with it, or "auto" to time each one on the arithmetic of a signature
+  check and keep the fastest.  The BADGER_MATH environment variable takes
+  the same values and is used when this isn't called.  The first backend
+  built in is used otherwise.  Signatures with the 1024/160 bit groups of
+  Badger keys are checked and made without the backend, which serves key
+  generation, the check of a key's y when it is first seen, and other
+  groups.
+  \note Must be called before anything else, the backend being fixed once
+  Badger has initialized.
+  \param[in] name  backend to use
+*/
+int bdgr_math_set( const char* name );
+
+/*!
+  Returns the name of the bignum backend in use, initializing Badger if
+  needed, or NULL on error.
+*/
+const char* bdgr_math_name();
+
+/*!
+  Opens the key cache consulted by bdgr_badge_verify() before it calls a
+  scheme handler.  The cache maps Identity URLs to the hash of their record,
+  the decoded public key and the time it was fetched.  A file backed cache
+  survives restarts and is written back to disk asynchronously.  Records
+  fetched over HTTP stay fresh for as long as their Cache-Control or Expires
+  headers allow, and stale ones are revalidated with the ETag and
+  Last-Modified the host sent, keeping the cached key when unchanged.
+  \note An existing cache file keeps the number of slots it was created with.
+  \param[in] path     cache file, or NULL for a cache kept only in memory
+  \param[in] slots    number of entries to create the cache with
+  \param[in] max_age  seconds an entry without HTTP freshness stays valid,
+                      or 0 to never expire
+*/
+int bdgr_key_cache_open(
+    const char* path,
+    unsigned long int slots,
+    unsigned long int max_age
+);
+
+/*!
+  Opens the key cache of bdgr_key_cache_open() in a POSIX shared memory
+  object, so that the processes of a prefork server share one cache and
+  fetch each Identity URL once per host rather than once per process.
+  Lookups read the cache without taking a lock, and a process about to
+  fetch a missing key has the others wait for its entry rather than fetch
+  it too.  The cache lasts until the object is unlinked or the host
+  restarts.
+  \note Only blocking verification waits on other processes' fetches.
+  \param[in] name     shared memory object, such as "/badger-keys"
+  \param[in] slots    number of entries to create the cache with
+  \param[in] max_age  seconds an entry without HTTP freshness stays valid,
+                      or 0 to never expire
+*/
+int bdgr_key_cache_shared(
+    const char* name,
+    unsigned long int slots,
+    unsigned long int max_age
+);
+
+/*!
+  Flushes and closes the key cache opened with bdgr_key_cache_open() or
+  bdgr_key_cache_shared().
+*/
+void bdgr_key_cache_close();
+
+/*!
+  Enables negative caching of failed lookups in bdgr_badge_verify().  An
+  Identity URL whose lookup failed is not looked up again until its TTL has
+  passed, and the TTL doubles with every consecutive failure.  A TTL of 0
+  disables caching of that kind of failure.
+  \param[in] not_found_ttl  seconds to remember ids unknown to the authority
+  \param[in] malformed_ttl  seconds to remember ids with unusable records
+  \param[in] transport_ttl  seconds to back off after a failed fetch
+  \param[in] max_backoff    upper bound in seconds of any wait, or 0
+*/
+int bdgr_negative_cache_set(
+    unsigned long int not_found_ttl,
+    unsigned long int malformed_ttl,
+    unsigned long int transport_ttl,
+    unsigned long int max_backoff
+);
+
+/*!
+  Starts mirroring the Namecoin id/ namespace in memory.  The mirror is
+  bootstrapped from namecoind before this returns, after which the nmc: and
+  id: schemes answer id/ lookups from memory.  New blocks are polled for
+  changed names at most every \c poll_interval seconds.  namecoind is
+  reached as set in ~/.namecoin/bitcoin.conf, or at the URL in the
+  BADGER_NMC_RPC environment variable.
+  \param[in] poll_interval  minimum seconds between polls of namecoind
+*/
+int bdgr_nmc_mirror_start(
+    unsigned long int poll_interval
+);
+
+/*!
+  Brings the Namecoin mirror up to date with the blocks mined since it
+  was last synchronized.
+*/
+int bdgr_nmc_mirror_sync();
+
+/*!
+  Stops the Namecoin mirror and releases its memory, once a sync under way
+  has returned.
+*/
+void bdgr_nmc_mirror_stop();
+
 #endif
@@ -19,16 +19,23 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <pwd.h>
-#include <unistd.h>
-#include <sys/types.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <tomcrypt.h>
 #include <jansson.h>
 #include <curl/curl.h>
 #include <badger.h>
+#include "badger_alloc.h"
 #include "badger_err.h"
-
-static int bdgr_init();
+#include "badger_cache.h"
+#include "badger_dsa.h"
+#include "badger_group.h"
+#include "badger_limit.h"
+#include "badger_math.h"
+#include "badger_scheme.h"
+#include "badger_table.h"
+#include "badger_token.h"
 
 int bdgr_key_generate(
     const char* const password,
@@ -86,7 +93,7 @@ int bdgr_key_generate(
         goto bdgr_key_generate_free;
     }
 
-    key->_impl = malloc( sizeof( dsa_key ));
+    key->_impl = bdgr_malloc( sizeof( dsa_key ));
     bdgr_check( key->_impl == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_key_generate_free;
@@ -110,7 +117,7 @@ int bdgr_key_generate(
     rc4_done( &prng );
 
     if( bdgr_error() && key->_impl != NULL ) {
-        free( key->_impl );
+        bdgr_free( key->_impl );
     }
 
     return bdgr_error();
@@ -128,13 +135,17 @@ int bdgr_key_import(
         return bdgr_error();
     }
 
-    key->_impl = malloc( sizeof( dsa_key ));
+    key->_impl = bdgr_malloc( sizeof( dsa_key ));
     bdgr_check( key->_impl == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         return bdgr_error();
     }
     
     bdgr_crypt( dsa_import( data, data_len, (dsa_key*)key->_impl ), __LINE__ );
+    if( bdgr_error() ) {
+        bdgr_free( key->_impl );
+        key->_impl = NULL;
+    }
 
     return bdgr_error();
 }
@@ -146,7 +157,7 @@ int bdgr_key_decode(
 {
     unsigned long int string_len = strlen( string );
     unsigned long int data_len = string_len;
-    unsigned char* data = malloc( data_len );
+    unsigned char* data = bdgr_malloc( data_len );
     bdgr_check( data == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         return bdgr_error();
@@ -154,7 +165,7 @@ int bdgr_key_decode(
     
     bdgr_init();
     if( bdgr_error() ) {
-        return bdgr_error();
+        goto bdgr_key_decode_free;
     }
     
     bdgr_crypt( base64_decode(
@@ -173,7 +184,7 @@ int bdgr_key_decode(
 
  bdgr_key_decode_free:
 
-    free( data );
+    bdgr_free( data );
     return bdgr_error();
 }
 
@@ -209,7 +220,7 @@ static int bdgr_key_encode(
 {
     char* string_out;
     unsigned long int data_len = 2048, string_out_len;
-    unsigned char* data = malloc( data_len );
+    unsigned char* data = bdgr_malloc( data_len );
     bdgr_check( data == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         return bdgr_error();
@@ -223,7 +234,7 @@ static int bdgr_key_encode(
         goto bdgr_key_encode_free;
     }
     string_out_len = (data_len * 1.37) + 815;
-    string_out = malloc( string_out_len );
+    string_out = bdgr_malloc( string_out_len );
     bdgr_check( string_out == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_key_encode_free;
@@ -238,10 +249,10 @@ static int bdgr_key_encode(
     
  bdgr_key_encode_free:
 
-    free( data );
+    bdgr_free( data );
     if( bdgr_error() ) {
         if( string_out ) {
-            free( string_out );
+            bdgr_free( string_out );
         }
     } else {
         if( string_out ) {
@@ -272,7 +283,7 @@ void bdgr_key_free(
 )
 {
     dsa_free( (dsa_key*)key->_impl );
-    free( key->_impl );
+    bdgr_free( key->_impl );
 }
 
 int bdgr_token_sign(
@@ -283,29 +294,15 @@ int bdgr_token_sign(
     unsigned long int* const signature_len
 )
 {
-    prng_state prng;
-    
     bdgr_init();
     if( bdgr_error() ) {
         return bdgr_error();
     }
 
-    bdgr_check( register_prng( &fortuna_desc ) == -1,
-                bdgr_register_prng_err, __LINE__ );
-    if( bdgr_error() ) {
-        return bdgr_error();
-
-    }
-    bdgr_crypt( rng_make_prng(
-                    128, find_prng("fortuna"), &prng, NULL ),
-                __LINE__ );
-    if( bdgr_error() ) {
-        return bdgr_error();
-    }
-    bdgr_crypt( dsa_sign_hash(
+    /* The nonce comes from the key and token, no PRNG to seed */
+    bdgr_crypt( bdgr_dsa_sign_hash(
                     token, token_len,
                     signature, signature_len,
-                    &prng, find_prng( "fortuna" ),
                     (dsa_key*)key->_impl ),
                 __LINE__ );
     if( bdgr_error() ) {
@@ -314,6 +311,14 @@ int bdgr_token_sign(
     return bdgr_no_err;
 }
 
+int bdgr_kid_valid( const char* const kid )
+{
+    const size_t len = strlen( kid );
+    return len > 0 && len <= BDGR_KID_MAX &&
+        strspn( kid, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                "0123456789._-" ) == len;
+}
+
 int bdgr_badge_make(
     const char* const id,
     const unsigned char* const token,
@@ -322,8 +327,28 @@ int bdgr_badge_make(
     const unsigned long int signature_len,
     bdgr_badge* const badge
 )
+{
+    return bdgr_badge_make_kid( id, NULL, token, token_len,
+                                signature, signature_len, badge );
+}
+
+int bdgr_badge_make_kid(
+    const char* const id,
+    const char* const kid,
+    const unsigned char* const token,
+    const unsigned long int token_len,
+    const unsigned char* const signature,
+    const unsigned long int signature_len,
+    bdgr_badge* const badge
+)
 {
     unsigned long int id_len = strlen( id );
+
+    bdgr_check( kid != NULL && !bdgr_kid_valid( kid ), bdgr_kid_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+
     memcpy( (void*)&badge->token_len,
             &token_len,
             sizeof( token_len ));
@@ -331,26 +356,38 @@ int bdgr_badge_make(
             &signature_len,
             sizeof( signature_len ));
     
-    badge->id = malloc( id_len );
+    badge->id = bdgr_malloc( id_len + 1 );
     bdgr_check( badge->id == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         return bdgr_error();
     }
     
-    badge->token = malloc( token_len );
+    badge->token = bdgr_malloc( token_len );
     bdgr_check( badge->token == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
-        free( (char*)badge->id );
+        bdgr_free( (char*)badge->id );
         return bdgr_error();
     }
     
-    badge->signature = malloc( signature_len );
+    badge->signature = bdgr_malloc( signature_len );
     bdgr_check( badge->signature == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
-        free( (char*)badge->id );
-        free( (char*)badge->token );
+        bdgr_free( (char*)badge->id );
+        bdgr_free( (char*)badge->token );
         return bdgr_error();
     }
+
+    badge->kid = NULL;
+    if( kid != NULL ) {
+        badge->kid = bdgr_strdup( kid );
+        bdgr_check( badge->kid == NULL, bdgr_malloc_err, __LINE__ );
+        if( bdgr_error() ) {
+            bdgr_free( (char*)badge->id );
+            bdgr_free( (char*)badge->token );
+            bdgr_free( (char*)badge->signature );
+            return bdgr_error();
+        }
+    }
     
     strcpy( (char*)badge->id, id );
     memcpy( (unsigned char*)badge->token, token, token_len );
@@ -373,7 +410,7 @@ int bdgr_signature_verify(
         return bdgr_error();
     }
     
-    bdgr_crypt( dsa_verify_hash(
+    bdgr_crypt( bdgr_dsa_verify_hash(
                     signature,
                     signature_len,
                     token,
@@ -384,22 +421,90 @@ int bdgr_signature_verify(
     return bdgr_error();
 }
 
-int bdgr_record_import(
+/*
+  Picks the member holding the key named kid out of a record, along with
+  the time the key may be used until, or 0 if it never runs out.
+*/
+static json_t* bdgr_record_key(
+    json_t* const root,
+    const char* const kid,
+    time_t* const until
+)
+{
+    json_t* keys, * entry = NULL, * member;
+    const time_t now = time( NULL );
+    size_t i;
+
+    *until = 0;
+    if( kid == NULL ) {
+        member = json_object_get( root, "dsa" );
+        bdgr_check( member == NULL, bdgr_json_dsa_missing_err, __LINE__ );
+        return member;
+    }
+
+    keys = json_object_get( root, "keys" );
+    bdgr_check( keys != NULL && !json_is_array( keys ),
+                bdgr_json_keys_not_array_err, __LINE__ );
+    if( bdgr_error() ) {
+        return NULL;
+    }
+
+    for( i = 0; i < json_array_size( keys ) && entry == NULL; i++ ) {
+        member = json_object_get( json_array_get( keys, i ), "kid" );
+        if( json_is_string( member ) &&
+            !strcmp( json_string_value( member ), kid )) {
+            entry = json_array_get( keys, i );
+        }
+    }
+    bdgr_check( entry == NULL, bdgr_kid_missing_err, __LINE__ );
+    if( bdgr_error() ) {
+        return NULL;
+    }
+
+    member = json_object_get( entry, "nbf" );
+    bdgr_check( member != NULL && !json_is_integer( member ),
+                bdgr_kid_period_err, __LINE__ );
+    if( bdgr_error() || bdgr_check( member != NULL &&
+                                    now < json_integer_value( member ),
+                                    bdgr_kid_expired_err, __LINE__ )) {
+        return NULL;
+    }
+
+    member = json_object_get( entry, "exp" );
+    bdgr_check( member != NULL && !json_is_integer( member ),
+                bdgr_kid_period_err, __LINE__ );
+    if( bdgr_error() || bdgr_check( member != NULL &&
+                                    now >= json_integer_value( member ),
+                                    bdgr_kid_expired_err, __LINE__ )) {
+        return NULL;
+    }
+    if( member != NULL ) {
+        *until = json_integer_value( member );
+    }
+
+    member = json_object_get( entry, "dsa" );
+    bdgr_check( member == NULL, bdgr_json_dsa_missing_err, __LINE__ );
+    return member;
+}
+
+static int bdgr_record_import_until(
     const char* const record,
-    bdgr_key* const key
+    const char* const kid,
+    bdgr_key* const key,
+    time_t* const until
 )
 {
     json_t* root, * dsa;
     const char* dsa_string;
 
-    root = json_loads( record, 0, bdgr_json_error() );
+    /* Parsers disagree on which of two members of a name counts */
+    root = json_loads( record, JSON_REJECT_DUPLICATES, bdgr_json_error() );
     bdgr_check( root == NULL, bdgr_json_load_err, __LINE__ );
     if( bdgr_error() ) {
         return bdgr_error();
     }
     
-    dsa = json_object_get( root, "dsa" );
-    bdgr_check( dsa == NULL, bdgr_json_dsa_missing_err, __LINE__ );
+    dsa = bdgr_record_key( root, kid, until );
     if( bdgr_error() ) {
         goto bdgr_record_import_free;
     }
@@ -416,7 +521,20 @@ int bdgr_record_import(
         goto bdgr_record_import_free;
     }
 
+    if( bdgr_limit_key_encoded( strlen( dsa_string ))) {
+        goto bdgr_record_import_free;
+    }
+
     bdgr_key_decode( dsa_string, key );
+    if( bdgr_error() ) {
+        goto bdgr_record_import_free;
+    }
+
+    /* Keys from records come from anyone, so hold them to the key spec */
+    if( bdgr_limit_key( (dsa_key*)key->_impl ) ||
+        bdgr_group_validate( (dsa_key*)key->_impl )) {
+        bdgr_key_free( key );
+    }
 
  bdgr_record_import_free:
     
@@ -425,62 +543,377 @@ int bdgr_record_import(
 
 }
 
-struct bdgr_scheme_handler {
-    char* scheme;
-    int (*handle_url)( const char* const url, const char** record );
-    struct bdgr_scheme_handler* next;
-};
+int bdgr_record_import(
+    const char* const record,
+    bdgr_key* const key
+)
+{
+    time_t until;
+    return bdgr_record_import_until( record, NULL, key, &until );
+}
 
-static struct bdgr_scheme_handler* bdgr_scheme_handlers = NULL;
+int bdgr_record_import_kid(
+    const char* const record,
+    const char* const kid,
+    bdgr_key* const key
+)
+{
+    time_t until;
+    return bdgr_record_import_until( record, kid, key, &until );
+}
 
-int bdgr_badge_verify(
-    const bdgr_badge* const badge,
-    int* const verified
+/*
+  A badge without a key id is checked against the "dsa" key of the record
+  at its Identity URL, and one with a key id against that key of the
+  record.  The cache, flights and peers hold keys by a reference made of
+  the Identity URL followed by a space and the key id, if any.  Identity
+  URLs never hold a space, so a badge claiming one is turned down rather
+  than left to pass for another key of the record.
+*/
+char* bdgr_key_ref( const bdgr_badge* const badge )
+{
+    const size_t id_len = strlen( badge->id );
+    char* ref;
+
+    bdgr_check( strchr( badge->id, ' ' ) != NULL, bdgr_badge_id_err, __LINE__ );
+    if( bdgr_error() || bdgr_check( badge->kid != NULL &&
+                                    !bdgr_kid_valid( badge->kid ),
+                                    bdgr_kid_err, __LINE__ )) {
+        return NULL;
+    }
+
+    ref = bdgr_malloc( id_len +
+                       ( badge->kid != NULL ? strlen( badge->kid ) + 1 : 0 ) +
+                       1 );
+    bdgr_check( ref == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return NULL;
+    }
+    strcpy( ref, badge->id );
+    if( badge->kid != NULL ) {
+        ref[ id_len ] = ' ';
+        strcpy( ref + id_len + 1, badge->kid );
+    }
+    return ref;
+}
+
+const char* bdgr_key_ref_kid( const char* const ref )
+{
+    const char* const space = strchr( ref, ' ' );
+    return space != NULL ? space + 1 : NULL;
+}
+
+/* Deadline of the verification running on this thread, if any */
+static __thread const struct timespec* bdgr_deadline = NULL;
+
+long int bdgr_deadline_remaining_ms()
+{
+    struct timespec now;
+    long int ms;
+    if( bdgr_deadline == NULL ) {
+        return -1;
+    }
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    ms = ( bdgr_deadline->tv_sec - now.tv_sec ) * 1000 +
+        ( bdgr_deadline->tv_nsec - now.tv_nsec ) / 1000000;
+    return ms > 0 ? ms : 0;
+}
+
+const struct timespec* bdgr_deadline_swap(
+    const struct timespec* const deadline
 )
 {
-    int support_scheme;
-    bdgr_key key;
-    struct bdgr_scheme_handler* curr;
-    const char* record;
+    const struct timespec* const previous = bdgr_deadline;
+    bdgr_deadline = deadline;
+    return previous;
+}
 
-    bdgr_init();
+static int bdgr_deadline_check( const int line )
+{
+    return bdgr_check( bdgr_deadline_remaining_ms() == 0,
+                       bdgr_timeout_err, line );
+}
+
+void bdgr_deadline_curl( CURL* const handle )
+{
+    const long int ms = bdgr_deadline_remaining_ms();
+    if( ms >= 0 ) {
+        curl_easy_setopt( handle, CURLOPT_TIMEOUT_MS, ms ? ms : 1 );
+        curl_easy_setopt( handle, CURLOPT_CONNECTTIMEOUT_MS, ms ? ms : 1 );
+    }
+}
+
+int bdgr_curl_check( const CURLcode res, const int line )
+{
+    if( res == CURLE_OPERATION_TIMEDOUT ) {
+        return bdgr_check( 1, bdgr_timeout_err, line );
+    }
+    if( res != CURLE_OK ) {
+        bdgr_fetch_error( curl_easy_strerror( res ), line );
+    }
+    return bdgr_error();
+}
+
+int bdgr_key_settle(
+    const char* const id,
+    const int revalidate,
+    const char* const record,
+    const time_t expires,
+    bdgr_key* const key
+)
+{
+    time_t until;
+
+    /* An unchanged record keeps its key without being parsed again */
+    if( revalidate && bdgr_cache_reuse( id, record, expires, key )) {
+        bdgr_cache_forget( id );
+        return 0;
+    }
+    if( record == NULL ) {
+        /* Not modified, but the entry was evicted meanwhile */
+        return !bdgr_check( !revalidate, bdgr_http_status_err, __LINE__ );
+    }
+    
+    bdgr_record_import_until( record, bdgr_key_ref_kid( id ), key, &until );
     if( bdgr_error() ) {
+        bdgr_cache_fail( id, bdgr_cache_import_failed );
+        return 0;
+    }
+
+    bdgr_cache_forget( id );
+    bdgr_cache_put( id, record, expires, until, key );
+    return 0;
+}
+
+static int bdgr_key_fetch(
+    const char* const id,
+    bdgr_key* const key
+)
+{
+    char* record;
+    time_t expires;
+    int revalidate, retry = 1;
+
+    if( bdgr_cache_backoff( id ) || bdgr_deadline_check( __LINE__ )) {
         return bdgr_error();
     }
 
-    curr = bdgr_scheme_handlers;
-    
-    while( curr ) {
-        if( !strncmp( badge->id, curr->scheme,
-                      strlen( curr->scheme ))) {
-            support_scheme = 1;
-
-            curr->handle_url( badge->id, &record );
-            if( bdgr_error() ) {
-                return bdgr_error();
+    /* Another process on this host may be fetching it already */
+    if( !bdgr_cache_claim( id, bdgr_deadline_remaining_ms() ) &&
+        bdgr_cache_await( id, key )) {
+        return bdgr_error();
+    }
+
+    revalidate = bdgr_cache_stale( id );
+    while( retry ) {
+        bdgr_scheme_lookup( id, bdgr_deadline, revalidate, &record, &expires );
+        if( bdgr_error() ) {
+            if( bdgr_error() != bdgr_unsupported_scheme_err ) {
+                bdgr_cache_fail( id, bdgr_cache_fetch_failed );
             }
             break;
         }
-        curr = curr->next;
+        retry = !bdgr_deadline_check( __LINE__ ) &&
+            bdgr_key_settle( id, revalidate, record, expires, key );
+        bdgr_free( record );
+        revalidate = 0;
     }
-    
-    if( bdgr_check( !support_scheme,
-                    bdgr_unsupported_scheme_err, __LINE__ )) {
-        return bdgr_error();
+    bdgr_cache_unclaim( id );
+    return bdgr_error();
+}
+
+/*
+  Concurrent lookups of the same Identity URL share one flight: the first
+  caller fetches and imports the record, the others wait for it and import
+  the public key it exported.
+*/
+struct bdgr_flight {
+    pthread_cond_t    landed_cond;
+    int               landed;
+    int               passengers;
+    int               err;
+    unsigned char     key[ BDGR_KEY_EXPORT_MAX ];
+    unsigned long int key_len;
+};
+
+static bdgr_table bdgr_flights;
+static pthread_mutex_t bdgr_flights_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void bdgr_flight_leave( struct bdgr_flight* const flight )
+{
+    if( --flight->passengers == 0 ) {
+        pthread_cond_destroy( &flight->landed_cond );
+        bdgr_free( flight );
     }
+}
+
+static int bdgr_key_resolve(
+    const char* const id,
+    bdgr_key* const key
+)
+{
+    struct bdgr_flight* flight;
+    pthread_condattr_t attr;
+    unsigned char data[ BDGR_KEY_EXPORT_MAX ];
+    unsigned long int data_len = 0;
+    int err;
+
+    pthread_mutex_lock( &bdgr_flights_lock );
     
-    bdgr_record_import( record, &key );
+    while( ( flight = bdgr_table_get( &bdgr_flights, id )) != NULL ) {
+
+        /* Wait for the flight already fetching this id */
+        flight->passengers++;
+        while( !flight->landed ) {
+            if( bdgr_deadline == NULL ) {
+                pthread_cond_wait( &flight->landed_cond, &bdgr_flights_lock );
+            } else if( pthread_cond_timedwait(
+                           &flight->landed_cond, &bdgr_flights_lock,
+                           bdgr_deadline ) == ETIMEDOUT ) {
+                break;
+            }
+        }
+        err = bdgr_timeout_err;
+        if( flight->landed ) {
+            err = flight->err;
+            data_len = flight->key_len;
+            memcpy( data, flight->key, data_len );
+        }
+        bdgr_flight_leave( flight );
+
+        /* The flight ran out of its own time, but there is some left */
+        if( err == bdgr_timeout_err && bdgr_deadline_remaining_ms() != 0 ) {
+            continue;
+        }
+        pthread_mutex_unlock( &bdgr_flights_lock );
+
+        if( bdgr_check( err, err, __LINE__ )) {
+            return bdgr_error();
+        }
+        return bdgr_key_import( data, data_len, key );
+        
+    }
+
+    flight = bdgr_malloc( sizeof( *flight ));
+    if( flight == NULL ||
+        bdgr_table_put( &bdgr_flights, id, flight )) {
+        /* Fly alone rather than fail */
+        bdgr_free( flight );
+        pthread_mutex_unlock( &bdgr_flights_lock );
+        return bdgr_key_fetch( id, key );
+    }
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &flight->landed_cond, &attr );
+    pthread_condattr_destroy( &attr );
+    flight->landed = 0;
+    flight->passengers = 1;
+    pthread_mutex_unlock( &bdgr_flights_lock );
+
+    bdgr_key_fetch( id, key );
+
+    err = bdgr_error();
+    flight->key_len = sizeof( flight->key );
+    if( !err && bdgr_key_export_public( key, flight->key, &flight->key_len )) {
+        /* The caller has its key; the passengers will get this error */
+        err = bdgr_error();
+        bdgr_check( 0, bdgr_no_err, __LINE__ );
+    }
+
+    pthread_mutex_lock( &bdgr_flights_lock );
+    bdgr_table_remove( &bdgr_flights, id );
+    flight->err = err;
+    flight->landed = 1;
+    pthread_cond_broadcast( &flight->landed_cond );
+    bdgr_flight_leave( flight );
+    pthread_mutex_unlock( &bdgr_flights_lock );
+
+    return bdgr_error();
+}
+
+int bdgr_key_find(
+    const char* const id,
+    const struct timespec* const deadline,
+    bdgr_key* const key
+)
+{
+    const struct timespec* const previous = bdgr_deadline_swap( deadline );
+
+    if( bdgr_cache_get( id, key )) {
+        bdgr_check( 0, bdgr_no_err, __LINE__ );
+    } else if( !bdgr_deadline_check( __LINE__ )) {
+        bdgr_key_resolve( id, key );
+    }
+    bdgr_deadline_swap( previous );
+    return bdgr_error();
+}
+
+int bdgr_badge_verify_deadline(
+    const bdgr_badge* const badge,
+    const struct timespec* const deadline,
+    int* const verified
+)
+{
+    const struct timespec* previous;
+    bdgr_key key;
+    char* ref = NULL;
+
+    bdgr_init();
     if( bdgr_error() ) {
         return bdgr_error();
     }
+
+    /* Nested in a verification of the thread's own, keep its deadline */
+    previous = bdgr_deadline_swap( deadline );
+    if( bdgr_deadline_check( __LINE__ ) ||
+        bdgr_limit_token( badge->token_len, badge->signature_len, 0 ) ||
+        bdgr_server_token_admit( badge->token, badge->token_len )) {
+        goto bdgr_badge_verify_deadline_done;
+    }
+
+    ref = bdgr_key_ref( badge );
+    if( bdgr_error() ) {
+        goto bdgr_badge_verify_deadline_done;
+    }
+
+    /* Only a fetch costs the identity a token, a cached key never does */
+    if( !bdgr_cache_get( ref, &key )) {
+        if( bdgr_limit_identity( badge->id )) {
+            goto bdgr_badge_verify_deadline_done;
+        }
+        bdgr_key_resolve( ref, &key );
+        if( bdgr_error() ) {
+            goto bdgr_badge_verify_deadline_done;
+        }
+        if( bdgr_deadline_check( __LINE__ )) {
+            bdgr_key_free( &key );
+            goto bdgr_badge_verify_deadline_done;
+        }
+    }
     
-    return bdgr_signature_verify(
+    bdgr_signature_verify(
         badge->token,
         badge->token_len,
         badge->signature,
         badge->signature_len,
         &key,
         verified );
+
+    bdgr_key_free( &key );
+
+ bdgr_badge_verify_deadline_done:
+
+    bdgr_free( ref );
+    bdgr_deadline_swap( previous );
+    return bdgr_error();
+}
+
+int bdgr_badge_verify(
+    const bdgr_badge* const badge,
+    int* const verified
+)
+{
+    return bdgr_badge_verify_deadline( badge, NULL, verified );
 }
 
 int bdgr_badge_import(
@@ -488,13 +921,17 @@ int bdgr_badge_import(
     bdgr_badge* const badge
 )
 {
-    json_t* root = NULL, * id, * token, * signature;
+    json_t* root = NULL, * id, * token, * signature, * kid;
     json_error_t error;
     const char* tokenc = NULL, * signaturec = NULL, * idc = NULL;
-    char* idc_copy;
+    char* idc_copy, * kidc_copy = NULL;
     unsigned char* tokenb = NULL, * signatureb = NULL;
     unsigned long int tokenb_len, signatureb_len;
 
+    if( bdgr_limit_badge( strlen( json_string ))) {
+        goto bdgr_badge_import_free;
+    }
+
     root = json_loads( json_string, 0, &error );
     bdgr_check( root == NULL, bdgr_json_load_err, __LINE__ );
     if( bdgr_error() ) {
@@ -537,14 +974,38 @@ int bdgr_badge_import(
         goto bdgr_badge_import_free;
     }
 
+    /* Badges without a key id use the record's "dsa" key */
+    kid = json_object_get( root, "kid" );
+    bdgr_check( kid != NULL && !json_is_string( kid ),
+                bdgr_json_kid_not_string_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_badge_import_free;
+    }
+
+    bdgr_check( kid != NULL && !bdgr_kid_valid( json_string_value( kid )),
+                bdgr_kid_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_badge_import_free;
+    }
+
     tokenc = json_string_value( token );
     bdgr_check( tokenc == NULL, bdgr_json_token_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_badge_import_free;
     }
+
+    signaturec = json_string_value( signature );
+    bdgr_check( signaturec == NULL, bdgr_json_signature_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_badge_import_free;
+    }
+
+    if( bdgr_limit_token( strlen( tokenc ), strlen( signaturec ), 1 )) {
+        goto bdgr_badge_import_free;
+    }
     
     tokenb_len = strlen( tokenc );
-    tokenb = malloc( tokenb_len );
+    tokenb = bdgr_malloc( tokenb_len );
     bdgr_check( tokenb == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_badge_import_free;
@@ -558,14 +1019,12 @@ int bdgr_badge_import(
         goto bdgr_badge_import_free;
     }
     
-    signaturec = json_string_value( signature );
-    bdgr_check( signaturec == NULL, bdgr_json_signature_err, __LINE__ );
+    signatureb_len = strlen( signaturec );
+    signatureb = bdgr_malloc( signatureb_len );
+    bdgr_check( signatureb == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_badge_import_free;
     }
-    
-    signatureb_len = strlen( signaturec );
-    signatureb = malloc( signatureb_len );
     bdgr_crypt( base64_decode(
                     (unsigned char*)signaturec, signatureb_len,
                     signatureb, &signatureb_len ),
@@ -580,7 +1039,15 @@ int bdgr_badge_import(
         goto bdgr_badge_import_free;
     }
 
-    idc_copy = strdup( idc );
+    if( kid != NULL ) {
+        kidc_copy = bdgr_strdup( json_string_value( kid ));
+        bdgr_check( kidc_copy == NULL, bdgr_malloc_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_badge_import_free;
+        }
+    }
+
+    idc_copy = bdgr_strdup( idc );
     bdgr_check( idc_copy == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_badge_import_free;
@@ -596,9 +1063,15 @@ int bdgr_badge_import(
             &signatureb, sizeof( signatureb ));
     memcpy( (void*)&badge->signature_len,
             &signatureb_len, sizeof( signatureb_len ));
+    badge->kid = kidc_copy;
     
  bdgr_badge_import_free:
 
+    if( bdgr_error() ) {
+        bdgr_free( tokenb );
+        bdgr_free( signatureb );
+        bdgr_free( kidc_copy );
+    }
     if( root != NULL ) {
         json_decref( root );
     }
@@ -616,14 +1089,14 @@ int bdgr_badge_export(
     unsigned long int tokenc_len, signaturec_len;
     
     tokenc_len = (badge->token_len * 1.37) + 815;
-    tokenc = malloc( tokenc_len );
+    tokenc = bdgr_malloc( tokenc_len );
     bdgr_check( tokenc == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_badge_export_free;
     }
     
     signaturec_len = (badge->signature_len * 1.37) + 815;
-    signaturec = malloc( signaturec_len );
+    signaturec = bdgr_malloc( signaturec_len );
     bdgr_check( signaturec == NULL, bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_badge_export_free;
@@ -645,11 +1118,20 @@ int bdgr_badge_export(
         goto bdgr_badge_export_free;
     }
     
-    root = json_pack(
-        "{ssssss}",
-        "id", badge->id,
-        "token", tokenc,
-        "signature", signaturec );
+    if( badge->kid != NULL ) {
+        root = json_pack(
+            "{ssssssss}",
+            "id", badge->id,
+            "kid", badge->kid,
+            "token", tokenc,
+            "signature", signaturec );
+    } else {
+        root = json_pack(
+            "{ssssss}",
+            "id", badge->id,
+            "token", tokenc,
+            "signature", signaturec );
+    }
     bdgr_check( root == NULL, bdgr_json_pack_err, __LINE__ );
     if( bdgr_error() ) {
         goto bdgr_badge_export_free;
@@ -661,10 +1143,10 @@ int bdgr_badge_export(
  bdgr_badge_export_free:
 
     if( tokenc != NULL ) {
-        free( tokenc );
+        bdgr_free( tokenc );
     }
     if( signaturec != NULL ) {
-        free( signaturec );
+        bdgr_free( signaturec );
     }
     if( root != NULL ) {
         json_decref( root );
@@ -677,353 +1159,112 @@ void bdgr_badge_free(
     bdgr_badge* const badge
 )
 {
-    free( (char*)badge->id );
-    free( (char*)badge->token );
-    free( (char*)badge->signature );
+    bdgr_free( (char*)badge->id );
+    bdgr_free( (char*)badge->token );
+    bdgr_free( (char*)badge->signature );
+    bdgr_free( (char*)badge->kid );
 }
 
-typedef struct {
+int bdgr_buffer_reserve(
+    bdgr_buffer* const buf,
+    const unsigned long int extra
+)
+{
+    unsigned long int capacity;
     char* data;
-    unsigned long int size;
-    bdgr_err error;
-} bdgr_buffer;
 
-static size_t bdgr_record_data(
-    char *ptr,
-    size_t size,
-    size_t nmemb,
-    void *_buf )
-{
-    bdgr_buffer *buf = (bdgr_buffer*)_buf;
-    int sane_size = size*nmemb;
     if( buf->data == NULL ) {
-        buf->data = malloc( sane_size );
         buf->size = 0;
+        buf->capacity = 0;
         buf->error = bdgr_no_err;
-        bdgr_check( buf->data == NULL, bdgr_malloc_err, __LINE__ );
-    } else  {
-        buf->data = realloc( buf->data, buf->size + sane_size );
-        bdgr_check( buf->data == NULL, bdgr_realloc_err, __LINE__ );
+    } else if( buf->size + extra <= buf->capacity ) {
+        return bdgr_no_err;
+    }
+
+    /* Grow geometrically so appending stays linear */
+    capacity = buf->capacity ? buf->capacity : 256;
+    while( capacity < buf->size + extra ) {
+        capacity *= 2;
     }
+    data = bdgr_realloc( buf->data, capacity );
+    bdgr_check( data == NULL,
+                buf->data == NULL ? bdgr_malloc_err : bdgr_realloc_err,
+                __LINE__ );
     if( bdgr_error() ) {
         buf->error = bdgr_error();
+        return bdgr_error();
+    }
+    buf->data = data;
+    buf->capacity = capacity;
+    return bdgr_no_err;
+}
+
+size_t bdgr_record_data(
+    char *ptr,
+    size_t size,
+    size_t nmemb,
+    void *_buf )
+{
+    bdgr_buffer *buf = (bdgr_buffer*)_buf;
+    size_t sane_size = size*nmemb;
+    if( bdgr_buffer_reserve( buf, sane_size )) {
         return 0;
     }
     memcpy( buf->data + buf->size, ptr, sane_size );
     buf->size += sane_size;
-    return size;
+    return sane_size;
 }
 
-static int bdgr_scheme_nmc( const char* const url, const char** record )
+static int bdgr_init_err = bdgr_no_err;
+
+static void bdgr_init_once()
 {
-    
-    CURL* const handle = curl_easy_init();
-    char* post_data;
-    const char* block_name, * rpc_error;
-    static const char* const rpc_fmt =
-        "{\"method\":\"name_show\",\"params\":[\"%s\"]}";
-    const unsigned long int rpc_fmt_len = strlen( rpc_fmt ) - 2;
-    struct curl_slist *headers = NULL;
-    bdgr_buffer buf;
-    json_t* root, * result, * value, * error, * message;
-    static char rpc_server[1024];
-    static int init = 0;
-    
-    if( !init ) {
-        
-        /* Parse out rpc connection details from bitcoin.conf */
-        struct passwd* pw = getpwuid( getuid() );
-        char* rel_path = "/.namecoin/bitcoin.conf";
-        char conf_path[256], name[256], val[256], * line = NULL, * pos;
-        char* rpc_scheme = "http://";
-        char rpcport[16], rpcconnect[256], rpcuser[256], rpcpass[256];
-        size_t len;
-        FILE* conf;
-
-        strcpy( rpcport, "8336" );
-        strcpy( rpcconnect, "127.0.0.1" );
-        rpcuser[0] = '\0';
-        rpcpass[0] = '\0';
-        sprintf( conf_path, "%s%s", pw->pw_dir, rel_path );
-        conf = fopen( conf_path, "r" );
-        if( conf != NULL ) {
-            while( getline( &line, &len, conf ) != -1) {
-                pos = strchr( line, '=' );
-                if( pos == NULL ) {
-                    continue;
-                }
-                strncpy( name, line, pos - line );
-                name[ pos - line ] = '\0';
-                strncpy( val, pos + 1,
-                         strlen( line ) - ((pos + 1) - line) - 1 );
-                val[ strlen( line ) - ((pos + 1) - line) - 1 ] = '\0';
-                if( !strcmp( "rpcport", name ) ) {
-                    strcpy( rpcport, val );
-                } else if ( !strcmp( "rpcconnect", name ) ) {
-                    strcpy( rpcconnect, val );
-                } else if ( !strcmp( "rpcuser", name ) ) {
-                    strcpy( rpcuser, val );
-                } else if ( !strcmp( "rpcpassword", name ) ) {
-                    strcpy( rpcpass, val );
-                }
-            }
-        }
-        if( !strlen( rpcuser )) {
-            sprintf( rpc_server, "%s%s:%s",
-                     rpc_scheme, rpcconnect, rpcport );
-        } else if( !strlen( rpcpass )) {
-            sprintf( rpc_server, "%s%s@%s:%s",
-                     rpc_scheme,
-                     rpcuser,
-                     rpcconnect, rpcport );
-        } else {
-            sprintf( rpc_server, "%s%s:%s@%s:%s",
-                     rpc_scheme,
-                     rpcuser, rpcpass,
-                     rpcconnect, rpcport );
-        }
-        
-        init = 1;
-        
+    if( bdgr_math_init() ) {
+        goto bdgr_init_once_done;
     }
 
-    /* make rpc request */
-
-    block_name = url + 4;
-    headers = curl_slist_append( headers, "Content-Type: text/plain" );
-    post_data = malloc( rpc_fmt_len + strlen( block_name ));
-    bdgr_check( post_data == NULL, bdgr_malloc_err, __LINE__ );
-    if( bdgr_error() ) {
-        goto bdgr_scheme_nmc_free;
-    }
-    sprintf( post_data, rpc_fmt, block_name );
-    
-    /* initialize response data buffer */
-    buf.data = NULL;
-    curl_easy_setopt( handle, CURLOPT_URL, rpc_server );
-    curl_easy_setopt( handle, CURLOPT_HTTPHEADER, headers );
-    curl_easy_setopt( handle, CURLOPT_POSTFIELDS, post_data );
-    curl_easy_setopt( handle, CURLOPT_WRITEFUNCTION, bdgr_record_data );
-    curl_easy_setopt( handle, CURLOPT_WRITEDATA, &buf );
-    curl_easy_perform( handle );
-
-    bdgr_check( buf.error != bdgr_no_err, buf.error, __LINE__ );
-    if( bdgr_error() ) {
-        return bdgr_error();
-    }
-    buf.data = realloc( buf.data, buf.size + 1 );
-    bdgr_check( buf.data == NULL, bdgr_realloc_err, __LINE__ );
+    /* Not thread safe, so it can't be left to the first curl handle */
+    bdgr_check( bdgr_alloc_curl_init( CURL_GLOBAL_ALL ) != CURLE_OK,
+                bdgr_curl_init_err, __LINE__ );
     if( bdgr_error() ) {
-        return bdgr_error();
+        goto bdgr_init_once_done;
     }
-    buf.data[ buf.size++ ] = '\0';
-    
-    root = json_loads( buf.data, 0, bdgr_json_error() );
-    bdgr_check( root == NULL,
-                bdgr_json_load_err, __LINE__ );
-    if( bdgr_error() ) {
-        goto bdgr_scheme_nmc_free;
-    }
-    
-    result = json_object_get( root, "result" );
-    bdgr_check( result == NULL,
-                bdgr_json_result_missing_err, __LINE__ );
-    if( bdgr_error() ) {
-        goto bdgr_scheme_nmc_free;
-    }
-    
-    if( json_is_null( result )) {
-
-        /* Error with RPC call */
-        error = json_object_get( root, "error" );
-        bdgr_check( error == NULL,
-                    bdgr_json_error_missing_err, __LINE__ );
-        if( bdgr_error() ) {
-            goto bdgr_scheme_nmc_free;
-        }
-
-        bdgr_check( !json_is_object( error ),
-                    bdgr_json_error_not_object_err, __LINE__ );
-        if( bdgr_error() ) {
-            goto bdgr_scheme_nmc_free;
-        }
 
-        message = json_object_get( error, "message" );
-        bdgr_check( message == NULL,
-                    bdgr_json_error_message_missing_err, __LINE__ );
-        if( bdgr_error() ) {
-            goto bdgr_scheme_nmc_free;
-        }
-
-        bdgr_check( !json_is_string( message ),
-                    bdgr_json_error_message_not_string_err, __LINE__ );
-        if( bdgr_error() ) {
-            goto bdgr_scheme_nmc_free;
-        }
-
-        rpc_error = json_string_value( message );
-        bdgr_check( rpc_error == NULL,
-                    bdgr_json_error_message_err, __LINE__ );
-        if( bdgr_error() ) {
-            goto bdgr_scheme_nmc_free;
-        }
-        
-        bdgr_rpc_error( rpc_error, __LINE__ );
-        goto bdgr_scheme_nmc_free;
-        
-    }
-    
-    bdgr_check( !json_is_object( result ),
-                bdgr_json_result_not_object_err, __LINE__ );
+    bdgr_check( bdgr_table_init( &bdgr_flights, 256, NULL ),
+                bdgr_malloc_err, __LINE__ );
     if( bdgr_error() ) {
-        goto bdgr_scheme_nmc_free;
-    }
-    
-    value = json_object_get( result, "value" );
-    bdgr_check( value == NULL,
-                bdgr_json_value_missing_err, __LINE__ );
-    if( bdgr_error() ) {
-        goto bdgr_scheme_nmc_free;
+        goto bdgr_init_once_done;
     }
 
-    bdgr_check( !json_is_string( value ),
-                bdgr_json_value_not_string_err, __LINE__ );
+    bdgr_scheme_handler_default( "id:", bdgr_scheme_id, NULL, 1 );
     if( bdgr_error() ) {
-        goto bdgr_scheme_nmc_free;
+        goto bdgr_init_once_done;
     }
-
-    *record = json_string_value( value );
-    bdgr_check( *record == NULL,
-                bdgr_json_value_err, __LINE__ );
+        
+    bdgr_scheme_handler_default( "nmc:", bdgr_scheme_nmc, NULL, 1 );
     if( bdgr_error() ) {
-        goto bdgr_scheme_nmc_free;
-    }
-    
-
- bdgr_scheme_nmc_free:
-
-    if( headers != NULL ) {
-        curl_slist_free_all( headers );
-    }
-    if( post_data != NULL ) {
-        free( post_data );
-    }
-    if( root != NULL ) {
-        json_decref( root );
-    }
-    if( buf.data != NULL ) {
-        free( buf.data );
+        goto bdgr_init_once_done;
     }
-
-    curl_easy_cleanup( handle );
-
-    return bdgr_error();
-
-}
-
-static int bdgr_scheme_id( const char* const url, const char** record )
-{
-    char* const nmc_url = malloc( strlen( url ) + 8 );
-    bdgr_check( nmc_url == NULL, bdgr_malloc_err, __LINE__ );
+        
+    bdgr_scheme_handler_default( "http:", bdgr_scheme_http,
+                                 bdgr_scheme_http_cancel, 0 );
     if( bdgr_error() ) {
-        goto bdgr_scheme_id_free;
+        goto bdgr_init_once_done;
     }
-    sprintf( nmc_url, "nmc:id/%s", strchr( url, ':' ) + 1 );
-    bdgr_scheme_nmc( nmc_url, record );
-
- bdgr_scheme_id_free:
-    
-    free( nmc_url );
-    return bdgr_error();
-}
+        
+    bdgr_scheme_handler_default( "https:", bdgr_scheme_http,
+                                 bdgr_scheme_http_cancel, 0 );
 
-static int bdgr_scheme_http( const char* const url, const char** record )
-{
-    CURL* const handle = curl_easy_init();
-    bdgr_buffer buf;
-    buf.data = NULL;
-    bdgr_check( buf.data == NULL, bdgr_malloc_err, __LINE__ );
-    if( bdgr_error() ) {
-        return bdgr_error();
-    }
-    curl_easy_setopt( handle, CURLOPT_URL, url );
-    curl_easy_setopt( handle, CURLOPT_WRITEFUNCTION, bdgr_record_data );
-    curl_easy_setopt( handle, CURLOPT_WRITEDATA, &buf );
-    curl_easy_perform( handle );
-    curl_easy_cleanup( handle );
-    
-    bdgr_check( buf.error != bdgr_no_err, buf.error, __LINE__ );
-    if( bdgr_error() ) {
-        return bdgr_error();
-    }
-    buf.data = realloc( buf.data, buf.size + 1 );
-    bdgr_check( buf.data == NULL, bdgr_realloc_err, __LINE__ );
-    if( bdgr_error() ) {
-        return bdgr_error();
-    }
-    buf.data[ buf.size++ ] = '\0';
-    
-    *record = buf.data;
-    return bdgr_no_err;
-}
+ bdgr_init_once_done:
 
-int bdgr_scheme_handler_add(
-    char* scheme,
-    int (*handle_url)( const char* const url, const char** record )
-)
-{
-    struct bdgr_scheme_handler* handler =
-        malloc( sizeof( struct bdgr_scheme_handler ));
-    bdgr_check( handler == NULL, bdgr_malloc_err, __LINE__ );
-    if( bdgr_error() ) {
-        return bdgr_error();
-    }
-    handler->scheme = scheme;
-    handler->handle_url = handle_url;
-    handler->next = NULL;
-    if( bdgr_scheme_handlers == NULL ) {
-        bdgr_scheme_handlers = handler;
-    } else {
-        struct bdgr_scheme_handler* curr = bdgr_scheme_handlers;
-        while( curr->next != NULL ) {
-            curr = curr->next;
-        }
-        curr->next = handler;
-    }
-    return bdgr_no_err;
+    bdgr_init_err = bdgr_error();
 }
 
-extern ltc_math_descriptor gmp_desc;
-
-static int bdgr_init()
+int bdgr_init()
 {
-    static int init = 0;
-    if( !init ) {
-        
-        ltc_mp = gmp_desc;
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once( &once, bdgr_init_once );
 
-        bdgr_scheme_handler_add( "id:", bdgr_scheme_id );
-        if( bdgr_error() ) {
-            return bdgr_error();
-        }
-        
-        bdgr_scheme_handler_add( "nmc:", bdgr_scheme_nmc );
-        if( bdgr_error() ) {
-            return bdgr_error();
-        }
-        
-        bdgr_scheme_handler_add( "http:", bdgr_scheme_http );
-        if( bdgr_error() ) {
-            return bdgr_error();
-        }
-        
-        bdgr_scheme_handler_add( "https:", bdgr_scheme_http );
-        if( bdgr_error() ) {
-            return bdgr_error();
-        }
-        
-        init = 1;
-        
-    }
-    return bdgr_no_err;
+    /* Don't let a previous call's error leak into this one */
+    return bdgr_check( bdgr_init_err, bdgr_init_err, __LINE__ );
 }
@@ -0,0 +1,315 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <tomcrypt.h>
+#include <badger.h>
+
+#define BUF_SIZE 4096
+#define SIGNATURE_SIZE 2048
+#define CLIENT_TIMEOUT 5
+
+void usage()
+{
+    fprintf(
+        stderr,
+        "Usage: badger_agent [options] <id>...\n"
+        "A private key for each id, one per line, must be available from "
+        "stdin.\n"
+        "Options:\n"
+        "-s, --socket  <path>, defaults to $BADGER_AGENT_SOCK\n"
+    );
+}
+
+/*
+  Keys are decoded once and kept in locked memory.  Clients connect to
+  the socket, send one request line and read one reply line:
+
+    SIGN <id> <base64-token>  ->  OK <base64-signature> | ERR <message>
+*/
+struct agent_key {
+    const char* id;
+    bdgr_key    key;
+};
+
+static struct agent_key* keys;
+static unsigned long int key_count;
+static volatile sig_atomic_t stopping = 0;
+
+static void agent_stop( const int signum )
+{
+    (void)signum;
+    stopping = 1;
+}
+
+static const bdgr_key* agent_find( const char* const id )
+{
+    unsigned long int i;
+
+    for( i = 0; i < key_count; i++ ) {
+        if( !strcmp( keys[ i ].id, id )) {
+            return &keys[ i ].key;
+        }
+    }
+    return NULL;
+}
+
+static void agent_reply(
+    const int client,
+    const char* const status,
+    const char* const text
+)
+{
+    char reply[ BUF_SIZE ];
+    const int len = snprintf( reply, sizeof( reply ), "%s %s\n", status, text );
+
+    if( len > 0 && len < (int)sizeof( reply ) &&
+        write( client, reply, len ) != len ) {
+        /* The client went away, nothing to tell it */
+    }
+}
+
+/* Reads a request line, returns 0 on a timeout, EOF or overlong line */
+static int agent_read_line(
+    const int client,
+    char* const line,
+    const size_t size
+)
+{
+    size_t len = 0;
+    ssize_t n;
+    char* end;
+
+    while( len < size - 1 ) {
+        n = read( client, line + len, size - 1 - len );
+        if( n <= 0 ) {
+            return 0;
+        }
+        len += n;
+        line[ len ] = '\0';
+        end = strchr( line, '\n' );
+        if( end != NULL ) {
+            *end = '\0';
+            if( end > line && end[ -1 ] == '\r' ) {
+                end[ -1 ] = '\0';
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void agent_serve( const int client )
+{
+    char request[ BUF_SIZE ], encoded[ BUF_SIZE ];
+    unsigned char token[ BUF_SIZE ], signature[ SIGNATURE_SIZE ];
+    unsigned long int token_len = sizeof( token );
+    unsigned long int signature_len = sizeof( signature );
+    unsigned long int encoded_len = sizeof( encoded );
+    char* verb, * id, * token_string, * save;
+    const bdgr_key* key;
+    int err;
+
+    if( !agent_read_line( client, request, sizeof( request ))) {
+        return;
+    }
+    verb = strtok_r( request, " ", &save );
+    if( verb == NULL || strcmp( verb, "SIGN" ) ||
+        ( id = strtok_r( NULL, " ", &save )) == NULL ||
+        ( token_string = strtok_r( NULL, " ", &save )) == NULL ) {
+        agent_reply( client, "ERR", "malformed request" );
+        return;
+    }
+
+    key = agent_find( id );
+    if( key == NULL ) {
+        agent_reply( client, "ERR", "no key for this id" );
+        return;
+    }
+    if( base64_decode( (unsigned char*)token_string, strlen( token_string ),
+                       token, &token_len ) != CRYPT_OK ) {
+        agent_reply( client, "ERR", "error decoding token" );
+        return;
+    }
+
+    err = bdgr_token_sign( token, token_len, key, signature, &signature_len );
+    if( err ) {
+        agent_reply( client, "ERR", bdgr_error_string( err ));
+        return;
+    }
+    if( base64_encode( signature, signature_len,
+                       (unsigned char*)encoded, &encoded_len ) != CRYPT_OK ) {
+        agent_reply( client, "ERR", "error encoding signature" );
+        return;
+    }
+    agent_reply( client, "OK", encoded );
+}
+
+/* Only processes of the user running the agent may use it */
+static int agent_peer_allowed( const int client )
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof( cred );
+
+    return getsockopt( client, SOL_SOCKET, SO_PEERCRED, &cred, &len ) == 0 &&
+        cred.uid == getuid();
+#else
+    (void)client;
+    return 1;
+#endif
+}
+
+static void load_keys( char* const* const ids, const unsigned long int count )
+{
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    unsigned long int i;
+    int err;
+
+    keys = calloc( count, sizeof( struct agent_key ));
+    if( keys == NULL ) {
+        fprintf( stderr, "error loading keys: out of memory\n" );
+        exit( 1 );
+    }
+    for( i = 0; i < count; i++ ) {
+        len = getline( &line, &size, stdin );
+        if( len == -1 ) {
+            fprintf( stderr, "error loading keys: no key for %s\n", ids[ i ] );
+            exit( 1 );
+        }
+        err = bdgr_key_decode( line, &keys[ i ].key );
+        memset( line, 0, size );
+        if( err ) {
+            fprintf( stderr,
+                     "error decoding key for %s: %s\n",
+                     ids[ i ], bdgr_error_string( err ));
+            exit( err );
+        }
+        keys[ i ].id = ids[ i ];
+        key_count++;
+    }
+    free( line );
+}
+
+int main( const int argc, char* const* argv )
+{
+    const char* path = getenv( "BADGER_AGENT_SOCK" );
+    struct sockaddr_un addr;
+    struct sigaction action;
+    struct timeval timeout = { CLIENT_TIMEOUT, 0 };
+    unsigned long int i;
+    int listener, client, c;
+
+    while (1) {
+        static struct option long_options[] = {
+            { "socket", required_argument, 0, 's' },
+            { 0, 0, 0, 0 }
+        };
+        int option_index = 0;
+        c = getopt_long( argc, argv, "s:", long_options, &option_index);
+        if (c == -1)
+            break;
+        switch(c) {
+        case 's':
+            path = optarg;
+            break;
+        case '?':
+            break;
+        default:
+            abort();
+        }
+    }
+    if( path == NULL || optind >= argc ||
+        strlen( path ) >= sizeof( addr.sun_path )) {
+        usage();
+        exit( 1 );
+    }
+
+    /* Keep keys out of swap and core dumps, and away from debuggers */
+    if( mlockall( MCL_CURRENT | MCL_FUTURE ) == -1 ) {
+        fprintf( stderr,
+                 "warning: could not lock memory: %s\n", strerror( errno ));
+    }
+#ifdef __linux__
+    prctl( PR_SET_DUMPABLE, 0 );
+#endif
+
+    load_keys( argv + optind, argc - optind );
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+    listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    umask( 0177 );
+    unlink( path );
+    if( listener == -1 ||
+        bind( listener, (struct sockaddr*)&addr, sizeof( addr )) == -1 ||
+        chmod( path, 0600 ) == -1 ||
+        listen( listener, 16 ) == -1 ) {
+        fprintf( stderr,
+                 "error listening on %s: %s\n", path, strerror( errno ));
+        exit( 1 );
+    }
+
+    /* Without SA_RESTART, so that accept() notices a stop */
+    memset( &action, 0, sizeof( action ));
+    action.sa_handler = agent_stop;
+    sigaction( SIGINT, &action, NULL );
+    sigaction( SIGTERM, &action, NULL );
+    signal( SIGPIPE, SIG_IGN );
+
+    while( !stopping ) {
+        client = accept( listener, NULL, NULL );
+        if( client == -1 ) {
+            continue;
+        }
+        setsockopt( client, SOL_SOCKET, SO_RCVTIMEO,
+                    &timeout, sizeof( timeout ));
+        if( agent_peer_allowed( client )) {
+            agent_serve( client );
+        }
+        close( client );
+    }
+
+    close( listener );
+    unlink( path );
+    for( i = 0; i < key_count; i++ ) {
+        bdgr_key_free( &keys[ i ].key );
+    }
+    free( keys );
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <jansson.h>
+#include <curl/curl.h>
+#ifdef BDGR_MATH_GMP
+#include <gmp.h>
+#endif
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+
+/*
+  The allocator can only change before Badger initializes, so the hooks
+  are read without locking.
+*/
+static struct {
+    void*         (*malloc_fn)( size_t size );
+    void*         (*realloc_fn)( void* ptr, size_t size );
+    void          (*free_fn)( void* ptr );
+    int             custom;
+    int             in_use;
+    pthread_mutex_t lock;
+} bdgr_g_alloc = { malloc, realloc, free, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+void* bdgr_malloc( const size_t size )
+{
+    return bdgr_g_alloc.malloc_fn( size );
+}
+
+void* bdgr_calloc( const size_t count, const size_t size )
+{
+    void* ptr;
+
+    if( !bdgr_g_alloc.custom ) {
+        return calloc( count, size );
+    }
+    if( size && count > (size_t)-1 / size ) {
+        return NULL;
+    }
+    ptr = bdgr_g_alloc.malloc_fn( count * size );
+    if( ptr != NULL ) {
+        memset( ptr, 0, count * size );
+    }
+    return ptr;
+}
+
+void* bdgr_realloc( void* const ptr, const size_t size )
+{
+    return bdgr_g_alloc.realloc_fn( ptr, size );
+}
+
+char* bdgr_strdup( const char* const string )
+{
+    const size_t len = strlen( string ) + 1;
+    char* const copy = bdgr_g_alloc.malloc_fn( len );
+
+    if( copy != NULL ) {
+        memcpy( copy, string, len );
+    }
+    return copy;
+}
+
+void bdgr_free( void* const ptr )
+{
+    bdgr_g_alloc.free_fn( ptr );
+}
+
+#ifdef BDGR_MATH_GMP
+static void* bdgr_gmp_realloc(
+    void* const ptr,
+    const size_t old_size,
+    const size_t size
+)
+{
+    (void)old_size;
+    return bdgr_realloc( ptr, size );
+}
+
+static void bdgr_gmp_free( void* const ptr, const size_t size )
+{
+    (void)size;
+    bdgr_free( ptr );
+}
+#endif
+
+CURLcode bdgr_alloc_curl_init( const long int flags )
+{
+    pthread_mutex_lock( &bdgr_g_alloc.lock );
+    bdgr_g_alloc.in_use = 1;
+    pthread_mutex_unlock( &bdgr_g_alloc.lock );
+
+    if( !bdgr_g_alloc.custom ) {
+        return curl_global_init( flags );
+    }
+    return curl_global_init_mem( flags, bdgr_malloc, bdgr_free, bdgr_realloc,
+                                 bdgr_strdup, bdgr_calloc );
+}
+
+int bdgr_set_allocator(
+    void* (*malloc_fn)( size_t size ),
+    void* (*realloc_fn)( void* ptr, size_t size ),
+    void (*free_fn)( void* ptr )
+)
+{
+    pthread_mutex_lock( &bdgr_g_alloc.lock );
+    bdgr_check( bdgr_g_alloc.in_use, bdgr_allocator_in_use_err, __LINE__ );
+    if( !bdgr_error() ) {
+        bdgr_g_alloc.malloc_fn = malloc_fn;
+        bdgr_g_alloc.realloc_fn = realloc_fn;
+        bdgr_g_alloc.free_fn = free_fn;
+        bdgr_g_alloc.custom = 1;
+
+        /* Whatever they allocate from now on is freed by Badger too */
+        json_set_alloc_funcs( bdgr_malloc, bdgr_free );
+#ifdef BDGR_MATH_GMP
+        mp_set_memory_functions( bdgr_malloc, bdgr_gmp_realloc,
+                                 bdgr_gmp_free );
+#endif
+    }
+    pthread_mutex_unlock( &bdgr_g_alloc.lock );
+    return bdgr_error();
+}
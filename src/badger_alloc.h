@@ -0,0 +1,39 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_ALLOC_H
+#define BADGER_ALLOC_H
+
+#include <stddef.h>
+#include <curl/curl.h>
+#include <badger.h>
+
+/* Every allocation of the library goes through these, see bdgr_free() */
+void* bdgr_malloc( size_t size );
+
+void* bdgr_calloc( size_t count, size_t size );
+
+void* bdgr_realloc( void* ptr, size_t size );
+
+char* bdgr_strdup( const char* string );
+
+/* curl_global_init(), handing curl the allocator if one was set */
+CURLcode bdgr_alloc_curl_init( long int flags );
+
+#endif
@@ -20,6 +20,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <tomcrypt.h>
 #include <badger.h>
 
@@ -29,45 +33,119 @@ void usage()
 {
     fprintf(
         stderr,
-        "Usage: badger_badge <id> <base64-token>\n"
-        "A record must be available from stdin.\n"
+        "Usage: badger_badge [options] <id> <base64-token>\n"
+        "A private key must be available from stdin, unless an agent is used.\n"
+        "Options:\n"
+        "-a, --agent  <socket>, sign with badger-agent, "
+        "defaults to $BADGER_AGENT_SOCK\n"
+        "-i, --kid    <kid>, name the key of the record signing the badge\n"
     );
 }
 
+/* Asks a badger-agent holding the key for id to sign the token */
+unsigned char* agent_sign(
+    const char* path,
+    const char* id,
+    const char* token,
+    unsigned long int* signature_len
+)
+{
+    struct sockaddr_un addr;
+    char request[BUF_SIZE * 4], reply[BUF_SIZE * 4], * end;
+    unsigned char* signature;
+    size_t reply_len = 0;
+    ssize_t n;
+    int fd, len;
+
+    len = snprintf( request, sizeof( request ), "SIGN %s %s\n", id, token );
+    if( len < 0 || len >= (int)sizeof( request ) ||
+        strlen( path ) >= sizeof( addr.sun_path )) {
+        fprintf( stderr, "error contacting agent: request too long\n" );
+        exit( 1 );
+    }
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+    fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd == -1 ||
+        connect( fd, (struct sockaddr*)&addr, sizeof( addr )) == -1 ||
+        write( fd, request, len ) != len ) {
+        fprintf( stderr, "error contacting agent at %s\n", path );
+        exit( 1 );
+    }
+    while( reply_len < sizeof( reply ) - 1 &&
+           ( n = read( fd, reply + reply_len,
+                       sizeof( reply ) - 1 - reply_len )) > 0 ) {
+        reply_len += n;
+    }
+    close( fd );
+    reply[ reply_len ] = '\0';
+    end = strchr( reply, '\n' );
+    if( end == NULL ) {
+        fprintf( stderr, "error signing token: no reply from agent\n" );
+        exit( 1 );
+    }
+    *end = '\0';
+    if( strncmp( reply, "OK ", 3 )) {
+        fprintf( stderr, "error signing token: %s\n", reply );
+        exit( 1 );
+    }
+
+    *signature_len = end - reply;
+    signature = malloc( *signature_len );
+    if( base64_decode( (unsigned char*)reply + 3, end - reply - 3,
+                       signature, signature_len ) != CRYPT_OK ) {
+        fprintf( stderr, "error signing token: bad reply from agent\n" );
+        exit( 1 );
+    }
+    return signature;
+}
+
 int main( const int argc, char* const* argv )
 {
 
     int err;
     bdgr_key key;
     bdgr_badge badge;
-    char* key_string, * id, * token, * badge_string;
+    char* key_string, * id, * token, * badge_string, * kid = NULL;
     unsigned long int token_len, tokenb_len, signature_len = 2048;
     unsigned char* tokenb, * signature = malloc( signature_len );
     char buffer[BUF_SIZE];
     size_t key_len = 1;
+    const char* agent = getenv( "BADGER_AGENT_SOCK" );
+    int c;
 
-    if( argc != 3 ) {
+    while (1) {
+        static struct option long_options[] = {
+            { "agent", required_argument, 0, 'a' },
+            { "kid",   required_argument, 0, 'i' },
+            { 0, 0, 0, 0 }
+        };
+        int option_index = 0;
+        c = getopt_long( argc, argv, "a:i:", long_options, &option_index);
+        if (c == -1)
+            break;
+        switch(c) {
+        case 'a':
+            agent = optarg;
+            break;
+        case 'i':
+            kid = optarg;
+            break;
+        case '?':
+            break;
+        default:
+            abort();
+        }
+    }
+    if( argc - optind != 2 ) {
         usage();
         exit( 1 );
     }
-    
-    key_string = malloc( BUF_SIZE );
-    key_string[0] = '\0';
-    while( fgets( buffer, BUF_SIZE, stdin )) {
-        key_len += strlen( buffer );
-        key_string = realloc( key_string, key_len );
-        strcat( key_string, buffer );
-    }
-    err = bdgr_key_decode( key_string, &key );
-    if( err ) {
-        fprintf( stderr,
-                 "error decoding key: %s\n",
-                 bdgr_error_string( err ));
-        exit( err );
-    }
-        
-    id = argv[ 1 ];
-    token = argv[ 2 ];
+
+    id = argv[ optind ];
+    token = argv[ optind + 1 ];
     token_len = strlen( token );
 
     tokenb_len = token_len;
@@ -80,15 +158,36 @@ int main( const int argc, char* const* argv )
         exit( err );
     }
 
-    err = bdgr_token_sign( tokenb, tokenb_len, &key, signature, &signature_len );
-    if( err ) {
-        fprintf( stderr,
-                 "error signing token: %s\n",
-                 bdgr_error_string( err ));
-        exit( err );
+    if( agent != NULL && *agent != '\0' ) {
+        free( signature );
+        signature = agent_sign( agent, id, token, &signature_len );
+    } else {
+        key_string = malloc( BUF_SIZE );
+        key_string[0] = '\0';
+        while( fgets( buffer, BUF_SIZE, stdin )) {
+            key_len += strlen( buffer );
+            key_string = realloc( key_string, key_len );
+            strcat( key_string, buffer );
+        }
+        err = bdgr_key_decode( key_string, &key );
+        if( err ) {
+            fprintf( stderr,
+                     "error decoding key: %s\n",
+                     bdgr_error_string( err ));
+            exit( err );
+        }
+
+        err = bdgr_token_sign( tokenb, tokenb_len, &key, signature, &signature_len );
+        if( err ) {
+            fprintf( stderr,
+                     "error signing token: %s\n",
+                     bdgr_error_string( err ));
+            exit( err );
+        }
     }
 
-    err = bdgr_badge_make( id, tokenb, tokenb_len, signature, signature_len, &badge );
+    err = bdgr_badge_make_kid( id, kid, tokenb, tokenb_len,
+                               signature, signature_len, &badge );
     if( err ) {
         fprintf( stderr,
                  "error making badge: %s\n",
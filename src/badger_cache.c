@@ -0,0 +1,922 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_cache.h"
+#include "badger_table.h"
+
+/*
+  The cache is a single file or shared memory object: one header page
+  followed by an array of fixed size slots, addressed by open addressing on
+  the SHA-256 of the Identity URL.  Slots never straddle a page, and each
+  carries a sequence number that is odd while the slot is being written and
+  a checksum over its contents, so a slot torn by a crash is simply treated
+  as empty.  An entry with an expiry, taken from the HTTP freshness of its
+  record, is fresh until then; others are fresh for the max_age of the
+  cache.  An entry whose key has a validity period is never used past it.
+
+  Every process mapping the cache shares it.  Readers take no lock: they
+  copy a slot and keep the copy only if its sequence number was even and
+  unchanged across the copy.  Writers serialize on one of the shard locks
+  in the header, chosen by slot, which hold the pid of their owner so that
+  a lock left by a dead process can be taken over.  The header also holds
+  fetch claims, so that of the processes missing the same entry only one
+  fetches it and the others wait for it to land.
+*/
+
+#define BDGR_CACHE_FAMILY      "BDGRKC"
+#define BDGR_CACHE_MAGIC       BDGR_CACHE_FAMILY "04"
+#define BDGR_CACHE_HEADER_SIZE 4096
+#define BDGR_CACHE_SLOT_SIZE   1024
+#define BDGR_CACHE_PROBE       8
+#define BDGR_CACHE_HASH_SIZE   32
+#define BDGR_CACHE_SHARDS      64
+#define BDGR_CACHE_CLAIMS      128
+#define BDGR_CACHE_CLAIM_MS    5000
+#define BDGR_CACHE_SPINS       4096
+#define BDGR_CACHE_READS       8
+
+struct bdgr_cache_claim {
+    uint64_t tag;
+    int64_t  until;
+    uint32_t pid;
+    uint32_t unused;
+};
+
+struct bdgr_cache_header {
+    char                    magic[8];
+    uint32_t                slot_size;
+    uint32_t                slot_count;
+    uint32_t                locks[ BDGR_CACHE_SHARDS ];
+    struct bdgr_cache_claim claims[ BDGR_CACHE_CLAIMS ];
+};
+
+typedef char bdgr_cache_header_size_check[
+    sizeof( struct bdgr_cache_header ) <= BDGR_CACHE_HEADER_SIZE ? 1 : -1 ];
+
+struct bdgr_cache_slot {
+    uint32_t      seq;
+    uint32_t      check;
+    uint64_t      fetched;
+    uint64_t      expires;
+    uint64_t      until;
+    unsigned char url_hash[ BDGR_CACHE_HASH_SIZE ];
+    unsigned char record_hash[ BDGR_CACHE_HASH_SIZE ];
+    uint32_t      key_len;
+    unsigned char key[ BDGR_CACHE_SLOT_SIZE - 100 ];
+};
+
+typedef char bdgr_cache_slot_size_check[
+    sizeof( struct bdgr_cache_slot ) == BDGR_CACHE_SLOT_SIZE ? 1 : -1 ];
+
+/* The lock only guards the mapping itself, which readers share */
+static struct {
+    unsigned char*    map;
+    size_t            map_len;
+    unsigned long int slot_count;
+    unsigned long int max_age;
+    int               fd;
+    int               sync;
+    int               sha256;
+    pthread_rwlock_t  lock;
+} bdgr_g_cache = { NULL, 0, 0, 0, -1, 0, -1, PTHREAD_RWLOCK_INITIALIZER };
+
+static struct bdgr_cache_header* bdgr_cache_header()
+{
+    return (struct bdgr_cache_header*)bdgr_g_cache.map;
+}
+
+static struct bdgr_cache_slot* bdgr_cache_slot( const unsigned long int i )
+{
+    return (struct bdgr_cache_slot*)(
+        bdgr_g_cache.map + BDGR_CACHE_HEADER_SIZE +
+        i * BDGR_CACHE_SLOT_SIZE );
+}
+
+static uint32_t bdgr_cache_check( const struct bdgr_cache_slot* const slot )
+{
+    /* FNV-1a over everything after the checksum, up to the end of the key */
+    const unsigned char* p = (const unsigned char*)&slot->fetched;
+    const unsigned char* const end = slot->key +
+        ( slot->key_len < sizeof( slot->key ) ?
+          slot->key_len : sizeof( slot->key ));
+    uint32_t hash = 2166136261u;
+    while( p < end ) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int bdgr_cache_hash(
+    const char* const data,
+    unsigned char* const hash
+)
+{
+    unsigned long int hash_len = BDGR_CACHE_HASH_SIZE;
+    return hash_memory( bdgr_g_cache.sha256,
+                        (const unsigned char*)data, strlen( data ),
+                        hash, &hash_len );
+}
+
+static int64_t bdgr_cache_now_ms()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+  Takes a shard lock, or gives up after a while: cache writes are never
+  worth stalling a verification for.
+*/
+static int bdgr_cache_lock( uint32_t* const lock )
+{
+    const uint32_t self = (uint32_t)getpid();
+    uint32_t owner;
+    int i;
+
+    for( i = 0; i < BDGR_CACHE_SPINS; i++ ) {
+        owner = 0;
+        if( __atomic_compare_exchange_n( lock, &owner, self, 0,
+                                         __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED )) {
+            return 1;
+        }
+
+        /* A process that died holding the lock leaves it to the next */
+        if( i % 64 == 63 && owner != self &&
+            kill( (pid_t)owner, 0 ) == -1 && errno == ESRCH &&
+            __atomic_compare_exchange_n( lock, &owner, self, 0,
+                                         __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED )) {
+            return 1;
+        }
+        sched_yield();
+    }
+    return 0;
+}
+
+static void bdgr_cache_unlock( uint32_t* const lock )
+{
+    __atomic_store_n( lock, 0, __ATOMIC_RELEASE );
+}
+
+static uint32_t* bdgr_cache_shard( const struct bdgr_cache_slot* const slot )
+{
+    const unsigned long int i =
+        ( (const unsigned char*)slot - bdgr_g_cache.map -
+          BDGR_CACHE_HEADER_SIZE ) / BDGR_CACHE_SLOT_SIZE;
+    return &bdgr_cache_header()->locks[ i % BDGR_CACHE_SHARDS ];
+}
+
+/* Marks a slot as being written, called with its shard locked */
+static void bdgr_cache_write_begin( struct bdgr_cache_slot* const slot )
+{
+    const uint32_t seq = slot->seq;
+
+    /* A slot torn by a crash is already odd */
+    __atomic_store_n( &slot->seq, seq + (( seq & 1 ) ? 2 : 1 ),
+                      __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+static void bdgr_cache_write_end( struct bdgr_cache_slot* const slot )
+{
+    slot->check = bdgr_cache_check( slot );
+    __atomic_store_n( &slot->seq, slot->seq + 1, __ATOMIC_RELEASE );
+}
+
+/*
+  Copies slot into copy, retrying while a writer is at it.  Returns 0 if
+  the slot is empty, torn or kept busy.
+*/
+static int bdgr_cache_read(
+    const struct bdgr_cache_slot* const slot,
+    struct bdgr_cache_slot* const copy
+)
+{
+    uint32_t seq;
+    int i;
+
+    for( i = 0; i < BDGR_CACHE_READS; i++ ) {
+        seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+        if( seq == 0 ) {
+            return 0;
+        }
+        if( !( seq & 1 )) {
+            memcpy( copy, slot, sizeof( *copy ));
+            __atomic_thread_fence( __ATOMIC_ACQUIRE );
+            if( __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) == seq ) {
+                return copy->key_len <= sizeof( copy->key ) &&
+                    copy->check == bdgr_cache_check( copy );
+            }
+        }
+        sched_yield();
+    }
+    return 0;
+}
+
+static void bdgr_cache_unmap()
+{
+    if( bdgr_g_cache.map != NULL ) {
+        if( bdgr_g_cache.sync ) {
+            msync( bdgr_g_cache.map, bdgr_g_cache.map_len, MS_SYNC );
+        }
+        munmap( bdgr_g_cache.map, bdgr_g_cache.map_len );
+        bdgr_g_cache.map = NULL;
+    }
+    if( bdgr_g_cache.fd != -1 ) {
+        close( bdgr_g_cache.fd );
+        bdgr_g_cache.fd = -1;
+    }
+    bdgr_g_cache.slot_count = 0;
+    bdgr_g_cache.sync = 0;
+}
+
+static int bdgr_cache_map(
+    const char* const path,
+    const int shm,
+    unsigned long int slots,
+    const unsigned long int max_age
+)
+{
+    struct bdgr_cache_header* header;
+    struct stat st;
+    int fresh = 1;
+
+    bdgr_cache_unmap();
+
+    bdgr_check( register_hash( &sha256_desc ) == -1,
+                bdgr_register_hash_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    bdgr_g_cache.sha256 = find_hash( "sha256" );
+
+    if( path == NULL ) {
+        bdgr_g_cache.map_len =
+            BDGR_CACHE_HEADER_SIZE + slots * BDGR_CACHE_SLOT_SIZE;
+        bdgr_g_cache.map = mmap( NULL, bdgr_g_cache.map_len,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        bdgr_check( bdgr_g_cache.map == MAP_FAILED,
+                    bdgr_cache_open_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_key_cache_open_free;
+        }
+    } else {
+        bdgr_g_cache.fd = shm ?
+            shm_open( path, O_RDWR | O_CREAT, 0600 ) :
+            open( path, O_RDWR | O_CREAT, 0600 );
+
+        /*
+          Processes opening the cache together take turns, so that none
+          sees the file between its creation and its header being written,
+          or sizes and initializes it over another.
+        */
+        bdgr_check( bdgr_g_cache.fd == -1 ||
+                    flock( bdgr_g_cache.fd, LOCK_EX ) == -1 ||
+                    fstat( bdgr_g_cache.fd, &st ) == -1,
+                    bdgr_cache_open_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_key_cache_open_free;
+        }
+        bdgr_g_cache.sync = !shm;
+
+        if( st.st_size == 0 ) {
+            bdgr_g_cache.map_len =
+                BDGR_CACHE_HEADER_SIZE + slots * BDGR_CACHE_SLOT_SIZE;
+            bdgr_check( ftruncate( bdgr_g_cache.fd,
+                                   bdgr_g_cache.map_len ) == -1,
+                        bdgr_cache_open_err, __LINE__ );
+            if( bdgr_error() ) {
+                goto bdgr_key_cache_open_free;
+            }
+        } else {
+            bdgr_check( st.st_size < BDGR_CACHE_HEADER_SIZE,
+                        bdgr_cache_format_err, __LINE__ );
+            if( bdgr_error() ) {
+                goto bdgr_key_cache_open_free;
+            }
+            bdgr_g_cache.map_len = st.st_size;
+            fresh = 0;
+        }
+
+        bdgr_g_cache.map = mmap( NULL, bdgr_g_cache.map_len,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, bdgr_g_cache.fd, 0 );
+        bdgr_check( bdgr_g_cache.map == MAP_FAILED,
+                    bdgr_cache_open_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_key_cache_open_free;
+        }
+    }
+
+    header = bdgr_cache_header();
+    if( !fresh &&
+        memcmp( header->magic, BDGR_CACHE_MAGIC, sizeof( header->magic )) &&
+        ( header->magic[0] == '\0' ||
+          !memcmp( header->magic, BDGR_CACHE_FAMILY,
+                   strlen( BDGR_CACHE_FAMILY )))) {
+        /* Never initialized before a crash, or left by an older version */
+        slots = ( bdgr_g_cache.map_len - BDGR_CACHE_HEADER_SIZE ) /
+            BDGR_CACHE_SLOT_SIZE;
+        memset( bdgr_g_cache.map, 0, bdgr_g_cache.map_len );
+        fresh = 1;
+    }
+    if( fresh ) {
+        memcpy( header->magic, BDGR_CACHE_MAGIC, sizeof( header->magic ));
+        header->slot_size = BDGR_CACHE_SLOT_SIZE;
+        header->slot_count = slots;
+    } else {
+        /* An existing file keeps the geometry it was created with */
+        slots = header->slot_count;
+        bdgr_check( memcmp( header->magic, BDGR_CACHE_MAGIC,
+                            sizeof( header->magic )) ||
+                    header->slot_size != BDGR_CACHE_SLOT_SIZE ||
+                    bdgr_g_cache.map_len < BDGR_CACHE_HEADER_SIZE +
+                    slots * BDGR_CACHE_SLOT_SIZE,
+                    bdgr_cache_format_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_key_cache_open_free;
+        }
+    }
+    bdgr_check( slots == 0, bdgr_cache_format_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_key_cache_open_free;
+    }
+
+    bdgr_g_cache.slot_count = slots;
+    bdgr_g_cache.max_age = max_age;
+
+ bdgr_key_cache_open_free:
+
+    if( bdgr_g_cache.fd != -1 ) {
+        flock( bdgr_g_cache.fd, LOCK_UN );
+    }
+    if( bdgr_error() ) {
+        if( bdgr_g_cache.map == MAP_FAILED ) {
+            bdgr_g_cache.map = NULL;
+        }
+        bdgr_cache_unmap();
+    }
+    return bdgr_error();
+}
+
+int bdgr_key_cache_open(
+    const char* const path,
+    const unsigned long int slots,
+    const unsigned long int max_age
+)
+{
+    pthread_rwlock_wrlock( &bdgr_g_cache.lock );
+    bdgr_cache_map( path, 0, slots, max_age );
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+    return bdgr_error();
+}
+
+int bdgr_key_cache_shared(
+    const char* const name,
+    const unsigned long int slots,
+    const unsigned long int max_age
+)
+{
+    pthread_rwlock_wrlock( &bdgr_g_cache.lock );
+    bdgr_cache_map( name, 1, slots, max_age );
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+    return bdgr_error();
+}
+
+void bdgr_key_cache_close()
+{
+    pthread_rwlock_wrlock( &bdgr_g_cache.lock );
+    bdgr_cache_unmap();
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+}
+
+static int bdgr_cache_vacant( const struct bdgr_cache_slot* const slot )
+{
+    const uint32_t seq = __atomic_load_n( &slot->seq, __ATOMIC_RELAXED );
+    return seq == 0 || seq & 1;
+}
+
+/*
+  The slot holding url_hash, if any, and in victim the one to write it to.
+  Slots are looked at without a lock, so the caller rereads or locks the
+  one it picks.
+*/
+static struct bdgr_cache_slot* bdgr_cache_find(
+    const unsigned char* const url_hash,
+    struct bdgr_cache_slot** const victim
+)
+{
+    unsigned long int i, start;
+    struct bdgr_cache_slot* slot;
+
+    memcpy( &start, url_hash, sizeof( start ));
+    start %= bdgr_g_cache.slot_count;
+    *victim = NULL;
+
+    for( i = 0; i < BDGR_CACHE_PROBE && i < bdgr_g_cache.slot_count; i++ ) {
+        slot = bdgr_cache_slot( ( start + i ) % bdgr_g_cache.slot_count );
+        if( !memcmp( slot->url_hash, url_hash, BDGR_CACHE_HASH_SIZE )) {
+            *victim = slot;
+            return slot;
+        }
+        /* Prefer an empty or torn slot, otherwise evict the oldest */
+        if( *victim == NULL ||
+            ( !bdgr_cache_vacant( *victim ) &&
+              ( bdgr_cache_vacant( slot ) ||
+                slot->fetched < (*victim)->fetched ))) {
+            *victim = slot;
+        }
+    }
+    return NULL;
+}
+
+/*
+  Copies out the key of the intact entry for url_hash, provided it is
+  fresh or stale is set, and it was decoded from a record hashing to
+  record_hash unless that is NULL.  Returns the key length, or 0.  Called
+  with the mapping held.
+*/
+static unsigned long int bdgr_cache_copy(
+    const unsigned char* const url_hash,
+    const unsigned char* const record_hash,
+    const int stale,
+    unsigned char* const data,
+    struct bdgr_cache_slot** const found
+)
+{
+    struct bdgr_cache_slot* slot, * victim;
+    struct bdgr_cache_slot copy;
+    const uint64_t now = time( NULL );
+
+    slot = bdgr_g_cache.map == NULL ? NULL :
+        bdgr_cache_find( url_hash, &victim );
+    if( slot == NULL || !bdgr_cache_read( slot, &copy ) ||
+        memcmp( copy.url_hash, url_hash, BDGR_CACHE_HASH_SIZE ) ||
+        ( copy.until && now >= copy.until )) {
+        return 0;
+    }
+    if( !stale &&
+        ( copy.expires ? now >= copy.expires :
+          bdgr_g_cache.max_age &&
+          now - copy.fetched > bdgr_g_cache.max_age )) {
+        return 0;
+    }
+    if( record_hash != NULL &&
+        memcmp( copy.record_hash, record_hash, BDGR_CACHE_HASH_SIZE )) {
+        return 0;
+    }
+    memcpy( data, copy.key, copy.key_len );
+    *found = slot;
+    return copy.key_len;
+}
+
+static void bdgr_cache_sync( const struct bdgr_cache_slot* const slot )
+{
+    const long int page = sysconf( _SC_PAGESIZE );
+
+    /* Write back without making the verifier wait on the disk */
+    if( bdgr_g_cache.sync ) {
+        msync( (void*)( (uintptr_t)slot & ~(uintptr_t)( page - 1 )),
+               page, MS_ASYNC );
+    }
+}
+
+static int bdgr_cache_import(
+    const unsigned char* const data,
+    const unsigned long int data_len,
+    bdgr_key* const key
+)
+{
+    if( !data_len ) {
+        return 0;
+    }
+    if( bdgr_key_import( data, data_len, key )) {
+        /* Unusable entry, fall back to the scheme handler */
+        bdgr_check( 0, bdgr_no_err, __LINE__ );
+        return 0;
+    }
+    return 1;
+}
+
+int bdgr_cache_get(
+    const char* const url,
+    bdgr_key* const key
+)
+{
+    unsigned char url_hash[ BDGR_CACHE_HASH_SIZE ];
+    unsigned char data[ sizeof( ((struct bdgr_cache_slot*)0)->key ) ];
+    unsigned long int data_len;
+    struct bdgr_cache_slot* slot;
+
+    if( bdgr_g_cache.map == NULL ||
+        bdgr_cache_hash( url, url_hash ) != CRYPT_OK ) {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock( &bdgr_g_cache.lock );
+    data_len = bdgr_cache_copy( url_hash, NULL, 0, data, &slot );
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+
+    return bdgr_cache_import( data, data_len, key );
+}
+
+int bdgr_cache_stale( const char* const url )
+{
+    unsigned char url_hash[ BDGR_CACHE_HASH_SIZE ];
+    unsigned char data[ sizeof( ((struct bdgr_cache_slot*)0)->key ) ];
+    unsigned long int data_len;
+    struct bdgr_cache_slot* slot;
+
+    if( bdgr_g_cache.map == NULL ||
+        bdgr_cache_hash( url, url_hash ) != CRYPT_OK ) {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock( &bdgr_g_cache.lock );
+    data_len = bdgr_cache_copy( url_hash, NULL, 1, data, &slot );
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+    return data_len > 0;
+}
+
+int bdgr_cache_reuse(
+    const char* const url,
+    const char* const record,
+    const time_t expires,
+    bdgr_key* const key
+)
+{
+    unsigned char url_hash[ BDGR_CACHE_HASH_SIZE ];
+    unsigned char record_hash[ BDGR_CACHE_HASH_SIZE ];
+    unsigned char data[ sizeof( ((struct bdgr_cache_slot*)0)->key ) ];
+    unsigned long int data_len;
+    struct bdgr_cache_slot* slot;
+    uint32_t* shard;
+
+    if( bdgr_g_cache.map == NULL ||
+        bdgr_cache_hash( url, url_hash ) != CRYPT_OK ||
+        ( record != NULL &&
+          bdgr_cache_hash( record, record_hash ) != CRYPT_OK )) {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock( &bdgr_g_cache.lock );
+    data_len = bdgr_cache_copy( url_hash, record != NULL ? record_hash : NULL,
+                                1, data, &slot );
+    if( data_len ) {
+        shard = bdgr_cache_shard( slot );
+        if( bdgr_cache_lock( shard )) {
+            /* The record is unchanged, only its freshness moves on */
+            if( !memcmp( slot->url_hash, url_hash, BDGR_CACHE_HASH_SIZE )) {
+                bdgr_cache_write_begin( slot );
+                slot->fetched = time( NULL );
+                slot->expires = expires;
+                bdgr_cache_write_end( slot );
+                bdgr_cache_sync( slot );
+            }
+            bdgr_cache_unlock( shard );
+        }
+    }
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+
+    return bdgr_cache_import( data, data_len, key );
+}
+
+void bdgr_cache_put(
+    const char* const url,
+    const char* const record,
+    const time_t expires,
+    const time_t until,
+    const bdgr_key* const key
+)
+{
+    unsigned char url_hash[ BDGR_CACHE_HASH_SIZE ];
+    unsigned char record_hash[ BDGR_CACHE_HASH_SIZE ];
+    unsigned char data[ sizeof( ((struct bdgr_cache_slot*)0)->key ) ];
+    unsigned long int data_len = sizeof( data );
+    struct bdgr_cache_slot* slot;
+    uint32_t* shard;
+
+    if( bdgr_g_cache.map == NULL ||
+        bdgr_cache_hash( url, url_hash ) != CRYPT_OK ||
+        bdgr_cache_hash( record, record_hash ) != CRYPT_OK ) {
+        return;
+    }
+
+    if( bdgr_key_export_public( key, data, &data_len )) {
+        /* Cache failures never fail a verification */
+        bdgr_check( 0, bdgr_no_err, __LINE__ );
+        return;
+    }
+
+    pthread_rwlock_rdlock( &bdgr_g_cache.lock );
+    slot = NULL;
+    if( bdgr_g_cache.map != NULL ) {
+        bdgr_cache_find( url_hash, &slot );
+    }
+    if( slot != NULL && bdgr_cache_lock( shard = bdgr_cache_shard( slot ))) {
+        bdgr_cache_write_begin( slot );
+        slot->fetched = time( NULL );
+        slot->expires = expires;
+        slot->until = until;
+        memcpy( slot->url_hash, url_hash, BDGR_CACHE_HASH_SIZE );
+        memcpy( slot->record_hash, record_hash, BDGR_CACHE_HASH_SIZE );
+        slot->key_len = data_len;
+        memcpy( slot->key, data, data_len );
+        bdgr_cache_write_end( slot );
+        bdgr_cache_sync( slot );
+        bdgr_cache_unlock( shard );
+    }
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+}
+
+/*
+  Fetch claims: a process about to fetch url claims it for a while, and
+  others missing it meanwhile wait for its entry instead of fetching too.
+  Claims are direct mapped on the URL hash and guarded by the shard locks;
+  one colliding with a live claim on another URL is simply not taken.
+*/
+static struct bdgr_cache_claim* bdgr_cache_claim_slot(
+    const char* const url,
+    uint64_t* const tag,
+    uint32_t** const shard
+)
+{
+    unsigned char url_hash[ BDGR_CACHE_HASH_SIZE ];
+    unsigned long int i;
+
+    /* A private mapping has no other process to share with */
+    if( bdgr_g_cache.map == NULL || bdgr_g_cache.fd == -1 ||
+        bdgr_cache_hash( url, url_hash ) != CRYPT_OK ) {
+        return NULL;
+    }
+    memcpy( tag, url_hash, sizeof( *tag ));
+    *tag |= 1;
+    i = *tag % BDGR_CACHE_CLAIMS;
+    *shard = &bdgr_cache_header()->locks[ i % BDGR_CACHE_SHARDS ];
+    return &bdgr_cache_header()->claims[ i ];
+}
+
+int bdgr_cache_claim( const char* const url, const long int ms )
+{
+    struct bdgr_cache_claim* claim;
+    const uint32_t self = (uint32_t)getpid();
+    const int64_t now = bdgr_cache_now_ms();
+    uint32_t* shard;
+    uint64_t tag;
+    int claimed = 1;
+
+    pthread_rwlock_rdlock( &bdgr_g_cache.lock );
+    claim = bdgr_cache_claim_slot( url, &tag, &shard );
+    if( claim != NULL && bdgr_cache_lock( shard )) {
+        if( claim->tag == tag && claim->until > now && claim->pid != self ) {
+            claimed = 0;
+        } else if( claim->tag == tag || claim->until <= now ) {
+            claim->tag = tag;
+            claim->pid = self;
+            claim->until = now +
+                ( ms > 0 && ms < BDGR_CACHE_CLAIM_MS ? ms : BDGR_CACHE_CLAIM_MS );
+        }
+        bdgr_cache_unlock( shard );
+    }
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+    return claimed;
+}
+
+void bdgr_cache_unclaim( const char* const url )
+{
+    struct bdgr_cache_claim* claim;
+    uint32_t* shard;
+    uint64_t tag;
+
+    pthread_rwlock_rdlock( &bdgr_g_cache.lock );
+    claim = bdgr_cache_claim_slot( url, &tag, &shard );
+    if( claim != NULL && bdgr_cache_lock( shard )) {
+        if( claim->tag == tag && claim->pid == (uint32_t)getpid() ) {
+            claim->tag = 0;
+            claim->until = 0;
+        }
+        bdgr_cache_unlock( shard );
+    }
+    pthread_rwlock_unlock( &bdgr_g_cache.lock );
+}
+
+int bdgr_cache_await( const char* const url, bdgr_key* const key )
+{
+    struct bdgr_cache_claim* claim;
+    struct timespec pause = { 0, 1000000 };
+    uint32_t* shard;
+    uint64_t tag;
+    int live = 1;
+
+    while( live && bdgr_deadline_remaining_ms() != 0 ) {
+        nanosleep( &pause, NULL );
+        if( pause.tv_nsec < 16000000 ) {
+            pause.tv_nsec *= 2;
+        }
+        if( bdgr_cache_get( url, key )) {
+            return 1;
+        }
+
+        /* Read without the lock, a stale answer only costs another round */
+        pthread_rwlock_rdlock( &bdgr_g_cache.lock );
+        claim = bdgr_cache_claim_slot( url, &tag, &shard );
+        live = claim != NULL &&
+            __atomic_load_n( &claim->tag, __ATOMIC_ACQUIRE ) == tag &&
+            __atomic_load_n( &claim->until, __ATOMIC_RELAXED ) >
+            bdgr_cache_now_ms();
+        pthread_rwlock_unlock( &bdgr_g_cache.lock );
+    }
+    return 0;
+}
+
+/*
+  Negative cache: Identity URLs whose last lookups failed, and when they
+  may be tried again.  The wait doubles with each consecutive failure.
+*/
+
+#define BDGR_NEGATIVE_MAX       65536
+#define BDGR_NEGATIVE_MAX_DOUBLE 16
+
+enum {
+    bdgr_negative_not_found,
+    bdgr_negative_malformed,
+    bdgr_negative_transport
+};
+
+struct bdgr_negative_entry {
+    unsigned int failures;
+    time_t       until;
+};
+
+static struct {
+    bdgr_table        urls;
+    unsigned long int ttl[3];
+    unsigned long int max_backoff;
+    pthread_mutex_t   lock;
+} bdgr_g_negative = { { NULL, 0, 0, NULL }, { 0, 0, 0 }, 0,
+                      PTHREAD_MUTEX_INITIALIZER };
+
+int bdgr_negative_cache_set(
+    const unsigned long int not_found_ttl,
+    const unsigned long int malformed_ttl,
+    const unsigned long int transport_ttl,
+    const unsigned long int max_backoff
+)
+{
+    pthread_mutex_lock( &bdgr_g_negative.lock );
+    if( bdgr_g_negative.urls.buckets == NULL ) {
+        bdgr_check( bdgr_table_init( &bdgr_g_negative.urls, 1024, bdgr_free ),
+                    bdgr_malloc_err, __LINE__ );
+        if( bdgr_error() ) {
+            pthread_mutex_unlock( &bdgr_g_negative.lock );
+            return bdgr_error();
+        }
+    }
+    bdgr_g_negative.ttl[ bdgr_negative_not_found ] = not_found_ttl;
+    bdgr_g_negative.ttl[ bdgr_negative_malformed ] = malformed_ttl;
+    bdgr_g_negative.ttl[ bdgr_negative_transport ] = transport_ttl;
+    bdgr_g_negative.max_backoff = max_backoff;
+    pthread_mutex_unlock( &bdgr_g_negative.lock );
+    return bdgr_check( 0, bdgr_no_err, __LINE__ );
+}
+
+int bdgr_cache_backoff( const char* const url )
+{
+    const struct bdgr_negative_entry* entry;
+    int backoff;
+    
+    pthread_mutex_lock( &bdgr_g_negative.lock );
+    entry = bdgr_table_get( &bdgr_g_negative.urls, url );
+    backoff = entry != NULL && time( NULL ) < entry->until;
+    pthread_mutex_unlock( &bdgr_g_negative.lock );
+    
+    return bdgr_check( backoff, bdgr_lookup_backoff_err, __LINE__ );
+}
+
+static int bdgr_negative_expired( void* const value, void* const now )
+{
+    return ((struct bdgr_negative_entry*)value)->until <= *(time_t*)now;
+}
+
+void bdgr_cache_fail(
+    const char* const url,
+    const bdgr_cache_failure stage
+)
+{
+    struct bdgr_negative_entry* entry;
+    unsigned long int ttl;
+    time_t now = time( NULL );
+    int kind;
+
+    /* Leaves the error state alone, the caller is reporting it */
+    switch( bdgr_error() ) {
+    case bdgr_malloc_err:
+    case bdgr_realloc_err:
+    case bdgr_timeout_err:
+    case bdgr_rate_limited_err:
+        return;
+    case bdgr_record_syntax_err:
+    case bdgr_record_too_large_err:
+    case bdgr_json_dsa_missing_err:
+    case bdgr_json_dsa_not_string_err:
+    case bdgr_json_dsa_duplicate_err:
+        /* Found while the record was still arriving */
+        kind = bdgr_negative_malformed;
+        break;
+    case bdgr_rpc_err:
+    case bdgr_nmc_name_missing_err:
+    case bdgr_http_not_found_err:
+        kind = stage == bdgr_cache_fetch_failed ?
+            bdgr_negative_not_found : bdgr_negative_malformed;
+        break;
+    default:
+        kind = stage == bdgr_cache_fetch_failed ?
+            bdgr_negative_transport : bdgr_negative_malformed;
+        break;
+    }
+
+    pthread_mutex_lock( &bdgr_g_negative.lock );
+    
+    ttl = bdgr_g_negative.ttl[ kind ];
+    if( !ttl ) {
+        goto bdgr_cache_fail_unlock;
+    }
+
+    entry = bdgr_table_get( &bdgr_g_negative.urls, url );
+    if( entry == NULL ) {
+        if( bdgr_g_negative.urls.count >= BDGR_NEGATIVE_MAX ) {
+            bdgr_table_sweep( &bdgr_g_negative.urls,
+                              bdgr_negative_expired, &now );
+            if( bdgr_g_negative.urls.count >= BDGR_NEGATIVE_MAX ) {
+                goto bdgr_cache_fail_unlock;
+            }
+        }
+        entry = bdgr_malloc( sizeof( *entry ));
+        if( entry == NULL ) {
+            goto bdgr_cache_fail_unlock;
+        }
+        entry->failures = 0;
+        if( bdgr_table_put( &bdgr_g_negative.urls, url, entry )) {
+            bdgr_free( entry );
+            goto bdgr_cache_fail_unlock;
+        }
+    }
+
+    /* Exponential backoff, capped */
+    if( entry->failures <= BDGR_NEGATIVE_MAX_DOUBLE ) {
+        entry->failures++;
+    }
+    ttl <<= entry->failures - 1;
+    if( bdgr_g_negative.max_backoff && ttl > bdgr_g_negative.max_backoff ) {
+        ttl = bdgr_g_negative.max_backoff;
+    }
+    entry->until = now + ttl;
+
+ bdgr_cache_fail_unlock:
+
+    pthread_mutex_unlock( &bdgr_g_negative.lock );
+}
+
+void bdgr_cache_forget( const char* const url )
+{
+    pthread_mutex_lock( &bdgr_g_negative.lock );
+    bdgr_table_remove( &bdgr_g_negative.urls, url );
+    pthread_mutex_unlock( &bdgr_g_negative.lock );
+}
@@ -0,0 +1,86 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_CACHE_H
+#define BADGER_CACHE_H
+
+#include <time.h>
+#include <badger.h>
+
+/* Room for any exported public key Badger keeps around */
+#define BDGR_KEY_EXPORT_MAX 1024
+
+int bdgr_cache_get( const char* url, bdgr_key* key );
+
+/* Whether an entry for url exists, fresh or not */
+int bdgr_cache_stale( const char* url );
+
+/*
+  Reuses the key cached for url, fresh or not, when the authority says it
+  is unchanged: record is NULL after a 304, otherwise it must hash to the
+  record the key was decoded from.  Returns 1 and renews the entry until
+  expires on success.
+*/
+int bdgr_cache_reuse(
+    const char* url,
+    const char* record,
+    time_t expires,
+    bdgr_key* key
+);
+
+/*
+  An expires of 0 leaves the entry to the max_age of the cache.  An until
+  other than 0 is when the key itself runs out, past which the entry is
+  never used, fresh or not.
+*/
+void bdgr_cache_put(
+    const char* url,
+    const char* record,
+    time_t expires,
+    time_t until,
+    const bdgr_key* key
+);
+
+/*
+  Claims the fetch of url for other processes sharing the cache, for at
+  most ms.  Returns 0 if another process holds the claim already.
+*/
+int bdgr_cache_claim( const char* url, long int ms );
+
+void bdgr_cache_unclaim( const char* url );
+
+/*
+  Waits, within the deadline of this thread, for the process holding the
+  claim on url to land its entry.  Returns 1 with the key on success, 0 if
+  the claim lapsed first.
+*/
+int bdgr_cache_await( const char* url, bdgr_key* key );
+
+typedef enum {
+    bdgr_cache_fetch_failed,
+    bdgr_cache_import_failed
+} bdgr_cache_failure;
+
+int bdgr_cache_backoff( const char* url );
+
+void bdgr_cache_fail( const char* url, bdgr_cache_failure stage );
+
+void bdgr_cache_forget( const char* url );
+
+#endif
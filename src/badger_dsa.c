@@ -0,0 +1,700 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <tomcrypt.h>
+#include "badger_dsa.h"
+#include "badger_mont.h"
+
+/* Window width of the exponent recoding and the odd powers it needs */
+#define BDGR_DSA_WINDOW     4
+#define BDGR_DSA_TABLE_SIZE ( 1 << ( BDGR_DSA_WINDOW - 1 ))
+
+/* Largest q the kernel handles, in bytes, beyond which LibTomCrypt does */
+#define BDGR_DSA_EXP_MAX    64
+
+/* Largest p and q of the fixed width kernel, in bytes */
+#define BDGR_DSA_P_MAX      ( BDGR_MONT_P_LIMBS * 4 )
+#define BDGR_DSA_Q_MAX      ( BDGR_MONT_Q_LIMBS * 4 )
+
+/* Output size of the HMAC behind the RFC 6979 nonces */
+#define BDGR_DSA_HMAC_SIZE  32
+
+/*
+  LibTomCrypt 1.18 took up FIPS 186-4 and uses only the leftmost bytes of
+  a hash longer than q; signatures must reduce the hash as the verifiers
+  linked alongside do.
+*/
+#if CRYPT >= 0x0118
+#define BDGR_DSA_TRUNCATES  1
+#else
+#define BDGR_DSA_TRUNCATES  0
+#endif
+
+/*
+  Left to right sliding window recoding of e: digits[i] is the odd window
+  whose lowest bit is bit i of e, or 0.  Returns the number of bits of e,
+  or -1 if e is too large.
+*/
+static int bdgr_dsa_recode( void* const e, unsigned char* const digits )
+{
+    unsigned char bytes[ BDGR_DSA_EXP_MAX ];
+    const unsigned long int len = mp_unsigned_bin_size( e );
+    int bits, i, lo, j;
+    unsigned char value;
+
+    if( len > sizeof( bytes ) || mp_to_unsigned_bin( e, bytes ) != CRYPT_OK ) {
+        return -1;
+    }
+    bits = (int)len * 8;
+    memset( digits, 0, bits );
+
+#define BDGR_DSA_BIT( n ) \
+    (( bytes[ len - 1 - ( n ) / 8 ] >> (( n ) % 8 )) & 1 )
+
+    for( i = bits - 1; i >= 0; i = lo - 1 ) {
+        lo = i;
+        if( BDGR_DSA_BIT( i )) {
+            lo = i - BDGR_DSA_WINDOW + 1 < 0 ? 0 : i - BDGR_DSA_WINDOW + 1;
+            while( !BDGR_DSA_BIT( lo )) {
+                lo++;
+            }
+            value = 0;
+            for( j = i; j >= lo; j-- ) {
+                value = (unsigned char)( value << 1 | BDGR_DSA_BIT( j ));
+            }
+            digits[ lo ] = value;
+        }
+    }
+
+#undef BDGR_DSA_BIT
+
+    return bits;
+}
+
+/* Fills table with g, g^3, g^5, ... in Montgomery form */
+static int bdgr_dsa_powers(
+    void* const g,
+    void* const p,
+    void* const mp,
+    void* const norm,
+    void* const t,
+    void** const table
+)
+{
+    int err, i;
+
+    if( ( err = mp_mulmod( g, norm, p, table[0] )) != CRYPT_OK ||
+        ( err = mp_sqr( table[0], t )) != CRYPT_OK ||
+        ( err = mp_montgomery_reduce( t, p, mp )) != CRYPT_OK ) {
+        return err;
+    }
+    for( i = 1; i < BDGR_DSA_TABLE_SIZE; i++ ) {
+        if( ( err = mp_mul( table[ i - 1 ], t, table[ i ] )) != CRYPT_OK ||
+            ( err = mp_montgomery_reduce( table[ i ], p, mp )) != CRYPT_OK ) {
+            return err;
+        }
+    }
+    return CRYPT_OK;
+}
+
+/* Multiplies acc by the table entry for digit, or starts acc off with it */
+static int bdgr_dsa_step(
+    void** const acc,
+    void** const t,
+    void* const entry,
+    void* const p,
+    void* const mp,
+    int* const started
+)
+{
+    void* swap;
+    int err;
+
+    if( !*started ) {
+        *started = 1;
+        return mp_copy( entry, *acc );
+    }
+    if( ( err = mp_mul( *acc, entry, *t )) != CRYPT_OK ||
+        ( err = mp_montgomery_reduce( *t, p, mp )) != CRYPT_OK ) {
+        return err;
+    }
+    swap = *acc;
+    *acc = *t;
+    *t = swap;
+    return CRYPT_OK;
+}
+
+/*
+  Straus/Shamir: out = g^a * y^b mod p, walking both recoded exponents from
+  the top so that one squaring of the accumulator serves both.  Backends
+  without Montgomery reduction plug plain reduction in with a norm of 1.
+*/
+static int bdgr_dsa_exptmod2(
+    void* const g,
+    void* const a,
+    void* const y,
+    void* const b,
+    void* const p,
+    void* const out
+)
+{
+    unsigned char digits_a[ BDGR_DSA_EXP_MAX * 8 ];
+    unsigned char digits_b[ BDGR_DSA_EXP_MAX * 8 ];
+    void* table_g[ BDGR_DSA_TABLE_SIZE ];
+    void* table_y[ BDGR_DSA_TABLE_SIZE ];
+    void* mp = NULL, * norm, * acc, * t, * swap;
+    int bits_a, bits_b, bits, i, started = 0, inited = 0, err;
+
+    bits_a = bdgr_dsa_recode( a, digits_a );
+    bits_b = bdgr_dsa_recode( b, digits_b );
+    if( bits_a < 0 || bits_b < 0 ) {
+        return CRYPT_INVALID_ARG;
+    }
+    bits = bits_a > bits_b ? bits_a : bits_b;
+
+    if( ( err = mp_init_multi( &norm, &acc, &t, NULL )) != CRYPT_OK ) {
+        return err;
+    }
+    for( inited = 0; inited < BDGR_DSA_TABLE_SIZE; inited++ ) {
+        if( ( err = mp_init_multi( &table_g[ inited ], &table_y[ inited ],
+                                   NULL )) != CRYPT_OK ) {
+            goto bdgr_dsa_exptmod2_free;
+        }
+    }
+    if( ( err = mp_montgomery_setup( p, &mp )) != CRYPT_OK ||
+        ( err = mp_montgomery_normalization( norm, p )) != CRYPT_OK ||
+        ( err = bdgr_dsa_powers( g, p, mp, norm, t, table_g )) != CRYPT_OK ||
+        ( err = bdgr_dsa_powers( y, p, mp, norm, t, table_y )) != CRYPT_OK ) {
+        goto bdgr_dsa_exptmod2_free;
+    }
+
+    for( i = bits - 1; i >= 0; i-- ) {
+        if( started ) {
+            if( ( err = mp_sqr( acc, t )) != CRYPT_OK ||
+                ( err = mp_montgomery_reduce( t, p, mp )) != CRYPT_OK ) {
+                goto bdgr_dsa_exptmod2_free;
+            }
+            swap = acc;
+            acc = t;
+            t = swap;
+        }
+        if( i < bits_a && digits_a[ i ] &&
+            ( err = bdgr_dsa_step( &acc, &t, table_g[ digits_a[ i ] >> 1 ],
+                                   p, mp, &started )) != CRYPT_OK ) {
+            goto bdgr_dsa_exptmod2_free;
+        }
+        if( i < bits_b && digits_b[ i ] &&
+            ( err = bdgr_dsa_step( &acc, &t, table_y[ digits_b[ i ] >> 1 ],
+                                   p, mp, &started )) != CRYPT_OK ) {
+            goto bdgr_dsa_exptmod2_free;
+        }
+    }
+
+    /* Out of Montgomery form, or 1 if both exponents were 0 */
+    if( !started ) {
+        err = mp_set( out, 1 );
+    } else if( ( err = mp_montgomery_reduce( acc, p, mp )) == CRYPT_OK ) {
+        err = mp_copy( acc, out );
+    }
+
+ bdgr_dsa_exptmod2_free:
+
+    if( mp != NULL ) {
+        mp_montgomery_free( mp );
+    }
+    while( inited-- > 0 ) {
+        mp_clear_multi( table_g[ inited ], table_y[ inited ], NULL );
+    }
+    mp_clear_multi( norm, acc, t, NULL );
+    return err;
+}
+
+/* Writes a into len bytes, big endian and zero padded on the left */
+static int bdgr_dsa_octets(
+    void* const a,
+    unsigned char* const out,
+    const unsigned long int len
+)
+{
+    const unsigned long int size = mp_unsigned_bin_size( a );
+
+    if( size > len ) {
+        return CRYPT_BUFFER_OVERFLOW;
+    }
+    memset( out, 0, len - size );
+    return mp_to_unsigned_bin( a, out + len - size );
+}
+
+/* Reads a minimally encoded DER length of at most 255 at *in */
+static int bdgr_dsa_der_length(
+    const unsigned char** const in,
+    const unsigned char* const end,
+    unsigned long int* const len
+)
+{
+    const unsigned char* const p = *in;
+
+    if( p >= end ) {
+        return 0;
+    }
+    if( p[ 0 ] < 0x80 ) {
+        *len = p[ 0 ];
+        *in = p + 1;
+        return 1;
+    }
+    if( p[ 0 ] != 0x81 || end - p < 2 || p[ 1 ] < 0x80 ) {
+        return 0;
+    }
+    *len = p[ 1 ];
+    *in = p + 2;
+    return 1;
+}
+
+/*
+  Reads the DER INTEGER at *in, which must be positive and minimally
+  encoded, and points value at its magnitude.  Returns 0 if malformed.
+*/
+static int bdgr_dsa_der_integer(
+    const unsigned char** const in,
+    const unsigned char* const end,
+    const unsigned char** const value,
+    unsigned long int* const value_len
+)
+{
+    const unsigned char* p = *in;
+    unsigned long int len;
+
+    if( p >= end || *p++ != 0x02 || !bdgr_dsa_der_length( &p, end, &len ) ||
+        len == 0 || (unsigned long int)( end - p ) < len || p[ 0 ] & 0x80 ||
+        ( len > 1 && p[ 0 ] == 0 && !( p[ 1 ] & 0x80 ))) {
+        return 0;
+    }
+    *in = p + len;
+    if( p[ 0 ] == 0 ) {
+        p++;
+        len--;
+    }
+    *value = p;
+    *value_len = len;
+    return 1;
+}
+
+/*
+  Reads a signature, SEQUENCE { INTEGER r, INTEGER s }, in strict DER with
+  nothing after it.  Returns 0 if it is anything else.
+*/
+static int bdgr_dsa_der_pair(
+    const unsigned char* const sig,
+    const unsigned long int siglen,
+    const unsigned char** const r,
+    unsigned long int* const r_len,
+    const unsigned char** const s,
+    unsigned long int* const s_len
+)
+{
+    const unsigned char* p = sig;
+    const unsigned char* const end = sig + siglen;
+    unsigned long int len;
+
+    return siglen > 0 && *p++ == 0x30 &&
+        bdgr_dsa_der_length( &p, end, &len ) &&
+        len == (unsigned long int)( end - p ) &&
+        bdgr_dsa_der_integer( &p, end, r, r_len ) &&
+        bdgr_dsa_der_integer( &p, end, s, s_len ) && p == end;
+}
+
+/* Sets ctx up for the modulus a of at most n limbs */
+static int bdgr_dsa_mont(
+    void* const a,
+    const int n,
+    bdgr_mont* const ctx
+)
+{
+    unsigned char bytes[ BDGR_DSA_P_MAX ];
+
+    return bdgr_dsa_octets( a, bytes, n * 4 ) == CRYPT_OK &&
+        bdgr_mont_init( ctx, bytes, n * 4, n );
+}
+
+/* Reads a into limbs, failing unless it's below the modulus of ctx */
+static int bdgr_dsa_limbs(
+    void* const a,
+    const bdgr_mont* const ctx,
+    uint32_t* const limbs
+)
+{
+    unsigned char bytes[ BDGR_DSA_P_MAX ];
+
+    return bdgr_dsa_octets( a, bytes, ctx->n * 4 ) == CRYPT_OK &&
+        bdgr_mont_read( limbs, ctx->n, bytes, ctx->n * 4 ) &&
+        bdgr_mont_cmp( limbs, ctx->m, ctx->n ) < 0;
+}
+
+/*
+  The verification of bdgr_dsa_verify_hash() in the fixed width kernel,
+  for the 1024/160 bit groups of Badger keys and any smaller ones, with
+  every number on the stack.  Returns CRYPT_NOP for keys it doesn't take.
+*/
+static int bdgr_dsa_verify_fixed(
+    const unsigned char* const r_bytes,
+    const unsigned long int r_len,
+    const unsigned char* const s_bytes,
+    const unsigned long int s_len,
+    const unsigned char* const hash,
+    const unsigned long int hashlen,
+    int* const stat,
+    dsa_key* const key
+)
+{
+    unsigned char e[ BDGR_DSA_Q_MAX ], u1[ BDGR_DSA_Q_MAX ];
+    unsigned char u2[ BDGR_DSA_Q_MAX ];
+    uint32_t r[ BDGR_MONT_Q_LIMBS ], s[ BDGR_MONT_Q_LIMBS ];
+    uint32_t w[ BDGR_MONT_Q_LIMBS ], t[ BDGR_MONT_Q_LIMBS ];
+    uint32_t g[ BDGR_MONT_P_LIMBS ], y[ BDGR_MONT_P_LIMBS ];
+    uint32_t v[ BDGR_MONT_P_LIMBS ];
+    uint32_t borrow;
+    bdgr_mont mod_p, mod_q;
+    int i;
+
+    if( hashlen > BDGR_DSA_Q_MAX ||
+        !bdgr_dsa_mont( key->q, BDGR_MONT_Q_LIMBS, &mod_q ) ||
+        !bdgr_dsa_mont( key->p, BDGR_MONT_P_LIMBS, &mod_p ) ||
+        !bdgr_dsa_limbs( key->g, &mod_p, g ) ||
+        !bdgr_dsa_limbs( key->y, &mod_p, y )) {
+        return CRYPT_NOP;
+    }
+
+    /* 0 < r < q and 0 < s < q */
+    *stat = 0;
+    if( !bdgr_mont_read( r, BDGR_MONT_Q_LIMBS, r_bytes, r_len ) ||
+        !bdgr_mont_read( s, BDGR_MONT_Q_LIMBS, s_bytes, s_len ) ||
+        bdgr_mont_is_zero( r, BDGR_MONT_Q_LIMBS ) ||
+        bdgr_mont_is_zero( s, BDGR_MONT_Q_LIMBS ) ||
+        bdgr_mont_cmp( r, mod_q.m, BDGR_MONT_Q_LIMBS ) >= 0 ||
+        bdgr_mont_cmp( s, mod_q.m, BDGR_MONT_Q_LIMBS ) >= 0 ) {
+        return CRYPT_INVALID_PACKET;
+    }
+
+    /* w = 1/s = s^(q-2) mod q, q being prime */
+    borrow = 2;
+    for( i = 0; i < BDGR_MONT_Q_LIMBS; i++ ) {
+        t[ i ] = mod_q.m[ i ] - borrow;
+        borrow = mod_q.m[ i ] < borrow;
+    }
+    bdgr_mont_write( t, BDGR_MONT_Q_LIMBS, e, sizeof( e ));
+    bdgr_mont_exp( &mod_q, w, s, e, sizeof( e ));
+
+    /* u1 = H*w, u2 = r*w mod q, multiplying by R^2 to undo both divisions */
+    bdgr_mont_read( t, BDGR_MONT_Q_LIMBS, hash, hashlen );
+    bdgr_mont_mul( &mod_q, t, t, w );
+    bdgr_mont_mul( &mod_q, t, t, mod_q.rr );
+    bdgr_mont_write( t, BDGR_MONT_Q_LIMBS, u1, sizeof( u1 ));
+    bdgr_mont_mul( &mod_q, t, r, w );
+    bdgr_mont_mul( &mod_q, t, t, mod_q.rr );
+    bdgr_mont_write( t, BDGR_MONT_Q_LIMBS, u2, sizeof( u2 ));
+
+    /* v = g^u1 * y^u2 mod p mod q */
+    bdgr_mont_exp2( &mod_p, v, g, u1, y, u2, sizeof( u1 ));
+    bdgr_mont_reduce( &mod_q, t, v, BDGR_MONT_P_LIMBS );
+
+    *stat = bdgr_mont_cmp( r, t, BDGR_MONT_Q_LIMBS ) == 0;
+    return CRYPT_OK;
+}
+
+int bdgr_dsa_verify_hash(
+    const unsigned char* const sig,
+    const unsigned long int siglen,
+    const unsigned char* const hash,
+    const unsigned long int hashlen,
+    int* const stat,
+    dsa_key* const key
+)
+{
+    const unsigned char* r_bytes, * s_bytes;
+    unsigned long int r_len, s_len;
+    void* r, * s, * w, * u1, * u2, * v;
+    int err;
+
+    /*
+      LibTomCrypt versions disagree on whether a hash longer than q is
+      truncated, and on which DER short of strict they take, so leave those
+      to it and stay bit for bit compatible.
+    */
+    if( hashlen > (unsigned long int)key->qord ||
+        key->qord > BDGR_DSA_EXP_MAX ||
+        !bdgr_dsa_der_pair( sig, siglen, &r_bytes, &r_len,
+                            &s_bytes, &s_len )) {
+        return dsa_verify_hash( sig, siglen, hash, hashlen, stat, key );
+    }
+
+    err = bdgr_dsa_verify_fixed( r_bytes, r_len, s_bytes, s_len,
+                                 hash, hashlen, stat, key );
+    if( err != CRYPT_NOP ) {
+        return err;
+    }
+
+    *stat = 0;
+    if( ( err = mp_init_multi( &r, &s, &w, &u1, &u2, &v, NULL )) != CRYPT_OK ) {
+        return err;
+    }
+    if( ( err = mp_read_unsigned_bin( r, (unsigned char*)r_bytes,
+                                      r_len )) != CRYPT_OK ||
+        ( err = mp_read_unsigned_bin( s, (unsigned char*)s_bytes,
+                                      s_len )) != CRYPT_OK ) {
+        goto bdgr_dsa_verify_hash_free;
+    }
+
+    /* 0 < r < q and 0 < s < q */
+    if( mp_iszero( r ) == LTC_MP_YES || mp_iszero( s ) == LTC_MP_YES ||
+        mp_cmp( r, key->q ) != LTC_MP_LT || mp_cmp( s, key->q ) != LTC_MP_LT ) {
+        err = CRYPT_INVALID_PACKET;
+        goto bdgr_dsa_verify_hash_free;
+    }
+
+    /* w = 1/s, u1 = H*w, u2 = r*w mod q; v = g^u1 * y^u2 mod p mod q */
+    if( ( err = mp_invmod( s, key->q, w )) != CRYPT_OK ||
+        ( err = mp_read_unsigned_bin( u1, (unsigned char*)hash,
+                                      hashlen )) != CRYPT_OK ||
+        ( err = mp_mulmod( u1, w, key->q, u1 )) != CRYPT_OK ||
+        ( err = mp_mulmod( r, w, key->q, u2 )) != CRYPT_OK ||
+        ( err = bdgr_dsa_exptmod2( key->g, u1, key->y, u2,
+                                   key->p, v )) != CRYPT_OK ||
+        ( err = mp_mod( v, key->q, v )) != CRYPT_OK ) {
+        goto bdgr_dsa_verify_hash_free;
+    }
+
+    *stat = mp_cmp( r, v ) == LTC_MP_EQ;
+
+ bdgr_dsa_verify_hash_free:
+
+    mp_clear_multi( r, s, w, u1, u2, v, NULL );
+    return err;
+}
+
+/*
+  r = g^k mod p for signing, in the fixed width kernel and in time that
+  doesn't depend on k when the group allows, through the backend if not.
+*/
+static int bdgr_dsa_exptmod(
+    void* const g,
+    void* const k,
+    void* const p,
+    void* const out
+)
+{
+    unsigned char bytes[ BDGR_DSA_P_MAX ], e[ BDGR_DSA_Q_MAX ];
+    uint32_t base[ BDGR_MONT_P_LIMBS ], result[ BDGR_MONT_P_LIMBS ];
+    bdgr_mont mod_p;
+    int err;
+
+    if( !bdgr_dsa_mont( p, BDGR_MONT_P_LIMBS, &mod_p ) ||
+        !bdgr_dsa_limbs( g, &mod_p, base ) ||
+        bdgr_dsa_octets( k, e, sizeof( e )) != CRYPT_OK ) {
+        return mp_exptmod( g, k, p, out );
+    }
+    bdgr_mont_exp( &mod_p, result, base, e, sizeof( e ));
+    bdgr_mont_write( result, BDGR_MONT_P_LIMBS, bytes, sizeof( bytes ));
+    err = mp_read_unsigned_bin( out, bytes, sizeof( bytes ));
+    memset( e, 0, sizeof( e ));
+    memset( result, 0, sizeof( result ));
+    memset( bytes, 0, sizeof( bytes ));
+    return err;
+}
+
+/* HMAC_K( V || sep || data ), sep left out if negative */
+static int bdgr_dsa_hmac(
+    const int hash,
+    const unsigned char* const key,
+    const unsigned char* const v,
+    const int sep,
+    const unsigned char* const data,
+    const unsigned long int data_len,
+    unsigned char* const out
+)
+{
+    hmac_state hmac;
+    unsigned char sep_byte = (unsigned char)sep;
+    unsigned long int out_len = BDGR_DSA_HMAC_SIZE;
+    int err;
+
+    if( ( err = hmac_init( &hmac, hash, key,
+                           BDGR_DSA_HMAC_SIZE )) != CRYPT_OK ||
+        ( err = hmac_process( &hmac, v, BDGR_DSA_HMAC_SIZE )) != CRYPT_OK ||
+        ( sep >= 0 &&
+          ( err = hmac_process( &hmac, &sep_byte, 1 )) != CRYPT_OK ) ||
+        ( data_len &&
+          ( err = hmac_process( &hmac, data, data_len )) != CRYPT_OK )) {
+        return err;
+    }
+    return hmac_done( &hmac, out, &out_len );
+}
+
+/*
+  RFC 6979 3.2: K and V are seeded from int2octets( x ) || bits2octets( h ),
+  then V is stretched until it yields qlen bits, which are taken as the next
+  candidate for k on each call.
+*/
+struct bdgr_dsa_drbg {
+    int           hash;
+    unsigned char k[ BDGR_DSA_HMAC_SIZE ];
+    unsigned char v[ BDGR_DSA_HMAC_SIZE ];
+    int           started;
+};
+
+static int bdgr_dsa_drbg_seed(
+    struct bdgr_dsa_drbg* const drbg,
+    const unsigned char* const seed,
+    const unsigned long int seed_len
+)
+{
+    int err, i;
+
+    memset( drbg->v, 0x01, BDGR_DSA_HMAC_SIZE );
+    memset( drbg->k, 0x00, BDGR_DSA_HMAC_SIZE );
+    drbg->started = 0;
+    for( i = 0; i < 2; i++ ) {
+        if( ( err = bdgr_dsa_hmac( drbg->hash, drbg->k, drbg->v, i,
+                                   seed, seed_len, drbg->k )) != CRYPT_OK ||
+            ( err = bdgr_dsa_hmac( drbg->hash, drbg->k, drbg->v, -1,
+                                   NULL, 0, drbg->v )) != CRYPT_OK ) {
+            return err;
+        }
+    }
+    return CRYPT_OK;
+}
+
+static int bdgr_dsa_drbg_next(
+    struct bdgr_dsa_drbg* const drbg,
+    const int qlen,
+    void* const k
+)
+{
+    unsigned char t[ BDGR_DSA_EXP_MAX + BDGR_DSA_HMAC_SIZE ];
+    const unsigned long int rlen = ( qlen + 7 ) / 8;
+    const int shift = (int)rlen * 8 - qlen;
+    unsigned long int tlen;
+    int err, i;
+
+    /* A candidate that was turned down moves the state on */
+    if( drbg->started &&
+        (( err = bdgr_dsa_hmac( drbg->hash, drbg->k, drbg->v, 0,
+                                NULL, 0, drbg->k )) != CRYPT_OK ||
+         ( err = bdgr_dsa_hmac( drbg->hash, drbg->k, drbg->v, -1,
+                                NULL, 0, drbg->v )) != CRYPT_OK )) {
+        return err;
+    }
+    drbg->started = 1;
+
+    for( tlen = 0; tlen < rlen; tlen += BDGR_DSA_HMAC_SIZE ) {
+        if( ( err = bdgr_dsa_hmac( drbg->hash, drbg->k, drbg->v, -1,
+                                   NULL, 0, drbg->v )) != CRYPT_OK ) {
+            return err;
+        }
+        memcpy( t + tlen, drbg->v, BDGR_DSA_HMAC_SIZE );
+    }
+
+    /* bits2int: the leftmost qlen bits */
+    for( i = (int)rlen - 1; shift && i >= 0; i-- ) {
+        t[ i ] = (unsigned char)(( t[ i ] >> shift ) |
+                                 ( i ? t[ i - 1 ] << ( 8 - shift ) : 0 ));
+    }
+    err = mp_read_unsigned_bin( k, t, rlen );
+    memset( t, 0, sizeof( t ));
+    return err;
+}
+
+int bdgr_dsa_sign_hash(
+    const unsigned char* const in,
+    const unsigned long int inlen,
+    unsigned char* const out,
+    unsigned long int* const outlen,
+    dsa_key* const key
+)
+{
+    unsigned char seed[ 2 * BDGR_DSA_EXP_MAX ];
+    struct bdgr_dsa_drbg drbg;
+    unsigned long int hashlen = inlen;
+    void* h, * k, * kinv, * r, * s;
+    int err, qlen;
+
+    if( key->type != PK_PRIVATE ) {
+        return CRYPT_PK_NOT_PRIVATE;
+    }
+    if( key->qord <= 0 || key->qord > BDGR_DSA_EXP_MAX ) {
+        return CRYPT_INVALID_ARG;
+    }
+    if( BDGR_DSA_TRUNCATES && hashlen > (unsigned long int)key->qord ) {
+        hashlen = key->qord;
+    }
+    if( register_hash( &sha256_desc ) == -1 ) {
+        return CRYPT_INVALID_HASH;
+    }
+    drbg.hash = find_hash( "sha256" );
+    qlen = mp_count_bits( key->q );
+
+    if( ( err = mp_init_multi( &h, &k, &kinv, &r, &s, NULL )) != CRYPT_OK ) {
+        return err;
+    }
+
+    /* The signature only sees h mod q, so neither does the nonce */
+    if( ( err = mp_read_unsigned_bin( h, (unsigned char*)in,
+                                      hashlen )) != CRYPT_OK ||
+        ( err = mp_mod( h, key->q, h )) != CRYPT_OK ||
+        ( err = bdgr_dsa_octets( key->x, seed, key->qord )) != CRYPT_OK ||
+        ( err = bdgr_dsa_octets( h, seed + key->qord,
+                                 key->qord )) != CRYPT_OK ||
+        ( err = bdgr_dsa_drbg_seed( &drbg, seed,
+                                    2 * key->qord )) != CRYPT_OK ) {
+        goto bdgr_dsa_sign_hash_free;
+    }
+
+    /* r = g^k mod p mod q, s = ( h + x*r ) / k mod q, both nonzero */
+    do {
+        do {
+            if( ( err = bdgr_dsa_drbg_next( &drbg, qlen, k )) != CRYPT_OK ) {
+                goto bdgr_dsa_sign_hash_free;
+            }
+        } while( mp_iszero( k ) == LTC_MP_YES ||
+                 mp_cmp( k, key->q ) != LTC_MP_LT );
+
+        if( ( err = bdgr_dsa_exptmod( key->g, k, key->p, r )) != CRYPT_OK ||
+            ( err = mp_mod( r, key->q, r )) != CRYPT_OK ||
+            ( err = mp_invmod( k, key->q, kinv )) != CRYPT_OK ||
+            ( err = mp_mulmod( key->x, r, key->q, s )) != CRYPT_OK ||
+            ( err = mp_add( s, h, s )) != CRYPT_OK ||
+            ( err = mp_mulmod( s, kinv, key->q, s )) != CRYPT_OK ) {
+            goto bdgr_dsa_sign_hash_free;
+        }
+    } while( mp_iszero( r ) == LTC_MP_YES || mp_iszero( s ) == LTC_MP_YES );
+
+    err = der_encode_sequence_multi(
+        out, outlen,
+        LTC_ASN1_INTEGER, 1UL, r,
+        LTC_ASN1_INTEGER, 1UL, s,
+        LTC_ASN1_EOL, 0UL, NULL );
+
+ bdgr_dsa_sign_hash_free:
+
+    memset( seed, 0, sizeof( seed ));
+    memset( &drbg, 0, sizeof( drbg ));
+    mp_clear_multi( h, k, kinv, r, s, NULL );
+    return err;
+}
@@ -0,0 +1,51 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_DSA_H
+#define BADGER_DSA_H
+
+#include <tomcrypt.h>
+
+/*
+  A drop-in for dsa_verify_hash() computing g^u1 * y^u2 mod p in one pass,
+  the two exponents sharing their squarings.  Returns a LibTomCrypt error.
+*/
+int bdgr_dsa_verify_hash(
+    const unsigned char* sig,
+    unsigned long int siglen,
+    const unsigned char* hash,
+    unsigned long int hashlen,
+    int* stat,
+    dsa_key* key
+);
+
+/*
+  A drop-in for dsa_sign_hash() drawing the nonce k from an HMAC-SHA256
+  DRBG seeded with the private key and the hash, as in RFC 6979, so that
+  no PRNG is needed.  Returns a LibTomCrypt error.
+*/
+int bdgr_dsa_sign_hash(
+    const unsigned char* in,
+    unsigned long int inlen,
+    unsigned char* out,
+    unsigned long int* outlen,
+    dsa_key* key
+);
+
+#endif
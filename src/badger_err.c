@@ -20,13 +20,15 @@
 #include "badger_err.h"
 #include <tomcrypt.h>
 
-static bdgr_err bdgr_last_err;
-static int bdgr_last_err_line;
-static int bdgr_last_crypt_err = CRYPT_OK;
-static json_error_t bdgr_g_json_error;
-static char bdgr_g_error_string[1024];
-static char bdgr_g_json_error_string[1024];
-static char bdgr_g_rpc_error_string[1024];
+/* Every thread has its own error state */
+static __thread bdgr_err bdgr_last_err;
+static __thread int bdgr_last_err_line;
+static __thread int bdgr_last_crypt_err = CRYPT_OK;
+static __thread json_error_t bdgr_g_json_error;
+static __thread char bdgr_g_error_string[1024];
+static __thread char bdgr_g_json_error_string[1024];
+static __thread char bdgr_g_rpc_error_string[1024];
+static __thread char bdgr_g_fetch_error_string[1024];
 
 int bdgr_error()
 {
@@ -65,6 +67,14 @@ void bdgr_rpc_error( const char* err, const int line )
     bdgr_check( 1, bdgr_rpc_err, line );
 }
 
+void bdgr_fetch_error( const char* err, const int line )
+{
+    snprintf( bdgr_g_fetch_error_string,
+              sizeof( bdgr_g_fetch_error_string ),
+              "Failed to fetch record: %s", err );
+    bdgr_check( 1, bdgr_fetch_err, line );
+}
+
 static const char* bdgr_short_error_string( const int err )
 {
     switch( err ) {
@@ -140,6 +150,104 @@ static const char* bdgr_short_error_string( const int err )
         return "Password cannot be more than 64 characters";
     case bdgr_unsupported_scheme_err:
         return "Unsupported id scheme";
+    case bdgr_register_hash_err:
+        return "Failed to register hash";
+    case bdgr_cache_open_err:
+        return "Failed to open key cache";
+    case bdgr_cache_format_err:
+        return "Key cache file has an incompatible format";
+    case bdgr_json_result_not_array_err:
+        return "Invalid RPC response (result is not an array)";
+    case bdgr_nmc_mirror_inactive_err:
+        return "Namecoin mirror is not running";
+    case bdgr_nmc_name_missing_err:
+        return "Name not found in Namecoin mirror";
+    case bdgr_fetch_err:
+        return bdgr_g_fetch_error_string;
+    case bdgr_http_not_found_err:
+        return "Record not found at Identity URL";
+    case bdgr_http_status_err:
+        return "Record host returned an error status";
+    case bdgr_lookup_backoff_err:
+        return "Identity lookup failed recently, backing off";
+    case bdgr_curl_init_err:
+        return "Failed to initialize curl";
+    case bdgr_timeout_err:
+        return "Verification deadline exceeded";
+    case bdgr_record_syntax_err:
+        return "Record is not a JSON object";
+    case bdgr_record_too_large_err:
+        return "Record exceeds the size limit";
+    case bdgr_thread_err:
+        return "Failed to start thread";
+    case bdgr_math_unavailable_err:
+        return "Math backend not available";
+    case bdgr_math_in_use_err:
+        return "Math backend already in use";
+    case bdgr_key_set_index_err:
+        return "No key at this index of the key set";
+    case bdgr_key_invalid_err:
+        return "Key fails the domain parameter checks";
+    case bdgr_register_cipher_err:
+        return "Failed to register cipher";
+    case bdgr_ticket_key_err:
+        return "Unusable session ticket key";
+    case bdgr_ticket_invalid_err:
+        return "Session ticket is invalid";
+    case bdgr_ticket_expired_err:
+        return "Session ticket has expired";
+    case bdgr_allocator_in_use_err:
+        return "Allocator already in use";
+    case bdgr_server_token_key_err:
+        return "Unusable server token key";
+    case bdgr_server_token_invalid_err:
+        return "Token was not issued by this server";
+    case bdgr_server_token_expired_err:
+        return "Token is no longer fresh";
+    case bdgr_server_token_audience_err:
+        return "Server token audience too long";
+    case bdgr_badge_too_large_err:
+        return "Badge exceeds the size limit";
+    case bdgr_token_too_large_err:
+        return "Token exceeds the length limit";
+    case bdgr_signature_too_large_err:
+        return "Signature exceeds the length limit";
+    case bdgr_key_too_large_err:
+        return "Key modulus exceeds the size limit";
+    case bdgr_rate_limited_err:
+        return "Rate limit exceeded";
+    case bdgr_peer_address_err:
+        return "Invalid peer address";
+    case bdgr_peer_listen_err:
+        return "Failed to listen for peers";
+    case bdgr_peer_listening_err:
+        return "Already listening for peers";
+    case bdgr_peer_err:
+        return "Peer failed the lookup";
+    case bdgr_json_kid_not_string_err:
+        return "Badge kid not a string";
+    case bdgr_kid_err:
+        return "Invalid key id";
+    case bdgr_badge_id_err:
+        return "Identity URL contains a space";
+    case bdgr_json_keys_not_array_err:
+        return "Record keys not an array";
+    case bdgr_kid_missing_err:
+        return "No key with this key id in record";
+    case bdgr_kid_period_err:
+        return "Key validity period not an integer";
+    case bdgr_kid_expired_err:
+        return "Key outside its validity period";
+    case bdgr_nmc_mirror_busy_err:
+        return "Namecoin mirror was started by another thread";
+    case bdgr_json_dsa_duplicate_err:
+        return "Record has more than one dsa attribute";
+    case bdgr_peer_self_err:
+        return "Node is not in the peer list";
+    case bdgr_json_result_not_integer_err:
+        return "Invalid RPC response (result is not an integer)";
+    case bdgr_peer_key_err:
+        return "Invalid or missing peer key";
     }
     return "";
 }
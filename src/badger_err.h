@@ -57,7 +57,56 @@ typedef enum {
     bdgr_rpc_err,
     bdgr_response_overflow,
     bdgr_password_len_err,
-    bdgr_unsupported_scheme_err
+    bdgr_unsupported_scheme_err,
+    bdgr_register_hash_err,
+    bdgr_cache_open_err,
+    bdgr_cache_format_err,
+    bdgr_json_result_not_array_err,
+    bdgr_nmc_mirror_inactive_err,
+    bdgr_nmc_name_missing_err,
+    bdgr_fetch_err,
+    bdgr_http_not_found_err,
+    bdgr_http_status_err,
+    bdgr_lookup_backoff_err,
+    bdgr_curl_init_err,
+    bdgr_timeout_err,
+    bdgr_record_syntax_err,
+    bdgr_record_too_large_err,
+    bdgr_thread_err,
+    bdgr_math_unavailable_err,
+    bdgr_math_in_use_err,
+    bdgr_key_set_index_err,
+    bdgr_key_invalid_err,
+    bdgr_register_cipher_err,
+    bdgr_ticket_key_err,
+    bdgr_ticket_invalid_err,
+    bdgr_ticket_expired_err,
+    bdgr_allocator_in_use_err,
+    bdgr_server_token_key_err,
+    bdgr_server_token_invalid_err,
+    bdgr_server_token_expired_err,
+    bdgr_server_token_audience_err,
+    bdgr_badge_too_large_err,
+    bdgr_token_too_large_err,
+    bdgr_signature_too_large_err,
+    bdgr_key_too_large_err,
+    bdgr_rate_limited_err,
+    bdgr_peer_address_err,
+    bdgr_peer_listen_err,
+    bdgr_peer_listening_err,
+    bdgr_peer_err,
+    bdgr_json_kid_not_string_err,
+    bdgr_kid_err,
+    bdgr_badge_id_err,
+    bdgr_json_keys_not_array_err,
+    bdgr_kid_missing_err,
+    bdgr_kid_period_err,
+    bdgr_kid_expired_err,
+    bdgr_nmc_mirror_busy_err,
+    bdgr_json_dsa_duplicate_err,
+    bdgr_peer_self_err,
+    bdgr_json_result_not_integer_err,
+    bdgr_peer_key_err
 } bdgr_err;
 
 int bdgr_error();
@@ -70,4 +119,6 @@ json_error_t *bdgr_json_error();
 
 void bdgr_rpc_error( const char* err, int line );
 
+void bdgr_fetch_error( const char* err, int line );
+
 #endif
@@ -0,0 +1,621 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_cache.h"
+#include "badger_limit.h"
+#include "badger_scheme.h"
+#include "badger_table.h"
+#include "badger_token.h"
+
+/*
+  A verification started with bdgr_verify_start().  It rides a flight while
+  its key is being looked up, and is checked once the key is known.  Done
+  is called from bdgr_verify_process() once checked is set.
+*/
+struct bdgr_verify {
+    bdgr_badge                badge;
+    char*                     ref;
+    struct timespec           deadline;
+    int                       has_deadline;
+    bdgr_verify_done          done;
+    void*                     ctx;
+    bdgr_key                  key;
+    int                       err;
+    int                       verified;
+    int                       cancelled;
+    struct bdgr_event_flight* flight;
+    struct bdgr_verify*       prev;
+    struct bdgr_verify*       next;
+};
+
+/*
+  Verifications against the same key share the lookup of a flight, like
+  concurrent calls to bdgr_badge_verify() do.  A flight left without
+  passengers is cancelled and taken off the table, but stays in the air
+  until its lookup lands so that the key it brings back is still cached.
+*/
+struct bdgr_event_flight {
+    char*                     url;
+    bdgr_lookup*              lookup;
+    int                       revalidate;
+    int                       cancelled;
+    struct bdgr_verify*       passengers;
+    struct bdgr_event_flight* prev;
+    struct bdgr_event_flight* next;
+    struct bdgr_event_flight* next_landed;
+};
+
+struct bdgr_event_job {
+    void                 (*run)( void* arg );
+    void*                  arg;
+    struct bdgr_event_job* next;
+};
+
+/*
+  Flights and passengers belong to the thread calling bdgr_verify_process().
+  Lookups land and workers finish jobs on other threads, so they hand their
+  results over through landed and checked and wake the loop with the pipe.
+*/
+static struct {
+    bdgr_table                flights;
+    struct bdgr_event_flight* flying;
+    struct bdgr_event_flight* landed;
+    struct bdgr_verify*       checked;
+    struct bdgr_event_job*    jobs;
+    struct bdgr_event_job**   jobs_tail;
+    unsigned long int         workers;
+    int                       wake[2];
+    int                       err;
+    pthread_mutex_t           lock;
+    pthread_cond_t            jobs_cond;
+} bdgr_g_event = {
+    { NULL, 0, 0, NULL }, NULL, NULL, NULL, NULL, NULL, 0, { -1, -1 }, 0,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+static void bdgr_event_start()
+{
+    bdgr_g_event.jobs_tail = &bdgr_g_event.jobs;
+    if( bdgr_table_init( &bdgr_g_event.flights, 256, NULL )) {
+        bdgr_g_event.err = bdgr_malloc_err;
+        return;
+    }
+    if( pipe( bdgr_g_event.wake ) == -1 ||
+        fcntl( bdgr_g_event.wake[0], F_SETFL, O_NONBLOCK ) == -1 ||
+        fcntl( bdgr_g_event.wake[1], F_SETFL, O_NONBLOCK ) == -1 ||
+        fcntl( bdgr_g_event.wake[0], F_SETFD, FD_CLOEXEC ) == -1 ||
+        fcntl( bdgr_g_event.wake[1], F_SETFD, FD_CLOEXEC ) == -1 ) {
+        bdgr_g_event.err = bdgr_thread_err;
+    }
+}
+
+static int bdgr_event_init()
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    if( bdgr_init() ) {
+        return bdgr_error();
+    }
+    pthread_once( &once, bdgr_event_start );
+    return bdgr_check( bdgr_g_event.err, bdgr_g_event.err, __LINE__ );
+}
+
+static void bdgr_event_wake()
+{
+    if( write( bdgr_g_event.wake[1], "", 1 ) == -1 ) {
+        /* The pipe is full, so the loop will be woken anyway */
+    }
+}
+
+static int bdgr_event_expired(
+    const struct bdgr_verify* const verify,
+    const struct timespec* const now
+)
+{
+    return verify->has_deadline &&
+        ( now->tv_sec > verify->deadline.tv_sec ||
+          ( now->tv_sec == verify->deadline.tv_sec &&
+            now->tv_nsec >= verify->deadline.tv_nsec ));
+}
+
+/* Hands a verification with its result over to the loop */
+static void bdgr_event_checked( struct bdgr_verify* const verify )
+{
+    pthread_mutex_lock( &bdgr_g_event.lock );
+    verify->next = bdgr_g_event.checked;
+    bdgr_g_event.checked = verify;
+    pthread_mutex_unlock( &bdgr_g_event.lock );
+    bdgr_event_wake();
+}
+
+/* Called with the lookup locked, from whichever thread completed it */
+static void bdgr_event_landed(
+    bdgr_lookup* const lookup,
+    void* const _flight
+)
+{
+    struct bdgr_event_flight* const flight = _flight;
+    (void)lookup;
+
+    pthread_mutex_lock( &bdgr_g_event.lock );
+    flight->next_landed = bdgr_g_event.landed;
+    bdgr_g_event.landed = flight;
+    pthread_mutex_unlock( &bdgr_g_event.lock );
+    bdgr_event_wake();
+}
+
+static void* bdgr_event_work( void* const unused )
+{
+    struct bdgr_event_job* job;
+    (void)unused;
+
+    pthread_mutex_lock( &bdgr_g_event.lock );
+    while( 1 ) {
+        while( bdgr_g_event.jobs == NULL ) {
+            pthread_cond_wait( &bdgr_g_event.jobs_cond, &bdgr_g_event.lock );
+        }
+        job = bdgr_g_event.jobs;
+        bdgr_g_event.jobs = job->next;
+        if( bdgr_g_event.jobs == NULL ) {
+            bdgr_g_event.jobs_tail = &bdgr_g_event.jobs;
+        }
+        pthread_mutex_unlock( &bdgr_g_event.lock );
+
+        job->run( job->arg );
+        bdgr_free( job );
+
+        pthread_mutex_lock( &bdgr_g_event.lock );
+    }
+    return NULL;
+}
+
+/* Returns nonzero when there is no worker to run the job */
+static int bdgr_event_submit(
+    void (*run)( void* arg ),
+    void* const arg
+)
+{
+    struct bdgr_event_job* job;
+
+    if( bdgr_g_event.workers == 0 ) {
+        return 1;
+    }
+    job = bdgr_malloc( sizeof( *job ));
+    if( job == NULL ) {
+        return 1;
+    }
+    job->run = run;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock( &bdgr_g_event.lock );
+    *bdgr_g_event.jobs_tail = job;
+    bdgr_g_event.jobs_tail = &job->next;
+    pthread_cond_signal( &bdgr_g_event.jobs_cond );
+    pthread_mutex_unlock( &bdgr_g_event.lock );
+    return 0;
+}
+
+static void bdgr_event_verify( void* const _verify )
+{
+    struct bdgr_verify* const verify = _verify;
+
+    bdgr_signature_verify( verify->badge.token, verify->badge.token_len,
+                           verify->badge.signature,
+                           verify->badge.signature_len,
+                           &verify->key, &verify->verified );
+    verify->err = bdgr_error();
+    bdgr_key_free( &verify->key );
+    bdgr_event_checked( verify );
+}
+
+static void bdgr_event_lookup( void* const lookup )
+{
+    bdgr_lookup_start( lookup );
+}
+
+/* Checks the signature of a verification whose key is known */
+static void bdgr_event_check( struct bdgr_verify* const verify )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    if( bdgr_event_expired( verify, &now )) {
+        bdgr_key_free( &verify->key );
+        verify->err = bdgr_timeout_err;
+        bdgr_event_checked( verify );
+        return;
+    }
+    if( bdgr_event_submit( bdgr_event_verify, verify )) {
+        bdgr_event_verify( verify );
+    }
+}
+
+static struct bdgr_event_flight* bdgr_event_takeoff(
+    const char* const url,
+    const int revalidate,
+    const struct timespec* const deadline
+)
+{
+    struct bdgr_event_flight* flight = bdgr_calloc( 1, sizeof( *flight ));
+
+    bdgr_check( flight == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return NULL;
+    }
+    flight->url = bdgr_strdup( url );
+    bdgr_check( flight->url == NULL ||
+                bdgr_table_put( &bdgr_g_event.flights, url, flight ),
+                bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_event_takeoff_free;
+    }
+    flight->revalidate = revalidate;
+    flight->lookup = bdgr_lookup_new( url, deadline, revalidate,
+                                      bdgr_event_landed, flight );
+    if( bdgr_error() ) {
+        bdgr_table_remove( &bdgr_g_event.flights, url );
+        goto bdgr_event_takeoff_free;
+    }
+
+    flight->next = bdgr_g_event.flying;
+    if( flight->next != NULL ) {
+        flight->next->prev = flight;
+    }
+    bdgr_g_event.flying = flight;
+
+    /* Blocking handlers would stall the loop, so hand them to a worker */
+    if( !flight->lookup->blocking ||
+        bdgr_event_submit( bdgr_event_lookup, flight->lookup )) {
+        bdgr_lookup_start( flight->lookup );
+    }
+    return flight;
+
+ bdgr_event_takeoff_free:
+
+    bdgr_free( flight->url );
+    bdgr_free( flight );
+    return NULL;
+}
+
+/* Puts a verification without a key on the flight looking it up */
+static void bdgr_event_board( struct bdgr_verify* const verify )
+{
+    const char* const url = verify->ref;
+    struct bdgr_event_flight* flight =
+        bdgr_table_get( &bdgr_g_event.flights, url );
+
+    if( flight == NULL ) {
+        if( !bdgr_cache_backoff( url )) {
+            flight = bdgr_event_takeoff(
+                url, bdgr_cache_stale( url ),
+                verify->has_deadline ? &verify->deadline : NULL );
+        }
+        if( flight == NULL ) {
+            verify->err = bdgr_error();
+            bdgr_event_checked( verify );
+            return;
+        }
+    }
+
+    verify->flight = flight;
+    verify->prev = NULL;
+    verify->next = flight->passengers;
+    if( verify->next != NULL ) {
+        verify->next->prev = verify;
+    }
+    flight->passengers = verify;
+}
+
+static void bdgr_event_unboard( struct bdgr_verify* const verify )
+{
+    struct bdgr_event_flight* const flight = verify->flight;
+
+    if( verify->prev != NULL ) {
+        verify->prev->next = verify->next;
+    } else {
+        flight->passengers = verify->next;
+    }
+    if( verify->next != NULL ) {
+        verify->next->prev = verify->prev;
+    }
+    verify->flight = NULL;
+
+    if( flight->passengers == NULL && !flight->cancelled ) {
+        /* Let later verifications of the URL start afresh */
+        flight->cancelled = 1;
+        bdgr_table_remove( &bdgr_g_event.flights, flight->url );
+        bdgr_lookup_cancel( flight->lookup );
+    }
+}
+
+static void bdgr_event_land( struct bdgr_event_flight* const flight )
+{
+    struct bdgr_verify* verify, * next;
+    struct timespec now;
+    unsigned char data[ BDGR_KEY_EXPORT_MAX ];
+    unsigned long int data_len = sizeof( data );
+    char* record = NULL;
+    time_t expires;
+    bdgr_key key;
+    int err, retry = 0, keyed = 0;
+
+    if( flight->prev != NULL ) {
+        flight->prev->next = flight->next;
+    } else {
+        bdgr_g_event.flying = flight->next;
+    }
+    if( flight->next != NULL ) {
+        flight->next->prev = flight->prev;
+    }
+    if( !flight->cancelled ) {
+        bdgr_table_remove( &bdgr_g_event.flights, flight->url );
+    }
+
+    bdgr_lookup_result( flight->lookup, &record, &expires );
+    if( bdgr_error() ) {
+        bdgr_cache_fail( flight->url, bdgr_cache_fetch_failed );
+    } else {
+        retry = bdgr_key_settle( flight->url, flight->revalidate,
+                                 record, expires, &key );
+        keyed = !retry && !bdgr_error();
+        if( keyed ) {
+            bdgr_key_export_public( &key, data, &data_len );
+        }
+    }
+    err = bdgr_error();
+    bdgr_free( record );
+    bdgr_lookup_release( flight->lookup );
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    for( verify = flight->passengers; verify != NULL; verify = next ) {
+        next = verify->next;
+        verify->flight = NULL;
+
+        /* The flight ran out of its own time, but this one has some left */
+        if( retry ||
+            ( err == bdgr_timeout_err && !bdgr_event_expired( verify, &now ))) {
+            bdgr_event_board( verify );
+            continue;
+        }
+
+        if( !err && keyed == 1 ) {
+            verify->key = key;
+            keyed = 2;
+        } else if( !err ) {
+            verify->err = bdgr_key_import( data, data_len, &verify->key );
+        } else {
+            verify->err = err;
+        }
+        if( verify->err ) {
+            bdgr_event_checked( verify );
+        } else {
+            bdgr_event_check( verify );
+        }
+    }
+
+    if( keyed == 1 ) {
+        bdgr_key_free( &key );
+    }
+    bdgr_free( flight->url );
+    bdgr_free( flight );
+}
+
+/* Times out the passengers whose deadline has passed */
+static void bdgr_event_expire()
+{
+    struct bdgr_event_flight* flight, * next_flight;
+    struct bdgr_verify* verify, * next;
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    for( flight = bdgr_g_event.flying; flight != NULL; flight = next_flight ) {
+        next_flight = flight->next;
+        for( verify = flight->passengers; verify != NULL; verify = next ) {
+            next = verify->next;
+            if( bdgr_event_expired( verify, &now )) {
+                bdgr_event_unboard( verify );
+                verify->err = bdgr_timeout_err;
+                bdgr_event_checked( verify );
+            }
+        }
+    }
+}
+
+int bdgr_verify_start(
+    const bdgr_badge* const badge,
+    const struct timespec* const deadline,
+    bdgr_verify_done done,
+    void* const ctx,
+    bdgr_verify** const handle
+)
+{
+    struct bdgr_verify* verify;
+
+    if( bdgr_event_init() ||
+        bdgr_limit_token( badge->token_len, badge->signature_len, 0 ) ||
+        bdgr_server_token_admit( badge->token, badge->token_len )) {
+        return bdgr_error();
+    }
+
+    verify = bdgr_calloc( 1, sizeof( *verify ));
+    bdgr_check( verify == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    verify->ref = bdgr_key_ref( badge );
+    if( bdgr_error() ) {
+        bdgr_free( verify );
+        return bdgr_error();
+    }
+    bdgr_badge_make_kid( badge->id, badge->kid, badge->token, badge->token_len,
+                         badge->signature, badge->signature_len,
+                         &verify->badge );
+    if( bdgr_error() ) {
+        bdgr_free( verify->ref );
+        bdgr_free( verify );
+        return bdgr_error();
+    }
+    if( deadline != NULL ) {
+        verify->deadline = *deadline;
+        verify->has_deadline = 1;
+    }
+    verify->done = done;
+    verify->ctx = ctx;
+
+    /* Only a fetch costs the identity a token, a cached key never does */
+    if( bdgr_cache_get( verify->ref, &verify->key )) {
+        *handle = verify;
+        bdgr_event_check( verify );
+    } else if( bdgr_limit_identity( badge->id )) {
+        bdgr_badge_free( &verify->badge );
+        bdgr_free( verify->ref );
+        bdgr_free( verify );
+        return bdgr_error();
+    } else {
+        *handle = verify;
+        bdgr_event_board( verify );
+    }
+
+    /* Anything that went wrong from here on is reported to done */
+    return bdgr_check( 0, bdgr_no_err, __LINE__ );
+}
+
+int bdgr_verify_fd()
+{
+    if( bdgr_event_init() ) {
+        return -1;
+    }
+    return bdgr_g_event.wake[0];
+}
+
+long int bdgr_verify_timeout()
+{
+    const struct bdgr_event_flight* flight;
+    const struct bdgr_verify* verify;
+    const struct timespec* earliest = NULL;
+    struct timespec now;
+    long int ms;
+
+    for( flight = bdgr_g_event.flying; flight != NULL; flight = flight->next ) {
+        for( verify = flight->passengers;
+             verify != NULL;
+             verify = verify->next ) {
+            if( verify->has_deadline &&
+                ( earliest == NULL ||
+                  verify->deadline.tv_sec < earliest->tv_sec ||
+                  ( verify->deadline.tv_sec == earliest->tv_sec &&
+                    verify->deadline.tv_nsec < earliest->tv_nsec ))) {
+                earliest = &verify->deadline;
+            }
+        }
+    }
+    if( earliest == NULL ) {
+        return -1;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    ms = ( earliest->tv_sec - now.tv_sec ) * 1000 +
+        ( earliest->tv_nsec - now.tv_nsec ) / 1000000;
+    return ms > 0 ? ms : 0;
+}
+
+int bdgr_verify_process( const int fd, const int events )
+{
+    struct bdgr_event_flight* flight, * next_flight;
+    struct bdgr_verify* verify, * next;
+    char drain[ 256 ];
+    (void)events;
+
+    if( bdgr_event_init() ) {
+        return bdgr_error();
+    }
+    if( fd == bdgr_g_event.wake[0] ) {
+        while( read( bdgr_g_event.wake[0], drain, sizeof( drain )) > 0 );
+    }
+
+    pthread_mutex_lock( &bdgr_g_event.lock );
+    flight = bdgr_g_event.landed;
+    bdgr_g_event.landed = NULL;
+    pthread_mutex_unlock( &bdgr_g_event.lock );
+    for( ; flight != NULL; flight = next_flight ) {
+        next_flight = flight->next_landed;
+        bdgr_event_land( flight );
+    }
+
+    bdgr_event_expire();
+
+    /* Callbacks may start verifications, which land on the next call */
+    pthread_mutex_lock( &bdgr_g_event.lock );
+    verify = bdgr_g_event.checked;
+    bdgr_g_event.checked = NULL;
+    pthread_mutex_unlock( &bdgr_g_event.lock );
+    for( ; verify != NULL; verify = next ) {
+        next = verify->next;
+        if( !verify->cancelled ) {
+            verify->done( verify, verify->err, verify->verified,
+                          verify->ctx );
+        }
+        bdgr_badge_free( &verify->badge );
+        bdgr_free( verify->ref );
+        bdgr_free( verify );
+    }
+
+    return bdgr_check( 0, bdgr_no_err, __LINE__ );
+}
+
+void bdgr_verify_cancel( bdgr_verify* const verify )
+{
+    if( verify->flight == NULL ) {
+        /* Being checked or about to be reported, so let process free it */
+        verify->cancelled = 1;
+        return;
+    }
+    bdgr_event_unboard( verify );
+    bdgr_badge_free( &verify->badge );
+    bdgr_free( verify->ref );
+    bdgr_free( verify );
+}
+
+int bdgr_verify_workers( const unsigned long int workers )
+{
+    pthread_t worker;
+
+    if( bdgr_event_init() ) {
+        return bdgr_error();
+    }
+    while( bdgr_g_event.workers < workers ) {
+        if( bdgr_check( pthread_create( &worker, NULL, bdgr_event_work, NULL ),
+                        bdgr_thread_err, __LINE__ )) {
+            return bdgr_error();
+        }
+        pthread_detach( worker );
+        bdgr_g_event.workers++;
+    }
+    return bdgr_error();
+}
@@ -0,0 +1,382 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_group.h"
+#include "badger_table.h"
+
+#define BDGR_GROUP_VALID_MAX    4096
+#define BDGR_GROUP_PRIME_ROUNDS 8
+
+/*
+  Groups are named by the hex SHA-256 of their lengths and parameters.
+  Interned groups are kept while referenced, validated ones only by name,
+  and forgotten wholesale when there are too many of them.
+*/
+static struct {
+    bdgr_table      groups;
+    bdgr_table      valid;
+    int             sha256;
+    pthread_mutex_t lock;
+} bdgr_g_group = {
+    { NULL, 0, 0, NULL }, { NULL, 0, 0, NULL }, -1, PTHREAD_MUTEX_INITIALIZER
+};
+
+/* Called with the groups locked */
+static int bdgr_group_init()
+{
+    if( bdgr_g_group.groups.buckets != NULL ) {
+        return bdgr_check( 0, bdgr_no_err, __LINE__ );
+    }
+    if( bdgr_check( register_hash( &sha256_desc ) == -1,
+                    bdgr_register_hash_err, __LINE__ )) {
+        return bdgr_error();
+    }
+    bdgr_g_group.sha256 = find_hash( "sha256" );
+    if( bdgr_check( bdgr_table_init( &bdgr_g_group.valid, 256, NULL ),
+                    bdgr_malloc_err, __LINE__ )) {
+        return bdgr_error();
+    }
+    if( bdgr_check( bdgr_table_init( &bdgr_g_group.groups, 256, NULL ),
+                    bdgr_malloc_err, __LINE__ )) {
+        bdgr_table_free( &bdgr_g_group.valid );
+    }
+    return bdgr_error();
+}
+
+/*
+  Returns the lengths of p, q and g followed by their bytes, which the
+  caller frees, and sets the lengths.
+*/
+static unsigned char* bdgr_group_encode(
+    const dsa_key* const key,
+    unsigned long int* const p_len,
+    unsigned long int* const q_len,
+    unsigned long int* const g_len,
+    unsigned long int* const data_len
+)
+{
+    unsigned char* data;
+    unsigned long int i;
+
+    *p_len = mp_unsigned_bin_size( key->p );
+    *q_len = mp_unsigned_bin_size( key->q );
+    *g_len = mp_unsigned_bin_size( key->g );
+    *data_len = 3 * 4 + *p_len + *q_len + *g_len;
+
+    data = bdgr_malloc( *data_len );
+    bdgr_check( data == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return NULL;
+    }
+    for( i = 0; i < 4; i++ ) {
+        data[ i ] = (unsigned char)( *p_len >> ( 24 - 8 * i ));
+        data[ 4 + i ] = (unsigned char)( *q_len >> ( 24 - 8 * i ));
+        data[ 8 + i ] = (unsigned char)( *g_len >> ( 24 - 8 * i ));
+    }
+    if( bdgr_crypt( mp_to_unsigned_bin( key->p, data + 12 ),
+                    __LINE__ ) != CRYPT_OK ||
+        bdgr_crypt( mp_to_unsigned_bin( key->q, data + 12 + *p_len ),
+                    __LINE__ ) != CRYPT_OK ||
+        bdgr_crypt( mp_to_unsigned_bin( key->g, data + 12 + *p_len + *q_len ),
+                    __LINE__ ) != CRYPT_OK ) {
+        bdgr_free( data );
+        return NULL;
+    }
+    return data;
+}
+
+static void bdgr_group_hex(
+    const unsigned char* const hash,
+    char* const name
+)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned long int i;
+
+    for( i = 0; i < BDGR_GROUP_HASH_SIZE; i++ ) {
+        name[ 2 * i ] = hex[ hash[ i ] >> 4 ];
+        name[ 2 * i + 1 ] = hex[ hash[ i ] & 0xf ];
+    }
+    name[ 2 * i ] = '\0';
+}
+
+/* Hashes an encoded group into hash and its name, called locked */
+static int bdgr_group_name(
+    const unsigned char* const data,
+    const unsigned long int data_len,
+    unsigned char* const hash,
+    char* const name
+)
+{
+    unsigned long int hash_len = BDGR_GROUP_HASH_SIZE;
+
+    if( bdgr_group_init() ||
+        bdgr_crypt( hash_memory( bdgr_g_group.sha256, data, data_len,
+                                 hash, &hash_len ),
+                    __LINE__ ) != CRYPT_OK ) {
+        return bdgr_error();
+    }
+    bdgr_group_hex( hash, name );
+    return bdgr_error();
+}
+
+const struct bdgr_group* bdgr_group_intern( const dsa_key* const key )
+{
+    struct bdgr_group* group, * found;
+    unsigned char* data;
+    unsigned long int p_len, q_len, g_len, data_len;
+    char name[ BDGR_GROUP_HASH_SIZE * 2 + 1 ];
+
+    data = bdgr_group_encode( key, &p_len, &q_len, &g_len, &data_len );
+    if( data == NULL ) {
+        return NULL;
+    }
+    group = bdgr_calloc( 1, sizeof( *group ));
+    bdgr_check( group == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        bdgr_free( data );
+        return NULL;
+    }
+
+    pthread_mutex_lock( &bdgr_g_group.lock );
+    if( bdgr_group_name( data, data_len, group->hash, name )) {
+        goto bdgr_group_intern_unlock;
+    }
+
+    found = bdgr_table_get( &bdgr_g_group.groups, name );
+    if( found != NULL ) {
+        bdgr_free( group );
+        group = found;
+        group->refs++;
+        goto bdgr_group_intern_unlock;
+    }
+
+    /* The group keeps the parameters, not the lengths before them */
+    memmove( data, data + 12, data_len - 12 );
+    group->refs = 1;
+    group->p_len = p_len;
+    group->q_len = q_len;
+    group->g_len = g_len;
+    group->p = data;
+    group->q = data + p_len;
+    group->g = data + p_len + q_len;
+    bdgr_check( bdgr_table_put( &bdgr_g_group.groups, name, group ),
+                bdgr_malloc_err, __LINE__ );
+    if( !bdgr_error() ) {
+        data = NULL;
+    }
+
+ bdgr_group_intern_unlock:
+
+    if( bdgr_error() ) {
+        bdgr_free( group );
+        group = NULL;
+    }
+    pthread_mutex_unlock( &bdgr_g_group.lock );
+    bdgr_free( data );
+    return group;
+}
+
+void bdgr_group_release( const struct bdgr_group* const _group )
+{
+    struct bdgr_group* const group = (struct bdgr_group*)_group;
+    char name[ BDGR_GROUP_HASH_SIZE * 2 + 1 ];
+    int last;
+
+    if( group == NULL ) {
+        return;
+    }
+    pthread_mutex_lock( &bdgr_g_group.lock );
+    last = --group->refs == 0;
+    if( last ) {
+        bdgr_group_hex( group->hash, name );
+        bdgr_table_remove( &bdgr_g_group.groups, name );
+    }
+    pthread_mutex_unlock( &bdgr_g_group.lock );
+
+    if( last ) {
+        bdgr_free( group->p );
+        bdgr_free( group );
+    }
+}
+
+int bdgr_group_key(
+    const struct bdgr_group* const group,
+    const unsigned char* const y,
+    const unsigned long int y_len,
+    dsa_key* const key
+)
+{
+    bdgr_crypt( mp_init_multi( &key->g, &key->q, &key->p, &key->x, &key->y,
+                               NULL ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+
+    bdgr_crypt( mp_read_unsigned_bin( key->p, group->p, group->p_len ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_group_key_free;
+    }
+    bdgr_crypt( mp_read_unsigned_bin( key->q, group->q, group->q_len ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_group_key_free;
+    }
+    bdgr_crypt( mp_read_unsigned_bin( key->g, group->g, group->g_len ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_group_key_free;
+    }
+    bdgr_crypt( mp_read_unsigned_bin( key->y, (unsigned char*)y, y_len ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_group_key_free;
+    }
+    key->type = PK_PUBLIC;
+    key->qord = group->q_len;
+
+ bdgr_group_key_free:
+
+    if( bdgr_error() ) {
+        mp_clear_multi( key->g, key->q, key->p, key->x, key->y, NULL );
+    }
+    return bdgr_error();
+}
+
+/* Whether a is prime, setting the error if it isn't */
+static int bdgr_group_prime( void* const a )
+{
+    int prime = 0;
+
+    if( bdgr_crypt( mp_prime_is_prime( a, BDGR_GROUP_PRIME_ROUNDS, &prime ),
+                    __LINE__ ) != CRYPT_OK ) {
+        return 0;
+    }
+    return !bdgr_check( prime != LTC_MP_YES, bdgr_key_invalid_err, __LINE__ );
+}
+
+/* Whether a^q mod p == 1, setting the error if not */
+static int bdgr_group_order(
+    const dsa_key* const key,
+    void* const a,
+    void* const t
+)
+{
+    if( bdgr_crypt( mp_exptmod( a, key->q, key->p, t ),
+                    __LINE__ ) != CRYPT_OK ) {
+        return 0;
+    }
+    return !bdgr_check( mp_cmp_d( t, 1 ) != LTC_MP_EQ,
+                        bdgr_key_invalid_err, __LINE__ );
+}
+
+/*
+  The checks on domain parameters: 1 < g < p, q < p, q divides p - 1, p
+  and q prime and g^q mod p == 1.  Primality is tested last, being the
+  dearest.
+*/
+static int bdgr_group_check( const dsa_key* const key, void* const t )
+{
+    bdgr_check( mp_cmp_d( key->g, 1 ) != LTC_MP_GT ||
+                mp_cmp( key->g, key->p ) != LTC_MP_LT ||
+                mp_cmp( key->q, key->p ) != LTC_MP_LT,
+                bdgr_key_invalid_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    if( bdgr_crypt( mp_sub_d( key->p, 1, t ), __LINE__ ) != CRYPT_OK ||
+        bdgr_crypt( mp_mod( t, key->q, t ), __LINE__ ) != CRYPT_OK ) {
+        return bdgr_error();
+    }
+    if( !bdgr_check( mp_iszero( t ) != LTC_MP_YES,
+                     bdgr_key_invalid_err, __LINE__ ) &&
+        bdgr_group_order( key, key->g, t ) &&
+        bdgr_group_prime( key->q ) ) {
+        bdgr_group_prime( key->p );
+    }
+    return bdgr_error();
+}
+
+int bdgr_group_validate( const dsa_key* const key )
+{
+    unsigned char hash[ BDGR_GROUP_HASH_SIZE ];
+    char name[ BDGR_GROUP_HASH_SIZE * 2 + 1 ];
+    unsigned char* data;
+    unsigned long int p_len, q_len, g_len, data_len;
+    void* t;
+    int known;
+
+    data = bdgr_group_encode( key, &p_len, &q_len, &g_len, &data_len );
+    if( data == NULL ) {
+        return bdgr_error();
+    }
+    pthread_mutex_lock( &bdgr_g_group.lock );
+    known = !bdgr_group_name( data, data_len, hash, name ) &&
+        bdgr_g_group.valid.buckets != NULL &&
+        bdgr_table_get( &bdgr_g_group.valid, name ) != NULL;
+    pthread_mutex_unlock( &bdgr_g_group.lock );
+    bdgr_free( data );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+
+    if( bdgr_crypt( mp_init( &t ), __LINE__ ) != CRYPT_OK ) {
+        return bdgr_error();
+    }
+
+    /* Only a group seen for the first time is checked in full */
+    if( !known && bdgr_group_check( key, t )) {
+        goto bdgr_group_validate_free;
+    }
+
+    /* 1 < y < p and y^q mod p == 1 */
+    if( bdgr_check( mp_cmp_d( key->y, 1 ) != LTC_MP_GT ||
+                    mp_cmp( key->y, key->p ) != LTC_MP_LT,
+                    bdgr_key_invalid_err, __LINE__ ) ||
+        !bdgr_group_order( key, key->y, t )) {
+        goto bdgr_group_validate_free;
+    }
+
+    if( !known ) {
+        pthread_mutex_lock( &bdgr_g_group.lock );
+        if( bdgr_g_group.valid.count >= BDGR_GROUP_VALID_MAX ) {
+            bdgr_table_free( &bdgr_g_group.valid );
+            bdgr_table_init( &bdgr_g_group.valid, 256, NULL );
+        }
+        /* The value only marks the name as present */
+        if( bdgr_g_group.valid.buckets != NULL ) {
+            bdgr_table_put( &bdgr_g_group.valid, name, &bdgr_g_group );
+        }
+        pthread_mutex_unlock( &bdgr_g_group.lock );
+    }
+
+ bdgr_group_validate_free:
+
+    mp_clear( t );
+    return bdgr_error();
+}
@@ -0,0 +1,67 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_GROUP_H
+#define BADGER_GROUP_H
+
+#include <tomcrypt.h>
+
+#define BDGR_GROUP_HASH_SIZE 32
+
+/*
+  DSA domain parameters, interned so that keys sharing them share one
+  copy.  Groups are immutable once interned, and counted so that the last
+  release frees them.
+*/
+struct bdgr_group {
+    unsigned char     hash[ BDGR_GROUP_HASH_SIZE ];
+    unsigned long int refs;
+    unsigned long int p_len;
+    unsigned long int q_len;
+    unsigned long int g_len;
+    unsigned char*    p;
+    unsigned char*    q;
+    unsigned char*    g;
+};
+
+/*
+  Returns the interned group of key, or NULL and sets the error.  Each
+  group returned is released with bdgr_group_release().
+*/
+const struct bdgr_group* bdgr_group_intern( const dsa_key* key );
+
+/* Drops a reference taken by bdgr_group_intern(), NULL being ignored */
+void bdgr_group_release( const struct bdgr_group* group );
+
+/*
+  Checks the key spec of the README on public key: p and q prime, q
+  dividing p - 1, g and y of order q.  The domain parameters are checked
+  once per group, later keys in it only have y checked.
+*/
+int bdgr_group_validate( const dsa_key* key );
+
+/* Initializes a verify-ready public key from group and y */
+int bdgr_group_key(
+    const struct bdgr_group* group,
+    const unsigned char* y,
+    unsigned long int y_len,
+    dsa_key* key
+);
+
+#endif
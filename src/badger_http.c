@@ -0,0 +1,693 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_scheme.h"
+#include "badger_table.h"
+
+#define BDGR_HTTP_VALIDATORS_MAX 65536
+#define BDGR_HTTP_STREAMS        100
+#define BDGR_HTTP_IDLE_MS        60000
+
+/*
+  Validators of the last record fetched for each cache entry, kept by the
+  same reference as the entry: the URL followed by a space and the key id,
+  if any.  They are sent back once the key decoded from the record goes
+  stale, so that an unchanged record costs a 304 instead of a download and
+  a parse.  Keeping them by URL alone would let a 304 to the validators of
+  a newer record fetched for one key id keep another key id's entry, taken
+  from an older record that may no longer list it.
+*/
+struct bdgr_http_validator {
+    char* etag;
+    char* last_modified;
+};
+
+static void bdgr_http_validator_free( void* const _validator )
+{
+    struct bdgr_http_validator* const validator = _validator;
+    bdgr_free( validator->etag );
+    bdgr_free( validator->last_modified );
+    bdgr_free( validator );
+}
+
+/* The caching headers of a response */
+struct bdgr_http_response {
+    char*    etag;
+    char*    last_modified;
+    long int max_age;
+    long int age;
+    time_t   expires;
+    int      no_cache;
+};
+
+struct bdgr_http_transfer {
+    CURL*                      handle;
+    struct curl_slist*         headers;
+    struct bdgr_http_response  response;
+    bdgr_lookup*               lookup;
+    int                        conditional;
+    int                        cancelled;
+    struct bdgr_http_transfer* prev;
+    struct bdgr_http_transfer* next;
+};
+
+/*
+  Transfers are driven by one thread through a curl multi handle, so that
+  concurrent fetches from a host share a connection over HTTP/2.  Lookups
+  queue their transfer on pending and wake the driver through a pipe, which
+  moves it to active until it finishes.  A cancelled lookup marks its
+  transfer and sets cancelling for the driver to take it off the multi
+  handle.
+*/
+static struct {
+    bdgr_table                 urls;
+    CURLM*                     multi;
+    struct bdgr_http_transfer* pending;
+    struct bdgr_http_transfer* active;
+    int                        cancelling;
+    int                        wake[2];
+    int                        driving;
+    unsigned long int          streams;
+    int                        streams_changed;
+    pthread_mutex_t            lock;
+} bdgr_g_http = {
+    { NULL, 0, 0, NULL }, NULL, NULL, NULL, 0, { -1, -1 }, 0,
+    BDGR_HTTP_STREAMS, 1, PTHREAD_MUTEX_INITIALIZER
+};
+
+static void bdgr_http_response_clear( struct bdgr_http_response* const response )
+{
+    bdgr_free( response->etag );
+    bdgr_free( response->last_modified );
+    memset( response, 0, sizeof( *response ));
+    response->max_age = -1;
+}
+
+static void bdgr_http_cache_control(
+    struct bdgr_http_response* const response,
+    char* const value
+)
+{
+    char* directive, * save;
+
+    for( directive = strtok_r( value, ",", &save );
+         directive != NULL;
+         directive = strtok_r( NULL, ",", &save )) {
+        directive += strspn( directive, " \t" );
+        if( !strncasecmp( directive, "max-age=", 8 )) {
+            response->max_age = strtol( directive + 8, NULL, 10 );
+        } else if( !strncasecmp( directive, "no-cache", 8 ) ||
+                   !strncasecmp( directive, "no-store", 8 )) {
+            response->no_cache = 1;
+        }
+    }
+}
+
+static size_t bdgr_http_header(
+    char* const buffer,
+    const size_t size,
+    const size_t nitems,
+    void* const _response
+)
+{
+    struct bdgr_http_response* const response = _response;
+    const size_t len = size * nitems;
+    char* const line = bdgr_malloc( len + 1 );
+    char* value, * end;
+    time_t date;
+
+    if( line == NULL ) {
+        /* Without its headers the record is merely not cached */
+        return len;
+    }
+    memcpy( line, buffer, len );
+    line[ len ] = '\0';
+
+    if( !strncmp( line, "HTTP/", 5 )) {
+        /* Only the headers of the final response count */
+        bdgr_http_response_clear( response );
+        goto bdgr_http_header_free;
+    }
+    value = strchr( line, ':' );
+    if( value == NULL ) {
+        goto bdgr_http_header_free;
+    }
+    *value++ = '\0';
+    value += strspn( value, " \t" );
+    end = value + strlen( value );
+    while( end > value && strchr( " \t\r\n", end[ -1 ] )) {
+        *--end = '\0';
+    }
+
+    if( !strcasecmp( line, "ETag" )) {
+        bdgr_free( response->etag );
+        response->etag = bdgr_strdup( value );
+    } else if( !strcasecmp( line, "Last-Modified" )) {
+        bdgr_free( response->last_modified );
+        response->last_modified = bdgr_strdup( value );
+    } else if( !strcasecmp( line, "Cache-Control" )) {
+        bdgr_http_cache_control( response, value );
+    } else if( !strcasecmp( line, "Age" )) {
+        response->age = strtol( value, NULL, 10 );
+    } else if( !strcasecmp( line, "Expires" )) {
+        /* An invalid date means already expired */
+        date = curl_getdate( value, NULL );
+        response->expires = date > 0 ? date : 1;
+    }
+
+ bdgr_http_header_free:
+
+    bdgr_free( line );
+    return len;
+}
+
+/*
+  Returns when a record stops being fresh, or 0 if the response doesn't
+  say.  Cache-Control takes precedence over Expires.
+*/
+static time_t bdgr_http_expires(
+    const struct bdgr_http_response* const response
+)
+{
+    const time_t now = time( NULL );
+
+    if( response->no_cache ) {
+        /* Stale at once, so every use revalidates */
+        return now;
+    }
+    if( response->max_age >= 0 ) {
+        return now + ( response->max_age > response->age ?
+                       response->max_age - response->age : 0 );
+    }
+    return response->expires;
+}
+
+static struct curl_slist* bdgr_http_header_append(
+    struct curl_slist* const headers,
+    const char* const name,
+    const char* const value
+)
+{
+    struct curl_slist* appended = headers;
+    char* const line = bdgr_malloc( strlen( name ) + strlen( value ) + 3 );
+
+    if( line != NULL ) {
+        sprintf( line, "%s: %s", name, value );
+        appended = curl_slist_append( headers, line );
+        bdgr_free( line );
+    }
+    return appended != NULL ? appended : headers;
+}
+
+/* The reference validators of lookup are kept by, to be freed */
+static char* bdgr_http_ref( const bdgr_lookup* const lookup )
+{
+    char* ref;
+
+    if( lookup->kid == NULL ) {
+        return bdgr_strdup( lookup->url );
+    }
+    ref = bdgr_malloc( strlen( lookup->url ) + strlen( lookup->kid ) + 2 );
+    if( ref != NULL ) {
+        sprintf( ref, "%s %s", lookup->url, lookup->kid );
+    }
+    return ref;
+}
+
+/*
+  Builds the headers revalidating the record last fetched for lookup.
+  Returns NULL when there is nothing to revalidate with.
+*/
+static struct curl_slist* bdgr_http_conditional(
+    const bdgr_lookup* const lookup
+)
+{
+    struct curl_slist* headers = NULL;
+    const struct bdgr_http_validator* validator = NULL;
+    char* const ref = bdgr_http_ref( lookup );
+
+    if( ref == NULL ) {
+        return NULL;
+    }
+    pthread_mutex_lock( &bdgr_g_http.lock );
+    if( bdgr_g_http.urls.buckets != NULL ) {
+        validator = bdgr_table_get( &bdgr_g_http.urls, ref );
+    }
+    if( validator != NULL && validator->etag != NULL ) {
+        headers = bdgr_http_header_append( headers, "If-None-Match",
+                                           validator->etag );
+    }
+    if( validator != NULL && validator->last_modified != NULL ) {
+        headers = bdgr_http_header_append( headers, "If-Modified-Since",
+                                           validator->last_modified );
+    }
+    pthread_mutex_unlock( &bdgr_g_http.lock );
+    bdgr_free( ref );
+    return headers;
+}
+
+/*
+  Keeps the validators of a response for the next revalidation of the
+  entry of lookup.  A 304 without validators leaves the ones it confirmed
+  in place.
+*/
+static void bdgr_http_remember(
+    const bdgr_lookup* const lookup,
+    struct bdgr_http_response* const response,
+    const int not_modified
+)
+{
+    struct bdgr_http_validator* validator = NULL;
+    const int has_validators =
+        response->etag != NULL || response->last_modified != NULL;
+    char* ref;
+
+    if( not_modified && !has_validators ) {
+        return;
+    }
+    ref = bdgr_http_ref( lookup );
+    if( ref == NULL ) {
+        return;
+    }
+    if( has_validators ) {
+        validator = bdgr_malloc( sizeof( struct bdgr_http_validator ));
+    }
+    if( validator != NULL ) {
+        validator->etag = response->etag;
+        validator->last_modified = response->last_modified;
+        response->etag = NULL;
+        response->last_modified = NULL;
+    }
+
+    pthread_mutex_lock( &bdgr_g_http.lock );
+    if( bdgr_g_http.urls.buckets == NULL &&
+        bdgr_table_init( &bdgr_g_http.urls, 1024,
+                         bdgr_http_validator_free )) {
+        bdgr_g_http.urls.buckets = NULL;
+    } else if( validator == NULL ||
+               ( bdgr_g_http.urls.count >= BDGR_HTTP_VALIDATORS_MAX &&
+                 !bdgr_table_get( &bdgr_g_http.urls, ref ))) {
+        bdgr_table_remove( &bdgr_g_http.urls, ref );
+    } else if( !bdgr_table_put( &bdgr_g_http.urls, ref, validator )) {
+        validator = NULL;
+    }
+    pthread_mutex_unlock( &bdgr_g_http.lock );
+
+    if( validator != NULL ) {
+        bdgr_http_validator_free( validator );
+    }
+    bdgr_free( ref );
+}
+
+int bdgr_http_streams( const unsigned long int streams )
+{
+    pthread_mutex_lock( &bdgr_g_http.lock );
+    bdgr_g_http.streams = streams;
+    bdgr_g_http.streams_changed = 1;
+    pthread_mutex_unlock( &bdgr_g_http.lock );
+    return bdgr_check( 0, bdgr_no_err, __LINE__ );
+}
+
+static void bdgr_http_transfer_free( struct bdgr_http_transfer* const transfer )
+{
+    if( transfer->handle != NULL ) {
+        curl_easy_cleanup( transfer->handle );
+    }
+    curl_slist_free_all( transfer->headers );
+    bdgr_http_response_clear( &transfer->response );
+    bdgr_free( transfer );
+}
+
+static size_t bdgr_http_data(
+    char* const ptr,
+    const size_t size,
+    const size_t nmemb,
+    void* const _lookup
+)
+{
+    bdgr_lookup* const lookup = _lookup;
+
+    /* Stop the transfer once it failed or the key has been found */
+    if( bdgr_lookup_write( lookup, ptr, size * nmemb ) || lookup->scan.done ) {
+        return 0;
+    }
+    return size * nmemb;
+}
+
+static struct bdgr_http_transfer* bdgr_http_transfer_new(
+    bdgr_lookup* const lookup,
+    const unsigned long int streams
+)
+{
+    struct bdgr_http_transfer* const transfer =
+        bdgr_calloc( 1, sizeof( struct bdgr_http_transfer ));
+
+    bdgr_check( transfer == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return NULL;
+    }
+    transfer->lookup = lookup;
+    transfer->response.max_age = -1;
+    transfer->handle = curl_easy_init();
+    bdgr_check( transfer->handle == NULL, bdgr_curl_init_err, __LINE__ );
+    if( bdgr_error() ) {
+        bdgr_http_transfer_free( transfer );
+        return NULL;
+    }
+    if( lookup->revalidate ) {
+        transfer->headers = bdgr_http_conditional( lookup );
+    }
+    transfer->conditional = transfer->headers != NULL;
+
+    curl_easy_setopt( transfer->handle, CURLOPT_URL, lookup->url );
+    curl_easy_setopt( transfer->handle, CURLOPT_WRITEFUNCTION,
+                      bdgr_http_data );
+    curl_easy_setopt( transfer->handle, CURLOPT_WRITEDATA, lookup );
+    curl_easy_setopt( transfer->handle, CURLOPT_HEADERFUNCTION,
+                      bdgr_http_header );
+    curl_easy_setopt( transfer->handle, CURLOPT_HEADERDATA,
+                      &transfer->response );
+    curl_easy_setopt( transfer->handle, CURLOPT_HTTPHEADER,
+                      transfer->headers );
+    curl_easy_setopt( transfer->handle, CURLOPT_PRIVATE, transfer );
+    if( streams ) {
+        /* Hosts without HTTP/2 are spoken to over HTTP/1.1 instead */
+        curl_easy_setopt( transfer->handle, CURLOPT_HTTP_VERSION,
+                          (long)CURL_HTTP_VERSION_2TLS );
+        curl_easy_setopt( transfer->handle, CURLOPT_PIPEWAIT, 1L );
+    } else {
+        curl_easy_setopt( transfer->handle, CURLOPT_HTTP_VERSION,
+                          (long)CURL_HTTP_VERSION_1_1 );
+    }
+    bdgr_deadline_curl( transfer->handle );
+    return transfer;
+}
+
+/* Completes the lookup of a finished transfer and releases it */
+static void bdgr_http_finish(
+    struct bdgr_http_transfer* const transfer,
+    const CURLcode res
+)
+{
+    bdgr_lookup* const lookup = transfer->lookup;
+    long int status = 0;
+
+    curl_easy_getinfo( transfer->handle, CURLINFO_RESPONSE_CODE, &status );
+    
+    /* Stopped by bdgr_http_data(), the status still tells what happened */
+    if( bdgr_curl_check( res == CURLE_WRITE_ERROR &&
+                         ( lookup->record.error || lookup->scan.done ) ?
+                         CURLE_OK : res, __LINE__ )) {
+        goto bdgr_http_finish_done;
+    }
+    bdgr_check( status == 404 || status == 410,
+                bdgr_http_not_found_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_http_finish_done;
+    }
+    bdgr_check( status >= 400 || ( status == 304 && !transfer->conditional ),
+                bdgr_http_status_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_http_finish_done;
+    }
+    bdgr_check( lookup->record.error != bdgr_no_err,
+                lookup->record.error, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_http_finish_done;
+    }
+
+    lookup->not_modified = status == 304;
+    lookup->expires = bdgr_http_expires( &transfer->response );
+    bdgr_http_remember( lookup, &transfer->response, lookup->not_modified );
+
+ bdgr_http_finish_done:
+
+    bdgr_http_transfer_free( transfer );
+    bdgr_lookup_complete( lookup, bdgr_error() );
+}
+
+static void bdgr_http_configure()
+{
+    const long int streams = bdgr_g_http.streams;
+
+    curl_multi_setopt( bdgr_g_http.multi, CURLMOPT_PIPELINING,
+                       streams ? (long)CURLPIPE_MULTIPLEX :
+                       (long)CURLPIPE_NOTHING );
+#if LIBCURL_VERSION_NUM >= 0x074300
+    if( streams ) {
+        curl_multi_setopt( bdgr_g_http.multi,
+                           CURLMOPT_MAX_CONCURRENT_STREAMS, streams );
+    }
+#endif
+    bdgr_g_http.streams_changed = 0;
+}
+
+/* Takes transfer off the active list, with the lock held */
+static void bdgr_http_deactivate( struct bdgr_http_transfer* const transfer )
+{
+    if( transfer->prev != NULL ) {
+        transfer->prev->next = transfer->next;
+    } else {
+        bdgr_g_http.active = transfer->next;
+    }
+    if( transfer->next != NULL ) {
+        transfer->next->prev = transfer->prev;
+    }
+    transfer->prev = NULL;
+    transfer->next = NULL;
+}
+
+/*
+  Takes the cancelled transfers off the active list into cancelled, then
+  moves the pending ones to its front, returning the last of those.  Called
+  with the lock held, so that bdgr_scheme_http_cancel() always finds a
+  transfer on one list.  Pending transfers already cancelled go straight to
+  cancelled without being added.
+*/
+static struct bdgr_http_transfer* bdgr_http_activate(
+    struct bdgr_http_transfer** const cancelled
+)
+{
+    struct bdgr_http_transfer* transfer, * next, * added = NULL;
+
+    *cancelled = NULL;
+    if( bdgr_g_http.cancelling ) {
+        for( transfer = bdgr_g_http.active; transfer != NULL;
+             transfer = next ) {
+            next = transfer->next;
+            if( transfer->cancelled ) {
+                bdgr_http_deactivate( transfer );
+                transfer->next = *cancelled;
+                *cancelled = transfer;
+            }
+        }
+        bdgr_g_http.cancelling = 0;
+    }
+
+    for( transfer = bdgr_g_http.pending; transfer != NULL; transfer = next ) {
+        next = transfer->next;
+        if( transfer->cancelled ) {
+            transfer->next = *cancelled;
+            *cancelled = transfer;
+            continue;
+        }
+        transfer->prev = NULL;
+        transfer->next = bdgr_g_http.active;
+        if( transfer->next != NULL ) {
+            transfer->next->prev = transfer;
+        }
+        bdgr_g_http.active = transfer;
+        if( added == NULL ) {
+            added = transfer;
+        }
+    }
+    bdgr_g_http.pending = NULL;
+    return added;
+}
+
+static void* bdgr_http_drive( void* const unused )
+{
+    struct bdgr_http_transfer* transfer, * next, * added, * cancelled;
+    struct curl_waitfd wake;
+    CURLMsg* msg;
+    CURL* handle;
+    CURLcode res;
+    char drain[ 64 ];
+    int running = 0, queued, more;
+    (void)unused;
+
+    while( 1 ) {
+
+        pthread_mutex_lock( &bdgr_g_http.lock );
+        if( bdgr_g_http.streams_changed ) {
+            bdgr_http_configure();
+        }
+        added = bdgr_http_activate( &cancelled );
+        transfer = bdgr_g_http.active;
+        pthread_mutex_unlock( &bdgr_g_http.lock );
+
+        /* Only this thread changes the active list, the rest just read it */
+        for( more = added != NULL; more; transfer = next ) {
+            more = transfer != added;
+            next = transfer->next;
+            if( curl_multi_add_handle( bdgr_g_http.multi,
+                                       transfer->handle ) != CURLM_OK ) {
+                pthread_mutex_lock( &bdgr_g_http.lock );
+                bdgr_http_deactivate( transfer );
+                pthread_mutex_unlock( &bdgr_g_http.lock );
+                bdgr_http_finish( transfer, CURLE_FAILED_INIT );
+            }
+        }
+
+        /* Given up on by their callers, so time them out */
+        for( transfer = cancelled; transfer != NULL; transfer = next ) {
+            next = transfer->next;
+            curl_multi_remove_handle( bdgr_g_http.multi, transfer->handle );
+            bdgr_http_finish( transfer, CURLE_OPERATION_TIMEDOUT );
+        }
+
+        curl_multi_perform( bdgr_g_http.multi, &running );
+        while( ( msg = curl_multi_info_read( bdgr_g_http.multi, &queued ))) {
+            if( msg->msg != CURLMSG_DONE ) {
+                continue;
+            }
+            handle = msg->easy_handle;
+            res = msg->data.result;
+            curl_multi_remove_handle( bdgr_g_http.multi, handle );
+            curl_easy_getinfo( handle, CURLINFO_PRIVATE, (char**)&transfer );
+            pthread_mutex_lock( &bdgr_g_http.lock );
+            bdgr_http_deactivate( transfer );
+            pthread_mutex_unlock( &bdgr_g_http.lock );
+            bdgr_http_finish( transfer, res );
+        }
+
+        wake.fd = bdgr_g_http.wake[0];
+        wake.events = CURL_WAIT_POLLIN;
+        wake.revents = 0;
+        curl_multi_wait( bdgr_g_http.multi, &wake, 1,
+                         running ? 1000 : BDGR_HTTP_IDLE_MS, NULL );
+        if( wake.revents ) {
+            while( read( bdgr_g_http.wake[0], drain, sizeof( drain )) > 0 );
+        }
+        
+    }
+    return NULL;
+}
+
+static void bdgr_http_start()
+{
+    pthread_t driver;
+
+    bdgr_g_http.multi = curl_multi_init();
+    if( bdgr_g_http.multi == NULL ) {
+        return;
+    }
+    if( pipe( bdgr_g_http.wake ) == -1 ||
+        fcntl( bdgr_g_http.wake[0], F_SETFL, O_NONBLOCK ) == -1 ||
+        fcntl( bdgr_g_http.wake[1], F_SETFL, O_NONBLOCK ) == -1 ||
+        pthread_create( &driver, NULL, bdgr_http_drive, NULL )) {
+        /* Transfers run on the verifying threads instead */
+        if( bdgr_g_http.wake[0] != -1 ) {
+            close( bdgr_g_http.wake[0] );
+            close( bdgr_g_http.wake[1] );
+        }
+        curl_multi_cleanup( bdgr_g_http.multi );
+        bdgr_g_http.multi = NULL;
+        return;
+    }
+    pthread_detach( driver );
+    bdgr_g_http.driving = 1;
+}
+
+int bdgr_scheme_http( bdgr_lookup* const lookup, void* const ctx )
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    struct bdgr_http_transfer* transfer;
+    unsigned long int streams;
+    (void)ctx;
+
+    pthread_once( &once, bdgr_http_start );
+
+    pthread_mutex_lock( &bdgr_g_http.lock );
+    streams = bdgr_g_http.streams;
+    pthread_mutex_unlock( &bdgr_g_http.lock );
+
+    transfer = bdgr_http_transfer_new( lookup, streams );
+    if( transfer == NULL ) {
+        bdgr_lookup_complete( lookup, bdgr_error() );
+        return bdgr_no_err;
+    }
+
+    if( !bdgr_g_http.driving ) {
+        bdgr_http_finish( transfer, curl_easy_perform( transfer->handle ));
+        return bdgr_no_err;
+    }
+
+    pthread_mutex_lock( &bdgr_g_http.lock );
+    transfer->next = bdgr_g_http.pending;
+    bdgr_g_http.pending = transfer;
+    pthread_mutex_unlock( &bdgr_g_http.lock );
+    if( write( bdgr_g_http.wake[1], "", 1 ) == -1 ) {
+        /* The pipe is full, so the driver is awake already */
+    }
+    return bdgr_no_err;
+}
+
+/*
+  Asks the driver to take the transfer of lookup off the multi handle and
+  time it out.  Transfers run on the verifying thread are bounded by the
+  deadline already.
+*/
+void bdgr_scheme_http_cancel( bdgr_lookup* const lookup, void* const ctx )
+{
+    struct bdgr_http_transfer* transfer;
+    (void)ctx;
+
+    pthread_mutex_lock( &bdgr_g_http.lock );
+    for( transfer = bdgr_g_http.pending;
+         transfer != NULL && transfer->lookup != lookup;
+         transfer = transfer->next );
+    if( transfer == NULL ) {
+        for( transfer = bdgr_g_http.active;
+             transfer != NULL && transfer->lookup != lookup;
+             transfer = transfer->next );
+    }
+    if( transfer != NULL ) {
+        transfer->cancelled = 1;
+        bdgr_g_http.cancelling = 1;
+    }
+    pthread_mutex_unlock( &bdgr_g_http.lock );
+
+    if( transfer != NULL &&
+        write( bdgr_g_http.wake[1], "", 1 ) == -1 ) {
+        /* The pipe is full, so the driver is awake already */
+    }
+}
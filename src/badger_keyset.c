@@ -0,0 +1,173 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_group.h"
+
+#define BDGR_KEY_SET_INITIAL 64
+
+/*
+  A key is a reference to its interned group and the offset of its y in
+  one flat array, where it is stored left padded to the length of p.  The
+  set releases the groups of its keys when it is freed.
+*/
+struct bdgr_key_set_entry {
+    const struct bdgr_group* group;
+    uint64_t                 y_offset;
+};
+
+struct bdgr_key_set {
+    struct bdgr_key_set_entry* entries;
+    unsigned long int          count;
+    unsigned long int          capacity;
+    unsigned char*             ys;
+    uint64_t                   ys_size;
+    uint64_t                   ys_capacity;
+};
+
+int bdgr_key_set_new( bdgr_key_set** const set )
+{
+    *set = bdgr_calloc( 1, sizeof( bdgr_key_set ));
+    return bdgr_check( *set == NULL, bdgr_malloc_err, __LINE__ );
+}
+
+static int bdgr_key_set_reserve(
+    bdgr_key_set* const set,
+    const unsigned long int y_len
+)
+{
+    struct bdgr_key_set_entry* entries;
+    unsigned char* ys;
+    unsigned long int capacity;
+    uint64_t ys_capacity;
+
+    if( set->count == set->capacity ) {
+        capacity = set->capacity ? set->capacity * 2 : BDGR_KEY_SET_INITIAL;
+        entries = bdgr_realloc( set->entries, capacity * sizeof( *entries ));
+        if( bdgr_check( entries == NULL, bdgr_malloc_err, __LINE__ )) {
+            return bdgr_error();
+        }
+        set->entries = entries;
+        set->capacity = capacity;
+    }
+    if( set->ys_size + y_len > set->ys_capacity ) {
+        ys_capacity = set->ys_capacity ? set->ys_capacity :
+            BDGR_KEY_SET_INITIAL * y_len;
+        while( ys_capacity < set->ys_size + y_len ) {
+            ys_capacity *= 2;
+        }
+        ys = bdgr_realloc( set->ys, ys_capacity );
+        if( bdgr_check( ys == NULL, bdgr_malloc_err, __LINE__ )) {
+            return bdgr_error();
+        }
+        set->ys = ys;
+        set->ys_capacity = ys_capacity;
+    }
+    return bdgr_error();
+}
+
+int bdgr_key_set_add(
+    bdgr_key_set* const set,
+    const bdgr_key* const key,
+    unsigned long int* const index
+)
+{
+    const dsa_key* const dsa = (const dsa_key*)key->_impl;
+    const struct bdgr_group* group;
+    struct bdgr_key_set_entry* entry;
+    unsigned long int y_len;
+
+    group = bdgr_group_intern( dsa );
+    if( group == NULL ) {
+        return bdgr_error();
+    }
+    y_len = mp_unsigned_bin_size( dsa->y );
+    bdgr_check( y_len > group->p_len, bdgr_crypt_err, __LINE__ );
+    if( bdgr_error() || bdgr_key_set_reserve( set, group->p_len )) {
+        bdgr_group_release( group );
+        return bdgr_error();
+    }
+
+    entry = &set->entries[ set->count ];
+    entry->group = group;
+    entry->y_offset = set->ys_size;
+    memset( set->ys + set->ys_size, 0, group->p_len - y_len );
+    bdgr_crypt( mp_to_unsigned_bin(
+                    dsa->y, set->ys + set->ys_size + group->p_len - y_len ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        bdgr_group_release( group );
+        return bdgr_error();
+    }
+    set->ys_size += group->p_len;
+    *index = set->count++;
+    return bdgr_error();
+}
+
+int bdgr_key_set_get(
+    const bdgr_key_set* const set,
+    const unsigned long int index,
+    bdgr_key* const key
+)
+{
+    const struct bdgr_key_set_entry* entry;
+
+    bdgr_check( index >= set->count, bdgr_key_set_index_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    entry = &set->entries[ index ];
+
+    key->_impl = bdgr_malloc( sizeof( dsa_key ));
+    bdgr_check( key->_impl == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    if( bdgr_group_key( entry->group, set->ys + entry->y_offset,
+                        entry->group->p_len, (dsa_key*)key->_impl )) {
+        bdgr_free( key->_impl );
+    }
+    return bdgr_error();
+}
+
+unsigned long int bdgr_key_set_count( const bdgr_key_set* const set )
+{
+    return set->count;
+}
+
+void bdgr_key_set_free( bdgr_key_set* const set )
+{
+    unsigned long int i;
+
+    if( set != NULL ) {
+        /* Every key holds its group */
+        for( i = 0; i < set->count; i++ ) {
+            bdgr_group_release( set->entries[ i ].group );
+        }
+        bdgr_free( set->entries );
+        bdgr_free( set->ys );
+        bdgr_free( set );
+    }
+}
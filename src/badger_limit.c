@@ -0,0 +1,324 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_limit.h"
+#include "badger_scheme.h"
+#include "badger_table.h"
+
+#define BDGR_LIMIT_BADGE      16384
+#define BDGR_LIMIT_TOKEN      4096
+#define BDGR_LIMIT_SIGNATURE  512
+#define BDGR_LIMIT_KEY_BITS   4096
+#define BDGR_LIMIT_BUCKETS    65536
+
+/*
+  Token buckets: a bucket holds up to burst tokens and gains one every
+  interval milliseconds.  A bucket that would be full again is the same
+  as none, so those are swept when the table fills up.  Identities that
+  still find no room share the overflow bucket, so flooding the table with
+  made-up Identity URLs gains nothing over reusing one.
+*/
+struct bdgr_bucket {
+    unsigned long int burst;
+    unsigned long int interval;
+    unsigned long int tokens;
+    uint64_t          stamp;
+};
+
+static struct {
+    unsigned long int  badge;
+    unsigned long int  token;
+    unsigned long int  signature;
+    unsigned long int  key_bits;
+    unsigned long int  identity_burst;
+    unsigned long int  identity_interval;
+    struct bdgr_bucket overflow;
+    bdgr_table         identities;
+    bdgr_table         schemes;
+    pthread_mutex_t    lock;
+} bdgr_g_limit = { BDGR_LIMIT_BADGE, BDGR_LIMIT_TOKEN, BDGR_LIMIT_SIGNATURE,
+                   BDGR_LIMIT_KEY_BITS, 0, 0, { 0, 0, 0, 0 },
+                   { NULL, 0, 0, NULL }, { NULL, 0, 0, NULL },
+                   PTHREAD_MUTEX_INITIALIZER };
+
+int bdgr_badge_limit(
+    const unsigned long int max_size,
+    const unsigned long int max_token_len,
+    const unsigned long int max_signature_len
+)
+{
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    bdgr_g_limit.badge = max_size;
+    bdgr_g_limit.token = max_token_len;
+    bdgr_g_limit.signature = max_signature_len;
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+    return bdgr_check( 0, bdgr_no_err, __LINE__ );
+}
+
+int bdgr_key_limit( const unsigned long int max_bits )
+{
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    bdgr_g_limit.key_bits = max_bits;
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+    return bdgr_check( 0, bdgr_no_err, __LINE__ );
+}
+
+static uint64_t bdgr_limit_now()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void bdgr_bucket_refill(
+    struct bdgr_bucket* const bucket,
+    const uint64_t now
+)
+{
+    const uint64_t earned = ( now - bucket->stamp ) / bucket->interval;
+
+    if( bucket->tokens + earned >= bucket->burst ) {
+        bucket->tokens = bucket->burst;
+        bucket->stamp = now;
+    } else {
+        bucket->tokens += earned;
+        bucket->stamp += earned * bucket->interval;
+    }
+}
+
+static int bdgr_bucket_full( void* const value, void* const now )
+{
+    struct bdgr_bucket* const bucket = value;
+    bdgr_bucket_refill( bucket, *(uint64_t*)now );
+    return bucket->tokens == bucket->burst;
+}
+
+/* Called with the limits locked */
+static int bdgr_bucket_take( struct bdgr_bucket* const bucket )
+{
+    bdgr_bucket_refill( bucket, bdgr_limit_now() );
+    if( !bucket->tokens ) {
+        return 0;
+    }
+    bucket->tokens--;
+    return 1;
+}
+
+static struct bdgr_bucket* bdgr_bucket_new(
+    const unsigned long int burst,
+    const unsigned long int interval
+)
+{
+    struct bdgr_bucket* const bucket = bdgr_malloc( sizeof( *bucket ));
+
+    if( bucket != NULL ) {
+        bucket->burst = burst;
+        bucket->interval = interval;
+        bucket->tokens = burst;
+        bucket->stamp = bdgr_limit_now();
+    }
+    return bucket;
+}
+
+int bdgr_rate_limit_identity(
+    const unsigned long int burst,
+    const unsigned long int interval_ms
+)
+{
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+
+    /* Buckets start over with the new rate */
+    bdgr_table_free( &bdgr_g_limit.identities );
+    bdgr_check( bdgr_table_init( &bdgr_g_limit.identities, 1024, bdgr_free ),
+                bdgr_malloc_err, __LINE__ );
+    bdgr_g_limit.identity_burst = bdgr_error() ? 0 : burst;
+    bdgr_g_limit.identity_interval = interval_ms;
+    bdgr_g_limit.overflow.burst = burst;
+    bdgr_g_limit.overflow.interval = interval_ms;
+    bdgr_g_limit.overflow.tokens = burst;
+    bdgr_g_limit.overflow.stamp = bdgr_limit_now();
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+    return bdgr_error();
+}
+
+int bdgr_rate_limit_scheme(
+    const char* const scheme,
+    const unsigned long int burst,
+    const unsigned long int interval_ms
+)
+{
+    const size_t len = strcspn( scheme, ":" );
+    char key[ BDGR_SCHEME_MAX ];
+    struct bdgr_bucket* bucket = NULL;
+
+    bdgr_check( len == 0 || len >= sizeof( key ),
+                bdgr_unsupported_scheme_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    memcpy( key, scheme, len );
+    key[ len ] = '\0';
+
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    if( bdgr_g_limit.schemes.buckets == NULL ) {
+        bdgr_check( bdgr_table_init( &bdgr_g_limit.schemes, 16, bdgr_free ),
+                    bdgr_malloc_err, __LINE__ );
+    }
+    if( !bdgr_error() ) {
+        if( !burst || !interval_ms ) {
+            bdgr_table_remove( &bdgr_g_limit.schemes, key );
+        } else {
+            bucket = bdgr_bucket_new( burst, interval_ms );
+            bdgr_check( bucket == NULL ||
+                        bdgr_table_put( &bdgr_g_limit.schemes, key, bucket ),
+                        bdgr_malloc_err, __LINE__ );
+            if( bdgr_error() ) {
+                bdgr_free( bucket );
+            }
+        }
+    }
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+    return bdgr_error();
+}
+
+int bdgr_limit_badge( const unsigned long int size )
+{
+    unsigned long int max;
+
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    max = bdgr_g_limit.badge;
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+    return bdgr_check( max && size > max, bdgr_badge_too_large_err, __LINE__ );
+}
+
+int bdgr_limit_token(
+    unsigned long int token_len,
+    unsigned long int signature_len,
+    const int encoded
+)
+{
+    unsigned long int token, signature;
+
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    token = bdgr_g_limit.token;
+    signature = bdgr_g_limit.signature;
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+
+    /* Every four characters of base64 decode to at most three bytes */
+    if( encoded ) {
+        token_len = token_len / 4 * 3;
+        signature_len = signature_len / 4 * 3;
+    }
+    if( bdgr_check( token && token_len > token,
+                    bdgr_token_too_large_err, __LINE__ )) {
+        return bdgr_error();
+    }
+    return bdgr_check( signature && signature_len > signature,
+                       bdgr_signature_too_large_err, __LINE__ );
+}
+
+int bdgr_limit_key_encoded( const unsigned long int len )
+{
+    unsigned long int bits;
+
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    bits = bdgr_g_limit.key_bits;
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+
+    /*
+      p, g and y each take at most as many bytes as the modulus, q fewer,
+      plus a little DER framing around them.
+    */
+    return bdgr_check( bits && len / 4 * 3 > bits / 8 * 4 + 64,
+                       bdgr_key_too_large_err, __LINE__ );
+}
+
+int bdgr_limit_key( dsa_key* const key )
+{
+    unsigned long int bits;
+
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    bits = bdgr_g_limit.key_bits;
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+    return bdgr_check( bits && (unsigned long int)mp_count_bits( key->p ) > bits,
+                       bdgr_key_too_large_err, __LINE__ );
+}
+
+int bdgr_limit_identity( const char* const id )
+{
+    struct bdgr_bucket* bucket;
+    uint64_t now;
+    int limited = 0;
+
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    if( !bdgr_g_limit.identity_burst || !bdgr_g_limit.identity_interval ) {
+        goto bdgr_limit_identity_unlock;
+    }
+    bucket = bdgr_table_get( &bdgr_g_limit.identities, id );
+    if( bucket == NULL ) {
+        if( bdgr_g_limit.identities.count >= BDGR_LIMIT_BUCKETS ) {
+            now = bdgr_limit_now();
+            bdgr_table_sweep( &bdgr_g_limit.identities,
+                              bdgr_bucket_full, &now );
+        }
+
+        /* Out of room, charge the bucket shared by all that found none */
+        if( bdgr_g_limit.identities.count < BDGR_LIMIT_BUCKETS ) {
+            bucket = bdgr_bucket_new( bdgr_g_limit.identity_burst,
+                                      bdgr_g_limit.identity_interval );
+            if( bucket != NULL &&
+                bdgr_table_put( &bdgr_g_limit.identities, id, bucket )) {
+                bdgr_free( bucket );
+                bucket = NULL;
+            }
+        }
+        if( bucket == NULL ) {
+            bucket = &bdgr_g_limit.overflow;
+        }
+    }
+    limited = !bdgr_bucket_take( bucket );
+
+ bdgr_limit_identity_unlock:
+
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+    return bdgr_check( limited, bdgr_rate_limited_err, __LINE__ );
+}
+
+int bdgr_limit_scheme( const char* const scheme )
+{
+    struct bdgr_bucket* bucket;
+    int limited = 0;
+
+    pthread_mutex_lock( &bdgr_g_limit.lock );
+    if( bdgr_g_limit.schemes.buckets != NULL ) {
+        bucket = bdgr_table_get( &bdgr_g_limit.schemes, scheme );
+        limited = bucket != NULL && !bdgr_bucket_take( bucket );
+    }
+    pthread_mutex_unlock( &bdgr_g_limit.lock );
+    return bdgr_check( limited, bdgr_rate_limited_err, __LINE__ );
+}
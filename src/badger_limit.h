@@ -0,0 +1,55 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_LIMIT_H
+#define BADGER_LIMIT_H
+
+#include <tomcrypt.h>
+
+/* Checks the size of a badge before it is parsed */
+int bdgr_limit_badge( unsigned long int size );
+
+/*
+  Checks the token and signature of a badge, given either their decoded
+  lengths or, with encoded set, those of their base64 encodings.
+*/
+int bdgr_limit_token(
+    unsigned long int token_len,
+    unsigned long int signature_len,
+    int encoded
+);
+
+/* Checks a base64-encoded key before it is decoded */
+int bdgr_limit_key_encoded( unsigned long int len );
+
+/* Checks the modulus of a decoded key before it is validated */
+int bdgr_limit_key( dsa_key* key );
+
+/*
+  Takes a token from the bucket of an Identity URL before its key is
+  fetched.  A badge whose key is cached is never charged, so forged badges
+  can't lock the identity they claim out of verifications that need no
+  fetch.
+*/
+int bdgr_limit_identity( const char* id );
+
+/* Takes a token from the bucket of scheme before a record is fetched */
+int bdgr_limit_scheme( const char* scheme );
+
+#endif
@@ -0,0 +1,237 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "badger_err.h"
+#include "badger_math.h"
+#include "badger_scheme.h"
+
+#define BDGR_MATH_ENV    "BADGER_MATH"
+#define BDGR_MATH_AUTO   "auto"
+#define BDGR_MATH_ROUNDS 16
+
+#ifdef BDGR_MATH_GMP
+extern ltc_math_descriptor gmp_desc;
+#endif
+#ifdef BDGR_MATH_LTM
+extern ltc_math_descriptor ltm_desc;
+#endif
+#ifdef BDGR_MATH_TFM
+extern ltc_math_descriptor tfm_desc;
+#endif
+
+/* The backends LibTomCrypt was built with, the first being the default */
+static const struct bdgr_math_backend {
+    const char*                name;
+    const ltc_math_descriptor* desc;
+} bdgr_math_backends[] = {
+#ifdef BDGR_MATH_GMP
+    { "gmp", &gmp_desc },
+#endif
+#ifdef BDGR_MATH_LTM
+    { "ltm", &ltm_desc },
+#endif
+#ifdef BDGR_MATH_TFM
+    { "tfm", &tfm_desc },
+#endif
+    { NULL, NULL }
+};
+
+/*
+  Keys hold numbers in the representation of the backend that made them, so
+  the backend is fixed for good once bdgr_init() has installed it.
+*/
+static struct {
+    const struct bdgr_math_backend* backend;
+    int                             autotune;
+    int                             in_use;
+    pthread_mutex_t                 lock;
+} bdgr_g_math = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static const struct bdgr_math_backend* bdgr_math_find( const char* const name )
+{
+    const struct bdgr_math_backend* backend;
+
+    for( backend = bdgr_math_backends; backend->name != NULL; backend++ ) {
+        if( strcmp( backend->name, name ) == 0 ) {
+            return backend;
+        }
+    }
+    return NULL;
+}
+
+/* Takes effect unless the backend is in use already, call with the lock */
+static int bdgr_math_choose( const char* const name )
+{
+    const struct bdgr_math_backend* backend = NULL;
+    const int autotune = strcmp( name, BDGR_MATH_AUTO ) == 0;
+
+    if( !autotune ) {
+        backend = bdgr_math_find( name );
+        if( bdgr_check( backend == NULL,
+                        bdgr_math_unavailable_err, __LINE__ )) {
+            return bdgr_error();
+        }
+    }
+    bdgr_g_math.backend = backend;
+    bdgr_g_math.autotune = autotune;
+    return bdgr_error();
+}
+
+/*
+  Times the arithmetic of dsa_verify_hash() with a 1024-bit p and a 160-bit
+  q: an inverse and two products mod q, then two exponentiations, a product
+  and a reduction mod p.  Signatures in such groups are checked and made in
+  the fixed width kernel of badger_mont.c whatever the backend, so this
+  stands for what is left to it: checking the y of a new key, whose
+  exponentiation by q is the same work, key generation, and groups the
+  kernel doesn't take.  Returns nanoseconds, or -1 if the backend failed.
+*/
+static long int bdgr_math_bench( const ltc_math_descriptor* const desc )
+{
+    unsigned char p[ 128 ], q[ 20 ], g[ 128 ], y[ 128 ], s[ 20 ], h[ 20 ];
+    void* mp, * mq, * mg, * my, * ms, * mh, * w, * u1, * u2, * v1, * v2;
+    struct timespec start, end;
+    unsigned long int i;
+    int round, err;
+
+    /* Fixed operands, so every backend does the same work */
+    for( i = 0; i < sizeof( p ); i++ ) {
+        p[ i ] = (unsigned char)( i * 167 + 13 );
+        g[ i ] = (unsigned char)( i * 89 + 7 );
+        y[ i ] = (unsigned char)( i * 53 + 101 );
+    }
+    p[ 0 ] |= 0x80;
+    p[ sizeof( p ) - 1 ] |= 0x01;
+    g[ 0 ] &= 0x7f;
+    y[ 0 ] &= 0x7f;
+
+    /* q = 2^160 - 47, a prime, so s is invertible */
+    memset( q, 0xff, sizeof( q ));
+    q[ sizeof( q ) - 1 ] = 0xd1;
+    for( i = 0; i < sizeof( s ); i++ ) {
+        s[ i ] = (unsigned char)( i * 31 + 3 );
+        h[ i ] = (unsigned char)( i * 71 + 29 );
+    }
+
+    ltc_mp = *desc;
+    if( mp_init_multi( &mp, &mq, &mg, &my, &ms, &mh, &w, &u1, &u2, &v1, &v2,
+                       NULL ) != CRYPT_OK ) {
+        return -1;
+    }
+    err = mp_read_unsigned_bin( mp, p, sizeof( p )) != CRYPT_OK ||
+        mp_read_unsigned_bin( mq, q, sizeof( q )) != CRYPT_OK ||
+        mp_read_unsigned_bin( mg, g, sizeof( g )) != CRYPT_OK ||
+        mp_read_unsigned_bin( my, y, sizeof( y )) != CRYPT_OK ||
+        mp_read_unsigned_bin( ms, s, sizeof( s )) != CRYPT_OK ||
+        mp_read_unsigned_bin( mh, h, sizeof( h )) != CRYPT_OK;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for( round = 0; round < BDGR_MATH_ROUNDS && !err; round++ ) {
+        err = mp_invmod( ms, mq, w ) != CRYPT_OK ||
+            mp_mulmod( mh, w, mq, u1 ) != CRYPT_OK ||
+            mp_mulmod( ms, w, mq, u2 ) != CRYPT_OK ||
+            mp_exptmod( mg, u1, mp, v1 ) != CRYPT_OK ||
+            mp_exptmod( my, u2, mp, v2 ) != CRYPT_OK ||
+            mp_mulmod( v1, v2, mp, v1 ) != CRYPT_OK ||
+            mp_mod( v1, mq, v2 ) != CRYPT_OK;
+    }
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    mp_clear_multi( mp, mq, mg, my, ms, mh, w, u1, u2, v1, v2, NULL );
+    if( err ) {
+        return -1;
+    }
+    return ( end.tv_sec - start.tv_sec ) * 1000000000L +
+        ( end.tv_nsec - start.tv_nsec );
+}
+
+static const struct bdgr_math_backend* bdgr_math_autotune()
+{
+    const struct bdgr_math_backend* backend, * fastest = NULL;
+    long int elapsed, best = -1;
+
+    for( backend = bdgr_math_backends; backend->name != NULL; backend++ ) {
+        elapsed = bdgr_math_bench( backend->desc );
+        if( elapsed >= 0 && ( best < 0 || elapsed < best )) {
+            best = elapsed;
+            fastest = backend;
+        }
+    }
+    return fastest;
+}
+
+int bdgr_math_init()
+{
+    const char* name;
+
+    pthread_mutex_lock( &bdgr_g_math.lock );
+    bdgr_g_math.in_use = 1;
+    bdgr_check( 0, bdgr_no_err, __LINE__ );
+
+    /* The environment decides what the application left open */
+    name = getenv( BDGR_MATH_ENV );
+    if( bdgr_g_math.backend == NULL && !bdgr_g_math.autotune &&
+        name != NULL && *name != '\0' ) {
+        bdgr_math_choose( name );
+    }
+    if( !bdgr_error() ) {
+        if( bdgr_g_math.autotune ) {
+            bdgr_g_math.backend = bdgr_math_autotune();
+        } else if( bdgr_g_math.backend == NULL &&
+                   bdgr_math_backends[0].name != NULL ) {
+            bdgr_g_math.backend = &bdgr_math_backends[0];
+        }
+        if( !bdgr_check( bdgr_g_math.backend == NULL,
+                         bdgr_math_unavailable_err, __LINE__ )) {
+            ltc_mp = *bdgr_g_math.backend->desc;
+        }
+    }
+
+    pthread_mutex_unlock( &bdgr_g_math.lock );
+    return bdgr_error();
+}
+
+int bdgr_math_set( const char* const name )
+{
+    pthread_mutex_lock( &bdgr_g_math.lock );
+    if( !bdgr_check( bdgr_g_math.in_use, bdgr_math_in_use_err, __LINE__ )) {
+        bdgr_math_choose( name );
+    }
+    pthread_mutex_unlock( &bdgr_g_math.lock );
+    return bdgr_error();
+}
+
+const char* bdgr_math_name()
+{
+    const char* name;
+
+    if( bdgr_init() ) {
+        return NULL;
+    }
+    pthread_mutex_lock( &bdgr_g_math.lock );
+    name = bdgr_g_math.backend->name;
+    pthread_mutex_unlock( &bdgr_g_math.lock );
+    return name;
+}
@@ -0,0 +1,29 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_MATH_H
+#define BADGER_MATH_H
+
+/*
+  Installs the bignum backend chosen with bdgr_math_set() or BADGER_MATH in
+  ltc_mp.  Called once by bdgr_init(), after which the choice is final.
+*/
+int bdgr_math_init();
+
+#endif
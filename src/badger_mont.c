@@ -0,0 +1,412 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include "badger_mont.h"
+
+/* Window width of the exponentiations and the size of their tables */
+#define BDGR_MONT_WINDOW     4
+#define BDGR_MONT_TABLE_SIZE ( 1 << BDGR_MONT_WINDOW )
+
+int bdgr_mont_read(
+    uint32_t* const a,
+    const int n,
+    const unsigned char* const in,
+    const unsigned long int len
+)
+{
+    unsigned long int i;
+    unsigned char c;
+
+    memset( a, 0, n * sizeof( *a ));
+    for( i = 0; i < len; i++ ) {
+        c = in[ len - 1 - i ];
+        if( i / 4 < (unsigned long int)n ) {
+            a[ i / 4 ] |= (uint32_t)c << ( 8 * ( i % 4 ));
+        } else if( c ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void bdgr_mont_write(
+    const uint32_t* const a,
+    const int n,
+    unsigned char* const out,
+    const unsigned long int len
+)
+{
+    unsigned long int i;
+
+    for( i = 0; i < len; i++ ) {
+        out[ len - 1 - i ] = i / 4 < (unsigned long int)n ?
+            (unsigned char)( a[ i / 4 ] >> ( 8 * ( i % 4 ))) : 0;
+    }
+}
+
+int bdgr_mont_cmp( const uint32_t* const a, const uint32_t* const b, const int n )
+{
+    int i;
+
+    for( i = n - 1; i >= 0; i-- ) {
+        if( a[ i ] != b[ i ] ) {
+            return a[ i ] < b[ i ] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+int bdgr_mont_is_zero( const uint32_t* const a, const int n )
+{
+    uint32_t bits = 0;
+    int i;
+
+    for( i = 0; i < n; i++ ) {
+        bits |= a[ i ];
+    }
+    return bits == 0;
+}
+
+/*
+  out = t - m if t, with top as its extra limb, is at least m, and t
+  otherwise.  Branch free, since t may depend on a secret exponent.
+*/
+static inline void bdgr_mont_fold(
+    uint32_t* const out,
+    const uint32_t* const t,
+    const uint32_t* const m,
+    const int n,
+    const uint32_t top
+)
+{
+    uint32_t d[ BDGR_MONT_MAX_LIMBS ];
+    uint32_t borrow = 0, mask;
+    uint64_t diff;
+    int i;
+
+    for( i = 0; i < n; i++ ) {
+        diff = (uint64_t)t[ i ] - m[ i ] - borrow;
+        d[ i ] = (uint32_t)diff;
+        borrow = (uint32_t)( diff >> 32 ) & 1;
+    }
+    mask = (uint32_t)0 - ( top | ( borrow ^ 1 ));
+    for( i = 0; i < n; i++ ) {
+        out[ i ] = ( d[ i ] & mask ) | ( t[ i ] & ~mask );
+    }
+}
+
+/*
+  Coarsely integrated operand scanning: each limb of b is multiplied in
+  and one limb reduced away in the same pass, so t never grows past n + 2
+  limbs.  Every caller passes n as a constant, which lets the compiler lay
+  out and unroll the loops of each size on their own.
+*/
+static inline void bdgr_mont_mul_n(
+    const bdgr_mont* const ctx,
+    uint32_t* const out,
+    const uint32_t* const a,
+    const uint32_t* const b,
+    const int n
+)
+{
+    uint32_t t[ BDGR_MONT_MAX_LIMBS + 2 ];
+    uint32_t carry, u;
+    uint64_t sum;
+    int i, j;
+
+    memset( t, 0, ( n + 2 ) * sizeof( *t ));
+    for( i = 0; i < n; i++ ) {
+        carry = 0;
+        for( j = 0; j < n; j++ ) {
+            sum = (uint64_t)a[ j ] * b[ i ] + t[ j ] + carry;
+            t[ j ] = (uint32_t)sum;
+            carry = (uint32_t)( sum >> 32 );
+        }
+        sum = (uint64_t)t[ n ] + carry;
+        t[ n ] = (uint32_t)sum;
+        t[ n + 1 ] = (uint32_t)( sum >> 32 );
+
+        /* Adding u * m clears the low limb, which is then shifted out */
+        u = t[ 0 ] * ctx->m0;
+        sum = (uint64_t)u * ctx->m[ 0 ] + t[ 0 ];
+        carry = (uint32_t)( sum >> 32 );
+        for( j = 1; j < n; j++ ) {
+            sum = (uint64_t)u * ctx->m[ j ] + t[ j ] + carry;
+            t[ j - 1 ] = (uint32_t)sum;
+            carry = (uint32_t)( sum >> 32 );
+        }
+        sum = (uint64_t)t[ n ] + carry;
+        t[ n - 1 ] = (uint32_t)sum;
+        t[ n ] = t[ n + 1 ] + (uint32_t)( sum >> 32 );
+    }
+
+    /* t < 2m, so one subtraction at most brings it under m */
+    bdgr_mont_fold( out, t, ctx->m, n, t[ n ] );
+}
+
+void bdgr_mont_mul(
+    const bdgr_mont* const ctx,
+    uint32_t* const out,
+    const uint32_t* const a,
+    const uint32_t* const b
+)
+{
+    switch( ctx->n ) {
+    case BDGR_MONT_P_LIMBS:
+        bdgr_mont_mul_n( ctx, out, a, b, BDGR_MONT_P_LIMBS );
+        break;
+    case BDGR_MONT_Q_LIMBS:
+        bdgr_mont_mul_n( ctx, out, a, b, BDGR_MONT_Q_LIMBS );
+        break;
+    default:
+        bdgr_mont_mul_n( ctx, out, a, b, ctx->n );
+    }
+}
+
+/* out = a + b mod m, for a, b < m */
+static void bdgr_mont_add(
+    const bdgr_mont* const ctx,
+    uint32_t* const out,
+    const uint32_t* const a,
+    const uint32_t* const b
+)
+{
+    uint32_t t[ BDGR_MONT_MAX_LIMBS ];
+    uint64_t sum = 0;
+    int i;
+
+    for( i = 0; i < ctx->n; i++ ) {
+        sum = (uint64_t)a[ i ] + b[ i ] + ( sum >> 32 );
+        t[ i ] = (uint32_t)sum;
+    }
+    bdgr_mont_fold( out, t, ctx->m, ctx->n, (uint32_t)( sum >> 32 ));
+}
+
+/* Into Montgomery form, for a < R */
+static void bdgr_mont_to(
+    const bdgr_mont* const ctx,
+    uint32_t* const out,
+    const uint32_t* const a
+)
+{
+    bdgr_mont_mul( ctx, out, a, ctx->rr );
+}
+
+/* Out of Montgomery form */
+static void bdgr_mont_from(
+    const bdgr_mont* const ctx,
+    uint32_t* const out,
+    const uint32_t* const a
+)
+{
+    uint32_t one[ BDGR_MONT_MAX_LIMBS ];
+
+    memset( one, 0, ctx->n * sizeof( *one ));
+    one[ 0 ] = 1;
+    bdgr_mont_mul( ctx, out, a, one );
+}
+
+int bdgr_mont_init(
+    bdgr_mont* const ctx,
+    const unsigned char* const m,
+    const unsigned long int m_len,
+    const int n
+)
+{
+    uint32_t x[ BDGR_MONT_MAX_LIMBS ];
+    uint32_t inv;
+    int bits, i, j, s;
+
+    if( n <= 0 || n > BDGR_MONT_MAX_LIMBS ||
+        !bdgr_mont_read( ctx->m, n, m, m_len ) || !( ctx->m[ 0 ] & 1 )) {
+        return 0;
+    }
+    ctx->n = n;
+
+    /* -1/m mod 2^32 by Newton's method, each step doubling the good bits */
+    inv = ctx->m[ 0 ];
+    for( i = 0; i < 4; i++ ) {
+        inv *= 2 - ctx->m[ 0 ] * inv;
+    }
+    ctx->m0 = (uint32_t)0 - inv;
+
+    for( bits = 32 * n; !( ctx->m[ ( bits - 1 ) / 32 ] >>
+                           (( bits - 1 ) % 32 ) & 1 ); bits-- ) {
+    }
+    if( bits < 2 ) {
+        return 0;
+    }
+
+    /* R mod m, doubling up from the power of two just below m */
+    memset( x, 0, n * sizeof( *x ));
+    x[ ( bits - 1 ) / 32 ] = (uint32_t)1 << (( bits - 1 ) % 32 );
+    for( i = bits - 1; i < 32 * n; i++ ) {
+        bdgr_mont_add( ctx, x, x, x );
+    }
+
+    /*
+      R mod m is 1 in Montgomery form, so doubling it j times and squaring
+      it s times, with j * 2^s = 32n, leaves R in Montgomery form: R^2 mod m.
+    */
+    for( j = 32 * n, s = 0; !( j & 1 ); j >>= 1, s++ ) {
+    }
+    for( i = 0; i < j; i++ ) {
+        bdgr_mont_add( ctx, x, x, x );
+    }
+    for( i = 0; i < s; i++ ) {
+        bdgr_mont_mul( ctx, x, x, x );
+    }
+    memcpy( ctx->rr, x, n * sizeof( *x ));
+    return 1;
+}
+
+void bdgr_mont_exp(
+    const bdgr_mont* const ctx,
+    uint32_t* const out,
+    const uint32_t* const base,
+    const unsigned char* const e,
+    const unsigned long int e_len
+)
+{
+    uint32_t table[ BDGR_MONT_TABLE_SIZE ][ BDGR_MONT_MAX_LIMBS ];
+    uint32_t acc[ BDGR_MONT_MAX_LIMBS ], entry[ BDGR_MONT_MAX_LIMBS ];
+    const int n = ctx->n;
+    unsigned long int i;
+    unsigned int digit, d;
+    uint32_t mask;
+    int w, k, l;
+
+    /* table[d] = base^d in Montgomery form */
+    memset( table[ 0 ], 0, n * sizeof( *table[ 0 ] ));
+    table[ 0 ][ 0 ] = 1;
+    bdgr_mont_to( ctx, table[ 0 ], table[ 0 ] );
+    bdgr_mont_to( ctx, table[ 1 ], base );
+    for( d = 2; d < BDGR_MONT_TABLE_SIZE; d++ ) {
+        bdgr_mont_mul( ctx, table[ d ], table[ d - 1 ], table[ 1 ] );
+    }
+
+    /* Fixed windows: the same squarings and multiplications for any e */
+    memcpy( acc, table[ 0 ], n * sizeof( *acc ));
+    for( i = 0; i < e_len; i++ ) {
+        for( w = 8 - BDGR_MONT_WINDOW; w >= 0; w -= BDGR_MONT_WINDOW ) {
+            digit = ( e[ i ] >> w ) & ( BDGR_MONT_TABLE_SIZE - 1 );
+            for( k = 0; k < BDGR_MONT_WINDOW; k++ ) {
+                bdgr_mont_mul( ctx, acc, acc, acc );
+            }
+
+            /* Every entry is read, so the digit leaves no trace in caches */
+            memset( entry, 0, n * sizeof( *entry ));
+            for( d = 0; d < BDGR_MONT_TABLE_SIZE; d++ ) {
+                mask = (uint32_t)0 - ((( d ^ digit ) - 1 ) >> 31 );
+                for( l = 0; l < n; l++ ) {
+                    entry[ l ] |= table[ d ][ l ] & mask;
+                }
+            }
+            bdgr_mont_mul( ctx, acc, acc, entry );
+        }
+    }
+    bdgr_mont_from( ctx, out, acc );
+
+    memset( table, 0, sizeof( table ));
+    memset( acc, 0, sizeof( acc ));
+    memset( entry, 0, sizeof( entry ));
+}
+
+void bdgr_mont_exp2(
+    const bdgr_mont* const ctx,
+    uint32_t* const out,
+    const uint32_t* const g,
+    const unsigned char* const a,
+    const uint32_t* const y,
+    const unsigned char* const b,
+    const unsigned long int len
+)
+{
+    uint32_t table_g[ BDGR_MONT_TABLE_SIZE ][ BDGR_MONT_MAX_LIMBS ];
+    uint32_t table_y[ BDGR_MONT_TABLE_SIZE ][ BDGR_MONT_MAX_LIMBS ];
+    uint32_t acc[ BDGR_MONT_MAX_LIMBS ];
+    const int n = ctx->n;
+    unsigned long int i;
+    unsigned int digit_a, digit_b, d;
+    int w, k, started = 0;
+
+    bdgr_mont_to( ctx, table_g[ 1 ], g );
+    bdgr_mont_to( ctx, table_y[ 1 ], y );
+    for( d = 2; d < BDGR_MONT_TABLE_SIZE; d++ ) {
+        bdgr_mont_mul( ctx, table_g[ d ], table_g[ d - 1 ], table_g[ 1 ] );
+        bdgr_mont_mul( ctx, table_y[ d ], table_y[ d - 1 ], table_y[ 1 ] );
+    }
+
+    /* Straus/Shamir: one run of squarings serves both exponents */
+    for( i = 0; i < len; i++ ) {
+        for( w = 8 - BDGR_MONT_WINDOW; w >= 0; w -= BDGR_MONT_WINDOW ) {
+            digit_a = ( a[ i ] >> w ) & ( BDGR_MONT_TABLE_SIZE - 1 );
+            digit_b = ( b[ i ] >> w ) & ( BDGR_MONT_TABLE_SIZE - 1 );
+            for( k = 0; started && k < BDGR_MONT_WINDOW; k++ ) {
+                bdgr_mont_mul( ctx, acc, acc, acc );
+            }
+            if( digit_a && started ) {
+                bdgr_mont_mul( ctx, acc, acc, table_g[ digit_a ] );
+            } else if( digit_a ) {
+                memcpy( acc, table_g[ digit_a ], n * sizeof( *acc ));
+                started = 1;
+            }
+            if( digit_b && started ) {
+                bdgr_mont_mul( ctx, acc, acc, table_y[ digit_b ] );
+            } else if( digit_b ) {
+                memcpy( acc, table_y[ digit_b ], n * sizeof( *acc ));
+                started = 1;
+            }
+        }
+    }
+
+    /* Out of Montgomery form, or 1 if both exponents were 0 */
+    if( !started ) {
+        memset( out, 0, n * sizeof( *out ));
+        out[ 0 ] = 1;
+    } else {
+        bdgr_mont_from( ctx, out, acc );
+    }
+}
+
+void bdgr_mont_reduce(
+    const bdgr_mont* const ctx,
+    uint32_t* const out,
+    const uint32_t* const a,
+    const int a_n
+)
+{
+    uint32_t acc[ BDGR_MONT_MAX_LIMBS ], chunk[ BDGR_MONT_MAX_LIMBS ];
+    const int n = ctx->n;
+    int c, i;
+
+    /* Horner's rule over chunks of n limbs, in Montgomery form throughout */
+    memset( acc, 0, n * sizeof( *acc ));
+    for( c = ( a_n - 1 ) / n; c >= 0; c-- ) {
+        for( i = 0; i < n; i++ ) {
+            chunk[ i ] = c * n + i < a_n ? a[ c * n + i ] : 0;
+        }
+        bdgr_mont_mul( ctx, acc, acc, ctx->rr );
+        bdgr_mont_to( ctx, chunk, chunk );
+        bdgr_mont_add( ctx, acc, acc, chunk );
+    }
+    bdgr_mont_from( ctx, out, acc );
+}
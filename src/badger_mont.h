@@ -0,0 +1,118 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_MONT_H
+#define BADGER_MONT_H
+
+#include <stdint.h>
+
+/*
+  Fixed width Montgomery arithmetic for the groups Badger makes its keys
+  in, a 1024 bit p and a 160 bit q.  Numbers are arrays of little endian
+  32 bit limbs on the stack, R is 2^(32n) for a modulus of n limbs, and
+  nothing is ever allocated.
+*/
+#define BDGR_MONT_P_LIMBS   32
+#define BDGR_MONT_Q_LIMBS   5
+#define BDGR_MONT_MAX_LIMBS BDGR_MONT_P_LIMBS
+
+typedef struct {
+    int      n;
+    uint32_t m[ BDGR_MONT_MAX_LIMBS ];
+    uint32_t rr[ BDGR_MONT_MAX_LIMBS ];
+    uint32_t m0;
+} bdgr_mont;
+
+/*
+  Reads len big endian bytes into n limbs.  Returns 0 if they don't fit.
+*/
+int bdgr_mont_read(
+    uint32_t* a,
+    int n,
+    const unsigned char* in,
+    unsigned long int len
+);
+
+/* Writes n limbs as len big endian bytes, dropping what doesn't fit */
+void bdgr_mont_write(
+    const uint32_t* a,
+    int n,
+    unsigned char* out,
+    unsigned long int len
+);
+
+/* Compares two numbers of n limbs, returning -1, 0 or 1 */
+int bdgr_mont_cmp( const uint32_t* a, const uint32_t* b, int n );
+
+int bdgr_mont_is_zero( const uint32_t* a, int n );
+
+/*
+  Sets ctx up for the odd modulus in m, of at most n limbs.  Returns 0 if
+  the modulus is even or doesn't fit.
+*/
+int bdgr_mont_init(
+    bdgr_mont* ctx,
+    const unsigned char* m,
+    unsigned long int m_len,
+    int n
+);
+
+/* out = a * b / R mod m, for a < R and b < m */
+void bdgr_mont_mul(
+    const bdgr_mont* ctx,
+    uint32_t* out,
+    const uint32_t* a,
+    const uint32_t* b
+);
+
+/*
+  out = base^e mod m for base < m, e being e_len big endian bytes.  The
+  time taken depends on e_len only, never on the value of e.
+*/
+void bdgr_mont_exp(
+    const bdgr_mont* ctx,
+    uint32_t* out,
+    const uint32_t* base,
+    const unsigned char* e,
+    unsigned long int e_len
+);
+
+/*
+  out = g^a * y^b mod m for g, y < m, a and b being len big endian bytes.
+  For public exponents only.
+*/
+void bdgr_mont_exp2(
+    const bdgr_mont* ctx,
+    uint32_t* out,
+    const uint32_t* g,
+    const unsigned char* a,
+    const uint32_t* y,
+    const unsigned char* b,
+    unsigned long int len
+);
+
+/* out = a mod m, a being a_n limbs of any size */
+void bdgr_mont_reduce(
+    const bdgr_mont* ctx,
+    uint32_t* out,
+    const uint32_t* a,
+    int a_n
+);
+
+#endif
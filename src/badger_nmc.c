@@ -0,0 +1,686 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <jansson.h>
+#include <curl/curl.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_scheme.h"
+#include "badger_table.h"
+
+#define BDGR_NMC_SCAN_PAGE 500
+#define BDGR_NMC_RPC_ENV   "BADGER_NMC_RPC"
+
+static struct {
+    pthread_once_t once;
+    char url[1024];
+} bdgr_g_nmc_rpc = { PTHREAD_ONCE_INIT, "" };
+
+/* Copies val into setting when name matches and val fits */
+static void bdgr_nmc_conf_set(
+    const char* const name,
+    const char* const val,
+    const char* const key,
+    char* const setting,
+    const size_t size
+)
+{
+    if( !strcmp( key, name ) && strlen( val ) < size ) {
+        strcpy( setting, val );
+    }
+}
+
+/*
+  Sets the rpc url from the environment or bitcoin.conf.  A url that does
+  not fit is left empty, which fails every call.
+*/
+static void bdgr_nmc_rpc_server_init()
+{
+    const char* const env = getenv( BDGR_NMC_RPC_ENV );
+    struct passwd* pw;
+    char conf_path[1024], * line = NULL, * pos, * end;
+    char rpcport[16] = "8336", rpcconnect[256] = "127.0.0.1";
+    char rpcuser[256] = "", rpcpass[256] = "";
+    size_t len = 0;
+    FILE* conf = NULL;
+    int n;
+
+    if( env != NULL ) {
+        if( strlen( env ) < sizeof( bdgr_g_nmc_rpc.url )) {
+            strcpy( bdgr_g_nmc_rpc.url, env );
+        }
+        return;
+    }
+
+    /* Parse out rpc connection details from bitcoin.conf */
+    pw = getpwuid( getuid() );
+    if( pw != NULL ) {
+        n = snprintf( conf_path, sizeof( conf_path ),
+                      "%s/.namecoin/bitcoin.conf", pw->pw_dir );
+        if( n > 0 && (size_t)n < sizeof( conf_path )) {
+            conf = fopen( conf_path, "r" );
+        }
+    }
+    if( conf != NULL ) {
+        while( getline( &line, &len, conf ) != -1 ) {
+            pos = strchr( line, '=' );
+            if( pos == NULL ) {
+                continue;
+            }
+            *pos++ = '\0';
+            end = pos + strcspn( pos, "\r\n" );
+            *end = '\0';
+            bdgr_nmc_conf_set( line, pos, "rpcport",
+                               rpcport, sizeof( rpcport ));
+            bdgr_nmc_conf_set( line, pos, "rpcconnect",
+                               rpcconnect, sizeof( rpcconnect ));
+            bdgr_nmc_conf_set( line, pos, "rpcuser",
+                               rpcuser, sizeof( rpcuser ));
+            bdgr_nmc_conf_set( line, pos, "rpcpassword",
+                               rpcpass, sizeof( rpcpass ));
+        }
+        free( line );
+        fclose( conf );
+    }
+
+    if( !strlen( rpcuser )) {
+        n = snprintf( bdgr_g_nmc_rpc.url, sizeof( bdgr_g_nmc_rpc.url ),
+                      "http://%s:%s", rpcconnect, rpcport );
+    } else if( !strlen( rpcpass )) {
+        n = snprintf( bdgr_g_nmc_rpc.url, sizeof( bdgr_g_nmc_rpc.url ),
+                      "http://%s@%s:%s", rpcuser, rpcconnect, rpcport );
+    } else {
+        n = snprintf( bdgr_g_nmc_rpc.url, sizeof( bdgr_g_nmc_rpc.url ),
+                      "http://%s:%s@%s:%s",
+                      rpcuser, rpcpass, rpcconnect, rpcport );
+    }
+    if( n < 0 || (size_t)n >= sizeof( bdgr_g_nmc_rpc.url )) {
+        bdgr_g_nmc_rpc.url[0] = '\0';
+    }
+}
+
+static const char* bdgr_nmc_rpc_server()
+{
+    pthread_once( &bdgr_g_nmc_rpc.once, bdgr_nmc_rpc_server_init );
+    return bdgr_g_nmc_rpc.url;
+}
+
+/*
+  Calls \c method on the namecoind RPC server.  \c params is stolen.  On
+  success \c root owns the response and \c result points into it.
+*/
+static int bdgr_nmc_rpc(
+    const char* const method,
+    json_t* const params,
+    json_t** const root,
+    json_t** const result
+)
+{
+    CURL* const handle = curl_easy_init();
+    CURLcode res;
+    char* post_data = NULL;
+    const char* rpc_error;
+    struct curl_slist *headers = NULL;
+    bdgr_buffer buf;
+    json_t* request, * error, * message;
+
+    *root = NULL;
+    buf.data = NULL;
+    buf.size = 0;
+    buf.capacity = 0;
+    buf.error = bdgr_no_err;
+
+    /* make rpc request */
+
+    request = json_pack( "{ssso}", "method", method, "params", params );
+    bdgr_check( request == NULL, bdgr_json_pack_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_rpc_free;
+    }
+    post_data = json_dumps( request, 0 );
+    json_decref( request );
+    bdgr_check( post_data == NULL, bdgr_json_dump_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_rpc_free;
+    }
+    
+    headers = curl_slist_append( headers, "Content-Type: text/plain" );
+    curl_easy_setopt( handle, CURLOPT_URL, bdgr_nmc_rpc_server() );
+    curl_easy_setopt( handle, CURLOPT_HTTPHEADER, headers );
+    curl_easy_setopt( handle, CURLOPT_POSTFIELDS, post_data );
+    curl_easy_setopt( handle, CURLOPT_WRITEFUNCTION, bdgr_record_data );
+    curl_easy_setopt( handle, CURLOPT_WRITEDATA, &buf );
+    bdgr_deadline_curl( handle );
+    res = curl_easy_perform( handle );
+
+    bdgr_check( buf.error != bdgr_no_err, buf.error, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_rpc_free;
+    }
+    if( bdgr_curl_check( res, __LINE__ )) {
+        goto bdgr_nmc_rpc_free;
+    }
+    buf.data = bdgr_realloc( buf.data, buf.size + 1 );
+    bdgr_check( buf.data == NULL, bdgr_realloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_rpc_free;
+    }
+    buf.data[ buf.size++ ] = '\0';
+    
+    *root = json_loads( buf.data, 0, bdgr_json_error() );
+    bdgr_check( *root == NULL,
+                bdgr_json_load_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_rpc_free;
+    }
+    
+    *result = json_object_get( *root, "result" );
+    bdgr_check( *result == NULL,
+                bdgr_json_result_missing_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_rpc_free;
+    }
+    
+    if( json_is_null( *result )) {
+
+        /* Error with RPC call */
+        error = json_object_get( *root, "error" );
+        bdgr_check( error == NULL,
+                    bdgr_json_error_missing_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_nmc_rpc_free;
+        }
+
+        bdgr_check( !json_is_object( error ),
+                    bdgr_json_error_not_object_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_nmc_rpc_free;
+        }
+
+        message = json_object_get( error, "message" );
+        bdgr_check( message == NULL,
+                    bdgr_json_error_message_missing_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_nmc_rpc_free;
+        }
+
+        bdgr_check( !json_is_string( message ),
+                    bdgr_json_error_message_not_string_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_nmc_rpc_free;
+        }
+
+        rpc_error = json_string_value( message );
+        bdgr_check( rpc_error == NULL,
+                    bdgr_json_error_message_err, __LINE__ );
+        if( bdgr_error() ) {
+            goto bdgr_nmc_rpc_free;
+        }
+        
+        bdgr_rpc_error( rpc_error, __LINE__ );
+        goto bdgr_nmc_rpc_free;
+        
+    }
+
+ bdgr_nmc_rpc_free:
+
+    if( headers != NULL ) {
+        curl_slist_free_all( headers );
+    }
+    if( post_data != NULL ) {
+        bdgr_free( post_data );
+    }
+    if( bdgr_error() && *root != NULL ) {
+        json_decref( *root );
+        *root = NULL;
+    }
+    if( buf.data != NULL ) {
+        bdgr_free( buf.data );
+    }
+
+    curl_easy_cleanup( handle );
+
+    return bdgr_error();
+}
+
+/*
+  The mirror holds every name of the id/ namespace and its value in
+  memory.  It is bootstrapped with name_scan and brought up to date with
+  name_filter over the blocks mined since the last poll.  Each stop starts
+  a new generation, and a sync only writes to the generation it began in.
+*/
+static struct {
+    bdgr_table        names;
+    int               active;
+    int               syncing;
+    int               stopping;
+    unsigned long int generation;
+    long int          height;
+    unsigned long int poll_interval;
+    time_t            polled;
+    pthread_mutex_t   lock;
+    pthread_cond_t    idle;
+} bdgr_g_nmc_mirror = { { NULL, 0, 0, NULL }, 0, 0, 0, 0, -1, 0, 0,
+                        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static const char bdgr_nmc_mirror_prefix[] = "id/";
+
+static int bdgr_nmc_mirror_prefixed( const char* const name )
+{
+    return !strncmp( name, bdgr_nmc_mirror_prefix,
+                     sizeof( bdgr_nmc_mirror_prefix ) - 1 );
+}
+
+/* Called with the mirror locked */
+static int bdgr_nmc_mirror_current( const unsigned long int generation )
+{
+    return bdgr_g_nmc_mirror.active &&
+        bdgr_g_nmc_mirror.generation == generation;
+}
+
+/* Called with the mirror locked */
+static int bdgr_nmc_mirror_put(
+    json_t* const entry,
+    const unsigned long int generation
+)
+{
+    json_t* name, * value, * expired;
+    char* copy;
+
+    if( !bdgr_nmc_mirror_current( generation )) {
+        return bdgr_no_err;
+    }
+
+    name = json_object_get( entry, "name" );
+    value = json_object_get( entry, "value" );
+    if( !json_is_string( name ) || !json_is_string( value ) ||
+        !bdgr_nmc_mirror_prefixed( json_string_value( name ))) {
+        return bdgr_no_err;
+    }
+
+    expired = json_object_get( entry, "expired" );
+    if( expired != NULL &&
+        ( json_is_true( expired ) ||
+          ( json_is_integer( expired ) && json_integer_value( expired )))) {
+        bdgr_table_remove( &bdgr_g_nmc_mirror.names,
+                           json_string_value( name ));
+        return bdgr_no_err;
+    }
+
+    copy = bdgr_strdup( json_string_value( value ));
+    bdgr_check( copy == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    bdgr_check( bdgr_table_put( &bdgr_g_nmc_mirror.names,
+                                json_string_value( name ), copy ),
+                bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        bdgr_free( copy );
+    }
+    return bdgr_error();
+}
+
+static int bdgr_nmc_mirror_scan( const unsigned long int generation )
+{
+    json_t* root = NULL, * result, * entry, * name;
+    const char* last;
+    char* start;
+    unsigned long int i, n;
+    int done = 0;
+
+    start = bdgr_strdup( bdgr_nmc_mirror_prefix );
+    bdgr_check( start == NULL, bdgr_malloc_err, __LINE__ );
+
+    while( !bdgr_error() && !done ) {
+
+        bdgr_nmc_rpc( "name_scan",
+                      json_pack( "[si]", start, BDGR_NMC_SCAN_PAGE ),
+                      &root, &result );
+        if( bdgr_error() ) {
+            break;
+        }
+        bdgr_check( !json_is_array( result ),
+                    bdgr_json_result_not_array_err, __LINE__ );
+        if( bdgr_error() ) {
+            break;
+        }
+
+        n = json_array_size( result );
+        last = NULL;
+        pthread_mutex_lock( &bdgr_g_nmc_mirror.lock );
+        /* Stopped meanwhile */
+        done = !bdgr_nmc_mirror_current( generation );
+        for( i = 0; i < n && !done && !bdgr_error(); i++ ) {
+            entry = json_array_get( result, i );
+            name = json_object_get( entry, "name" );
+            if( !json_is_string( name ) ) {
+                continue;
+            }
+            if( !bdgr_nmc_mirror_prefixed( json_string_value( name ))) {
+                /* Names are scanned in order, so id/ is over */
+                done = 1;
+                break;
+            }
+            last = json_string_value( name );
+            bdgr_nmc_mirror_put( entry, generation );
+        }
+        pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+
+        /*
+          The next page starts at the last name of this one, whatever
+          entries without a name come after it.  A full page without a
+          new name can't be got past.
+        */
+        if( !done && !bdgr_error() && n >= BDGR_NMC_SCAN_PAGE &&
+            last != NULL && strcmp( last, start )) {
+            bdgr_free( start );
+            start = bdgr_strdup( last );
+            bdgr_check( start == NULL, bdgr_malloc_err, __LINE__ );
+        } else {
+            done = 1;
+        }
+
+        json_decref( root );
+        root = NULL;
+        
+    }
+
+    if( root != NULL ) {
+        json_decref( root );
+    }
+    bdgr_free( start );
+    return bdgr_error();
+}
+
+/*
+  Brings the mirror of generation up to date from height from, or
+  bootstraps it if from is negative.  The caller has set syncing, which is
+  cleared once the mirror is left alone.
+*/
+static int bdgr_nmc_mirror_update(
+    const unsigned long int generation,
+    const long int from
+)
+{
+    json_t* root, * result;
+    long int height = -1;
+    unsigned long int i;
+
+    bdgr_nmc_rpc( "getblockcount", json_array(), &root, &result );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_mirror_update_done;
+    }
+    if( bdgr_check( !json_is_integer( result ),
+                    bdgr_json_result_not_integer_err, __LINE__ )) {
+        json_decref( root );
+        goto bdgr_nmc_mirror_update_done;
+    }
+    height = json_integer_value( result );
+    json_decref( root );
+
+    if( from < 0 ) {
+        
+        /* Names updated while scanning are caught by the next poll */
+        bdgr_nmc_mirror_scan( generation );
+        
+    } else if( height > from ) {
+
+        bdgr_nmc_rpc( "name_filter",
+                      json_pack( "[si]", "^id/", (int)( height - from + 1 )),
+                      &root, &result );
+        if( bdgr_error() ) {
+            goto bdgr_nmc_mirror_update_done;
+        }
+        bdgr_check( !json_is_array( result ),
+                    bdgr_json_result_not_array_err, __LINE__ );
+        pthread_mutex_lock( &bdgr_g_nmc_mirror.lock );
+        for( i = 0; !bdgr_error() && i < json_array_size( result ); i++ ) {
+            bdgr_nmc_mirror_put( json_array_get( result, i ), generation );
+        }
+        pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+        json_decref( root );
+        
+    }
+
+ bdgr_nmc_mirror_update_done:
+
+    pthread_mutex_lock( &bdgr_g_nmc_mirror.lock );
+    if( !bdgr_error() && bdgr_nmc_mirror_current( generation )) {
+        bdgr_g_nmc_mirror.height = height;
+    }
+    /* A failed poll waits for the next interval too */
+    bdgr_g_nmc_mirror.polled = time( NULL );
+    bdgr_g_nmc_mirror.syncing = 0;
+    pthread_cond_broadcast( &bdgr_g_nmc_mirror.idle );
+    pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+    return bdgr_error();
+}
+
+int bdgr_nmc_mirror_sync()
+{
+    unsigned long int generation;
+    long int from;
+
+    /* Only one thread syncs at a time, lookups carry on meanwhile */
+    pthread_mutex_lock( &bdgr_g_nmc_mirror.lock );
+    bdgr_check( !bdgr_g_nmc_mirror.active || bdgr_g_nmc_mirror.stopping,
+                bdgr_nmc_mirror_inactive_err, __LINE__ );
+    if( bdgr_error() || bdgr_g_nmc_mirror.syncing ) {
+        pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+        return bdgr_error();
+    }
+    bdgr_g_nmc_mirror.syncing = 1;
+    generation = bdgr_g_nmc_mirror.generation;
+    from = bdgr_g_nmc_mirror.height;
+    pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+
+    return bdgr_nmc_mirror_update( generation, from );
+}
+
+int bdgr_nmc_mirror_start( const unsigned long int poll_interval )
+{
+    unsigned long int generation = 0;
+
+    bdgr_nmc_mirror_stop();
+
+    /* Bootstrapped by this thread, before any lookup can start a poll */
+    pthread_mutex_lock( &bdgr_g_nmc_mirror.lock );
+    bdgr_check( bdgr_g_nmc_mirror.active || bdgr_g_nmc_mirror.syncing,
+                bdgr_nmc_mirror_busy_err, __LINE__ );
+    if( !bdgr_error() ) {
+        bdgr_check( bdgr_table_init( &bdgr_g_nmc_mirror.names, 1 << 16,
+                                     bdgr_free ),
+                    bdgr_malloc_err, __LINE__ );
+    }
+    if( !bdgr_error() ) {
+        bdgr_g_nmc_mirror.active = 1;
+        bdgr_g_nmc_mirror.syncing = 1;
+        bdgr_g_nmc_mirror.height = -1;
+        bdgr_g_nmc_mirror.poll_interval = poll_interval;
+        generation = bdgr_g_nmc_mirror.generation;
+    }
+    pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+
+    bdgr_nmc_mirror_update( generation, -1 );
+    if( bdgr_error() ) {
+        bdgr_nmc_mirror_stop();
+    }
+    return bdgr_error();
+}
+
+void bdgr_nmc_mirror_stop()
+{
+    pthread_mutex_lock( &bdgr_g_nmc_mirror.lock );
+
+    /* A sync under way writes no more, and the table outlives it */
+    bdgr_g_nmc_mirror.generation++;
+    bdgr_g_nmc_mirror.stopping++;
+    while( bdgr_g_nmc_mirror.syncing ) {
+        pthread_cond_wait( &bdgr_g_nmc_mirror.idle, &bdgr_g_nmc_mirror.lock );
+    }
+    bdgr_g_nmc_mirror.stopping--;
+
+    if( bdgr_g_nmc_mirror.active ) {
+        bdgr_table_free( &bdgr_g_nmc_mirror.names );
+        bdgr_g_nmc_mirror.active = 0;
+    }
+    pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+}
+
+/*
+  Answers a lookup of \c name from the mirror by writing its record into
+  \c lookup.  Returns 0 when the mirror does not cover \c name and the node
+  has to be asked instead.
+*/
+static int bdgr_nmc_mirror_lookup(
+    const char* const name,
+    bdgr_lookup* const lookup
+)
+{
+    const char* value;
+    int poll;
+
+    if( !bdgr_nmc_mirror_prefixed( name )) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &bdgr_g_nmc_mirror.lock );
+    poll = !bdgr_g_nmc_mirror.syncing &&
+        time( NULL ) - bdgr_g_nmc_mirror.polled >=
+        (time_t)bdgr_g_nmc_mirror.poll_interval;
+    if( !bdgr_g_nmc_mirror.active ) {
+        pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+        return 0;
+    }
+    pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+
+    if( poll ) {
+        /* Keep answering from the mirror if the node is unreachable */
+        bdgr_nmc_mirror_sync();
+    }
+
+    pthread_mutex_lock( &bdgr_g_nmc_mirror.lock );
+    if( !bdgr_g_nmc_mirror.active ) {
+        /* Stopped meanwhile */
+        pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+        return 0;
+    }
+    value = bdgr_table_get( &bdgr_g_nmc_mirror.names, name );
+    bdgr_check( value == NULL, bdgr_nmc_name_missing_err, __LINE__ );
+    if( !bdgr_error() ) {
+        bdgr_check( bdgr_lookup_write( lookup, value, strlen( value )),
+                    lookup->record.error, __LINE__ );
+    }
+    pthread_mutex_unlock( &bdgr_g_nmc_mirror.lock );
+    return 1;
+}
+
+static int bdgr_nmc_name_show(
+    const char* const name,
+    bdgr_lookup* const lookup
+)
+{
+    json_t* root, * result, * value;
+    const char* record;
+    
+    if( bdgr_nmc_mirror_lookup( name, lookup )) {
+        return bdgr_error();
+    }
+
+    bdgr_nmc_rpc( "name_show", json_pack( "[s]", name ), &root, &result );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    
+    bdgr_check( !json_is_object( result ),
+                bdgr_json_result_not_object_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_name_show_free;
+    }
+    
+    value = json_object_get( result, "value" );
+    bdgr_check( value == NULL,
+                bdgr_json_value_missing_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_name_show_free;
+    }
+
+    bdgr_check( !json_is_string( value ),
+                bdgr_json_value_not_string_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_name_show_free;
+    }
+
+    record = json_string_value( value );
+    bdgr_check( record == NULL,
+                bdgr_json_value_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_nmc_name_show_free;
+    }
+
+    /* Copied out before root and the string it holds are released */
+    bdgr_check( bdgr_lookup_write( lookup, record, strlen( record )),
+                lookup->record.error, __LINE__ );
+
+ bdgr_nmc_name_show_free:
+
+    json_decref( root );
+    return bdgr_error();
+
+}
+
+int bdgr_scheme_nmc( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)ctx;
+    bdgr_nmc_name_show( lookup->url + 4, lookup );
+    bdgr_lookup_complete( lookup, bdgr_error() );
+    return bdgr_no_err;
+}
+
+int bdgr_scheme_id( bdgr_lookup* const lookup, void* const ctx )
+{
+    const char* const id = strchr( lookup->url, ':' ) + 1;
+    char* const name = bdgr_malloc( strlen( id ) + 4 );
+    (void)ctx;
+    bdgr_check( name == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_scheme_id_done;
+    }
+    sprintf( name, "id/%s", id );
+    bdgr_nmc_name_show( name, lookup );
+
+ bdgr_scheme_id_done:
+    
+    bdgr_free( name );
+    bdgr_lookup_complete( lookup, bdgr_error() );
+    return bdgr_no_err;
+}
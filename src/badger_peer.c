@@ -0,0 +1,777 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_cache.h"
+#include "badger_peer.h"
+#include "badger_scheme.h"
+
+#define BDGR_PEER_REPLICAS    64
+#define BDGR_PEER_TIMEOUT     5000
+#define BDGR_PEER_CONNECT     250
+#define BDGR_PEER_LINE_MAX    4096
+#define BDGR_PEER_CONNECTIONS 64
+#define BDGR_PEER_KEY_MAX     64
+#define BDGR_PEER_NONCE       16
+#define BDGR_PEER_TAG         16
+#define BDGR_PEER_SCHEMES     8
+
+/*
+  Peer fill: every Identity URL is owned by one node, picked by consistent
+  hashing over BDGR_PEER_REPLICAS points per node, so that adding or
+  removing a node moves only its share of the URLs.  A node missing a key
+  asks the owner before the authority, and the owner answers from its
+  cache, fetching the record itself if it has to.  The protocol is a line
+  each way over TCP:
+
+    GET <nonce> <ms> <url>[ <kid>] <tag>  ->  OK <record> <tag> |
+                                              ERR <code> <tag> | BUSY
+
+  where ms is what is left of the deadline of the asking node, or 0.  The
+  owner answers with a record of its own, {"dsa":"<base64-key>"}, or one
+  listing just that key for a key id, which is imported and cached like
+  any other.  Tags are a truncated HMAC-SHA256 under the key shared by the
+  nodes, over the request, and over its nonce and the reply, so that an
+  answer can't be forged or replayed for another request.  A request
+  without a good tag is hung up on.  Only a node that can't be reached, is
+  busy, doesn't own the URL or answers without a good tag sends the asking
+  node to the authority; an error it got from the authority is passed on
+  as is.
+*/
+struct bdgr_peer_point {
+    uint64_t          hash;
+    unsigned long int peer;
+};
+
+static struct {
+    char**                  peers;
+    unsigned long int       count;
+    struct bdgr_peer_point* ring;
+    long int                self;
+    int                     listening;
+    unsigned long int       answering;
+    unsigned char           key[ BDGR_PEER_KEY_MAX ];
+    unsigned long int       key_len;
+    int                     sha256;
+    char                    schemes[ BDGR_PEER_SCHEMES ][ BDGR_SCHEME_MAX ];
+    unsigned long int       scheme_count;
+    pthread_mutex_t         lock;
+} bdgr_g_peer = { NULL, 0, NULL, -1, 0, 0, { 0 }, 0, -1,
+                  { "http", "https" }, 2, PTHREAD_MUTEX_INITIALIZER };
+
+/* Set on threads answering a peer, which must not ask another in turn */
+static __thread int bdgr_peer_answering = 0;
+
+/* FNV-1a, finished with a mix so that nearby strings land far apart */
+static uint64_t bdgr_peer_hash( const char* const string, const size_t len )
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t i;
+
+    for( i = 0; i < len; i++ ) {
+        hash ^= (unsigned char)string[ i ];
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static int bdgr_peer_point_cmp( const void* const a, const void* const b )
+{
+    const uint64_t x = ((const struct bdgr_peer_point*)a)->hash;
+    const uint64_t y = ((const struct bdgr_peer_point*)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+/* Called with the peers locked */
+static void bdgr_peer_clear()
+{
+    unsigned long int i;
+
+    for( i = 0; i < bdgr_g_peer.count; i++ ) {
+        bdgr_free( bdgr_g_peer.peers[ i ] );
+    }
+    bdgr_free( bdgr_g_peer.peers );
+    bdgr_free( bdgr_g_peer.ring );
+    bdgr_g_peer.peers = NULL;
+    bdgr_g_peer.ring = NULL;
+    bdgr_g_peer.count = 0;
+    bdgr_g_peer.self = -1;
+}
+
+int bdgr_peers_set(
+    const char* const* const peers,
+    const unsigned long int count,
+    const long int self
+)
+{
+    char point[ BDGR_PEER_LINE_MAX ];
+    struct bdgr_peer_point* ring = NULL;
+    char** copies = NULL;
+    unsigned long int i, j, made = 0;
+    int len;
+
+    bdgr_check( self < -1 || ( self >= 0 && (unsigned long int)self >= count ),
+                bdgr_peer_self_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    if( count ) {
+        copies = bdgr_calloc( count, sizeof( char* ));
+        ring = bdgr_malloc( count * BDGR_PEER_REPLICAS * sizeof( *ring ));
+        bdgr_check( copies == NULL || ring == NULL, bdgr_malloc_err, __LINE__ );
+    }
+    for( i = 0; i < count && !bdgr_error(); i++ ) {
+        copies[ i ] = bdgr_strdup( peers[ i ] );
+        bdgr_check( copies[ i ] == NULL, bdgr_malloc_err, __LINE__ );
+        made = i + 1;
+        for( j = 0; j < BDGR_PEER_REPLICAS && !bdgr_error(); j++ ) {
+            len = snprintf( point, sizeof( point ), "%s#%lu", peers[ i ], j );
+            bdgr_check( len < 0 || len >= (int)sizeof( point ),
+                        bdgr_peer_address_err, __LINE__ );
+            ring[ i * BDGR_PEER_REPLICAS + j ].hash =
+                bdgr_peer_hash( point, len );
+            ring[ i * BDGR_PEER_REPLICAS + j ].peer = i;
+        }
+    }
+    if( bdgr_error() ) {
+        for( i = 0; i < made; i++ ) {
+            bdgr_free( copies[ i ] );
+        }
+        bdgr_free( copies );
+        bdgr_free( ring );
+        return bdgr_error();
+    }
+    if( count ) {
+        qsort( ring, count * BDGR_PEER_REPLICAS, sizeof( *ring ),
+               bdgr_peer_point_cmp );
+    }
+
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    bdgr_peer_clear();
+    bdgr_g_peer.peers = copies;
+    bdgr_g_peer.ring = ring;
+    bdgr_g_peer.count = count;
+    bdgr_g_peer.self = self;
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    return bdgr_error();
+}
+
+int bdgr_peer_key_set(
+    const unsigned char* const key,
+    const unsigned long int key_len
+)
+{
+    bdgr_check( key_len < 16 || key_len > BDGR_PEER_KEY_MAX,
+                bdgr_peer_key_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    if( bdgr_g_peer.sha256 == -1 &&
+        !bdgr_check( register_hash( &sha256_desc ) == -1,
+                     bdgr_register_hash_err, __LINE__ )) {
+        bdgr_g_peer.sha256 = find_hash( "sha256" );
+    }
+    if( !bdgr_error() ) {
+        memset( bdgr_g_peer.key, 0, sizeof( bdgr_g_peer.key ));
+        memcpy( bdgr_g_peer.key, key, key_len );
+        bdgr_g_peer.key_len = key_len;
+    }
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    return bdgr_error();
+}
+
+int bdgr_peer_schemes(
+    const char* const* const schemes,
+    const unsigned long int count
+)
+{
+    char copies[ BDGR_PEER_SCHEMES ][ BDGR_SCHEME_MAX ];
+    unsigned long int i;
+    size_t len;
+
+    bdgr_check( count > BDGR_PEER_SCHEMES, bdgr_unsupported_scheme_err,
+                __LINE__ );
+    for( i = 0; i < count && !bdgr_error(); i++ ) {
+        len = strcspn( schemes[ i ], ":" );
+        if( !bdgr_check( len == 0 || len >= BDGR_SCHEME_MAX,
+                         bdgr_unsupported_scheme_err, __LINE__ )) {
+            memcpy( copies[ i ], schemes[ i ], len );
+            copies[ i ][ len ] = '\0';
+        }
+    }
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    memcpy( bdgr_g_peer.schemes, copies, count * BDGR_SCHEME_MAX );
+    bdgr_g_peer.scheme_count = count;
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    return bdgr_error();
+}
+
+static void bdgr_peer_hex(
+    const unsigned char* const data,
+    const unsigned long int len,
+    char* const hex
+)
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned long int i;
+
+    for( i = 0; i < len; i++ ) {
+        hex[ 2 * i ] = digits[ data[ i ] >> 4 ];
+        hex[ 2 * i + 1 ] = digits[ data[ i ] & 15 ];
+    }
+    hex[ 2 * len ] = '\0';
+}
+
+/*
+  The tag of text, after prefix unless NULL, under the peer key.  Fails
+  without a peer key.
+*/
+static int bdgr_peer_tag(
+    const char* const prefix,
+    const char* const text,
+    const size_t len,
+    char* const tag
+)
+{
+    hmac_state hmac;
+    unsigned char mac[ 32 ];
+    unsigned long int mac_len = sizeof( mac );
+    int failed;
+
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    failed = !bdgr_g_peer.key_len ||
+        hmac_init( &hmac, bdgr_g_peer.sha256, bdgr_g_peer.key,
+                   bdgr_g_peer.key_len ) != CRYPT_OK;
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    if( failed ) {
+        return -1;
+    }
+    failed = ( prefix != NULL &&
+               hmac_process( &hmac, (const unsigned char*)prefix,
+                             strlen( prefix )) != CRYPT_OK ) ||
+        hmac_process( &hmac, (const unsigned char*)text, len ) != CRYPT_OK;
+    if( hmac_done( &hmac, mac, &mac_len ) != CRYPT_OK || failed ) {
+        return -1;
+    }
+    bdgr_peer_hex( mac, BDGR_PEER_TAG, tag );
+    return 0;
+}
+
+/*
+  Splits the tag off the end of line, checking it over what is left after
+  prefix unless NULL.  Returns 0 if it holds.
+*/
+static int bdgr_peer_untag( const char* const prefix, char* const line )
+{
+    char tag[ 2 * BDGR_PEER_TAG + 1 ];
+    char* const space = strrchr( line, ' ' );
+
+    if( space == NULL || strlen( space + 1 ) != 2 * BDGR_PEER_TAG ||
+        bdgr_peer_tag( prefix, line, space - line, tag ) ||
+        mem_neq( tag, space + 1, 2 * BDGR_PEER_TAG )) {
+        return -1;
+    }
+    *space = '\0';
+    return 0;
+}
+
+/* Called with the peers locked: the index of the node owning url */
+static unsigned long int bdgr_peer_index(
+    const char* const url,
+    const size_t len
+)
+{
+    const uint64_t hash = bdgr_peer_hash( url, len );
+    unsigned long int lo = 0, hi, mid;
+
+    /* The first point at or after the hash, wrapping around */
+    hi = bdgr_g_peer.count * BDGR_PEER_REPLICAS;
+    while( lo < hi ) {
+        mid = lo + ( hi - lo ) / 2;
+        if( bdgr_g_peer.ring[ mid ].hash < hash ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if( lo == bdgr_g_peer.count * BDGR_PEER_REPLICAS ) {
+        lo = 0;
+    }
+    return bdgr_g_peer.ring[ lo ].peer;
+}
+
+char* bdgr_peer_owner( const char* const url )
+{
+    unsigned long int peer;
+    char* copy = NULL;
+
+    if( bdgr_peer_answering || strpbrk( url, " \r\n" ) != NULL ) {
+        return NULL;
+    }
+
+    /* Without the peer key, no answer could be trusted */
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    if( bdgr_g_peer.count && bdgr_g_peer.key_len ) {
+        peer = bdgr_peer_index( url, strlen( url ));
+        if( bdgr_g_peer.self < 0 ||
+            peer != (unsigned long int)bdgr_g_peer.self ) {
+            copy = bdgr_strdup( bdgr_g_peer.peers[ peer ] );
+        }
+    }
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    return copy;
+}
+
+/*
+  Whether this node answers peers for ref: its URL must be owned by this
+  node and in one of the schemes fetched for peers.
+*/
+static int bdgr_peer_serves( const char* const ref )
+{
+    const size_t len = strcspn( ref, " " );
+    const size_t scheme_len = strcspn( ref, ":" );
+    unsigned long int i;
+    int serves = 0;
+
+    if( scheme_len >= len || strpbrk( ref, "\r\n" ) != NULL ) {
+        return 0;
+    }
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    for( i = 0; i < bdgr_g_peer.scheme_count && !serves; i++ ) {
+        serves = strlen( bdgr_g_peer.schemes[ i ] ) == scheme_len &&
+            !strncmp( bdgr_g_peer.schemes[ i ], ref, scheme_len );
+    }
+    serves = serves && bdgr_g_peer.count && bdgr_g_peer.self >= 0 &&
+        bdgr_peer_index( ref, len ) == (unsigned long int)bdgr_g_peer.self;
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    return serves;
+}
+
+/* Splits host:port, or [host]:port, and resolves it */
+static struct addrinfo* bdgr_peer_resolve(
+    const char* const address,
+    const int passive
+)
+{
+    char host[ 256 ];
+    const char* colon = strrchr( address, ':' );
+    const char* start = address;
+    size_t len;
+    struct addrinfo hints, * info = NULL;
+
+    if( colon == NULL ) {
+        return NULL;
+    }
+    len = colon - address;
+    if( *start == '[' && len >= 2 && start[ len - 1 ] == ']' ) {
+        start++;
+        len -= 2;
+    }
+    if( len >= sizeof( host )) {
+        return NULL;
+    }
+    memcpy( host, start, len );
+    host[ len ] = '\0';
+
+    memset( &hints, 0, sizeof( hints ));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    if( getaddrinfo( len ? host : NULL, colon + 1, &hints, &info )) {
+        return NULL;
+    }
+    return info;
+}
+
+/* Waits for events on fd until the monotonic time until_ms */
+static int bdgr_peer_wait(
+    const int fd,
+    const short events,
+    const int64_t until_ms
+)
+{
+    struct pollfd pfd;
+    struct timespec now;
+    int64_t left;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    left = until_ms - ( (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000 );
+    return left > 0 && poll( &pfd, 1, (int)left ) == 1 &&
+        ( pfd.revents & events );
+}
+
+static int bdgr_peer_connect(
+    const char* const address,
+    const int64_t until_ms
+)
+{
+    struct addrinfo* const info = bdgr_peer_resolve( address, 0 );
+    socklen_t len = sizeof( int );
+    int fd = -1, err = 0;
+
+    if( info == NULL ) {
+        return -1;
+    }
+    fd = socket( info->ai_family, info->ai_socktype | SOCK_CLOEXEC,
+                 info->ai_protocol );
+    if( fd != -1 &&
+        ( fcntl( fd, F_SETFL, O_NONBLOCK ) == -1 ||
+          ( connect( fd, info->ai_addr, info->ai_addrlen ) == -1 &&
+            ( errno != EINPROGRESS ||
+              !bdgr_peer_wait( fd, POLLOUT, until_ms ) ||
+              getsockopt( fd, SOL_SOCKET, SO_ERROR, &err, &len ) == -1 ||
+              err )))) {
+        close( fd );
+        fd = -1;
+    }
+    freeaddrinfo( info );
+    return fd;
+}
+
+/* Reads one line into line, returning its length or -1 */
+static long int bdgr_peer_read_line(
+    const int fd,
+    char* const line,
+    const size_t size,
+    const int64_t until_ms
+)
+{
+    size_t len = 0;
+    ssize_t n;
+    char* end;
+
+    while( len < size - 1 ) {
+        if( until_ms && !bdgr_peer_wait( fd, POLLIN, until_ms )) {
+            return -1;
+        }
+        n = read( fd, line + len, size - 1 - len );
+        if( n <= 0 ) {
+            /* Without until_ms, EAGAIN is the receive timeout */
+            if( n == -1 &&
+                ( errno == EINTR || ( until_ms && errno == EAGAIN ))) {
+                continue;
+            }
+            return -1;
+        }
+        len += n;
+        line[ len ] = '\0';
+        end = strchr( line, '\n' );
+        if( end != NULL ) {
+            *end = '\0';
+            return end - line;
+        }
+    }
+    return -1;
+}
+
+static int bdgr_peer_write( const int fd, const char* data, size_t len )
+{
+    ssize_t n;
+
+    while( len ) {
+        n = send( fd, data, len, MSG_NOSIGNAL );
+        if( n == -1 && errno == EAGAIN ) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            if( poll( &pfd, 1, BDGR_PEER_TIMEOUT ) != 1 ) {
+                return -1;
+            }
+            continue;
+        }
+        if( n <= 0 ) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int bdgr_peer_fill( bdgr_lookup* const lookup )
+{
+    char line[ BDGR_PEER_LINE_MAX ];
+    char nonce[ 2 * BDGR_PEER_NONCE + 1 ], tag[ 2 * BDGR_PEER_TAG + 1 ];
+    unsigned char random[ BDGR_PEER_NONCE ];
+    const long int remaining = bdgr_deadline_remaining_ms();
+    const long int ms = remaining == -1 || remaining > BDGR_PEER_TIMEOUT ?
+        BDGR_PEER_TIMEOUT : remaining;
+    struct timespec now;
+    int64_t until_ms;
+    long int len;
+    int fd, code;
+
+    if( rng_get_bytes( random, sizeof( random ), NULL ) != sizeof( random )) {
+        return 0;
+    }
+    bdgr_peer_hex( random, sizeof( random ), nonce );
+    len = snprintf( line, sizeof( line ), "GET %s %ld %s%s%s", nonce,
+                    remaining == -1 ? 0 : remaining, lookup->url,
+                    lookup->kid != NULL ? " " : "",
+                    lookup->kid != NULL ? lookup->kid : "" );
+    if( len < 0 || len + 2 + 2 * BDGR_PEER_TAG >= (long int)sizeof( line ) ||
+        bdgr_peer_tag( NULL, line, len, tag )) {
+        return 0;
+    }
+    len += sprintf( line + len, " %s\n", tag );
+
+    /* A node that is down is given up on quickly */
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    until_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    fd = bdgr_peer_connect( lookup->peer, until_ms +
+                            ( ms < BDGR_PEER_CONNECT ? ms : BDGR_PEER_CONNECT ));
+    until_ms += ms;
+    if( fd == -1 ) {
+        return 0;
+    }
+    if( bdgr_peer_write( fd, line, len ) ||
+        bdgr_peer_read_line( fd, line, sizeof( line ), until_ms ) == -1 ) {
+        close( fd );
+        return 0;
+    }
+    close( fd );
+
+    /* Only an answer to this request from a node holding the peer key */
+    if( bdgr_peer_untag( nonce, line )) {
+        return 0;
+    }
+    if( !strncmp( line, "ERR ", 4 )) {
+        code = atoi( line + 4 );
+        bdgr_lookup_complete( lookup, code ? code : bdgr_peer_err );
+        return 1;
+    }
+    if( strncmp( line, "OK ", 3 )) {
+        return 0;
+    }
+    bdgr_lookup_write( lookup, line + 3, strlen( line + 3 ));
+    bdgr_lookup_complete( lookup, bdgr_no_err );
+    return 1;
+}
+
+/* Answers one request of a peer from this node's cache or authority */
+static void bdgr_peer_answer( const int fd )
+{
+    char line[ BDGR_PEER_LINE_MAX ], reply[ BDGR_PEER_LINE_MAX ];
+    char nonce[ 2 * BDGR_PEER_NONCE + 1 ], tag[ 2 * BDGR_PEER_TAG + 1 ];
+    char encoded[ BDGR_KEY_EXPORT_MAX / 3 * 4 + 8 ];
+    unsigned char data[ BDGR_KEY_EXPORT_MAX ];
+    unsigned long int data_len = sizeof( data );
+    unsigned long int encoded_len = sizeof( encoded );
+    struct timeval timeout = { BDGR_PEER_TIMEOUT / 1000, 0 };
+    struct timespec deadline;
+    char* ref, * kid, * end;
+    long int ms;
+    int len;
+    bdgr_key key;
+
+    /* Anyone without the peer key is hung up on */
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ));
+    if( bdgr_peer_read_line( fd, line, sizeof( line ), 0 ) == -1 ||
+        strncmp( line, "GET ", 4 ) || bdgr_peer_untag( NULL, line ) ||
+        strspn( line + 4, "0123456789abcdef" ) != 2 * BDGR_PEER_NONCE ||
+        line[ 4 + 2 * BDGR_PEER_NONCE ] != ' ' ) {
+        return;
+    }
+    memcpy( nonce, line + 4, 2 * BDGR_PEER_NONCE );
+    nonce[ 2 * BDGR_PEER_NONCE ] = '\0';
+    ms = strtol( line + 5 + 2 * BDGR_PEER_NONCE, &end, 10 );
+    if( *end != ' ' || ms < 0 ) {
+        return;
+    }
+    ref = end + 1;
+
+    /* Nothing is fetched for a URL another node owns, or in another scheme */
+    if( !bdgr_peer_serves( ref )) {
+        bdgr_peer_write( fd, "BUSY\n", 5 );
+        return;
+    }
+    if( !ms || ms > BDGR_PEER_TIMEOUT ) {
+        ms = BDGR_PEER_TIMEOUT;
+    }
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += ( ms % 1000 ) * 1000000;
+    if( deadline.tv_nsec >= 1000000000 ) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    if( !bdgr_init() && !bdgr_key_find( ref, &deadline, &key )) {
+        bdgr_key_export_public( &key, data, &data_len );
+        bdgr_key_free( &key );
+    }
+    if( !bdgr_error() ) {
+        bdgr_crypt( base64_encode( data, data_len, (unsigned char*)encoded,
+                                   &encoded_len ),
+                    __LINE__ );
+    }
+
+    /* Key ids are plain enough to go into the record as they are */
+    len = 0;
+    if( !bdgr_error() ) {
+        kid = strchr( ref, ' ' );
+        len = kid != NULL ?
+            snprintf( reply, sizeof( reply ),
+                      "OK {\"keys\":[{\"kid\":\"%s\",\"dsa\":\"%s\"}]}",
+                      kid + 1, encoded ) :
+            snprintf( reply, sizeof( reply ), "OK {\"dsa\":\"%s\"}", encoded );
+        bdgr_check( len < 0 ||
+                    len + 2 + 2 * BDGR_PEER_TAG >= (int)sizeof( reply ),
+                    bdgr_peer_err, __LINE__ );
+    }
+    if( bdgr_error() ) {
+        len = snprintf( reply, sizeof( reply ), "ERR %d", bdgr_error() );
+    }
+    if( bdgr_peer_tag( nonce, reply, len, tag )) {
+        return;
+    }
+    len += sprintf( reply + len, " %s\n", tag );
+    bdgr_peer_write( fd, reply, len );
+}
+
+static void* bdgr_peer_connection( void* const _fd )
+{
+    const int fd = (int)(intptr_t)_fd;
+
+    bdgr_peer_answering = 1;
+    bdgr_peer_answer( fd );
+    close( fd );
+
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    bdgr_g_peer.answering--;
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    return NULL;
+}
+
+static void* bdgr_peer_accept( void* const _listener )
+{
+    const int listener = (int)(intptr_t)_listener;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd, busy;
+
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    while( 1 ) {
+        fd = accept( listener, NULL, NULL );
+        if( fd == -1 ) {
+            continue;
+        }
+        pthread_mutex_lock( &bdgr_g_peer.lock );
+        busy = bdgr_g_peer.answering >= BDGR_PEER_CONNECTIONS;
+        if( !busy ) {
+            bdgr_g_peer.answering++;
+        }
+        pthread_mutex_unlock( &bdgr_g_peer.lock );
+
+        if( busy ||
+            pthread_create( &thread, &attr, bdgr_peer_connection,
+                            (void*)(intptr_t)fd )) {
+            if( !busy ) {
+                pthread_mutex_lock( &bdgr_g_peer.lock );
+                bdgr_g_peer.answering--;
+                pthread_mutex_unlock( &bdgr_g_peer.lock );
+            }
+            bdgr_peer_write( fd, "BUSY\n", 5 );
+            close( fd );
+        }
+    }
+    return NULL;
+}
+
+int bdgr_peer_listen( const char* const address )
+{
+    struct addrinfo* const info = bdgr_peer_resolve( address, 1 );
+    pthread_attr_t attr;
+    pthread_t thread;
+    int listener = -1, on = 1;
+
+    bdgr_check( info == NULL, bdgr_peer_address_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_peer_listen_free;
+    }
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    if( !bdgr_check( !bdgr_g_peer.key_len, bdgr_peer_key_err, __LINE__ )) {
+        bdgr_check( bdgr_g_peer.listening, bdgr_peer_listening_err, __LINE__ );
+    }
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    if( bdgr_error() ) {
+        goto bdgr_peer_listen_free;
+    }
+
+    listener = socket( info->ai_family, info->ai_socktype | SOCK_CLOEXEC,
+                       info->ai_protocol );
+    bdgr_check( listener == -1 ||
+                setsockopt( listener, SOL_SOCKET, SO_REUSEADDR,
+                            &on, sizeof( on )) == -1 ||
+                bind( listener, info->ai_addr, info->ai_addrlen ) == -1 ||
+                listen( listener, 128 ) == -1,
+                bdgr_peer_listen_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_peer_listen_free;
+    }
+
+    pthread_attr_init( &attr );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    bdgr_check( pthread_create( &thread, &attr, bdgr_peer_accept,
+                                (void*)(intptr_t)listener ),
+                bdgr_thread_err, __LINE__ );
+    pthread_attr_destroy( &attr );
+    if( bdgr_error() ) {
+        goto bdgr_peer_listen_free;
+    }
+
+    pthread_mutex_lock( &bdgr_g_peer.lock );
+    bdgr_g_peer.listening = 1;
+    pthread_mutex_unlock( &bdgr_g_peer.lock );
+    listener = -1;
+
+ bdgr_peer_listen_free:
+
+    if( listener != -1 ) {
+        close( listener );
+    }
+    if( info != NULL ) {
+        freeaddrinfo( info );
+    }
+    return bdgr_error();
+}
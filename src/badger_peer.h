@@ -0,0 +1,38 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_PEER_H
+#define BADGER_PEER_H
+
+#include "badger_scheme.h"
+
+/*
+  The peer owning url, as a copy to be freed, or NULL if peer fill is off,
+  this node owns it, or the calling thread is answering a peer.
+*/
+char* bdgr_peer_owner( const char* url );
+
+/*
+  Asks the owner of the lookup for its record.  Returns 1 if the lookup
+  was completed, or 0 if the owner couldn't be reached and the lookup is
+  left to its scheme handler.
+*/
+int bdgr_peer_fill( bdgr_lookup* lookup );
+
+#endif
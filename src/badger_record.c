@@ -31,28 +31,40 @@ void usage()
         stderr,
         "Usage: badger_key\n"
         "Options:\n"
-        "-p, --pass  <password>\n"
-        "-k, --key   <base64-dsa-public-key>\n"
+        "-p, --pass        <password>\n"
+        "-k, --key         <base64-dsa-public-key>\n"
+        "-i, --kid         <kid>, list the key under a key id\n"
+        "-b, --not-before  <seconds since the epoch>, for a key with a kid\n"
+        "-e, --expires     <seconds since the epoch>, for a key with a kid\n"
+        "-r, --record      <file>, add the key to an existing record\n"
     );
 }
 
 int main( const int argc, char* const* argv )
 {
     int err;
-    json_t* root;
-    char* pass = NULL, * key_string = NULL, * string = NULL;
+    json_t* root, * keys, * entry, * member;
+    json_error_t error;
+    char* pass = NULL, * key_string = NULL, * string = NULL, * kid = NULL;
+    char* record = NULL;
+    long long int not_before = 0, expires = 0;
+    size_t i;
     unsigned long int pass_len;
     bdgr_key key;
     int c;
     
     while (1) {
         static struct option long_options[] = {
-            { "pass", required_argument, 0, 'p' },
-            { "key",  required_argument, 0, 'k' },
+            { "pass",       required_argument, 0, 'p' },
+            { "key",        required_argument, 0, 'k' },
+            { "kid",        required_argument, 0, 'i' },
+            { "not-before", required_argument, 0, 'b' },
+            { "expires",    required_argument, 0, 'e' },
+            { "record",     required_argument, 0, 'r' },
             { 0, 0, 0, 0 }
         };
         int option_index = 0;
-        c = getopt_long( argc, argv, "p:", long_options, &option_index);
+        c = getopt_long( argc, argv, "p:i:b:e:r:", long_options, &option_index);
         if (c == -1)
             break;
         switch(c) {
@@ -63,6 +75,18 @@ int main( const int argc, char* const* argv )
         case 'k':
             key_string = optarg;
             break;
+        case 'i':
+            kid = optarg;
+            break;
+        case 'b':
+            not_before = atoll( optarg );
+            break;
+        case 'e':
+            expires = atoll( optarg );
+            break;
+        case 'r':
+            record = optarg;
+            break;
         case '?':
             break;
         default:
@@ -100,12 +124,60 @@ int main( const int argc, char* const* argv )
         
     }
 
-    root = json_pack(
-        "{ss}",
-        "dsa", key_string );
-    if( root == NULL ) {
-        fprintf( stderr, "error packing json\n" );
-        exit( 1 );
+    if( record != NULL ) {
+        root = json_load_file( record, 0, &error );
+        if( root == NULL ) {
+            fprintf( stderr, "error loading record: %s\n", error.text );
+            exit( 1 );
+        }
+        if( !json_is_object( root )) {
+            fprintf( stderr, "error loading record: not an object\n" );
+            exit( 1 );
+        }
+    } else {
+        root = json_object();
+    }
+
+    if( kid == NULL ) {
+        /* The key for badges without a key id */
+        if( root == NULL ||
+            json_object_set_new( root, "dsa", json_string( key_string ))) {
+            fprintf( stderr, "error packing json\n" );
+            exit( 1 );
+        }
+    } else {
+        entry = json_pack( "{ssss}", "kid", kid, "dsa", key_string );
+        if( entry == NULL || root == NULL ||
+            ( not_before && json_object_set_new(
+                  entry, "nbf", json_integer( not_before ))) ||
+            ( expires && json_object_set_new(
+                  entry, "exp", json_integer( expires )))) {
+            fprintf( stderr, "error packing json\n" );
+            exit( 1 );
+        }
+
+        keys = json_object_get( root, "keys" );
+        if( keys == NULL ) {
+            keys = json_array();
+            json_object_set_new( root, "keys", keys );
+        }
+        if( !json_is_array( keys )) {
+            fprintf( stderr, "error loading record: keys not an array\n" );
+            exit( 1 );
+        }
+
+        /* A key listed again under the same key id replaces the old one */
+        for( i = 0; i < json_array_size( keys ); i++ ) {
+            member = json_object_get( json_array_get( keys, i ), "kid" );
+            if( json_is_string( member ) &&
+                !strcmp( json_string_value( member ), kid )) {
+                json_array_remove( keys, i-- );
+            }
+        }
+        if( json_array_append_new( keys, entry )) {
+            fprintf( stderr, "error packing json\n" );
+            exit( 1 );
+        }
     }
 
     string = json_dumps( root, 0 );
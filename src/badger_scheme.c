@@ -0,0 +1,653 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+#include "badger_limit.h"
+#include "badger_peer.h"
+#include "badger_scheme.h"
+#include "badger_table.h"
+
+struct bdgr_scheme_handler {
+    int  (*start)( bdgr_lookup* lookup, void* ctx );
+    void (*cancel)( bdgr_lookup* lookup, void* ctx );
+    void* ctx;
+    int  (*handle_url)( const char* url, const char** record );
+    int    blocking;
+};
+
+/* Handlers keyed on the scheme without its colon */
+static bdgr_table bdgr_scheme_handlers;
+static unsigned long int bdgr_record_max = BDGR_RECORD_LIMIT;
+static pthread_mutex_t bdgr_scheme_handlers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int bdgr_scheme_handler_put(
+    const char* const scheme,
+    int (*start)( bdgr_lookup* lookup, void* ctx ),
+    void (*cancel)( bdgr_lookup* lookup, void* ctx ),
+    void* const ctx,
+    int (*handle_url)( const char* url, const char** record ),
+    const int blocking,
+    const int replace
+)
+{
+    const size_t len = strcspn( scheme, ":" );
+    char key[ BDGR_SCHEME_MAX ];
+    struct bdgr_scheme_handler* handler;
+
+    bdgr_check( len == 0 || len >= BDGR_SCHEME_MAX,
+                bdgr_unsupported_scheme_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    memcpy( key, scheme, len );
+    key[ len ] = '\0';
+
+    handler = bdgr_malloc( sizeof( struct bdgr_scheme_handler ));
+    bdgr_check( handler == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    handler->start = start;
+    handler->cancel = cancel;
+    handler->ctx = ctx;
+    handler->handle_url = handle_url;
+    handler->blocking = blocking;
+
+    pthread_mutex_lock( &bdgr_scheme_handlers_lock );
+    if( bdgr_scheme_handlers.buckets == NULL ) {
+        bdgr_check( bdgr_table_init( &bdgr_scheme_handlers, 16, bdgr_free ),
+                    bdgr_malloc_err, __LINE__ );
+    }
+    if( !bdgr_error() &&
+        ( replace || !bdgr_table_get( &bdgr_scheme_handlers, key ))) {
+        bdgr_check( bdgr_table_put( &bdgr_scheme_handlers, key, handler ),
+                    bdgr_malloc_err, __LINE__ );
+        handler = NULL;
+    }
+    pthread_mutex_unlock( &bdgr_scheme_handlers_lock );
+
+    /* Left over when it failed or the scheme was taken */
+    bdgr_free( handler );
+    return bdgr_error();
+}
+
+/*
+  Runs a blocking handler added with bdgr_scheme_handler_add() to
+  completion on the calling thread.
+*/
+static int bdgr_scheme_adapt( bdgr_lookup* const lookup, void* const ctx )
+{
+    const char* record;
+    (void)ctx;
+
+    lookup->handle_url( lookup->url, &record );
+    if( !bdgr_error() ) {
+        bdgr_check( bdgr_lookup_write( lookup, record, strlen( record )),
+                    lookup->record.error, __LINE__ );
+    }
+    bdgr_lookup_complete( lookup, bdgr_error() );
+    return bdgr_no_err;
+}
+
+int bdgr_scheme_handler_add(
+    char* scheme,
+    int (*handle_url)( const char* const url, const char** record )
+)
+{
+    return bdgr_scheme_handler_put( scheme, bdgr_scheme_adapt, NULL, NULL,
+                                    handle_url, 1, 1 );
+}
+
+int bdgr_scheme_handler_add_async(
+    const char* scheme,
+    int (*start)( bdgr_lookup* lookup, void* ctx ),
+    void (*cancel)( bdgr_lookup* lookup, void* ctx ),
+    void* ctx
+)
+{
+    return bdgr_scheme_handler_put( scheme, start, cancel, ctx, NULL, 0, 1 );
+}
+
+int bdgr_scheme_handler_default(
+    const char* const scheme,
+    int (*start)( bdgr_lookup* lookup, void* ctx ),
+    void (*cancel)( bdgr_lookup* lookup, void* ctx ),
+    const int blocking
+)
+{
+    return bdgr_scheme_handler_put( scheme, start, cancel, NULL, NULL,
+                                    blocking, 0 );
+}
+
+int bdgr_record_limit( const unsigned long int max_size )
+{
+    pthread_mutex_lock( &bdgr_scheme_handlers_lock );
+    bdgr_record_max = max_size;
+    pthread_mutex_unlock( &bdgr_scheme_handlers_lock );
+    return bdgr_check( 0, bdgr_no_err, __LINE__ );
+}
+
+static void bdgr_scan_init( bdgr_scan* const scan, const char* const name )
+{
+    memset( scan, 0, sizeof( *scan ));
+    scan->name = name;
+}
+
+static int bdgr_scan_emit(
+    bdgr_scan* const scan,
+    const unsigned char c,
+    bdgr_buffer* const value
+)
+{
+    if( scan->is_key ) {
+        scan->key_match = scan->key_match && c != '\0' &&
+            (unsigned char)scan->name[ scan->key_pos ] == c;
+        scan->key_pos++;
+    } else if( scan->capturing ) {
+        if( bdgr_buffer_reserve( value, 1 )) {
+            return value->error;
+        }
+        value->data[ value->size++ ] = c;
+    }
+    return bdgr_no_err;
+}
+
+static int bdgr_scan_utf8(
+    bdgr_scan* const scan,
+    const unsigned int code,
+    bdgr_buffer* const value
+)
+{
+    int err;
+
+    if( code < 0x80 ) {
+        return bdgr_scan_emit( scan, code, value );
+    }
+    if( code < 0x800 ) {
+        err = bdgr_scan_emit( scan, 0xc0 | code >> 6, value );
+    } else {
+        err = bdgr_scan_emit( scan, 0xe0 | code >> 12, value );
+        if( !err ) {
+            err = bdgr_scan_emit( scan, 0x80 | ( code >> 6 & 0x3f ), value );
+        }
+    }
+    if( !err ) {
+        err = bdgr_scan_emit( scan, 0x80 | ( code & 0x3f ), value );
+    }
+    return err;
+}
+
+static int bdgr_scan_string(
+    bdgr_scan* const scan,
+    const unsigned char c,
+    bdgr_buffer* const value
+)
+{
+    const char* const hex = "0123456789abcdef0123456789ABCDEF";
+    const char* digit;
+
+    if( scan->unicode_left ) {
+        digit = c ? strchr( hex, c ) : NULL;
+        if( digit == NULL ) {
+            return bdgr_record_syntax_err;
+        }
+        scan->unicode = scan->unicode << 4 | ( ( digit - hex ) & 0xf );
+        if( --scan->unicode_left ) {
+            return bdgr_no_err;
+        }
+        return bdgr_scan_utf8( scan, scan->unicode, value );
+    }
+    if( scan->escape ) {
+        scan->escape = 0;
+        switch( c ) {
+        case '"':
+        case '\\':
+        case '/':
+            return bdgr_scan_emit( scan, c, value );
+        case 'b':
+            return bdgr_scan_emit( scan, '\b', value );
+        case 'f':
+            return bdgr_scan_emit( scan, '\f', value );
+        case 'n':
+            return bdgr_scan_emit( scan, '\n', value );
+        case 'r':
+            return bdgr_scan_emit( scan, '\r', value );
+        case 't':
+            return bdgr_scan_emit( scan, '\t', value );
+        case 'u':
+            scan->unicode_left = 4;
+            scan->unicode = 0;
+            return bdgr_no_err;
+        default:
+            return bdgr_record_syntax_err;
+        }
+    }
+    if( c < 0x20 ) {
+        return bdgr_record_syntax_err;
+    }
+    if( c == '\\' ) {
+        scan->escape = 1;
+        return bdgr_no_err;
+    }
+    if( c != '"' ) {
+        return bdgr_scan_emit( scan, c, value );
+    }
+    
+    scan->in_string = 0;
+    if( scan->is_key ) {
+        scan->is_key = 0;
+        scan->capture = scan->key_match &&
+            scan->name[ scan->key_pos ] == '\0';
+        if( scan->capture && scan->captured ) {
+            return bdgr_json_dsa_duplicate_err;
+        }
+    } else if( scan->capturing ) {
+        scan->capturing = 0;
+        scan->captured = 1;
+    }
+    return bdgr_no_err;
+}
+
+/* Everything outside strings; only members of the outer object matter */
+static int bdgr_scan_token( bdgr_scan* const scan, const unsigned char c )
+{
+    if( c == ' ' || c == '\t' || c == '\r' || c == '\n' || scan->closed ) {
+        return bdgr_no_err;
+    }
+    if( !scan->started ) {
+        scan->started = 1;
+        scan->depth = 1;
+        scan->expect_key = 1;
+        return c == '{' ? bdgr_no_err : bdgr_record_syntax_err;
+    }
+
+    switch( c ) {
+    case '"':
+        scan->in_string = 1;
+        if( scan->depth == 1 && scan->expect_key ) {
+            scan->is_key = 1;
+            scan->key_match = 1;
+            scan->key_pos = 0;
+        } else if( scan->depth == 1 && scan->capture ) {
+            scan->capturing = 1;
+        }
+        return bdgr_no_err;
+    case ':':
+        if( scan->depth == 1 ) {
+            scan->expect_key = 0;
+        }
+        return bdgr_no_err;
+    case ',':
+        if( scan->depth == 1 ) {
+            scan->expect_key = 1;
+            scan->capture = 0;
+        }
+        return bdgr_no_err;
+    case '{':
+    case '[':
+        if( scan->depth == 1 && scan->capture ) {
+            return bdgr_json_dsa_not_string_err;
+        }
+        scan->depth++;
+        return bdgr_no_err;
+    case '}':
+    case ']':
+        scan->closed = --scan->depth == 0;
+        scan->done = scan->closed && scan->captured;
+        return bdgr_no_err;
+    default:
+        if( scan->depth == 1 && scan->capture ) {
+            return bdgr_json_dsa_not_string_err;
+        }
+        return scan->depth == 1 && scan->expect_key ?
+            bdgr_record_syntax_err : bdgr_no_err;
+    }
+}
+
+static int bdgr_scan_feed(
+    bdgr_scan* const scan,
+    const char* const data,
+    const unsigned long int size,
+    bdgr_buffer* const value
+)
+{
+    unsigned long int i;
+    int err = bdgr_no_err;
+
+    /* Without a name to pick, the record is kept whole */
+    if( scan->name == NULL ) {
+        if( bdgr_buffer_reserve( value, size )) {
+            return value->error;
+        }
+        memcpy( value->data + value->size, data, size );
+        value->size += size;
+        return bdgr_no_err;
+    }
+
+    for( i = 0; i < size && !scan->done && !err; i++ ) {
+        if( scan->in_string ) {
+            err = bdgr_scan_string( scan, data[ i ], value );
+        } else {
+            err = bdgr_scan_token( scan, data[ i ] );
+        }
+    }
+    return err;
+}
+
+/*
+  Replaces the scanned value with a record holding just that value, which
+  is what the rest of the library parses, caches and hashes.
+*/
+static int bdgr_scan_record( bdgr_scan* const scan, bdgr_buffer* const value )
+{
+    const char* const prefix = "{\"dsa\":\"";
+    bdgr_buffer record;
+    unsigned long int i;
+    unsigned char c;
+
+    if( scan->name == NULL ) {
+        if( !value->size || bdgr_buffer_reserve( value, 1 )) {
+            return value->size ? value->error : bdgr_record_syntax_err;
+        }
+        value->data[ value->size++ ] = '\0';
+        return bdgr_no_err;
+    }
+
+    if( !scan->done ) {
+        return scan->closed ?
+            bdgr_json_dsa_missing_err : bdgr_record_syntax_err;
+    }
+
+    memset( &record, 0, sizeof( record ));
+    if( bdgr_buffer_reserve( &record,
+                             strlen( prefix ) + value->size * 6 + 3 )) {
+        return record.error;
+    }
+    strcpy( record.data, prefix );
+    record.size = strlen( prefix );
+    for( i = 0; i < value->size; i++ ) {
+        c = value->data[ i ];
+        if( c == '"' || c == '\\' ) {
+            record.data[ record.size++ ] = '\\';
+            record.data[ record.size++ ] = c;
+        } else if( c < 0x20 ) {
+            record.size += sprintf( record.data + record.size,
+                                    "\\u%04x", c );
+        } else {
+            record.data[ record.size++ ] = c;
+        }
+    }
+    strcpy( record.data + record.size, "\"}" );
+    record.size += 3;
+
+    bdgr_free( value->data );
+    *value = record;
+    return bdgr_no_err;
+}
+
+const char* bdgr_lookup_url( const bdgr_lookup* const lookup )
+{
+    return lookup->url;
+}
+
+const struct timespec* bdgr_lookup_deadline( const bdgr_lookup* const lookup )
+{
+    return lookup->has_deadline ? &lookup->deadline : NULL;
+}
+
+int bdgr_lookup_write(
+    bdgr_lookup* const lookup,
+    const char* const data,
+    const unsigned long int size
+)
+{
+    int err;
+
+    if( lookup->record.error || lookup->scan.done ) {
+        return lookup->record.error;
+    }
+    lookup->seen += size;
+    if( lookup->limit && lookup->seen > lookup->limit ) {
+        err = bdgr_record_too_large_err;
+    } else {
+        err = bdgr_scan_feed( &lookup->scan, data, size, &lookup->record );
+    }
+    if( err ) {
+        lookup->record.error = err;
+    }
+    return err;
+}
+
+/*
+  Both the caller and the handler hold a reference, so a caller that gives
+  up at its deadline leaves the lookup to whichever finishes last.
+*/
+void bdgr_lookup_release( bdgr_lookup* const lookup )
+{
+    int refs;
+
+    pthread_mutex_lock( &lookup->lock );
+    refs = --lookup->refs;
+    pthread_mutex_unlock( &lookup->lock );
+    if( refs > 0 ) {
+        return;
+    }
+    pthread_cond_destroy( &lookup->completed_cond );
+    pthread_mutex_destroy( &lookup->lock );
+    bdgr_free( lookup->record.data );
+    bdgr_free( lookup->peer );
+    bdgr_free( lookup->kid );
+    bdgr_free( lookup->url );
+    bdgr_free( lookup );
+}
+
+void bdgr_lookup_complete( bdgr_lookup* const lookup, const int err )
+{
+    int failed = err ? err : (int)lookup->record.error;
+
+    if( !failed && !lookup->not_modified ) {
+        failed = bdgr_scan_record( &lookup->scan, &lookup->record );
+    }
+    pthread_mutex_lock( &lookup->lock );
+    lookup->err = failed;
+    lookup->completed = 1;
+    pthread_cond_broadcast( &lookup->completed_cond );
+    if( lookup->landed != NULL ) {
+        lookup->landed( lookup, lookup->landed_ctx );
+    }
+    pthread_mutex_unlock( &lookup->lock );
+    bdgr_lookup_release( lookup );
+}
+
+bdgr_lookup* bdgr_lookup_new(
+    const char* const url,
+    const struct timespec* const deadline,
+    const int revalidate,
+    void (*landed)( bdgr_lookup* lookup, void* ctx ),
+    void* const landed_ctx
+)
+{
+    const size_t len = strcspn( url, ":" );
+    const size_t url_len = strcspn( url, " " );
+    const char* const kid = bdgr_key_ref_kid( url );
+    char key[ BDGR_SCHEME_MAX ];
+    struct bdgr_scheme_handler* found = NULL;
+    struct bdgr_scheme_handler handler;
+    pthread_condattr_t attr;
+    bdgr_lookup* lookup;
+    unsigned long int limit;
+
+    bdgr_check( url[ len ] != ':' || len >= BDGR_SCHEME_MAX || len > url_len,
+                bdgr_unsupported_scheme_err, __LINE__ );
+    if( bdgr_error() || bdgr_check( kid != NULL && !bdgr_kid_valid( kid ),
+                                    bdgr_kid_err, __LINE__ )) {
+        return NULL;
+    }
+    memcpy( key, url, len );
+    key[ len ] = '\0';
+
+    pthread_mutex_lock( &bdgr_scheme_handlers_lock );
+    if( bdgr_scheme_handlers.buckets != NULL ) {
+        found = bdgr_table_get( &bdgr_scheme_handlers, key );
+    }
+    if( found != NULL ) {
+        handler = *found;
+    }
+    limit = bdgr_record_max;
+    pthread_mutex_unlock( &bdgr_scheme_handlers_lock );
+
+    bdgr_check( found == NULL, bdgr_unsupported_scheme_err, __LINE__ );
+    if( bdgr_error() || bdgr_limit_scheme( key )) {
+        return NULL;
+    }
+
+    lookup = bdgr_calloc( 1, sizeof( bdgr_lookup ));
+    bdgr_check( lookup == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        return NULL;
+    }
+    /* The URL of a key reference is that of the record holding the key */
+    lookup->url = bdgr_malloc( url_len + 1 );
+    lookup->kid = kid != NULL ? bdgr_strdup( kid ) : NULL;
+    bdgr_check( lookup->url == NULL || ( kid != NULL && lookup->kid == NULL ),
+                bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        bdgr_free( lookup->url );
+        bdgr_free( lookup->kid );
+        bdgr_free( lookup );
+        return NULL;
+    }
+    memcpy( lookup->url, url, url_len );
+    lookup->url[ url_len ] = '\0';
+    if( deadline != NULL ) {
+        lookup->deadline = *deadline;
+        lookup->has_deadline = 1;
+    }
+    lookup->revalidate = revalidate;
+    lookup->limit = limit;
+    bdgr_scan_init( &lookup->scan, kid == NULL ? "dsa" : NULL );
+    lookup->start = handler.start;
+    lookup->cancel = handler.cancel;
+    lookup->ctx = handler.ctx;
+    lookup->handle_url = handler.handle_url;
+    lookup->blocking = handler.blocking;
+    lookup->peer = bdgr_peer_owner( lookup->url );
+    if( lookup->peer != NULL ) {
+        lookup->blocking = 1;
+    }
+    lookup->landed = landed;
+    lookup->landed_ctx = landed_ctx;
+    lookup->refs = 2;
+    pthread_mutex_init( &lookup->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &lookup->completed_cond, &attr );
+    pthread_condattr_destroy( &attr );
+    return lookup;
+}
+
+void bdgr_lookup_start( bdgr_lookup* const lookup )
+{
+    /* Handlers read the deadline of the thread they start on */
+    const struct timespec* const deadline =
+        bdgr_deadline_swap( bdgr_lookup_deadline( lookup ));
+    int err = bdgr_no_err;
+
+    if( lookup->peer == NULL || !bdgr_peer_fill( lookup )) {
+        err = lookup->start( lookup, lookup->ctx );
+    }
+    bdgr_deadline_swap( deadline );
+    if( err ) {
+        /* Never started, so complete it on the handler's behalf */
+        bdgr_lookup_complete( lookup, err );
+    }
+}
+
+void bdgr_lookup_cancel( bdgr_lookup* const lookup )
+{
+    /* The handler keeps its reference until it completes */
+    if( lookup->cancel != NULL ) {
+        lookup->cancel( lookup, lookup->ctx );
+    }
+}
+
+int bdgr_lookup_result(
+    bdgr_lookup* const lookup,
+    char** const record,
+    time_t* const expires
+)
+{
+    if( !bdgr_check( lookup->err, lookup->err, __LINE__ )) {
+        /* No record means the one the caller holds is still good */
+        *record = NULL;
+        if( !lookup->not_modified ) {
+            *record = lookup->record.data;
+            lookup->record.data = NULL;
+        }
+        *expires = lookup->expires;
+    }
+    return bdgr_error();
+}
+
+int bdgr_scheme_lookup(
+    const char* const url,
+    const struct timespec* const deadline,
+    const int revalidate,
+    char** const record,
+    time_t* const expires
+)
+{
+    bdgr_lookup* const lookup =
+        bdgr_lookup_new( url, deadline, revalidate, NULL, NULL );
+    int cancelled = 0;
+
+    if( lookup == NULL ) {
+        return bdgr_error();
+    }
+    bdgr_lookup_start( lookup );
+
+    pthread_mutex_lock( &lookup->lock );
+    while( !lookup->completed && !cancelled ) {
+        if( deadline == NULL ) {
+            pthread_cond_wait( &lookup->completed_cond, &lookup->lock );
+        } else if( pthread_cond_timedwait( &lookup->completed_cond,
+                                           &lookup->lock,
+                                           deadline ) == ETIMEDOUT ) {
+            cancelled = !lookup->completed;
+        }
+    }
+    pthread_mutex_unlock( &lookup->lock );
+
+    if( cancelled ) {
+        bdgr_lookup_cancel( lookup );
+        bdgr_check( 1, bdgr_timeout_err, __LINE__ );
+    } else {
+        bdgr_lookup_result( lookup, record, expires );
+    }
+    bdgr_lookup_release( lookup );
+    return bdgr_error();
+}
@@ -0,0 +1,189 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_SCHEME_H
+#define BADGER_SCHEME_H
+
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include <badger.h>
+#include "badger_err.h"
+
+#define BDGR_SCHEME_MAX 32
+#define BDGR_RECORD_LIMIT 65536
+#define BDGR_KID_MAX 32
+
+typedef struct {
+    char* data;
+    unsigned long int size;
+    unsigned long int capacity;
+    bdgr_err error;
+} bdgr_buffer;
+
+/*
+  Picks the string value of one member of a JSON object out of its text as
+  it arrives, without building the document.  It is lenient about what it
+  skips over, but reads on to the end of the object and refuses a second
+  member of that name, which would leave parsers to disagree on the value.
+*/
+typedef struct {
+    const char*       name;
+    int               depth;
+    int               started;
+    int               closed;
+    int               in_string;
+    int               escape;
+    int               unicode_left;
+    unsigned int      unicode;
+    int               expect_key;
+    int               is_key;
+    int               key_match;
+    unsigned long int key_pos;
+    int               capture;
+    int               capturing;
+    int               captured;
+    int               done;
+} bdgr_scan;
+
+/*
+  A lookup owns a copy of its URL and deadline.  Its record holds only the
+  dsa attribute scanned out of what the handler wrote, until completion
+  turns it into a record of its own; more than limit bytes written fail the
+  lookup.  A caller holding a key for the URL asks for revalidation, and a
+  handler that finds the record unchanged answers not_modified instead of
+  writing it.  A handler that knows how long the record stays fresh sets
+  expires.  The lookup is shared by the caller waiting on it and the
+  handler answering it, and released by whichever lets go last.  A caller
+  that doesn't wait is told through landed, called with the lookup locked
+  from whichever thread completes it.  A lookup owned by a peer names it in
+  peer, which is asked first, and is blocking whatever its handler.  A
+  lookup for a key id keeps the whole record, where that key is listed.
+*/
+struct bdgr_lookup {
+    char*             url;
+    char*             kid;
+    char*             peer;
+    struct timespec   deadline;
+    int               has_deadline;
+    bdgr_buffer       record;
+    bdgr_scan         scan;
+    unsigned long int seen;
+    unsigned long int limit;
+    int               revalidate;
+    int               not_modified;
+    time_t            expires;
+    int             (*start)( bdgr_lookup* lookup, void* ctx );
+    void            (*cancel)( bdgr_lookup* lookup, void* ctx );
+    void*             ctx;
+    int             (*handle_url)( const char* url, const char** record );
+    int               blocking;
+    void            (*landed)( bdgr_lookup* lookup, void* ctx );
+    void*             landed_ctx;
+    pthread_mutex_t   lock;
+    pthread_cond_t    completed_cond;
+    int               completed;
+    int               err;
+    int               refs;
+};
+
+int bdgr_buffer_reserve( bdgr_buffer* buf, unsigned long int extra );
+
+size_t bdgr_record_data( char* ptr, size_t size, size_t nmemb, void* _buf );
+
+void bdgr_deadline_curl( CURL* handle );
+
+int bdgr_curl_check( CURLcode res, int line );
+
+int bdgr_scheme_handler_default(
+    const char* scheme,
+    int (*start)( bdgr_lookup* lookup, void* ctx ),
+    void (*cancel)( bdgr_lookup* lookup, void* ctx ),
+    int blocking
+);
+
+const struct timespec* bdgr_deadline_swap( const struct timespec* deadline );
+
+bdgr_lookup* bdgr_lookup_new(
+    const char* url,
+    const struct timespec* deadline,
+    int revalidate,
+    void (*landed)( bdgr_lookup* lookup, void* ctx ),
+    void* landed_ctx
+);
+
+void bdgr_lookup_start( bdgr_lookup* lookup );
+
+void bdgr_lookup_cancel( bdgr_lookup* lookup );
+
+int bdgr_lookup_result( bdgr_lookup* lookup, char** record, time_t* expires );
+
+void bdgr_lookup_release( bdgr_lookup* lookup );
+
+int bdgr_kid_valid( const char* kid );
+
+/* The reference to the key badge is checked against */
+char* bdgr_key_ref( const bdgr_badge* badge );
+
+/* The key id in ref, or NULL */
+const char* bdgr_key_ref_kid( const char* ref );
+
+/*
+  Turns the answer to a lookup of id into key and caches it.  Returns 1
+  when a not modified answer came too late to be used and the lookup has to
+  be repeated without revalidation.
+*/
+int bdgr_key_settle(
+    const char* id,
+    int revalidate,
+    const char* record,
+    time_t expires,
+    bdgr_key* key
+);
+
+/*
+  Finds the key for id in the cache, or fetches it sharing any flight
+  already under way, within deadline.
+*/
+int bdgr_key_find(
+    const char* id,
+    const struct timespec* deadline,
+    bdgr_key* key
+);
+
+int bdgr_init();
+
+int bdgr_scheme_lookup(
+    const char* url,
+    const struct timespec* deadline,
+    int revalidate,
+    char** record,
+    time_t* expires
+);
+
+int bdgr_scheme_http( bdgr_lookup* lookup, void* ctx );
+
+void bdgr_scheme_http_cancel( bdgr_lookup* lookup, void* ctx );
+
+int bdgr_scheme_nmc( bdgr_lookup* lookup, void* ctx );
+
+int bdgr_scheme_id( bdgr_lookup* lookup, void* ctx );
+
+#endif
@@ -0,0 +1,210 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "badger_alloc.h"
+#include "badger_table.h"
+
+unsigned long int bdgr_hash_string( const char* string )
+{
+    /* FNV-1a */
+    unsigned long int hash = 2166136261ul;
+    while( *string ) {
+        hash ^= (unsigned char)*string++;
+        hash *= 16777619ul;
+    }
+    return hash;
+}
+
+int bdgr_table_init(
+    bdgr_table* const table,
+    const unsigned long int size,
+    void (*free_value)( void* value )
+)
+{
+    table->size = size ? size : 64;
+    table->count = 0;
+    table->free_value = free_value;
+    table->buckets = bdgr_calloc( table->size, sizeof( *table->buckets ));
+    return table->buckets == NULL;
+}
+
+static struct bdgr_table_entry** bdgr_table_find(
+    const bdgr_table* const table,
+    const char* const key,
+    const unsigned long int hash
+)
+{
+    struct bdgr_table_entry** entry = &table->buckets[ hash % table->size ];
+    while( *entry != NULL ) {
+        if( (*entry)->hash == hash && !strcmp( (*entry)->key, key )) {
+            break;
+        }
+        entry = &(*entry)->next;
+    }
+    return entry;
+}
+
+void* bdgr_table_get(
+    const bdgr_table* const table,
+    const char* const key
+)
+{
+    struct bdgr_table_entry* const* entry;
+    if( table->buckets == NULL ) {
+        return NULL;
+    }
+    entry = bdgr_table_find( table, key, bdgr_hash_string( key ));
+    return *entry != NULL ? (*entry)->value : NULL;
+}
+
+static void bdgr_table_grow( bdgr_table* const table )
+{
+    unsigned long int i, size = table->size * 2;
+    struct bdgr_table_entry** buckets, * entry, * next;
+
+    buckets = bdgr_calloc( size, sizeof( *buckets ));
+    if( buckets == NULL ) {
+        /* Keep the longer chains rather than fail the insert */
+        return;
+    }
+    for( i = 0; i < table->size; i++ ) {
+        for( entry = table->buckets[i]; entry != NULL; entry = next ) {
+            next = entry->next;
+            entry->next = buckets[ entry->hash % size ];
+            buckets[ entry->hash % size ] = entry;
+        }
+    }
+    bdgr_free( table->buckets );
+    table->buckets = buckets;
+    table->size = size;
+}
+
+int bdgr_table_put(
+    bdgr_table* const table,
+    const char* const key,
+    void* const value
+)
+{
+    const unsigned long int hash = bdgr_hash_string( key );
+    struct bdgr_table_entry** entry = bdgr_table_find( table, key, hash );
+
+    if( *entry != NULL ) {
+        if( table->free_value != NULL && (*entry)->value != value ) {
+            table->free_value( (*entry)->value );
+        }
+        (*entry)->value = value;
+        return 0;
+    }
+
+    *entry = bdgr_malloc( sizeof( **entry ));
+    if( *entry == NULL ) {
+        return 1;
+    }
+    (*entry)->key = bdgr_strdup( key );
+    if( (*entry)->key == NULL ) {
+        bdgr_free( *entry );
+        *entry = NULL;
+        return 1;
+    }
+    (*entry)->value = value;
+    (*entry)->hash = hash;
+    (*entry)->next = NULL;
+
+    if( ++table->count > table->size * 2 ) {
+        bdgr_table_grow( table );
+    }
+    return 0;
+}
+
+void bdgr_table_remove(
+    bdgr_table* const table,
+    const char* const key
+)
+{
+    struct bdgr_table_entry** entry, * found;
+    if( table->buckets == NULL ) {
+        return;
+    }
+    entry = bdgr_table_find( table, key, bdgr_hash_string( key ));
+    if( *entry == NULL ) {
+        return;
+    }
+    found = *entry;
+    *entry = found->next;
+    if( table->free_value != NULL ) {
+        table->free_value( found->value );
+    }
+    bdgr_free( found->key );
+    bdgr_free( found );
+    table->count--;
+}
+
+void bdgr_table_sweep(
+    bdgr_table* const table,
+    int (*stale)( void* value, void* ctx ),
+    void* const ctx
+)
+{
+    unsigned long int i;
+    struct bdgr_table_entry** entry, * found;
+    if( table->buckets == NULL ) {
+        return;
+    }
+    for( i = 0; i < table->size; i++ ) {
+        entry = &table->buckets[i];
+        while( *entry != NULL ) {
+            if( !stale( (*entry)->value, ctx )) {
+                entry = &(*entry)->next;
+                continue;
+            }
+            found = *entry;
+            *entry = found->next;
+            if( table->free_value != NULL ) {
+                table->free_value( found->value );
+            }
+            bdgr_free( found->key );
+            bdgr_free( found );
+            table->count--;
+        }
+    }
+}
+
+void bdgr_table_free( bdgr_table* const table )
+{
+    unsigned long int i;
+    struct bdgr_table_entry* entry, * next;
+    if( table->buckets == NULL ) {
+        return;
+    }
+    for( i = 0; i < table->size; i++ ) {
+        for( entry = table->buckets[i]; entry != NULL; entry = next ) {
+            next = entry->next;
+            if( table->free_value != NULL ) {
+                table->free_value( entry->value );
+            }
+            bdgr_free( entry->key );
+            bdgr_free( entry );
+        }
+    }
+    bdgr_free( table->buckets );
+    table->buckets = NULL;
+    table->count = 0;
+}
@@ -0,0 +1,65 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_TABLE_H
+#define BADGER_TABLE_H
+
+struct bdgr_table_entry {
+    char*                    key;
+    void*                    value;
+    unsigned long int        hash;
+    struct bdgr_table_entry* next;
+};
+
+/*
+  A string keyed hash table.  Keys are copied, values are owned by the
+  table and released with free_value when replaced or removed.  Functions
+  returning int return nonzero when they fail to allocate memory and leave
+  the error state alone.
+*/
+typedef struct {
+    struct bdgr_table_entry** buckets;
+    unsigned long int         size;
+    unsigned long int         count;
+    void                    (*free_value)( void* value );
+} bdgr_table;
+
+unsigned long int bdgr_hash_string( const char* string );
+
+int bdgr_table_init(
+    bdgr_table* table,
+    unsigned long int size,
+    void (*free_value)( void* value )
+);
+
+void* bdgr_table_get( const bdgr_table* table, const char* key );
+
+int bdgr_table_put( bdgr_table* table, const char* key, void* value );
+
+void bdgr_table_remove( bdgr_table* table, const char* key );
+
+void bdgr_table_sweep(
+    bdgr_table* table,
+    int (*stale)( void* value, void* ctx ),
+    void* ctx
+);
+
+void bdgr_table_free( bdgr_table* table );
+
+#endif
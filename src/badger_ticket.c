@@ -0,0 +1,310 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "badger_alloc.h"
+#include "badger_err.h"
+
+#define BDGR_TICKET_VERSION  1
+#define BDGR_TICKET_KEYS     4
+#define BDGR_TICKET_KEY_MAX  32
+#define BDGR_TICKET_NONCE    16
+#define BDGR_TICKET_TAG      16
+#define BDGR_TICKET_HEADER   ( 1 + 4 + BDGR_TICKET_NONCE )
+#define BDGR_TICKET_OVERHEAD ( BDGR_TICKET_HEADER + 8 + BDGR_TICKET_TAG )
+
+/*
+  A ticket is a version byte, the id of the server key it was sealed with
+  and a random nonce, all authenticated as the header, followed by the
+  expiry and the Identity URL sealed with AES in EAX mode, and the tag.
+  Key ids are taken from the hash of the key, so servers sharing keys
+  agree on them.  The latest key issues tickets; the ones before it are
+  kept so that tickets they issued stay good until they expire.
+*/
+struct bdgr_ticket_key {
+    uint32_t          id;
+    unsigned long int len;
+    unsigned char     key[ BDGR_TICKET_KEY_MAX ];
+};
+
+static struct {
+    struct bdgr_ticket_key keys[ BDGR_TICKET_KEYS ];
+    unsigned int           count;
+    unsigned int           current;
+    int                    aes;
+    int                    sha256;
+    pthread_mutex_t        lock;
+} bdgr_g_ticket = { { { 0, 0, { 0 } } }, 0, 0, -1, -1,
+                    PTHREAD_MUTEX_INITIALIZER };
+
+/* Called with the tickets locked */
+static int bdgr_ticket_init()
+{
+    if( bdgr_g_ticket.aes != -1 ) {
+        return bdgr_check( 0, bdgr_no_err, __LINE__ );
+    }
+    if( bdgr_check( register_cipher( &aes_desc ) == -1,
+                    bdgr_register_cipher_err, __LINE__ ) ||
+        bdgr_check( register_hash( &sha256_desc ) == -1,
+                    bdgr_register_hash_err, __LINE__ )) {
+        return bdgr_error();
+    }
+    bdgr_g_ticket.sha256 = find_hash( "sha256" );
+    bdgr_g_ticket.aes = find_cipher( "aes" );
+    return bdgr_error();
+}
+
+/* Called with the tickets locked */
+static int bdgr_ticket_key_put(
+    const unsigned char* const key,
+    const unsigned long int key_len
+)
+{
+    unsigned char hash[ 32 ];
+    unsigned long int hash_len = sizeof( hash );
+    struct bdgr_ticket_key* slot;
+
+    bdgr_check( key_len != 16 && key_len != 24 && key_len != 32,
+                bdgr_ticket_key_err, __LINE__ );
+    if( bdgr_error() || bdgr_ticket_init() ) {
+        return bdgr_error();
+    }
+    if( bdgr_crypt( hash_memory( bdgr_g_ticket.sha256, key, key_len,
+                                 hash, &hash_len ),
+                    __LINE__ ) != CRYPT_OK ) {
+        return bdgr_error();
+    }
+
+    /* Overwrites the oldest key */
+    if( bdgr_g_ticket.count ) {
+        bdgr_g_ticket.current =
+            ( bdgr_g_ticket.current + 1 ) % BDGR_TICKET_KEYS;
+    }
+    if( bdgr_g_ticket.count < BDGR_TICKET_KEYS ) {
+        bdgr_g_ticket.count++;
+    }
+    slot = &bdgr_g_ticket.keys[ bdgr_g_ticket.current ];
+    slot->id = (uint32_t)hash[0] << 24 | (uint32_t)hash[1] << 16 |
+        (uint32_t)hash[2] << 8 | hash[3];
+    slot->len = key_len;
+    memcpy( slot->key, key, key_len );
+    return bdgr_error();
+}
+
+int bdgr_session_ticket_key_add(
+    const unsigned char* const key,
+    const unsigned long int key_len
+)
+{
+    pthread_mutex_lock( &bdgr_g_ticket.lock );
+    bdgr_ticket_key_put( key, key_len );
+    pthread_mutex_unlock( &bdgr_g_ticket.lock );
+    return bdgr_error();
+}
+
+/* Called with the tickets locked */
+static int bdgr_ticket_rotate()
+{
+    unsigned char key[ BDGR_TICKET_KEY_MAX ];
+
+    if( !bdgr_check( rng_get_bytes( key, sizeof( key ), NULL ) !=
+                     sizeof( key ),
+                     bdgr_ticket_key_err, __LINE__ )) {
+        bdgr_ticket_key_put( key, sizeof( key ));
+    }
+    memset( key, 0, sizeof( key ));
+    return bdgr_error();
+}
+
+int bdgr_session_ticket_rotate()
+{
+    pthread_mutex_lock( &bdgr_g_ticket.lock );
+    bdgr_ticket_rotate();
+    pthread_mutex_unlock( &bdgr_g_ticket.lock );
+    return bdgr_error();
+}
+
+int bdgr_session_ticket_issue(
+    const char* const id,
+    const unsigned long int lifetime,
+    unsigned char* const ticket,
+    unsigned long int* const ticket_len
+)
+{
+    const unsigned long int id_len = strlen( id );
+    const unsigned long int needed = BDGR_TICKET_OVERHEAD + id_len;
+    struct bdgr_ticket_key key;
+    unsigned char* plain = NULL;
+    unsigned long int tag_len = BDGR_TICKET_TAG;
+    uint64_t expires;
+    int aes, i;
+
+    if( *ticket_len < needed ) {
+        *ticket_len = needed;
+        bdgr_crypt( CRYPT_BUFFER_OVERFLOW, __LINE__ );
+        return bdgr_error();
+    }
+
+    /* A server that never set a key gets a random one */
+    pthread_mutex_lock( &bdgr_g_ticket.lock );
+    if( !bdgr_ticket_init() && !bdgr_g_ticket.count ) {
+        bdgr_ticket_rotate();
+    }
+    key = bdgr_g_ticket.keys[ bdgr_g_ticket.current ];
+    aes = bdgr_g_ticket.aes;
+    pthread_mutex_unlock( &bdgr_g_ticket.lock );
+    if( bdgr_error() ) {
+        goto bdgr_session_ticket_issue_free;
+    }
+
+    plain = bdgr_malloc( 8 + id_len );
+    bdgr_check( plain == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_session_ticket_issue_free;
+    }
+    expires = (uint64_t)time( NULL ) + lifetime;
+    for( i = 0; i < 8; i++ ) {
+        plain[ i ] = (unsigned char)( expires >> ( 56 - 8 * i ));
+    }
+    memcpy( plain + 8, id, id_len );
+
+    ticket[0] = BDGR_TICKET_VERSION;
+    for( i = 0; i < 4; i++ ) {
+        ticket[ 1 + i ] = (unsigned char)( key.id >> ( 24 - 8 * i ));
+    }
+    bdgr_check( rng_get_bytes( ticket + 5, BDGR_TICKET_NONCE, NULL ) !=
+                BDGR_TICKET_NONCE,
+                bdgr_ticket_key_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_session_ticket_issue_free;
+    }
+
+    bdgr_crypt( eax_encrypt_authenticate_memory(
+                    aes, key.key, key.len,
+                    ticket + 5, BDGR_TICKET_NONCE,
+                    ticket, BDGR_TICKET_HEADER,
+                    plain, 8 + id_len,
+                    ticket + BDGR_TICKET_HEADER,
+                    ticket + BDGR_TICKET_HEADER + 8 + id_len, &tag_len ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_session_ticket_issue_free;
+    }
+    *ticket_len = needed;
+
+ bdgr_session_ticket_issue_free:
+
+    if( plain != NULL ) {
+        memset( plain, 0, 8 + id_len );
+        bdgr_free( plain );
+    }
+    memset( &key, 0, sizeof( key ));
+    return bdgr_error();
+}
+
+int bdgr_session_ticket_check(
+    const unsigned char* const ticket,
+    const unsigned long int ticket_len,
+    char** const id
+)
+{
+    struct bdgr_ticket_key key;
+    unsigned char tag[ BDGR_TICKET_TAG ];
+    unsigned long int plain_len;
+    unsigned char* plain = NULL;
+    uint32_t key_id = 0;
+    uint64_t expires = 0;
+    unsigned int i, found = 0;
+    int aes, stat = 0;
+
+    bdgr_check( ticket_len < BDGR_TICKET_OVERHEAD ||
+                ticket[0] != BDGR_TICKET_VERSION,
+                bdgr_ticket_invalid_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    for( i = 0; i < 4; i++ ) {
+        key_id = key_id << 8 | ticket[ 1 + i ];
+    }
+
+    pthread_mutex_lock( &bdgr_g_ticket.lock );
+    for( i = 0; i < bdgr_g_ticket.count && !found; i++ ) {
+        if( bdgr_g_ticket.keys[ i ].id == key_id ) {
+            key = bdgr_g_ticket.keys[ i ];
+            found = 1;
+        }
+    }
+    aes = bdgr_g_ticket.aes;
+    pthread_mutex_unlock( &bdgr_g_ticket.lock );
+    bdgr_check( !found, bdgr_ticket_invalid_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+
+    /* Room for the Identity URL to be terminated in place */
+    plain_len = ticket_len - BDGR_TICKET_HEADER - BDGR_TICKET_TAG;
+    plain = bdgr_malloc( plain_len + 1 );
+    bdgr_check( plain == NULL, bdgr_malloc_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_session_ticket_check_free;
+    }
+    memcpy( tag, ticket + ticket_len - BDGR_TICKET_TAG, BDGR_TICKET_TAG );
+    bdgr_crypt( eax_decrypt_verify_memory(
+                    aes, key.key, key.len,
+                    ticket + 5, BDGR_TICKET_NONCE,
+                    ticket, BDGR_TICKET_HEADER,
+                    ticket + BDGR_TICKET_HEADER, plain_len,
+                    plain, tag, BDGR_TICKET_TAG, &stat ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_session_ticket_check_free;
+    }
+    bdgr_check( !stat, bdgr_ticket_invalid_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_session_ticket_check_free;
+    }
+
+    for( i = 0; i < 8; i++ ) {
+        expires = expires << 8 | plain[ i ];
+    }
+    bdgr_check( (uint64_t)time( NULL ) >= expires,
+                bdgr_ticket_expired_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_session_ticket_check_free;
+    }
+
+    plain[ plain_len ] = '\0';
+    *id = bdgr_strdup( (char*)plain + 8 );
+    bdgr_check( *id == NULL, bdgr_malloc_err, __LINE__ );
+
+ bdgr_session_ticket_check_free:
+
+    if( plain != NULL ) {
+        memset( plain, 0, plain_len );
+        bdgr_free( plain );
+    }
+    memset( &key, 0, sizeof( key ));
+    return bdgr_error();
+}
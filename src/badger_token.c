@@ -0,0 +1,349 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "badger_err.h"
+#include "badger_token.h"
+
+#define BDGR_SERVER_TOKEN_VERSION      1
+#define BDGR_SERVER_TOKEN_KEYS         4
+#define BDGR_SERVER_TOKEN_KEY_MAX      64
+#define BDGR_SERVER_TOKEN_NONCE        16
+#define BDGR_SERVER_TOKEN_TAG          16
+#define BDGR_SERVER_TOKEN_AUDIENCE_MAX 256
+#define BDGR_SERVER_TOKEN_SKEW         30
+#define BDGR_SERVER_TOKEN_HEADER       ( 1 + 4 + 8 + BDGR_SERVER_TOKEN_NONCE )
+#define BDGR_SERVER_TOKEN_OVERHEAD     \
+    ( BDGR_SERVER_TOKEN_HEADER + BDGR_SERVER_TOKEN_TAG )
+
+/*
+  A server token is a version byte, the id of the server key, the issue
+  time and a random nonce, followed by the audience, if any, and a
+  truncated HMAC-SHA256 over all of it.  Nothing is kept per token:
+  whichever server holds the key can tell that it was issued by one of
+  its peers and how long ago.  Key ids are taken from the hash of the key
+  as for session tickets, and the three keys before the latest one keep
+  checking the tokens they issued.
+*/
+struct bdgr_server_token_key {
+    uint32_t          id;
+    unsigned long int len;
+    unsigned char     key[ BDGR_SERVER_TOKEN_KEY_MAX ];
+};
+
+static struct {
+    struct bdgr_server_token_key keys[ BDGR_SERVER_TOKEN_KEYS ];
+    unsigned int                 count;
+    unsigned int                 current;
+    int                          sha256;
+    unsigned long int            max_age;
+    unsigned long int            audience_len;
+    char                         audience[ BDGR_SERVER_TOKEN_AUDIENCE_MAX ];
+    pthread_mutex_t              lock;
+} bdgr_g_server_token = { { { 0, 0, { 0 } } }, 0, 0, -1, 0, 0, { 0 },
+                          PTHREAD_MUTEX_INITIALIZER };
+
+/* Called with the server tokens locked */
+static int bdgr_server_token_init()
+{
+    if( bdgr_g_server_token.sha256 != -1 ) {
+        return bdgr_check( 0, bdgr_no_err, __LINE__ );
+    }
+    if( bdgr_check( register_hash( &sha256_desc ) == -1,
+                    bdgr_register_hash_err, __LINE__ )) {
+        return bdgr_error();
+    }
+    bdgr_g_server_token.sha256 = find_hash( "sha256" );
+    return bdgr_error();
+}
+
+/* Called with the server tokens locked */
+static int bdgr_server_token_key_put(
+    const unsigned char* const key,
+    const unsigned long int key_len
+)
+{
+    unsigned char hash[ 32 ];
+    unsigned long int hash_len = sizeof( hash );
+    struct bdgr_server_token_key* slot;
+
+    bdgr_check( key_len < 16 || key_len > BDGR_SERVER_TOKEN_KEY_MAX,
+                bdgr_server_token_key_err, __LINE__ );
+    if( bdgr_error() || bdgr_server_token_init() ) {
+        return bdgr_error();
+    }
+    if( bdgr_crypt( hash_memory( bdgr_g_server_token.sha256, key, key_len,
+                                 hash, &hash_len ),
+                    __LINE__ ) != CRYPT_OK ) {
+        return bdgr_error();
+    }
+
+    /* Overwrites the oldest key */
+    if( bdgr_g_server_token.count ) {
+        bdgr_g_server_token.current =
+            ( bdgr_g_server_token.current + 1 ) % BDGR_SERVER_TOKEN_KEYS;
+    }
+    if( bdgr_g_server_token.count < BDGR_SERVER_TOKEN_KEYS ) {
+        bdgr_g_server_token.count++;
+    }
+    slot = &bdgr_g_server_token.keys[ bdgr_g_server_token.current ];
+    slot->id = (uint32_t)hash[0] << 24 | (uint32_t)hash[1] << 16 |
+        (uint32_t)hash[2] << 8 | hash[3];
+    slot->len = key_len;
+    memset( slot->key, 0, sizeof( slot->key ));
+    memcpy( slot->key, key, key_len );
+    return bdgr_error();
+}
+
+int bdgr_server_token_key_add(
+    const unsigned char* const key,
+    const unsigned long int key_len
+)
+{
+    pthread_mutex_lock( &bdgr_g_server_token.lock );
+    bdgr_server_token_key_put( key, key_len );
+    pthread_mutex_unlock( &bdgr_g_server_token.lock );
+    return bdgr_error();
+}
+
+/* Called with the server tokens locked */
+static int bdgr_server_token_rotate_locked()
+{
+    unsigned char key[ 32 ];
+
+    if( !bdgr_check( rng_get_bytes( key, sizeof( key ), NULL ) !=
+                     sizeof( key ),
+                     bdgr_server_token_key_err, __LINE__ )) {
+        bdgr_server_token_key_put( key, sizeof( key ));
+    }
+    memset( key, 0, sizeof( key ));
+    return bdgr_error();
+}
+
+int bdgr_server_token_rotate()
+{
+    pthread_mutex_lock( &bdgr_g_server_token.lock );
+    bdgr_server_token_rotate_locked();
+    pthread_mutex_unlock( &bdgr_g_server_token.lock );
+    return bdgr_error();
+}
+
+int bdgr_server_token_make(
+    const char* const audience,
+    unsigned char* const token,
+    unsigned long int* const token_len
+)
+{
+    const unsigned long int audience_len =
+        audience == NULL ? 0 : strlen( audience );
+    const unsigned long int needed = BDGR_SERVER_TOKEN_OVERHEAD + audience_len;
+    struct bdgr_server_token_key key;
+    unsigned char tag[ 32 ];
+    unsigned long int tag_len = sizeof( tag );
+    uint64_t issued;
+    int sha256, i;
+
+    if( *token_len < needed ) {
+        *token_len = needed;
+        bdgr_crypt( CRYPT_BUFFER_OVERFLOW, __LINE__ );
+        return bdgr_error();
+    }
+
+    /* A server that never set a key gets a random one */
+    pthread_mutex_lock( &bdgr_g_server_token.lock );
+    if( !bdgr_server_token_init() && !bdgr_g_server_token.count ) {
+        bdgr_server_token_rotate_locked();
+    }
+    key = bdgr_g_server_token.keys[ bdgr_g_server_token.current ];
+    sha256 = bdgr_g_server_token.sha256;
+    pthread_mutex_unlock( &bdgr_g_server_token.lock );
+    if( bdgr_error() ) {
+        goto bdgr_server_token_make_free;
+    }
+
+    issued = (uint64_t)time( NULL );
+    token[0] = BDGR_SERVER_TOKEN_VERSION;
+    for( i = 0; i < 4; i++ ) {
+        token[ 1 + i ] = (unsigned char)( key.id >> ( 24 - 8 * i ));
+    }
+    for( i = 0; i < 8; i++ ) {
+        token[ 5 + i ] = (unsigned char)( issued >> ( 56 - 8 * i ));
+    }
+    bdgr_check( rng_get_bytes( token + 13, BDGR_SERVER_TOKEN_NONCE, NULL ) !=
+                BDGR_SERVER_TOKEN_NONCE,
+                bdgr_server_token_key_err, __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_server_token_make_free;
+    }
+    if( audience_len ) {
+        memcpy( token + BDGR_SERVER_TOKEN_HEADER, audience, audience_len );
+    }
+
+    bdgr_crypt( hmac_memory( sha256, key.key, key.len,
+                             token, BDGR_SERVER_TOKEN_HEADER + audience_len,
+                             tag, &tag_len ),
+                __LINE__ );
+    if( bdgr_error() ) {
+        goto bdgr_server_token_make_free;
+    }
+    memcpy( token + BDGR_SERVER_TOKEN_HEADER + audience_len,
+            tag, BDGR_SERVER_TOKEN_TAG );
+    *token_len = needed;
+
+ bdgr_server_token_make_free:
+
+    memset( &key, 0, sizeof( key ));
+    return bdgr_error();
+}
+
+/*
+  Everything short of the HMAC is checked first, so that most garbage is
+  turned away for the price of a few compares.
+*/
+static int bdgr_server_token_test(
+    const unsigned char* const token,
+    const unsigned long int token_len,
+    const unsigned long int max_age,
+    const char* const audience,
+    const unsigned long int audience_len
+)
+{
+    struct bdgr_server_token_key key;
+    unsigned char tag[ 32 ];
+    unsigned long int tag_len = sizeof( tag );
+    const uint64_t now = (uint64_t)time( NULL );
+    uint32_t key_id = 0;
+    uint64_t issued = 0;
+    unsigned int i, found = 0;
+    int sha256;
+
+    bdgr_check( token_len < BDGR_SERVER_TOKEN_OVERHEAD ||
+                token[0] != BDGR_SERVER_TOKEN_VERSION,
+                bdgr_server_token_invalid_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    bdgr_check( audience != NULL &&
+                ( token_len - BDGR_SERVER_TOKEN_OVERHEAD != audience_len ||
+                  memcmp( token + BDGR_SERVER_TOKEN_HEADER,
+                          audience, audience_len )),
+                bdgr_server_token_invalid_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+    for( i = 0; i < 8; i++ ) {
+        issued = issued << 8 | token[ 5 + i ];
+    }
+    bdgr_check( issued > now + BDGR_SERVER_TOKEN_SKEW ||
+                ( max_age && issued + max_age <= now ),
+                bdgr_server_token_expired_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+
+    for( i = 0; i < 4; i++ ) {
+        key_id = key_id << 8 | token[ 1 + i ];
+    }
+    pthread_mutex_lock( &bdgr_g_server_token.lock );
+    for( i = 0; i < bdgr_g_server_token.count && !found; i++ ) {
+        if( bdgr_g_server_token.keys[ i ].id == key_id ) {
+            key = bdgr_g_server_token.keys[ i ];
+            found = 1;
+        }
+    }
+    sha256 = bdgr_g_server_token.sha256;
+    pthread_mutex_unlock( &bdgr_g_server_token.lock );
+    bdgr_check( !found, bdgr_server_token_invalid_err, __LINE__ );
+    if( bdgr_error() ) {
+        return bdgr_error();
+    }
+
+    if( bdgr_crypt( hmac_memory( sha256, key.key, key.len,
+                                 token, token_len - BDGR_SERVER_TOKEN_TAG,
+                                 tag, &tag_len ),
+                    __LINE__ ) == CRYPT_OK ) {
+        bdgr_check( mem_neq( tag, token + token_len - BDGR_SERVER_TOKEN_TAG,
+                             BDGR_SERVER_TOKEN_TAG ),
+                    bdgr_server_token_invalid_err, __LINE__ );
+    }
+    memset( &key, 0, sizeof( key ));
+    return bdgr_error();
+}
+
+int bdgr_server_token_check(
+    const unsigned char* const token,
+    const unsigned long int token_len,
+    const unsigned long int max_age,
+    const char* const audience
+)
+{
+    return bdgr_server_token_test(
+        token, token_len, max_age,
+        audience, audience == NULL ? 0 : strlen( audience ));
+}
+
+int bdgr_server_token_require(
+    const unsigned long int max_age,
+    const char* const audience
+)
+{
+    const unsigned long int audience_len =
+        audience == NULL ? 0 : strlen( audience );
+
+    if( bdgr_check( audience_len >= BDGR_SERVER_TOKEN_AUDIENCE_MAX,
+                    bdgr_server_token_audience_err, __LINE__ )) {
+        return bdgr_error();
+    }
+    pthread_mutex_lock( &bdgr_g_server_token.lock );
+    bdgr_g_server_token.max_age = max_age;
+    bdgr_g_server_token.audience_len = audience_len;
+    if( audience_len ) {
+        memcpy( bdgr_g_server_token.audience, audience, audience_len );
+    }
+    pthread_mutex_unlock( &bdgr_g_server_token.lock );
+    return bdgr_error();
+}
+
+int bdgr_server_token_admit(
+    const unsigned char* const token,
+    const unsigned long int token_len
+)
+{
+    char audience[ BDGR_SERVER_TOKEN_AUDIENCE_MAX ];
+    unsigned long int max_age, audience_len;
+
+    pthread_mutex_lock( &bdgr_g_server_token.lock );
+    max_age = bdgr_g_server_token.max_age;
+    audience_len = bdgr_g_server_token.audience_len;
+    memcpy( audience, bdgr_g_server_token.audience, audience_len );
+    pthread_mutex_unlock( &bdgr_g_server_token.lock );
+
+    if( !max_age ) {
+        return bdgr_check( 0, bdgr_no_err, __LINE__ );
+    }
+    return bdgr_server_token_test( token, token_len, max_age,
+                                   audience_len ? audience : NULL,
+                                   audience_len );
+}
@@ -0,0 +1,32 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_TOKEN_H
+#define BADGER_TOKEN_H
+
+/*
+  Checks the token of a badge against the requirements set with
+  bdgr_server_token_require(), if any, before anything is fetched.
+*/
+int bdgr_server_token_admit(
+    const unsigned char* token,
+    unsigned long int token_len
+);
+
+#endif
@@ -20,37 +20,376 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <jansson.h>
 #include <badger.h>
 
 #define BUF_SIZE 1024
+#define CACHE_SLOTS 65536
+#define WINDOW_PER_JOB 64
 
 void usage()
 {
     fprintf(
         stderr,
-        "Usage: badger_verify <badge-string>\n"
+        "Usage: badger_verify [options] [<badge-string>]\n"
+        "Options:\n"
+        "-s, --stream     verify newline-delimited badges from stdin\n"
+        "-j, --jobs       <workers>, implies --stream\n"
+        "-u, --unordered  print results as they finish, tagged with their line\n"
+        "-c, --cache      <key-cache-file>\n"
+        "-l, --listen     <host:port>, answer key lookups of peers\n"
+        "-p, --peers      <host:port,...>, ask the owning peer for keys\n"
+        "-n, --node       <n>, this node is the nth of --peers, by default\n"
+        "                 the one spelled like --listen\n"
     );
 }
 
+/*
+  A badge read from stdin and, once verified, its result.  Slots are
+  reused round robin, so at most window lines are in flight.
+*/
+struct verify_slot {
+    char*             line;
+    unsigned long int lineno;
+    char*             result;
+    int               done;
+};
+
+struct verify_stream {
+    struct verify_slot* slots;
+    unsigned long int   window;
+    unsigned long int   read;
+    unsigned long int   claimed;
+    unsigned long int   printed;
+    unsigned long int   failed;
+    int                 eof;
+    int                 ordered;
+    pthread_mutex_t     lock;
+    pthread_cond_t      work_cond;
+    pthread_cond_t      space_cond;
+};
+
+static char* read_all( FILE* const file )
+{
+    size_t size = BUF_SIZE, len = 0, n;
+    char* data = malloc( size ), * grown;
+
+    while( data != NULL &&
+           ( n = fread( data + len, 1, size - len - 1, file )) > 0 ) {
+        len += n;
+        if( size - len - 1 == 0 ) {
+            size *= 2;
+            grown = realloc( data, size );
+            if( grown == NULL ) {
+                free( data );
+            }
+            data = grown;
+        }
+    }
+    if( data != NULL ) {
+        data[ len ] = '\0';
+    }
+    return data;
+}
+
+/*
+  Verifies one badge and returns its result as a line of JSON, setting
+  failed unless the signature matched.
+*/
+static char* verify_line(
+    const char* const line,
+    const unsigned long int lineno,
+    const int tagged,
+    int* const failed
+)
+{
+    bdgr_badge badge;
+    json_t* result;
+    char* string;
+    int verified = 0;
+    int err;
+
+    err = bdgr_badge_import( line, &badge );
+    if( !err ) {
+        err = bdgr_badge_verify( &badge, &verified );
+        bdgr_badge_free( &badge );
+    }
+    *failed = err || !verified;
+
+    if( err ) {
+        result = json_pack( "{ss}", "error", bdgr_error_string( err ));
+    } else {
+        result = json_pack( "{sb}", "verified", verified );
+    }
+    if( result == NULL ) {
+        return NULL;
+    }
+    if( tagged ) {
+        json_object_set_new( result, "line", json_integer( lineno ));
+    }
+    string = json_dumps( result, JSON_COMPACT | JSON_PRESERVE_ORDER );
+    json_decref( result );
+    return string;
+}
+
+static void verify_print( const char* const result )
+{
+    puts( result ? result : "{\"error\":\"Failed to allocate memory\"}" );
+}
+
+static void* verify_worker( void* const _stream )
+{
+    struct verify_stream* const stream = _stream;
+    struct verify_slot* slot;
+    unsigned long int seq;
+    char* result;
+    int failed;
+
+    pthread_mutex_lock( &stream->lock );
+    while( 1 ) {
+
+        while( stream->claimed == stream->read && !stream->eof ) {
+            pthread_cond_wait( &stream->work_cond, &stream->lock );
+        }
+        if( stream->claimed == stream->read ) {
+            break;
+        }
+        seq = stream->claimed++;
+        slot = &stream->slots[ seq % stream->window ];
+        pthread_mutex_unlock( &stream->lock );
+
+        result = verify_line( slot->line, slot->lineno,
+                              !stream->ordered, &failed );
+
+        pthread_mutex_lock( &stream->lock );
+        free( slot->line );
+        slot->line = NULL;
+        slot->result = result;
+        slot->done = 1;
+        stream->failed += failed;
+        if( !stream->ordered ) {
+            verify_print( slot->result );
+            free( slot->result );
+            slot->result = NULL;
+        }
+
+        /* Retire finished lines in input order to make room */
+        while( stream->printed < stream->claimed ) {
+            slot = &stream->slots[ stream->printed % stream->window ];
+            if( !slot->done ) {
+                break;
+            }
+            if( stream->ordered ) {
+                verify_print( slot->result );
+                free( slot->result );
+                slot->result = NULL;
+            }
+            slot->done = 0;
+            stream->printed++;
+        }
+        pthread_cond_signal( &stream->space_cond );
+        
+    }
+    pthread_mutex_unlock( &stream->lock );
+    return NULL;
+}
+
+static int verify_stream( const unsigned long int jobs, const int ordered )
+{
+    struct verify_stream stream;
+    pthread_t* const workers = malloc( jobs * sizeof( pthread_t ));
+    struct verify_slot* slot;
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    unsigned long int lineno = 0, i;
+
+    memset( &stream, 0, sizeof( stream ));
+    stream.window = jobs * WINDOW_PER_JOB;
+    stream.slots = calloc( stream.window, sizeof( struct verify_slot ));
+    stream.ordered = ordered;
+    if( workers == NULL || stream.slots == NULL ) {
+        fprintf( stderr, "error starting workers: out of memory\n" );
+        exit( 1 );
+    }
+    pthread_mutex_init( &stream.lock, NULL );
+    pthread_cond_init( &stream.work_cond, NULL );
+    pthread_cond_init( &stream.space_cond, NULL );
+
+    for( i = 0; i < jobs; i++ ) {
+        if( pthread_create( &workers[ i ], NULL, verify_worker, &stream )) {
+            fprintf( stderr, "error starting workers\n" );
+            exit( 1 );
+        }
+    }
+
+    while( ( len = getline( &line, &size, stdin )) != -1 ) {
+        lineno++;
+        while( len > 0 &&
+               ( line[ len - 1 ] == '\n' || line[ len - 1 ] == '\r' )) {
+            line[ --len ] = '\0';
+        }
+        if( len == 0 ) {
+            continue;
+        }
+
+        pthread_mutex_lock( &stream.lock );
+        while( stream.read - stream.printed >= stream.window ) {
+            pthread_cond_wait( &stream.space_cond, &stream.lock );
+        }
+        slot = &stream.slots[ stream.read % stream.window ];
+        slot->line = line;
+        slot->lineno = lineno;
+        stream.read++;
+        pthread_cond_signal( &stream.work_cond );
+        pthread_mutex_unlock( &stream.lock );
+
+        /* The slot owns the line now */
+        line = NULL;
+        size = 0;
+    }
+    free( line );
+
+    pthread_mutex_lock( &stream.lock );
+    stream.eof = 1;
+    pthread_cond_broadcast( &stream.work_cond );
+    pthread_mutex_unlock( &stream.lock );
+
+    for( i = 0; i < jobs; i++ ) {
+        pthread_join( workers[ i ], NULL );
+    }
+
+    pthread_cond_destroy( &stream.space_cond );
+    pthread_cond_destroy( &stream.work_cond );
+    pthread_mutex_destroy( &stream.lock );
+    free( stream.slots );
+    free( workers );
+    return stream.failed > 0;
+}
+
 int main( const int argc, char* const* argv )
 {
 
     int err;
     char* badge_string;
+    char* cache = NULL, * listen_address = NULL, * peers = NULL, * peer;
+    const char** peer_list = NULL;
+    unsigned long int peer_count = 0;
+    long int self = -1, node = 0;
     bdgr_badge badge;
     int verified;
+    int stream = 0, ordered = 1;
+    long int jobs = 1;
+    int c;
+
+    while (1) {
+        static struct option long_options[] = {
+            { "stream", no_argument, 0, 's' },
+            { "jobs", required_argument, 0, 'j' },
+            { "unordered", no_argument, 0, 'u' },
+            { "cache", required_argument, 0, 'c' },
+            { "listen", required_argument, 0, 'l' },
+            { "peers", required_argument, 0, 'p' },
+            { "node", required_argument, 0, 'n' },
+            { 0, 0, 0, 0 }
+        };
+        int option_index = 0;
+        c = getopt_long( argc, argv, "sj:uc:l:p:n:", long_options, &option_index);
+        if (c == -1)
+            break;
+        switch(c) {
+        case 's':
+            stream = 1;
+            break;
+        case 'j':
+            stream = 1;
+            jobs = strtol( optarg, NULL, 10 );
+            break;
+        case 'u':
+            ordered = 0;
+            break;
+        case 'c':
+            cache = optarg;
+            break;
+        case 'l':
+            listen_address = optarg;
+            break;
+        case 'p':
+            peers = optarg;
+            break;
+        case 'n':
+            node = strtol( optarg, NULL, 10 );
+            break;
+        case '?':
+            usage();
+            exit( 1 );
+        default:
+            abort();
+        }
+    }
+
+    if( jobs < 1 || ( stream && optind != argc ) || optind + 1 < argc ) {
+        usage();
+        exit( 1 );
+    }
+
+    if( peers != NULL ) {
+        peer_list = malloc( ( strlen( peers ) / 2 + 1 ) * sizeof( char* ));
+        for( peer = strtok( peers, "," ); peer != NULL;
+             peer = strtok( NULL, "," )) {
+            if( listen_address != NULL && !strcmp( peer, listen_address )) {
+                self = peer_count;
+            }
+            peer_list[ peer_count++ ] = peer;
+        }
+        if( node ) {
+            self = node - 1;
+        }
+        err = bdgr_peers_set( peer_list, peer_count, self );
+        free( peer_list );
+        if( err ) {
+            fprintf( stderr,
+                     "error setting peers: %s\n",
+                     bdgr_error_string( err ));
+            exit( err );
+        }
+    }
+    if( listen_address != NULL ) {
+        err = bdgr_peer_listen( listen_address );
+        if( err ) {
+            fprintf( stderr,
+                     "error listening for peers: %s\n",
+                     bdgr_error_string( err ));
+            exit( err );
+        }
+    }
+
+    /* Workers share one key cache, kept in memory unless a file is given */
+    if( stream || cache != NULL || listen_address != NULL ) {
+        err = bdgr_key_cache_open( cache, CACHE_SLOTS, 0 );
+        if( err ) {
+            fprintf( stderr,
+                     "error opening key cache: %s\n",
+                     bdgr_error_string( err ));
+            exit( err );
+        }
+    }
+
+    if( stream ) {
+        err = verify_stream( (unsigned long int)jobs, ordered );
+        bdgr_key_cache_close();
+        return err;
+    }
 
-    if( argc == 2 ) {
-        badge_string = argv[1];
+    if( optind < argc ) {
+        badge_string = argv[ optind ];
     } else {
-        char buffer[BUF_SIZE];
-        size_t badge_len = 1;
-        badge_string = malloc( BUF_SIZE );
-        badge_string[0] = '\0';
-        while( fgets( buffer, BUF_SIZE, stdin )) {
-            badge_len += strlen( buffer );
-            badge_string = realloc( badge_string, badge_len );
-            strcat( badge_string, buffer );
+        badge_string = read_all( stdin );
+        if( badge_string == NULL ) {
+            fprintf( stderr, "error reading badge: out of memory\n" );
+            exit( 1 );
         }
     }
 
@@ -0,0 +1,111 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BADGER_TEST_H
+#define BADGER_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <badger.h>
+
+/* Checks that failed, the test exiting nonzero if there are any */
+static int bdgr_test_failed = 0;
+
+/* Reports cond if it doesn't hold and carries on, evaluating to it */
+#define bdgr_test( cond )                                           \
+    (( cond ) ? 1 :                                                 \
+     ( fprintf( stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond ), \
+       bdgr_test_failed++, 0 ))
+
+/* A record holding the public part of key as its dsa, to be freed */
+static inline char* bdgr_test_record( const bdgr_key* const key )
+{
+    char* encoded, * record = NULL;
+
+    if( !bdgr_key_encode_public( key, &encoded )) {
+        record = malloc( strlen( encoded ) + 16 );
+        if( record != NULL ) {
+            sprintf( record, "{\"dsa\":\"%s\"}", encoded );
+        }
+        bdgr_free( encoded );
+    }
+    return record;
+}
+
+/* A badge for id, naming kid unless NULL, with token signed by key */
+static inline int bdgr_test_badge(
+    const char* const id,
+    const char* const kid,
+    const bdgr_key* const key,
+    const char* const token,
+    bdgr_badge* const badge
+)
+{
+    unsigned char signature[ 128 ];
+    unsigned long int signature_len = sizeof( signature );
+    int err;
+
+    err = bdgr_token_sign( (const unsigned char*)token, strlen( token ), key,
+                           signature, &signature_len );
+    if( !err ) {
+        err = bdgr_badge_make_kid( id, kid, (const unsigned char*)token,
+                                   strlen( token ), signature, signature_len,
+                                   badge );
+    }
+    return err;
+}
+
+/*
+  Verifies a badge for id signed by key, within deadline_ms unless
+  negative.  Returns whether it verified, and its error in err unless NULL.
+*/
+static inline int bdgr_test_verifies(
+    const char* const id,
+    const char* const kid,
+    const bdgr_key* const key,
+    const long int deadline_ms,
+    int* const err
+)
+{
+    struct timespec deadline;
+    bdgr_badge badge;
+    int verified = 0, result;
+
+    result = bdgr_test_badge( id, kid, key, "badger test", &badge );
+    if( !result ) {
+        clock_gettime( CLOCK_MONOTONIC, &deadline );
+        deadline.tv_sec += deadline_ms / 1000;
+        deadline.tv_nsec += deadline_ms % 1000 * 1000000;
+        if( deadline.tv_nsec >= 1000000000 ) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        result = bdgr_badge_verify_deadline(
+            &badge, deadline_ms < 0 ? NULL : &deadline, &verified );
+        bdgr_badge_free( &badge );
+    }
+    if( err != NULL ) {
+        *err = result;
+    }
+    return !result && verified;
+}
+
+#endif
@@ -0,0 +1,228 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs verifications on an event loop against a stub scheme whose lookups
+  are completed by the test: verifications of one URL share a lookup, a
+  cancelled one is never reported and cancels a lookup nobody else waits
+  for, deadlines time verifications out, and lookup errors are reported.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <poll.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+#define BDGR_STUB_PENDING 8
+
+static struct {
+    bdgr_lookup* pending[ BDGR_STUB_PENDING ];
+    int          starts;
+    int          cancels;
+} bdgr_stub;
+
+static bdgr_key bdgr_test_signer;
+static char* bdgr_test_signed = NULL;
+
+/* Leaves the lookup for the test to complete */
+static int bdgr_stub_start( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)ctx;
+    if( bdgr_stub.starts == BDGR_STUB_PENDING ) {
+        return bdgr_fetch_err;
+    }
+    bdgr_stub.pending[ bdgr_stub.starts++ ] = lookup;
+    return 0;
+}
+
+static void bdgr_stub_cancel( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)lookup;
+    (void)ctx;
+    bdgr_stub.cancels++;
+}
+
+/* Completes the lookup started last, with the record unless err */
+static void bdgr_stub_answer( const int err )
+{
+    bdgr_lookup* const lookup = bdgr_stub.pending[ bdgr_stub.starts - 1 ];
+
+    if( !err ) {
+        bdgr_lookup_write( lookup, bdgr_test_signed,
+                           strlen( bdgr_test_signed ));
+    }
+    bdgr_lookup_complete( lookup, err );
+}
+
+struct bdgr_test_outcome {
+    int called;
+    int err;
+    int verified;
+};
+
+static int bdgr_test_reported = 0;
+
+static void bdgr_test_done(
+    bdgr_verify* const verify,
+    const int err,
+    const int verified,
+    void* const ctx
+)
+{
+    struct bdgr_test_outcome* const outcome = ctx;
+    (void)verify;
+
+    outcome->called++;
+    outcome->err = err;
+    outcome->verified = verified;
+    bdgr_test_reported++;
+}
+
+/* Starts verifying a badge for id, within deadline_ms unless negative */
+static bdgr_verify* bdgr_test_start(
+    const char* const id,
+    const long int deadline_ms,
+    struct bdgr_test_outcome* const outcome
+)
+{
+    struct timespec deadline;
+    bdgr_badge badge;
+    bdgr_verify* verify = NULL;
+
+    memset( outcome, 0, sizeof( *outcome ));
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    deadline.tv_sec += deadline_ms / 1000;
+    deadline.tv_nsec += deadline_ms % 1000 * 1000000;
+    if( deadline.tv_nsec >= 1000000000 ) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    if( !bdgr_test_badge( id, NULL, &bdgr_test_signer, "badger test",
+                          &badge )) {
+        bdgr_test( bdgr_verify_start( &badge,
+                                      deadline_ms < 0 ? NULL : &deadline,
+                                      bdgr_test_done, outcome,
+                                      &verify ) == 0 );
+        bdgr_badge_free( &badge );
+    }
+    return verify;
+}
+
+/*
+  Runs the loop as an application would until reports verifications have
+  been reported in all, or for at most max_ms.
+*/
+static void bdgr_test_loop( const int reports, const long int max_ms )
+{
+    struct pollfd fd;
+    long int timeout, waited = 0;
+    int ready;
+
+    fd.fd = bdgr_verify_fd();
+    fd.events = POLLIN;
+    while( bdgr_test_reported < reports && waited < max_ms ) {
+        timeout = bdgr_verify_timeout();
+        if( timeout < 0 || timeout > 50 ) {
+            timeout = 50;
+        }
+        ready = poll( &fd, 1, (int)timeout );
+        waited += timeout;
+        bdgr_test( bdgr_verify_process( ready > 0 ? fd.fd : -1,
+                                        ready > 0 ? fd.revents : 0 ) == 0 );
+    }
+}
+
+int main()
+{
+    struct bdgr_test_outcome first, second;
+    bdgr_verify* verify;
+    long int timeout;
+
+    if( !bdgr_test( bdgr_key_generate( "async test",
+                                       &bdgr_test_signer ) == 0 ) ||
+        !bdgr_test( ( bdgr_test_signed = bdgr_test_record(
+                          &bdgr_test_signer )) != NULL ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "stub:", bdgr_stub_start,
+                                                   bdgr_stub_cancel,
+                                                   NULL ) == 0 ) ||
+        !bdgr_test( bdgr_verify_fd() >= 0 )) {
+        return 1;
+    }
+
+    /* Two verifications, one lookup, both reported once it lands */
+    bdgr_test( bdgr_test_start( "stub:alice", -1, &first ) != NULL );
+    bdgr_test( bdgr_test_start( "stub:alice", -1, &second ) != NULL );
+    bdgr_test( bdgr_stub.starts == 1 );
+    bdgr_test( bdgr_verify_timeout() == -1 );
+    bdgr_test_loop( 1, 100 );
+    bdgr_test( bdgr_test_reported == 0 );
+    bdgr_stub_answer( 0 );
+    bdgr_test_loop( 2, 1000 );
+    bdgr_test( first.called == 1 && first.err == 0 && first.verified );
+    bdgr_test( second.called == 1 && second.err == 0 && second.verified );
+
+    /* Cancelling one of two leaves the lookup to the other */
+    bdgr_test_reported = 0;
+    verify = bdgr_test_start( "stub:bob", -1, &first );
+    bdgr_test( bdgr_test_start( "stub:bob", -1, &second ) != NULL );
+    bdgr_test( verify != NULL && bdgr_stub.starts == 2 );
+    bdgr_verify_cancel( verify );
+    bdgr_test( bdgr_stub.cancels == 0 );
+    bdgr_stub_answer( 0 );
+    bdgr_test_loop( 1, 1000 );
+    bdgr_test( first.called == 0 );
+    bdgr_test( second.called == 1 && second.verified );
+
+    /* Cancelling the last cancels the lookup, which may still land */
+    bdgr_test_reported = 0;
+    verify = bdgr_test_start( "stub:carol", -1, &first );
+    bdgr_test( verify != NULL && bdgr_stub.starts == 3 );
+    bdgr_verify_cancel( verify );
+    bdgr_test( bdgr_stub.cancels == 1 );
+    bdgr_stub_answer( 0 );
+    bdgr_test_loop( 1, 200 );
+    bdgr_test( bdgr_test_reported == 0 && first.called == 0 );
+
+    /* Timed out at its deadline, which the loop is told about */
+    bdgr_test( bdgr_test_start( "stub:dave", 100, &first ) != NULL );
+    bdgr_test( bdgr_stub.starts == 4 );
+    timeout = bdgr_verify_timeout();
+    bdgr_test( timeout >= 0 && timeout <= 100 );
+    bdgr_test_loop( 1, 1000 );
+    bdgr_test( first.called == 1 && first.err == bdgr_timeout_err &&
+               !first.verified );
+    bdgr_test( bdgr_stub.cancels == 2 );
+    bdgr_stub_answer( 0 );
+    bdgr_test_loop( 2, 100 );
+
+    /* A failed lookup is reported with its error */
+    bdgr_test_reported = 0;
+    bdgr_test( bdgr_test_start( "stub:erin", -1, &first ) != NULL );
+    bdgr_stub_answer( bdgr_http_not_found_err );
+    bdgr_test_loop( 1, 1000 );
+    bdgr_test( first.called == 1 && first.err == bdgr_http_not_found_err &&
+               !first.verified );
+
+    free( bdgr_test_signed );
+    bdgr_key_free( &bdgr_test_signer );
+    return bdgr_test_failed != 0;
+}
@@ -0,0 +1,148 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs the file backed key cache across restarts: a key fetched once is
+  found by a new process opening the same file without asking the scheme
+  handler, a reopened file keeps the geometry it was created with,
+  processes creating the file together all get a good cache, and a file
+  that isn't a cache is refused rather than overwritten.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <badger.h>
+#include "test.h"
+
+static const char* bdgr_stub_record = NULL;
+static int bdgr_stub_fetches = 0;
+
+static int bdgr_stub_handle( const char* const url, const char** const record )
+{
+    (void)url;
+    bdgr_stub_fetches++;
+    *record = bdgr_stub_record;
+    return 0;
+}
+
+/*
+  Verifies id in a process of its own, as a restarted server would, with
+  the cache in path.  Returns 0 if it verified without any fetch.
+*/
+static int bdgr_test_restart(
+    const char* const path,
+    const char* const id,
+    const bdgr_key* const key
+)
+{
+    int status;
+    pid_t pid = fork();
+
+    if( pid == 0 ) {
+        bdgr_stub_fetches = 0;
+        _exit( bdgr_key_cache_open( path, 16, 0 ) ||
+               !bdgr_test_verifies( id, NULL, key, -1, NULL ) ||
+               bdgr_stub_fetches != 0 );
+    }
+    return pid < 0 || waitpid( pid, &status, 0 ) != pid ||
+        !WIFEXITED( status ) ? -1 : WEXITSTATUS( status );
+}
+
+int main()
+{
+    char scheme[] = "stub:", path[ 64 ], junk[ 8192 ];
+    bdgr_key key;
+    char* record;
+    pid_t pids[ 8 ];
+    int gate[ 2 ], status, fd, i;
+
+    sprintf( path, "/tmp/badger-test-cache-%d", (int)getpid() );
+    unlink( path );
+    if( !bdgr_test( bdgr_key_generate( "cache test", &key ) == 0 ) ||
+        !bdgr_test( ( record = bdgr_test_record( &key )) != NULL ) ||
+        !bdgr_test( bdgr_scheme_handler_add( scheme,
+                                             bdgr_stub_handle ) == 0 )) {
+        return 1;
+    }
+    bdgr_stub_record = record;
+
+    /* Fetched once, then found in the cache */
+    bdgr_test( bdgr_key_cache_open( path, 64, 0 ) == 0 );
+    bdgr_test( bdgr_test_verifies( "stub:alice", NULL, &key, -1, NULL ));
+    bdgr_test( bdgr_test_verifies( "stub:alice", NULL, &key, -1, NULL ));
+    bdgr_test( bdgr_stub_fetches == 1 );
+    bdgr_key_cache_close();
+
+    /* A new process, asking for fewer slots, finds it on disk */
+    bdgr_test( bdgr_test_restart( path, "stub:alice", &key ) == 0 );
+    bdgr_test( bdgr_test_restart( path, "stub:bob", &key ) == 1 );
+
+    /* So does this one once it opens the file again */
+    bdgr_stub_fetches = 0;
+    bdgr_test( bdgr_key_cache_open( path, 64, 0 ) == 0 );
+    bdgr_test( bdgr_test_verifies( "stub:alice", NULL, &key, -1, NULL ));
+    bdgr_test( bdgr_stub_fetches == 0 );
+
+    /* Without the cache, every verification fetches */
+    bdgr_key_cache_close();
+    bdgr_test( bdgr_test_verifies( "stub:alice", NULL, &key, -1, NULL ));
+    bdgr_test( bdgr_stub_fetches == 1 );
+    unlink( path );
+
+    /* Processes racing to create it all open it, whatever size they ask */
+    bdgr_test( pipe( gate ) == 0 );
+    for( i = 0; i < 8; i++ ) {
+        pids[ i ] = fork();
+        if( pids[ i ] == 0 ) {
+            close( gate[1] );
+            _exit( read( gate[0], junk, 1 ) != 0 ||
+                   bdgr_key_cache_open( path, 16 + i, 0 ) != 0 );
+        }
+    }
+    close( gate[0] );
+    close( gate[1] );
+    for( i = 0; i < 8; i++ ) {
+        bdgr_test( pids[ i ] > 0 && waitpid( pids[ i ], &status, 0 ) > 0 &&
+                   WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+    }
+    bdgr_test( bdgr_key_cache_open( path, 64, 0 ) == 0 );
+    bdgr_key_cache_close();
+    unlink( path );
+
+    /* Something else under that name is left alone */
+    memset( junk, 'x', sizeof( junk ));
+    fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+    bdgr_test( fd != -1 && write( fd, junk, sizeof( junk )) ==
+               (ssize_t)sizeof( junk ));
+    close( fd );
+    bdgr_test( bdgr_key_cache_open( path, 64, 0 ) != 0 );
+    fd = open( path, O_RDONLY );
+    bdgr_test( fd != -1 && read( fd, junk, 8 ) == 8 &&
+               !memcmp( junk, "xxxxxxxx", 8 ));
+    close( fd );
+    unlink( path );
+
+    free( record );
+    bdgr_key_free( &key );
+    return bdgr_test_failed != 0;
+}
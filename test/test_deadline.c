@@ -0,0 +1,128 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs verification deadlines against a stub scheme that answers from a
+  thread of its own: handlers see the time remaining, a verification whose
+  lookup outlives the deadline times out on time and cancels the lookup,
+  and one already past its deadline fetches nothing.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+static struct {
+    const char* record;
+    long int    delay_ms;
+    long int    remaining_ms;
+    int         fetches;
+    int         cancels;
+    pthread_t   thread;
+} bdgr_stub;
+
+static void* bdgr_stub_answer( void* const arg )
+{
+    bdgr_lookup* const lookup = arg;
+
+    usleep( bdgr_stub.delay_ms * 1000 );
+    bdgr_lookup_write( lookup, bdgr_stub.record, strlen( bdgr_stub.record ));
+    bdgr_lookup_complete( lookup, 0 );
+    return NULL;
+}
+
+static int bdgr_stub_start( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)ctx;
+    bdgr_stub.fetches++;
+    bdgr_stub.remaining_ms = bdgr_deadline_remaining_ms();
+    return pthread_create( &bdgr_stub.thread, NULL, bdgr_stub_answer,
+                           lookup ) ? bdgr_thread_err : 0;
+}
+
+/* Lets the answer arrive late; the lookup is still valid until then */
+static void bdgr_stub_cancel( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)lookup;
+    (void)ctx;
+    bdgr_stub.cancels++;
+}
+
+/* Milliseconds since start */
+static long int bdgr_test_elapsed_ms( const struct timespec* const start )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - start->tv_sec ) * 1000 +
+        ( now.tv_nsec - start->tv_nsec ) / 1000000;
+}
+
+int main()
+{
+    struct timespec start;
+    bdgr_key key;
+    char* record;
+    int err;
+
+    if( !bdgr_test( bdgr_key_generate( "deadline test", &key ) == 0 ) ||
+        !bdgr_test( ( record = bdgr_test_record( &key )) != NULL ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "stub:", bdgr_stub_start,
+                                                   bdgr_stub_cancel,
+                                                   NULL ) == 0 )) {
+        return 1;
+    }
+    bdgr_stub.record = record;
+
+    /* Answered in time, with the handler told how long it has */
+    bdgr_test( bdgr_test_verifies( "stub:alice", NULL, &key, 2000, NULL ));
+    pthread_join( bdgr_stub.thread, NULL );
+    bdgr_test( bdgr_stub.fetches == 1 && bdgr_stub.cancels == 0 );
+    bdgr_test( bdgr_stub.remaining_ms > 0 &&
+               bdgr_stub.remaining_ms <= 2000 );
+
+    /* No deadline at all */
+    bdgr_test( bdgr_test_verifies( "stub:alice", NULL, &key, -1, NULL ));
+    pthread_join( bdgr_stub.thread, NULL );
+    bdgr_test( bdgr_stub.remaining_ms == -1 );
+
+    /* Answered too late: given up on at the deadline, and cancelled */
+    bdgr_stub.delay_ms = 1000;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    bdgr_test( !bdgr_test_verifies( "stub:bob", NULL, &key, 100, &err ));
+    bdgr_test( bdgr_test_elapsed_ms( &start ) < 500 );
+    bdgr_test( err == bdgr_timeout_err );
+    bdgr_test( bdgr_stub.cancels == 1 );
+    pthread_join( bdgr_stub.thread, NULL );
+
+    /* Already past it: nothing is fetched */
+    bdgr_stub.fetches = 0;
+    bdgr_test( !bdgr_test_verifies( "stub:carol", NULL, &key, 0, &err ));
+    bdgr_test( err == bdgr_timeout_err );
+    bdgr_test( bdgr_stub.fetches == 0 );
+
+    free( record );
+    bdgr_key_free( &key );
+    return bdgr_test_failed != 0;
+}
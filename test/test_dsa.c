@@ -0,0 +1,358 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Checks bdgr_dsa_verify_hash() against LibTomCrypt's dsa_verify_hash(),
+  which it must agree with on every signature, good or bad: keys in the
+  groups of the fixed width kernel and in larger ones, r and s out of
+  range, DER short of strict, and hashes shorter and longer than q.  Also
+  checks bdgr_dsa_sign_hash() against the vectors of RFC 6979, and that
+  bdgr_token_sign() gives one signature per key and token.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "../src/badger_dsa.h"
+#include "test.h"
+
+#define BDGR_TEST_KEYS       3
+#define BDGR_TEST_SIGNATURES 64
+
+static prng_state bdgr_test_prng;
+static int bdgr_test_wprng;
+
+static void bdgr_test_random( unsigned char* const out, unsigned long int len )
+{
+    while( len-- ) {
+        out[ len ] = (unsigned char)rand();
+    }
+}
+
+/* Same error, same outcome, and the outcome expected unless negative */
+static void bdgr_test_agree(
+    const unsigned char* const sig,
+    const unsigned long int siglen,
+    const unsigned char* const hash,
+    const unsigned long int hashlen,
+    dsa_key* const key,
+    const int expected
+)
+{
+    int stat = -1, ours = -1, err;
+
+    err = dsa_verify_hash( sig, siglen, hash, hashlen, &stat, key );
+    bdgr_test( bdgr_dsa_verify_hash( sig, siglen, hash, hashlen,
+                                     &ours, key ) == err );
+    bdgr_test( err != CRYPT_OK || ours == stat );
+    if( expected >= 0 ) {
+        bdgr_test( err == CRYPT_OK && ours == expected );
+    }
+}
+
+static void bdgr_test_pair(
+    void* const r,
+    void* const s,
+    const unsigned char* const hash,
+    const unsigned long int hashlen,
+    dsa_key* const key
+)
+{
+    unsigned char sig[ 256 ];
+    unsigned long int siglen = sizeof( sig );
+
+    if( bdgr_test( der_encode_sequence_multi(
+                       sig, &siglen,
+                       LTC_ASN1_INTEGER, 1UL, r,
+                       LTC_ASN1_INTEGER, 1UL, s,
+                       LTC_ASN1_EOL, 0UL, NULL ) == CRYPT_OK )) {
+        bdgr_test_agree( sig, siglen, hash, hashlen, key, -1 );
+    }
+}
+
+/*
+  Rewrites sig, whose length fits one byte, in DER short of strict: r with
+  a needless leading zero, a byte trailing, or the length in long form.
+*/
+static unsigned long int bdgr_test_loose(
+    const unsigned char* const sig,
+    const unsigned long int siglen,
+    const int variant,
+    unsigned char* const out
+)
+{
+    switch( variant ) {
+    case 0:
+        out[ 0 ] = 0x30;
+        out[ 1 ] = (unsigned char)( sig[ 1 ] + 1 );
+        out[ 2 ] = 0x02;
+        out[ 3 ] = (unsigned char)( sig[ 3 ] + 1 );
+        out[ 4 ] = 0x00;
+        memcpy( out + 5, sig + 4, siglen - 4 );
+        return siglen + 1;
+    case 1:
+        memcpy( out, sig, siglen );
+        out[ siglen ] = 0x00;
+        return siglen + 1;
+    default:
+        out[ 0 ] = 0x30;
+        out[ 1 ] = 0x81;
+        memcpy( out + 2, sig + 1, siglen - 1 );
+        return siglen + 1;
+    }
+}
+
+static void bdgr_test_key( dsa_key* const key )
+{
+    unsigned char hash[ 64 ], sig[ 256 ], bad[ 260 ];
+    unsigned long int hashlen, siglen, badlen;
+    void* r, * s, * t;
+    int i, variant;
+
+    if( !bdgr_test( mp_init_multi( &r, &s, &t, NULL ) == CRYPT_OK )) {
+        return;
+    }
+    for( i = 0; i < BDGR_TEST_SIGNATURES; i++ ) {
+
+        /* Hashes as long as q, shorter, and longer */
+        hashlen = (unsigned long int)key->qord;
+        hashlen = i % 4 == 3 ? hashlen + 12 : i % 4 == 2 ? 12 : hashlen;
+        bdgr_test_random( hash, hashlen );
+        siglen = sizeof( sig );
+        if( !bdgr_test( dsa_sign_hash( hash, hashlen, sig, &siglen,
+                                       &bdgr_test_prng, bdgr_test_wprng,
+                                       key ) == CRYPT_OK ) ||
+            !bdgr_test( sig[ 0 ] == 0x30 && sig[ 1 ] < 0x80 ) ||
+            !bdgr_test( der_decode_sequence_multi(
+                            sig, siglen,
+                            LTC_ASN1_INTEGER, 1UL, r,
+                            LTC_ASN1_INTEGER, 1UL, s,
+                            LTC_ASN1_EOL, 0UL, NULL ) == CRYPT_OK )) {
+            continue;
+        }
+        bdgr_test_agree( sig, siglen, hash, hashlen, key, 1 );
+
+        /* Another hash, and a signature off by a bit */
+        hash[ i % hashlen ] ^= 0x01;
+        bdgr_test_agree( sig, siglen, hash, hashlen, key, 0 );
+        hash[ i % hashlen ] ^= 0x01;
+        memcpy( bad, sig, siglen );
+        bad[ siglen - 1 - i % 8 ] ^= 0x01;
+        bdgr_test_agree( bad, siglen, hash, hashlen, key, 0 );
+
+        /* r or s of 0, q or above */
+        mp_set( t, 0 );
+        bdgr_test_pair( t, s, hash, hashlen, key );
+        bdgr_test_pair( r, t, hash, hashlen, key );
+        bdgr_test_pair( key->q, s, hash, hashlen, key );
+        bdgr_test_pair( r, key->q, hash, hashlen, key );
+        mp_add( s, key->q, t );
+        bdgr_test_pair( r, t, hash, hashlen, key );
+
+        for( variant = 0; variant < 3; variant++ ) {
+            badlen = bdgr_test_loose( sig, siglen, variant, bad );
+            bdgr_test_agree( bad, badlen, hash, hashlen, key, -1 );
+        }
+    }
+    mp_clear_multi( r, s, t, NULL );
+}
+
+/* RFC 6979, A.2.1: DSA, 1024 bits, with SHA-256 */
+static const char* const bdgr_test_rfc_p =
+    "86F5CA03DCFEB225063FF830A0C769B9DD9D6153AD91D7CE27F787C43278B447"
+    "E6533B86B18BED6E8A48B784A14C252C5BE0DBF60B86D6385BD2F12FB763ED88"
+    "73ABFD3F5BA2E0A8C0A59082EAC056935E529DAF7C610467899C77ADEDFC846C"
+    "881870B7B19B2B58F9BE0521A17002E3BDD6B86685EE90B3D9A1B02B782B1779";
+static const char* const bdgr_test_rfc_q =
+    "996F967F6C8E388D9E28D01E205FBA957A5698B1";
+static const char* const bdgr_test_rfc_g =
+    "07B0F92546150B62514BB771E2A0C0CE387F03BDA6C56B505209FF25FD3C133D"
+    "89BBCD97E904E09114D9A7DEFDEADFC9078EA544D2E401AEECC40BB9FBBF78FD"
+    "87995A10A1C27CB7789B594BA7EFB5C4326A9FE59A070E136DB77175464ADCA4"
+    "17BE5DCE2F40D10A46A3A3943F26AB7FD9C0398FF8C76EE0A56826A8A88F1DBD";
+static const char* const bdgr_test_rfc_x =
+    "411602CB19A6CCC34494D79D98EF1E7ED5AF25F7";
+static const char* const bdgr_test_rfc_y =
+    "5DF5E01DED31D0297E274E1691C192FE5868FEF9E19A84776454B100CF16F653"
+    "92195A38B90523E2542EE61871C0440CB87C322FC4B4D2EC5E1E7EC766E1BE8D"
+    "4CE935437DC11C3C8FD426338933EBFE739CB3465F4D3668C5E473508253B1E6"
+    "82F65CBDC4FAE93C2EA212390E54905A86E2223170B44EAA7DA5DD9FFCFB7F3B";
+
+static const struct {
+    const char* message;
+    const char* k;
+    const char* r;
+    const char* s;
+} bdgr_test_rfc[] = {
+    { "sample",
+      "519BA0546D0C39202A7D34D7DFA5E760B318BCFB",
+      "81F2F5850BE5BC123C43F71A3033E9384611C545",
+      "4CDD914B65EB6C66A8AAAD27299BEE6B035F5E89" },
+    { "test",
+      "5A67592E8128E03A417B0484410FB72C0B630E1A",
+      "22518C127299B0F6FDC9872B282B9E70D0790812",
+      "6837EC18F150D55DE95B5E29BE7AF5D01E4FE160" }
+};
+
+/*
+  The key's q is 160 bits, so the hash signed is the leftmost 160 bits of
+  SHA-256, as RFC 6979 takes it.  k is checked through r = g^k mod p mod q.
+*/
+static void bdgr_test_rfc6979()
+{
+    unsigned char hash[ 32 ], sig[ 256 ];
+    unsigned long int hashlen, siglen;
+    dsa_key key;
+    void* r, * s, * k, * t;
+    size_t i;
+    int stat;
+
+    memset( &key, 0, sizeof( key ));
+    key.type = PK_PRIVATE;
+    key.qord = 20;
+    if( !bdgr_test( register_hash( &sha256_desc ) != -1 ) ||
+        !bdgr_test( mp_init_multi( &key.g, &key.q, &key.p, &key.x, &key.y,
+                                   &r, &s, &k, &t, NULL ) == CRYPT_OK )) {
+        return;
+    }
+    if( bdgr_test( mp_read_radix( key.p, bdgr_test_rfc_p, 16 ) == CRYPT_OK &&
+                   mp_read_radix( key.q, bdgr_test_rfc_q, 16 ) == CRYPT_OK &&
+                   mp_read_radix( key.g, bdgr_test_rfc_g, 16 ) == CRYPT_OK &&
+                   mp_read_radix( key.x, bdgr_test_rfc_x, 16 ) == CRYPT_OK &&
+                   mp_read_radix( key.y, bdgr_test_rfc_y, 16 ) == CRYPT_OK )) {
+
+        for( i = 0; i < sizeof( bdgr_test_rfc ) / sizeof( *bdgr_test_rfc ); i++ ) {
+            hashlen = sizeof( hash );
+            siglen = sizeof( sig );
+            if( !bdgr_test( hash_memory(
+                                find_hash( "sha256" ),
+                                (const unsigned char*)bdgr_test_rfc[ i ].message,
+                                strlen( bdgr_test_rfc[ i ].message ),
+                                hash, &hashlen ) == CRYPT_OK ) ||
+                !bdgr_test( bdgr_dsa_sign_hash( hash, key.qord, sig, &siglen,
+                                                &key ) == CRYPT_OK ) ||
+                !bdgr_test( der_decode_sequence_multi(
+                                sig, siglen,
+                                LTC_ASN1_INTEGER, 1UL, r,
+                                LTC_ASN1_INTEGER, 1UL, s,
+                                LTC_ASN1_EOL, 0UL, NULL ) == CRYPT_OK )) {
+                continue;
+            }
+            mp_read_radix( t, bdgr_test_rfc[ i ].r, 16 );
+            bdgr_test( mp_cmp( r, t ) == LTC_MP_EQ );
+            mp_read_radix( t, bdgr_test_rfc[ i ].s, 16 );
+            bdgr_test( mp_cmp( s, t ) == LTC_MP_EQ );
+
+            mp_read_radix( k, bdgr_test_rfc[ i ].k, 16 );
+            bdgr_test( mp_exptmod( key.g, k, key.p, t ) == CRYPT_OK &&
+                       mp_mod( t, key.q, t ) == CRYPT_OK &&
+                       mp_cmp( r, t ) == LTC_MP_EQ );
+
+            stat = 0;
+            bdgr_test( dsa_verify_hash( sig, siglen, hash, key.qord,
+                                        &stat, &key ) == CRYPT_OK && stat );
+            bdgr_test_agree( sig, siglen, hash, key.qord, &key, 1 );
+        }
+    }
+    mp_clear_multi( key.g, key.q, key.p, key.x, key.y, r, s, k, t, NULL );
+}
+
+/* Signing a token twice with key gives one signature, which verifies */
+static void bdgr_test_deterministic(
+    const bdgr_key* const key,
+    const bdgr_key* const other
+)
+{
+    static const unsigned char token[] = "dsa test token";
+    unsigned char first[ 128 ], second[ 128 ], third[ 128 ];
+    unsigned long int first_len = sizeof( first );
+    unsigned long int second_len = sizeof( second );
+    unsigned long int third_len = sizeof( third );
+    int verified = 0;
+
+    if( !bdgr_test( bdgr_token_sign( token, sizeof( token ), key,
+                                     first, &first_len ) == 0 ) ||
+        !bdgr_test( bdgr_token_sign( token, sizeof( token ), key,
+                                     second, &second_len ) == 0 )) {
+        return;
+    }
+    bdgr_test( first_len == second_len &&
+               !memcmp( first, second, first_len ));
+    bdgr_test( bdgr_signature_verify( token, sizeof( token ), first,
+                                      first_len, key, &verified ) == 0 &&
+               verified );
+
+    /* Another token, or another key, signs differently */
+    bdgr_test( bdgr_token_sign( token, sizeof( token ) - 1, key,
+                                third, &third_len ) == 0 );
+    bdgr_test( third_len != first_len || memcmp( first, third, first_len ));
+    third_len = sizeof( third );
+    bdgr_test( bdgr_token_sign( token, sizeof( token ), other,
+                                third, &third_len ) == 0 );
+    bdgr_test( third_len != first_len || memcmp( first, third, first_len ));
+}
+
+int main()
+{
+    bdgr_key keys[ BDGR_TEST_KEYS ];
+    dsa_key large;
+    char password[ 32 ];
+    int i;
+
+    /* Badger keys, in the groups of the fixed width kernel */
+    for( i = 0; i < BDGR_TEST_KEYS; i++ ) {
+        sprintf( password, "dsa test %d", i );
+        if( !bdgr_test( bdgr_key_generate( password, &keys[ i ] ) == 0 )) {
+            return 1;
+        }
+    }
+
+    srand( 1 );
+    if( !bdgr_test( register_prng( &rc4_desc ) != -1 ) ||
+        !bdgr_test( rc4_start( &bdgr_test_prng ) == CRYPT_OK ) ||
+        !bdgr_test( rc4_add_entropy( (const unsigned char*)"dsa test", 8,
+                                     &bdgr_test_prng ) == CRYPT_OK ) ||
+        !bdgr_test( rc4_ready( &bdgr_test_prng ) == CRYPT_OK )) {
+        return 1;
+    }
+    bdgr_test_wprng = find_prng( "rc4" );
+
+    for( i = 0; i < BDGR_TEST_KEYS; i++ ) {
+        bdgr_test_deterministic( &keys[ i ],
+                                 &keys[ ( i + 1 ) % BDGR_TEST_KEYS ] );
+    }
+    for( i = 0; i < BDGR_TEST_KEYS; i++ ) {
+        bdgr_test_key( (dsa_key*)keys[ i ]._impl );
+        bdgr_key_free( &keys[ i ] );
+    }
+
+    /* A group too large for it, verified by the generic path */
+    if( bdgr_test( dsa_make_key( &bdgr_test_prng, bdgr_test_wprng, 24, 160,
+                                 &large ) == CRYPT_OK )) {
+        bdgr_test_key( &large );
+        dsa_free( &large );
+    }
+
+    rc4_done( &bdgr_test_prng );
+
+    bdgr_test_rfc6979();
+    return bdgr_test_failed != 0;
+}
@@ -0,0 +1,146 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs concurrent verifications of one Identity URL against a slow stub
+  scheme: they share a single fetch, get its key when it succeeds, and all
+  get its error when it fails.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+#define BDGR_TEST_THREADS 8
+
+static struct {
+    pthread_mutex_t   lock;
+    pthread_barrier_t start;
+    const char*       record;
+    int               err;
+    int               fetches;
+} bdgr_stub;
+
+static bdgr_key bdgr_test_signer;
+
+/* Answers slowly enough for every thread to ask meanwhile */
+static int bdgr_stub_start( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)ctx;
+    pthread_mutex_lock( &bdgr_stub.lock );
+    bdgr_stub.fetches++;
+    pthread_mutex_unlock( &bdgr_stub.lock );
+    usleep( 300000 );
+    if( !bdgr_stub.err ) {
+        bdgr_lookup_write( lookup, bdgr_stub.record,
+                           strlen( bdgr_stub.record ));
+    }
+    bdgr_lookup_complete( lookup, bdgr_stub.err );
+    return 0;
+}
+
+struct bdgr_test_thread {
+    pthread_t   thread;
+    const char* id;
+    int         verified;
+    int         err;
+};
+
+static void* bdgr_test_run( void* const arg )
+{
+    struct bdgr_test_thread* const t = arg;
+
+    pthread_barrier_wait( &bdgr_stub.start );
+    t->verified = bdgr_test_verifies( t->id, NULL, &bdgr_test_signer, -1,
+                                      &t->err );
+    return NULL;
+}
+
+/*
+  Verifies id on every thread at once.  Returns how many verified, with
+  the number that failed with err in failed.
+*/
+static int bdgr_test_together(
+    const char* const id,
+    const int err,
+    int* const failed
+)
+{
+    struct bdgr_test_thread threads[ BDGR_TEST_THREADS ];
+    int i, verified = 0;
+
+    bdgr_stub.fetches = 0;
+    *failed = 0;
+    for( i = 0; i < BDGR_TEST_THREADS; i++ ) {
+        threads[i].id = id;
+        pthread_create( &threads[i].thread, NULL, bdgr_test_run, &threads[i] );
+    }
+    for( i = 0; i < BDGR_TEST_THREADS; i++ ) {
+        pthread_join( threads[i].thread, NULL );
+        verified += threads[i].verified;
+        *failed += !threads[i].verified && threads[i].err == err;
+    }
+    return verified;
+}
+
+int main()
+{
+    char* record;
+    int failed;
+
+    if( !bdgr_test( bdgr_key_generate( "flight test",
+                                       &bdgr_test_signer ) == 0 ) ||
+        !bdgr_test( ( record = bdgr_test_record(
+                          &bdgr_test_signer )) != NULL ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "stub:", bdgr_stub_start,
+                                                   NULL, NULL ) == 0 )) {
+        return 1;
+    }
+    bdgr_stub.record = record;
+    pthread_mutex_init( &bdgr_stub.lock, NULL );
+    pthread_barrier_init( &bdgr_stub.start, NULL, BDGR_TEST_THREADS );
+
+    /* One fetch, every thread verified with its key */
+    bdgr_test( bdgr_test_together( "stub:alice", 0, &failed ) ==
+               BDGR_TEST_THREADS );
+    bdgr_test( bdgr_stub.fetches == 1 );
+
+    /* Nothing is left flying: the next round fetches again */
+    bdgr_test( bdgr_test_together( "stub:alice", 0, &failed ) ==
+               BDGR_TEST_THREADS );
+    bdgr_test( bdgr_stub.fetches == 1 );
+
+    /* One fetch, its error passed to every thread */
+    bdgr_stub.err = bdgr_http_not_found_err;
+    bdgr_test( bdgr_test_together( "stub:bob", bdgr_http_not_found_err,
+                                   &failed ) == 0 );
+    bdgr_test( failed == BDGR_TEST_THREADS );
+    bdgr_test( bdgr_stub.fetches == 1 );
+
+    pthread_barrier_destroy( &bdgr_stub.start );
+    pthread_mutex_destroy( &bdgr_stub.lock );
+    free( record );
+    bdgr_key_free( &bdgr_test_signer );
+    return bdgr_test_failed != 0;
+}
@@ -0,0 +1,145 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Checks the key spec on keys imported from records: the domain parameters
+  of a group are checked the first time a key in it is seen and only y for
+  later keys, which still refuses a y outside the group, and a group that
+  failed is checked again.  Exponentiations are counted through the bignum
+  descriptor, the g check costing one.  Also checks that key sets sharing
+  an interned group can be freed in any order.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+static int (*bdgr_test_exptmod_backend)( void* a, void* b, void* c, void* d );
+static int bdgr_test_exptmods = 0;
+
+static int bdgr_test_exptmod( void* a, void* b, void* c, void* d )
+{
+    bdgr_test_exptmods++;
+    return bdgr_test_exptmod_backend( a, b, c, d );
+}
+
+/* Imports the public part of key from a record, counting exptmods */
+static int bdgr_test_import( const bdgr_key* const key, int* const exptmods )
+{
+    bdgr_key imported;
+    char* record = bdgr_test_record( key );
+    int err = bdgr_malloc_err;
+
+    bdgr_test_exptmods = 0;
+    if( record != NULL ) {
+        err = bdgr_record_import( record, &imported );
+        if( !err ) {
+            bdgr_key_free( &imported );
+        }
+    }
+    free( record );
+    *exptmods = bdgr_test_exptmods;
+    return err;
+}
+
+/* Whether a signature made with signer verifies with key */
+static int bdgr_test_signed_by(
+    const bdgr_key* const signer,
+    const bdgr_key* const key
+)
+{
+    static const unsigned char token[] = "group test";
+    unsigned char signature[ 128 ];
+    unsigned long int signature_len = sizeof( signature );
+    int verified = 0;
+
+    return !bdgr_token_sign( token, sizeof( token ), signer,
+                             signature, &signature_len ) &&
+        !bdgr_signature_verify( token, sizeof( token ), signature,
+                                signature_len, key, &verified ) &&
+        verified;
+}
+
+int main()
+{
+    bdgr_key key, other;
+    bdgr_key_set* first, * second;
+    unsigned long int index;
+    dsa_key* dsa;
+    int full, known, again, count;
+
+    if( !bdgr_test( bdgr_key_generate( "group test", &key ) == 0 ) ||
+        !bdgr_test( bdgr_key_generate( "group test", &other ) == 0 )) {
+        return 1;
+    }
+    dsa = (dsa_key*)key._impl;
+    bdgr_test_exptmod_backend = ltc_mp.exptmod;
+    ltc_mp.exptmod = bdgr_test_exptmod;
+
+    /* A new group is checked in full, a known one only has y checked */
+    bdgr_test( bdgr_test_import( &key, &full ) == 0 );
+    bdgr_test( bdgr_test_import( &key, &known ) == 0 );
+    bdgr_test( known >= 1 && known < full );
+    bdgr_test( mp_mulmod( dsa->y, dsa->y, dsa->p, dsa->y ) == CRYPT_OK );
+    bdgr_test( bdgr_test_import( &key, &again ) == 0 );
+    bdgr_test( again == known );
+
+    /* A y outside the group is refused, however well known the group */
+    bdgr_test( mp_sub_d( dsa->p, 1, dsa->y ) == CRYPT_OK );
+    bdgr_test( bdgr_test_import( &key, &count ) == bdgr_key_invalid_err );
+    bdgr_test( mp_set( dsa->y, 1 ) == CRYPT_OK );
+    bdgr_test( bdgr_test_import( &key, &count ) == bdgr_key_invalid_err );
+    bdgr_test( mp_copy( dsa->p, dsa->y ) == CRYPT_OK );
+    bdgr_test( bdgr_test_import( &key, &count ) == bdgr_key_invalid_err );
+
+    /* A group that failed isn't taken for known */
+    dsa = (dsa_key*)other._impl;
+    bdgr_test( mp_set( dsa->g, 1 ) == CRYPT_OK );
+    bdgr_test( bdgr_test_import( &other, &count ) == bdgr_key_invalid_err );
+    bdgr_test( bdgr_test_import( &other, &count ) == bdgr_key_invalid_err );
+    ltc_mp.exptmod = bdgr_test_exptmod_backend;
+
+    /* Sets holding keys of one group, freed in either order */
+    bdgr_key_free( &other );
+    bdgr_test( bdgr_key_generate( "group test", &other ) == 0 );
+    bdgr_test( bdgr_key_set_new( &first ) == 0 );
+    bdgr_test( bdgr_key_set_new( &second ) == 0 );
+    bdgr_test( bdgr_key_set_add( first, &other, &index ) == 0 );
+    bdgr_test( bdgr_key_set_add( second, &other, &index ) == 0 );
+    bdgr_test( bdgr_key_set_add( second, &other, &index ) == 0 );
+    bdgr_key_set_free( first );
+    bdgr_key_free( &key );
+    bdgr_test( bdgr_key_set_get( second, index, &key ) == 0 );
+    bdgr_test( bdgr_test_signed_by( &other, &key ));
+    bdgr_key_free( &key );
+    bdgr_key_set_free( second );
+    bdgr_test( bdgr_key_set_new( &first ) == 0 );
+    bdgr_test( bdgr_key_set_add( first, &other, &index ) == 0 );
+    bdgr_test( bdgr_key_set_get( first, index, &key ) == 0 );
+    bdgr_test( bdgr_test_signed_by( &other, &key ));
+    bdgr_key_set_free( first );
+
+    bdgr_key_free( &key );
+    bdgr_key_free( &other );
+    return bdgr_test_failed != 0;
+}
@@ -0,0 +1,282 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs http: lookups against a stub web server: records fresh by
+  Cache-Control are not fetched again, stale ones are revalidated with
+  their ETag and an unchanged record costs a 304, a changed record brings
+  its new key, a key id dropped from a record is noticed even after another
+  key id of it was fetched anew, and a missing one is reported as not
+  found.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+#define BDGR_STUB_DOCUMENTS 4
+
+struct bdgr_stub_document {
+    const char* path;
+    const char* body;
+    const char* etag;
+    const char* cache_control;
+};
+
+static struct {
+    int                       fd;
+    int                       port;
+    struct bdgr_stub_document documents[ BDGR_STUB_DOCUMENTS ];
+    int                       requests;
+    int                       not_modified;
+    pthread_mutex_t           lock;
+} bdgr_stub;
+
+/* Serves path from now on, replacing what was served there */
+static void bdgr_stub_put(
+    const char* const path,
+    const char* const body,
+    const char* const etag,
+    const char* const cache_control
+)
+{
+    int i;
+
+    pthread_mutex_lock( &bdgr_stub.lock );
+    for( i = 0; i < BDGR_STUB_DOCUMENTS - 1 &&
+             bdgr_stub.documents[i].path != NULL &&
+             strcmp( bdgr_stub.documents[i].path, path ); i++ );
+    bdgr_stub.documents[i].path = path;
+    bdgr_stub.documents[i].body = body;
+    bdgr_stub.documents[i].etag = etag;
+    bdgr_stub.documents[i].cache_control = cache_control;
+    pthread_mutex_unlock( &bdgr_stub.lock );
+}
+
+/* Answers one request per connection, 304 if If-None-Match still holds */
+static void bdgr_stub_serve( const int fd )
+{
+    const struct bdgr_stub_document* document = NULL;
+    char request[ 4096 ], response[ 4096 ], path[ 256 ], * match;
+    ssize_t got;
+    size_t size = 0;
+    int i;
+
+    while( size < sizeof( request ) - 1 &&
+           ( got = read( fd, request + size,
+                         sizeof( request ) - 1 - size )) > 0 ) {
+        size += got;
+        request[ size ] = '\0';
+        if( strstr( request, "\r\n\r\n" ) != NULL ) {
+            break;
+        }
+    }
+    request[ size ] = '\0';
+    if( sscanf( request, "GET %255s ", path ) != 1 ) {
+        return;
+    }
+    match = strstr( request, "If-None-Match: " );
+
+    pthread_mutex_lock( &bdgr_stub.lock );
+    bdgr_stub.requests++;
+    for( i = 0; i < BDGR_STUB_DOCUMENTS; i++ ) {
+        if( bdgr_stub.documents[i].path != NULL &&
+            !strcmp( bdgr_stub.documents[i].path, path )) {
+            document = &bdgr_stub.documents[i];
+        }
+    }
+    if( document == NULL ) {
+        sprintf( response, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+                 "Connection: close\r\n\r\n" );
+    } else if( match != NULL &&
+               !strncmp( match + 15, document->etag,
+                         strlen( document->etag ))) {
+        bdgr_stub.not_modified++;
+        sprintf( response, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n"
+                 "Cache-Control: %s\r\nConnection: close\r\n\r\n",
+                 document->etag, document->cache_control );
+    } else {
+        snprintf( response, sizeof( response ),
+                  "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                  "ETag: %s\r\nCache-Control: %s\r\nContent-Length: %lu\r\n"
+                  "Connection: close\r\n\r\n%s",
+                  document->etag, document->cache_control,
+                  (unsigned long int)strlen( document->body ),
+                  document->body );
+    }
+    pthread_mutex_unlock( &bdgr_stub.lock );
+
+    if( write( fd, response, strlen( response )) < 0 ) {
+        perror( "write" );
+    }
+}
+
+static void* bdgr_stub_run( void* const arg )
+{
+    int fd;
+    (void)arg;
+
+    while( ( fd = accept( bdgr_stub.fd, NULL, NULL )) >= 0 ) {
+        bdgr_stub_serve( fd );
+        close( fd );
+    }
+    return NULL;
+}
+
+/* Starts the stub on a free port */
+static int bdgr_stub_start( pthread_t* const thread )
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof( addr );
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    pthread_mutex_init( &bdgr_stub.lock, NULL );
+    bdgr_stub.fd = socket( AF_INET, SOCK_STREAM, 0 );
+    if( bdgr_stub.fd < 0 ||
+        bind( bdgr_stub.fd, (struct sockaddr*)&addr, sizeof( addr )) ||
+        listen( bdgr_stub.fd, 16 ) ||
+        getsockname( bdgr_stub.fd, (struct sockaddr*)&addr, &addr_len )) {
+        return -1;
+    }
+    bdgr_stub.port = ntohs( addr.sin_port );
+    return pthread_create( thread, NULL, bdgr_stub_run, NULL );
+}
+
+static int bdgr_stub_count( const int* const counter )
+{
+    int count;
+
+    pthread_mutex_lock( &bdgr_stub.lock );
+    count = *counter;
+    pthread_mutex_unlock( &bdgr_stub.lock );
+    return count;
+}
+
+/* The Identity URL of path on the stub */
+static const char* bdgr_stub_url( const char* const path )
+{
+    static char url[ 128 ];
+
+    sprintf( url, "http://127.0.0.1:%d%s", bdgr_stub.port, path );
+    return url;
+}
+
+int main()
+{
+    char cache_path[ 64 ];
+    bdgr_key key, changed;
+    char* record, * changed_record, * encoded, * changed_encoded;
+    char* both = NULL, * only = NULL;
+    pthread_t thread;
+    int err, not_modified;
+
+    sprintf( cache_path, "/tmp/badger-test-http-%d", (int)getpid() );
+    unlink( cache_path );
+    if( !bdgr_test( bdgr_key_generate( "http test", &key ) == 0 ) ||
+        !bdgr_test( bdgr_key_generate( "http test", &changed ) == 0 ) ||
+        !bdgr_test( ( record = bdgr_test_record( &key )) != NULL ) ||
+        !bdgr_test( ( changed_record = bdgr_test_record(
+                          &changed )) != NULL ) ||
+        !bdgr_test( bdgr_key_encode_public( &key, &encoded ) == 0 ) ||
+        !bdgr_test( bdgr_key_encode_public( &changed,
+                                            &changed_encoded ) == 0 ) ||
+        !bdgr_test( ( both = malloc( strlen( encoded ) +
+                                     strlen( changed_encoded ) + 64 )) !=
+                    NULL ) ||
+        !bdgr_test( ( only = malloc( strlen( changed_encoded ) +
+                                     64 )) != NULL ) ||
+        !bdgr_test( bdgr_stub_start( &thread ) == 0 ) ||
+        !bdgr_test( bdgr_key_cache_open( cache_path, 64, 0 ) == 0 )) {
+        return 1;
+    }
+
+    /* Fresh for a minute, so fetched once */
+    bdgr_stub_put( "/fresh", record, "\"f1\"", "max-age=60" );
+    bdgr_test( bdgr_test_verifies( bdgr_stub_url( "/fresh" ), NULL, &key, -1,
+                                   NULL ));
+    bdgr_test( bdgr_test_verifies( bdgr_stub_url( "/fresh" ), NULL, &key, -1,
+                                   NULL ));
+    bdgr_test( bdgr_stub_count( &bdgr_stub.requests ) == 1 );
+
+    /* Revalidated on every use, an unchanged record costing a 304 */
+    bdgr_stub_put( "/always", record, "\"a1\"", "no-cache" );
+    bdgr_test( bdgr_test_verifies( bdgr_stub_url( "/always" ), NULL, &key, -1,
+                                   NULL ));
+    bdgr_test( bdgr_stub_count( &bdgr_stub.requests ) == 2 );
+    bdgr_test( bdgr_stub_count( &bdgr_stub.not_modified ) == 0 );
+    bdgr_test( bdgr_test_verifies( bdgr_stub_url( "/always" ), NULL, &key, -1,
+                                   NULL ));
+    bdgr_test( bdgr_stub_count( &bdgr_stub.requests ) == 3 );
+    bdgr_test( bdgr_stub_count( &bdgr_stub.not_modified ) == 1 );
+
+    /* A changed record brings its key, and the old one no longer works */
+    bdgr_stub_put( "/always", changed_record, "\"a2\"", "no-cache" );
+    bdgr_test( bdgr_test_verifies( bdgr_stub_url( "/always" ), NULL,
+                                   &changed, -1, NULL ));
+    bdgr_test( bdgr_stub_count( &bdgr_stub.requests ) == 4 );
+    bdgr_test( bdgr_stub_count( &bdgr_stub.not_modified ) == 1 );
+    bdgr_test( !bdgr_test_verifies( bdgr_stub_url( "/always" ), NULL, &key,
+                                    -1, &err ));
+    bdgr_test( err == 0 );
+    bdgr_test( bdgr_stub_count( &bdgr_stub.not_modified ) == 2 );
+
+    /* Validators are kept per key id, so a 304 can't keep a dropped key */
+    sprintf( both, "{\"keys\":[{\"kid\":\"a\",\"dsa\":\"%s\"},"
+             "{\"kid\":\"b\",\"dsa\":\"%s\"}]}", encoded, changed_encoded );
+    sprintf( only, "{\"keys\":[{\"kid\":\"b\",\"dsa\":\"%s\"}]}",
+             changed_encoded );
+    bdgr_stub_put( "/rotating", both, "\"r1\"", "no-cache" );
+    bdgr_test( bdgr_test_verifies( bdgr_stub_url( "/rotating" ), "a", &key,
+                                   -1, NULL ));
+    not_modified = bdgr_stub_count( &bdgr_stub.not_modified );
+    bdgr_stub_put( "/rotating", only, "\"r2\"", "no-cache" );
+    bdgr_test( bdgr_test_verifies( bdgr_stub_url( "/rotating" ), "b",
+                                   &changed, -1, NULL ));
+    bdgr_test( !bdgr_test_verifies( bdgr_stub_url( "/rotating" ), "a", &key,
+                                    -1, &err ));
+    bdgr_test( err == bdgr_kid_missing_err );
+    bdgr_test( bdgr_stub_count( &bdgr_stub.not_modified ) == not_modified );
+
+    /* Nothing there */
+    bdgr_test( !bdgr_test_verifies( bdgr_stub_url( "/missing" ), NULL, &key,
+                                    -1, &err ));
+    bdgr_test( err == bdgr_http_not_found_err );
+
+    bdgr_key_cache_close();
+    unlink( cache_path );
+    free( record );
+    free( changed_record );
+    free( both );
+    free( only );
+    bdgr_free( encoded );
+    bdgr_free( changed_encoded );
+    bdgr_key_free( &key );
+    bdgr_key_free( &changed );
+    return bdgr_test_failed != 0;
+}
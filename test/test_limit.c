@@ -0,0 +1,165 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Checks the size limits on badges, records and keys, and the token
+  buckets on fetches: an Identity URL or scheme that used up its burst is
+  refused without a fetch until a token is earned back, other Identity
+  URLs keep their own, and badges whose key is cached are never charged.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+static struct {
+    const char* record;
+    int         fetches;
+} bdgr_stub;
+
+static int bdgr_stub_start( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)ctx;
+    bdgr_stub.fetches++;
+    bdgr_lookup_write( lookup, bdgr_stub.record, strlen( bdgr_stub.record ));
+    bdgr_lookup_complete( lookup, 0 );
+    return 0;
+}
+
+/* Whether the badge for id verifies, fetches counted in fetched */
+static int bdgr_test_limited(
+    const char* const id,
+    const bdgr_key* const key,
+    int* const fetched
+)
+{
+    int err, before = bdgr_stub.fetches;
+
+    bdgr_test_verifies( id, NULL, key, -1, &err );
+    *fetched = bdgr_stub.fetches - before;
+    return err;
+}
+
+int main()
+{
+    bdgr_key key, other;
+    bdgr_badge badge, imported;
+    char* record, * exported;
+    int fetched, fetches, err, i;
+
+    if( !bdgr_test( bdgr_key_generate( "limit test", &key ) == 0 ) ||
+        !bdgr_test( bdgr_key_generate( "limit test", &other ) == 0 ) ||
+        !bdgr_test( ( record = bdgr_test_record( &key )) != NULL ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "stub:", bdgr_stub_start,
+                                                   NULL, NULL ) == 0 )) {
+        return 1;
+    }
+    bdgr_stub.record = record;
+
+    /* Tokens and signatures over their limit cost no fetch */
+    bdgr_test( bdgr_badge_limit( 0, 4, 0 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) ==
+               bdgr_token_too_large_err && !fetched );
+    bdgr_test( bdgr_badge_limit( 0, 0, 8 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) ==
+               bdgr_signature_too_large_err && !fetched );
+
+    /* A badge over the limit isn't parsed */
+    bdgr_test( bdgr_badge_limit( 16384, 4096, 512 ) == 0 );
+    if( bdgr_test( bdgr_test_badge( "stub:alice", NULL, &key, "badger test",
+                                    &badge ) == 0 )) {
+        if( bdgr_test( bdgr_badge_export( &badge, &exported ) == 0 )) {
+            bdgr_test( bdgr_badge_limit( strlen( exported ), 0, 0 ) == 0 );
+            if( bdgr_test( bdgr_badge_import( exported, &imported ) == 0 )) {
+                bdgr_badge_free( &imported );
+            }
+            bdgr_test( bdgr_badge_limit( strlen( exported ) - 1, 0, 0 ) == 0 );
+            bdgr_test( bdgr_badge_import( exported, &imported ) ==
+                       bdgr_badge_too_large_err );
+            bdgr_free( exported );
+        }
+        bdgr_badge_free( &badge );
+    }
+    bdgr_test( bdgr_badge_limit( 16384, 4096, 512 ) == 0 );
+
+    /* Records and keys over their limit fail the lookup */
+    bdgr_test( bdgr_record_limit( 16 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) ==
+               bdgr_record_too_large_err && fetched == 1 );
+    bdgr_test( bdgr_record_limit( 65536 ) == 0 );
+    bdgr_test( bdgr_key_limit( 512 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) ==
+               bdgr_key_too_large_err && fetched == 1 );
+    bdgr_test( bdgr_key_limit( 4096 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) == 0 );
+
+    /* Two fetches at once, then one every 300ms, per Identity URL */
+    bdgr_test( bdgr_rate_limit_identity( 2, 300 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) ==
+               bdgr_rate_limited_err && !fetched );
+    bdgr_test( bdgr_test_limited( "stub:bob", &key, &fetched ) == 0 &&
+               fetched == 1 );
+    usleep( 350000 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) == 0 &&
+               fetched == 1 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) ==
+               bdgr_rate_limited_err && !fetched );
+    bdgr_test( bdgr_rate_limit_identity( 0, 0 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:alice", &key, &fetched ) == 0 );
+
+    /* One fetch for the whole scheme, and only for that scheme */
+    bdgr_test( bdgr_rate_limit_scheme( "stub:", 1, 60000 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:carol", &key, &fetched ) == 0 &&
+               fetched == 1 );
+    bdgr_test( bdgr_test_limited( "stub:dave", &key, &fetched ) ==
+               bdgr_rate_limited_err && !fetched );
+    bdgr_test( bdgr_rate_limit_scheme( "stub", 0, 0 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:dave", &key, &fetched ) == 0 );
+    bdgr_test( bdgr_rate_limit_scheme( "", 1, 1 ) ==
+               bdgr_unsupported_scheme_err );
+
+    /* Cached keys don't count, so forged badges lock nobody out */
+    bdgr_test( bdgr_key_cache_open( NULL, 64, 0 ) == 0 );
+    bdgr_test( bdgr_rate_limit_identity( 1, 60000 ) == 0 );
+    bdgr_test( bdgr_test_limited( "stub:erin", &key, &fetched ) == 0 &&
+               fetched == 1 );
+    fetches = bdgr_stub.fetches;
+    for( i = 0; i < 4; i++ ) {
+        bdgr_test( !bdgr_test_verifies( "stub:erin", NULL, &other, -1,
+                                        &err ));
+        bdgr_test( err == 0 && bdgr_stub.fetches == fetches );
+    }
+    bdgr_test( bdgr_test_limited( "stub:erin", &key, &fetched ) == 0 &&
+               !fetched );
+    bdgr_test( bdgr_test_limited( "stub:frank", &key, &fetched ) == 0 &&
+               fetched == 1 );
+    bdgr_test( bdgr_rate_limit_identity( 0, 0 ) == 0 );
+    bdgr_key_cache_close();
+
+    free( record );
+    bdgr_key_free( &key );
+    bdgr_key_free( &other );
+    return bdgr_test_failed != 0;
+}
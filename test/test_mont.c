@@ -0,0 +1,186 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Checks the fixed width Montgomery kernel against LibTomCrypt's math on
+  random operands and on the edges, a base of 0, 1 or m - 1 and exponents
+  of 0 or m - 1, for moduli of the widths of p and q and narrower ones.
+  That verifying with the kernel agrees with dsa_verify_hash() is checked
+  by test_dsa.c.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <tomcrypt.h>
+#include <badger.h>
+#include "../src/badger_mont.h"
+#include "test.h"
+
+#define BDGR_TEST_ROUNDS 32
+
+static void bdgr_test_random( unsigned char* const out, unsigned long int len )
+{
+    while( len-- ) {
+        out[ len ] = (unsigned char)rand();
+    }
+}
+
+/* a as n limbs, a being under 2^(32n) */
+static void bdgr_test_limbs( uint32_t* const out, const int n, void* const a )
+{
+    unsigned char bytes[ 4 * BDGR_MONT_MAX_LIMBS ];
+    const unsigned long int size = mp_unsigned_bin_size( a );
+
+    memset( bytes, 0, sizeof( bytes ));
+    mp_to_unsigned_bin( a, bytes + 4 * n - size );
+    bdgr_test( bdgr_mont_read( out, n, bytes, 4 * n ));
+}
+
+/* Whether n limbs hold the same number as a */
+static int bdgr_test_equal( const uint32_t* const limbs, const int n, void* const a )
+{
+    uint32_t expected[ BDGR_MONT_MAX_LIMBS ];
+
+    bdgr_test_limbs( expected, n, a );
+    return bdgr_mont_cmp( limbs, expected, n ) == 0;
+}
+
+/* 0, 1, m - 1 or a random number under m, as kind is 0 to 3 */
+static void bdgr_test_base(
+    void* const a,
+    void* const m,
+    const unsigned long int m_len,
+    const int kind
+)
+{
+    unsigned char bytes[ 4 * BDGR_MONT_MAX_LIMBS ];
+
+    switch( kind ) {
+    case 0:
+        mp_set( a, 0 );
+        break;
+    case 1:
+        mp_set( a, 1 );
+        break;
+    case 2:
+        mp_sub_d( m, 1, a );
+        break;
+    default:
+        bdgr_test_random( bytes, m_len );
+        mp_read_unsigned_bin( a, bytes, m_len );
+        mp_mod( a, m, a );
+    }
+}
+
+/* An exponent of m_len bytes: 0, m - 1 or random, as kind is 0 to 2 */
+static void bdgr_test_exponent(
+    unsigned char* const e,
+    void* const b,
+    void* const m,
+    const unsigned long int m_len,
+    const int kind
+)
+{
+    switch( kind ) {
+    case 0:
+        memset( e, 0, m_len );
+        break;
+    case 1:
+        mp_sub_d( m, 1, b );
+        memset( e, 0, m_len );
+        mp_to_unsigned_bin( b, e + m_len - mp_unsigned_bin_size( b ));
+        break;
+    default:
+        bdgr_test_random( e, m_len );
+    }
+    mp_read_unsigned_bin( b, e, m_len );
+}
+
+static void bdgr_test_modulus( const unsigned long int m_len, const int n )
+{
+    unsigned char m_bytes[ 4 * BDGR_MONT_MAX_LIMBS ];
+    unsigned char e[ 4 * BDGR_MONT_MAX_LIMBS ], f[ 4 * BDGR_MONT_MAX_LIMBS ];
+    unsigned char wide_bytes[ 8 * BDGR_MONT_MAX_LIMBS ];
+    uint32_t g[ BDGR_MONT_MAX_LIMBS ], y[ BDGR_MONT_MAX_LIMBS ];
+    uint32_t out[ BDGR_MONT_MAX_LIMBS ], wide[ 2 * BDGR_MONT_MAX_LIMBS ];
+    bdgr_mont ctx;
+    void* m, * a, * b, * c, * d, * t, * u;
+    int i, wide_n;
+
+    bdgr_test_random( m_bytes, m_len );
+    m_bytes[ 0 ] |= 0x80;
+    m_bytes[ m_len - 1 ] |= 0x01;
+    if( !bdgr_test( bdgr_mont_init( &ctx, m_bytes, m_len, n )) ||
+        !bdgr_test( mp_init_multi( &m, &a, &b, &c, &d, &t, &u,
+                                   NULL ) == CRYPT_OK )) {
+        return;
+    }
+    mp_read_unsigned_bin( m, m_bytes, m_len );
+
+    /* Every pairing of the edges first, then random operands */
+    for( i = 0; i < BDGR_TEST_ROUNDS; i++ ) {
+        bdgr_test_base( a, m, m_len, i < 12 ? i % 4 : 3 );
+        bdgr_test_base( c, m, m_len, i < 12 ? ( i + 1 ) % 4 : 3 );
+        bdgr_test_exponent( e, b, m, m_len, i < 12 ? i / 4 : 2 );
+        bdgr_test_exponent( f, d, m, m_len, i < 4 ? 0 : 2 );
+        bdgr_test_limbs( g, n, a );
+        bdgr_test_limbs( y, n, c );
+
+        bdgr_mont_exp( &ctx, out, g, e, m_len );
+        bdgr_test( mp_exptmod( a, b, m, t ) == CRYPT_OK &&
+                   bdgr_test_equal( out, n, t ));
+
+        bdgr_mont_exp2( &ctx, out, g, e, y, f, m_len );
+        bdgr_test( mp_exptmod( c, d, m, u ) == CRYPT_OK &&
+                   mp_mulmod( t, u, m, t ) == CRYPT_OK &&
+                   bdgr_test_equal( out, n, t ));
+
+        /* m itself, m - 1, then numbers of n to 2n limbs */
+        wide_n = i < 2 ? n : n + i % ( n + 1 );
+        if( i == 0 ) {
+            bdgr_test( bdgr_mont_read( wide, n, m_bytes, m_len ));
+        } else if( i == 1 ) {
+            mp_sub_d( m, 1, t );
+            bdgr_test_limbs( wide, n, t );
+        } else {
+            bdgr_test_random( wide_bytes, 4 * wide_n );
+            bdgr_test( bdgr_mont_read( wide, wide_n, wide_bytes, 4 * wide_n ));
+        }
+        bdgr_mont_write( wide, wide_n, wide_bytes, 4 * wide_n );
+        mp_read_unsigned_bin( t, wide_bytes, 4 * wide_n );
+        bdgr_mont_reduce( &ctx, out, wide, wide_n );
+        bdgr_test( mp_mod( t, m, t ) == CRYPT_OK &&
+                   bdgr_test_equal( out, n, t ));
+    }
+    mp_clear_multi( m, a, b, c, d, t, u, NULL );
+}
+
+int main()
+{
+    /* bdgr_init() sets LibTomCrypt's math up */
+    bdgr_test( bdgr_math_name() != NULL );
+    srand( 1 );
+
+    bdgr_test_modulus( 4 * BDGR_MONT_P_LIMBS, BDGR_MONT_P_LIMBS );
+    bdgr_test_modulus( 4 * BDGR_MONT_Q_LIMBS, BDGR_MONT_Q_LIMBS );
+    bdgr_test_modulus( 4 * BDGR_MONT_P_LIMBS - 3, BDGR_MONT_P_LIMBS );
+    bdgr_test_modulus( 4 * BDGR_MONT_Q_LIMBS - 7, BDGR_MONT_Q_LIMBS );
+    bdgr_test_modulus( 4 * 8, 8 );
+    return bdgr_test_failed != 0;
+}
@@ -0,0 +1,121 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs the negative cache against a stub scheme: a failed lookup is not
+  repeated until its TTL has passed, the TTL doubles with each failure in a
+  row, a success forgets the failures, and a TTL of 0 caches nothing.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+static struct {
+    const char* record;
+    int         err;
+    int         fetches;
+} bdgr_stub = { NULL, 0, 0 };
+
+/* Answers with the record unless told to fail */
+static int bdgr_stub_start( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)ctx;
+    bdgr_stub.fetches++;
+    if( !bdgr_stub.err ) {
+        bdgr_lookup_write( lookup, bdgr_stub.record,
+                           strlen( bdgr_stub.record ));
+    }
+    bdgr_lookup_complete( lookup, bdgr_stub.err );
+    return 0;
+}
+
+/* Whether verifying id fetched once and failed with err */
+static int bdgr_test_fails(
+    const char* const id,
+    const bdgr_key* const key,
+    const int fetches,
+    const int err
+)
+{
+    int result;
+
+    bdgr_stub.fetches = 0;
+    return !bdgr_test_verifies( id, NULL, key, -1, &result ) &&
+        result == err && bdgr_stub.fetches == fetches;
+}
+
+int main()
+{
+    bdgr_key key;
+    char* record;
+
+    if( !bdgr_test( bdgr_key_generate( "negative test", &key ) == 0 ) ||
+        !bdgr_test( ( record = bdgr_test_record( &key )) != NULL ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "stub:", bdgr_stub_start,
+                                                   NULL, NULL ) == 0 ) ||
+        !bdgr_test( bdgr_negative_cache_set( 1, 0, 1, 0 ) == 0 )) {
+        return 1;
+    }
+    bdgr_stub.record = record;
+
+    /* Unknown to the authority, then not asked again for a second */
+    bdgr_stub.err = bdgr_http_not_found_err;
+    bdgr_test( bdgr_test_fails( "stub:gone", &key, 1,
+                                bdgr_http_not_found_err ));
+    bdgr_test( bdgr_test_fails( "stub:gone", &key, 0,
+                                bdgr_lookup_backoff_err ));
+
+    /* Other ids are still looked up */
+    bdgr_stub.err = bdgr_fetch_err;
+    bdgr_test( bdgr_test_fails( "stub:down", &key, 1, bdgr_fetch_err ));
+    bdgr_test( bdgr_test_fails( "stub:down", &key, 0,
+                                bdgr_lookup_backoff_err ));
+
+    /* Failing again doubles the wait */
+    sleep( 2 );
+    bdgr_stub.err = bdgr_http_not_found_err;
+    bdgr_test( bdgr_test_fails( "stub:gone", &key, 1,
+                                bdgr_http_not_found_err ));
+    usleep( 500000 );
+    bdgr_test( bdgr_test_fails( "stub:gone", &key, 0,
+                                bdgr_lookup_backoff_err ));
+
+    /* A success once it has passed clears the failures */
+    sleep( 2 );
+    bdgr_stub.err = 0;
+    bdgr_stub.fetches = 0;
+    bdgr_test( bdgr_test_verifies( "stub:gone", NULL, &key, -1, NULL ));
+    bdgr_test( bdgr_stub.fetches == 1 );
+
+    /* Malformed records have a TTL of 0 and are looked up every time */
+    bdgr_stub.record = "{}";
+    bdgr_test( bdgr_test_fails( "stub:broken", &key, 1,
+                                bdgr_json_dsa_missing_err ));
+    bdgr_test( bdgr_test_fails( "stub:broken", &key, 1,
+                                bdgr_json_dsa_missing_err ));
+
+    free( record );
+    bdgr_key_free( &key );
+    return bdgr_test_failed != 0;
+}
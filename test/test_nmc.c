@@ -0,0 +1,345 @@
+/*
+  Copyright 2013 John Driscoll
+   
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs the Namecoin mirror against a stub of namecoind's JSON-RPC server:
+  bootstrap over several name_scan pages, lookups answered from memory,
+  name_filter polls, and a stop while a poll is under way.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <jansson.h>
+#include <badger.h>
+#include "test.h"
+
+/* Full pages of name_scan end with an entry without a name */
+#define BDGR_STUB_NAMES 1100
+#define BDGR_STUB_PAGE  500
+
+static struct {
+    int             fd;
+    json_t*         names;
+    json_t*         filtered;
+    long int        height;
+    unsigned int    delay_ms;
+    int             scans;
+    int             filters;
+    int             shows;
+    pthread_mutex_t lock;
+} bdgr_stub = { -1, NULL, NULL, 100, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static json_t* bdgr_stub_find( json_t* const entries, const char* const name )
+{
+    json_t* value;
+    unsigned long int i;
+
+    for( i = 0; i < json_array_size( entries ); i++ ) {
+        value = json_object_get( json_array_get( entries, i ), "name" );
+        if( json_is_string( value ) &&
+            !strcmp( json_string_value( value ), name )) {
+            return json_object_get( json_array_get( entries, i ), "value" );
+        }
+    }
+    return NULL;
+}
+
+/* name_scan: count entries from the first name at or after start */
+static json_t* bdgr_stub_scan( const char* const start, const int count )
+{
+    json_t* const result = json_array();
+    json_t* entry, * name;
+    unsigned long int i;
+    int found = 0;
+
+    for( i = 0; i < json_array_size( bdgr_stub.names ) &&
+             json_array_size( result ) < (size_t)count; i++ ) {
+        entry = json_array_get( bdgr_stub.names, i );
+        name = json_object_get( entry, "name" );
+        found = found || ( json_is_string( name ) &&
+                           strcmp( json_string_value( name ), start ) >= 0 );
+        if( found ) {
+            json_array_append( result, entry );
+        }
+    }
+    return result;
+}
+
+static json_t* bdgr_stub_answer( json_t* const request )
+{
+    const char* const method =
+        json_string_value( json_object_get( request, "method" ));
+    json_t* const params = json_object_get( request, "params" );
+    json_t* result = NULL, * value;
+
+    pthread_mutex_lock( &bdgr_stub.lock );
+    if( method == NULL ) {
+        result = NULL;
+    } else if( !strcmp( method, "getblockcount" )) {
+        result = json_integer( bdgr_stub.height );
+    } else if( !strcmp( method, "name_scan" )) {
+        /* A scan that doesn't move on is failed rather than left to spin */
+        if( ++bdgr_stub.scans % 100 ) {
+            result = bdgr_stub_scan(
+                json_string_value( json_array_get( params, 0 )),
+                (int)json_integer_value( json_array_get( params, 1 )));
+        }
+    } else if( !strcmp( method, "name_filter" )) {
+        pthread_mutex_unlock( &bdgr_stub.lock );
+        usleep( bdgr_stub.delay_ms * 1000 );
+        pthread_mutex_lock( &bdgr_stub.lock );
+        bdgr_stub.filters++;
+        result = json_incref( bdgr_stub.filtered );
+    } else if( !strcmp( method, "name_show" )) {
+        bdgr_stub.shows++;
+        value = json_array_get( params, 0 );
+        value = json_is_string( value ) ? bdgr_stub_find(
+            bdgr_stub.names, json_string_value( value )) : NULL;
+        if( value != NULL ) {
+            result = json_pack( "{sO}", "value", value );
+        }
+    }
+    pthread_mutex_unlock( &bdgr_stub.lock );
+
+    if( result == NULL ) {
+        return json_pack( "{sns{si ss}sn}", "result", "error",
+                          "code", -4, "message", "stub error", "id" );
+    }
+    return json_pack( "{sosnsn}", "result", result, "error", "id" );
+}
+
+/* Answers one request per connection */
+static void bdgr_stub_serve( const int fd )
+{
+    char request[ 4096 ], head[ 128 ], * body, * dump;
+    json_t* root, * response;
+    long int length = -1;
+    ssize_t got;
+    size_t size = 0;
+
+    while( size < sizeof( request ) - 1 &&
+           ( got = read( fd, request + size,
+                         sizeof( request ) - 1 - size )) > 0 ) {
+        size += got;
+        request[ size ] = '\0';
+        body = strstr( request, "\r\n\r\n" );
+        if( body != NULL && length < 0 ) {
+            length = strtol( strstr( request, "Content-Length:" ) + 15,
+                             NULL, 10 );
+        }
+        if( body != NULL && (size_t)( body + 4 - request + length ) <= size ) {
+            break;
+        }
+    }
+    body = strstr( request, "\r\n\r\n" );
+    if( body == NULL ) {
+        return;
+    }
+
+    root = json_loadb( body + 4, length, 0, NULL );
+    response = bdgr_stub_answer( root );
+    dump = json_dumps( response, JSON_COMPACT );
+    sprintf( head, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+             "Content-Length: %lu\r\nConnection: close\r\n\r\n",
+             (unsigned long int)strlen( dump ));
+    if( write( fd, head, strlen( head )) < 0 ||
+        write( fd, dump, strlen( dump )) < 0 ) {
+        perror( "write" );
+    }
+    free( dump );
+    json_decref( response );
+    json_decref( root );
+}
+
+static void* bdgr_stub_run( void* const arg )
+{
+    int fd;
+    (void)arg;
+
+    while( ( fd = accept( bdgr_stub.fd, NULL, NULL )) >= 0 ) {
+        bdgr_stub_serve( fd );
+        close( fd );
+    }
+    return NULL;
+}
+
+/* Starts the stub on a free port and points Badger at it */
+static int bdgr_stub_start( pthread_t* const thread )
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof( addr );
+    char url[ 64 ];
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    bdgr_stub.fd = socket( AF_INET, SOCK_STREAM, 0 );
+    if( bdgr_stub.fd < 0 ||
+        bind( bdgr_stub.fd, (struct sockaddr*)&addr, sizeof( addr )) ||
+        listen( bdgr_stub.fd, 16 ) ||
+        getsockname( bdgr_stub.fd, (struct sockaddr*)&addr, &addr_len )) {
+        return -1;
+    }
+    sprintf( url, "http://127.0.0.1:%d/", ntohs( addr.sin_port ));
+    setenv( "BADGER_NMC_RPC", url, 1 );
+    return pthread_create( thread, NULL, bdgr_stub_run, NULL );
+}
+
+static void bdgr_stub_names( const char* const record )
+{
+    char name[ 32 ];
+    int i;
+
+    bdgr_stub.names = json_array();
+    for( i = 0; i < BDGR_STUB_NAMES; i++ ) {
+        sprintf( name, "id/n%04d", i );
+        json_array_append_new(
+            bdgr_stub.names,
+            i % BDGR_STUB_PAGE == BDGR_STUB_PAGE - 1 ?
+            json_pack( "{sisi}", "name", i, "value", 0 ) :
+            json_pack( "{ssss}", "name", name, "value",
+                       i == 10 || i == 1050 ? record : "{}" ));
+    }
+    json_array_append_new( bdgr_stub.names,
+                           json_pack( "{ssss}", "name", "x/after",
+                                      "value", "{}" ));
+    bdgr_stub.filtered = json_array();
+}
+
+/*
+  Adds a name the next name_filter reports, mined in a new block.  It goes
+  last of the id/ names, which it must sort after.
+*/
+static void bdgr_stub_mine( const char* const name, const char* const record )
+{
+    json_t* const entry = json_pack( "{ssss}", "name", name, "value", record );
+
+    pthread_mutex_lock( &bdgr_stub.lock );
+    json_array_insert( bdgr_stub.names, json_array_size( bdgr_stub.names ) - 1,
+                       entry );
+    json_array_clear( bdgr_stub.filtered );
+    json_array_append_new( bdgr_stub.filtered, entry );
+    bdgr_stub.height++;
+    pthread_mutex_unlock( &bdgr_stub.lock );
+}
+
+static int bdgr_stub_count( const int* const counter )
+{
+    int count;
+
+    pthread_mutex_lock( &bdgr_stub.lock );
+    count = *counter;
+    pthread_mutex_unlock( &bdgr_stub.lock );
+    return count;
+}
+
+static int bdgr_test_verify( const char* const id, const bdgr_key* const key )
+{
+    static const unsigned char token[] = "mirror test";
+    unsigned char signature[ 128 ];
+    unsigned long int signature_len = sizeof( signature );
+    bdgr_badge badge;
+    int verified = 0;
+
+    if( bdgr_token_sign( token, sizeof( token ), key,
+                         signature, &signature_len ) ||
+        bdgr_badge_make( id, token, sizeof( token ),
+                         signature, signature_len, &badge )) {
+        return 0;
+    }
+    bdgr_badge_verify( &badge, &verified );
+    bdgr_badge_free( &badge );
+    return verified;
+}
+
+static void* bdgr_test_sync( void* const arg )
+{
+    (void)arg;
+    bdgr_nmc_mirror_sync();
+    return NULL;
+}
+
+int main()
+{
+    pthread_t stub, sync;
+    bdgr_key key;
+    char* encoded, * record;
+
+    if( !bdgr_test( bdgr_stub_start( &stub ) == 0 ) ||
+        !bdgr_test( bdgr_key_generate( "mirror test", &key ) == 0 ) ||
+        !bdgr_test( bdgr_key_encode_public( &key, &encoded ) == 0 )) {
+        return 1;
+    }
+    record = malloc( strlen( encoded ) + 16 );
+    sprintf( record, "{\"dsa\":\"%s\"}", encoded );
+    bdgr_stub_names( record );
+
+    /* Three pages, each but the last ending without a name */
+    bdgr_test( bdgr_nmc_mirror_start( 3600 ) == 0 );
+    bdgr_test( bdgr_stub_count( &bdgr_stub.scans ) == 3 );
+    bdgr_test( bdgr_test_verify( "id:n0010", &key ));
+    bdgr_test( bdgr_test_verify( "id:n1050", &key ));
+    bdgr_test( bdgr_test_verify( "nmc:id/n1050", &key ));
+    bdgr_test( !bdgr_test_verify( "id:n0011", &key ));
+    bdgr_test( bdgr_stub_count( &bdgr_stub.shows ) == 0 );
+
+    /* Names mined since are picked up by a poll */
+    bdgr_stub_mine( "id/z-fresh", record );
+    bdgr_test( bdgr_nmc_mirror_sync() == 0 );
+    bdgr_test( bdgr_stub_count( &bdgr_stub.filters ) == 1 );
+    bdgr_test( bdgr_test_verify( "id:z-fresh", &key ));
+    bdgr_test( bdgr_stub_count( &bdgr_stub.shows ) == 0 );
+
+    /* Stopping waits for the poll under way, which then writes nothing */
+    bdgr_stub_mine( "id/z-late", record );
+    bdgr_stub.delay_ms = 300;
+    pthread_create( &sync, NULL, bdgr_test_sync, NULL );
+    usleep( 100 * 1000 );
+    bdgr_nmc_mirror_stop();
+    bdgr_test( bdgr_stub_count( &bdgr_stub.filters ) == 2 );
+    pthread_join( sync, NULL );
+    bdgr_stub.delay_ms = 0;
+
+    /* Stopped, lookups go to the node */
+    bdgr_test( bdgr_test_verify( "id:z-late", &key ));
+    bdgr_test( bdgr_stub_count( &bdgr_stub.shows ) == 1 );
+
+    /* Started again, the mirror is bootstrapped anew */
+    bdgr_test( bdgr_nmc_mirror_start( 3600 ) == 0 );
+    bdgr_test( bdgr_stub_count( &bdgr_stub.scans ) == 6 );
+    bdgr_test( bdgr_test_verify( "id:z-late", &key ));
+    bdgr_test( bdgr_stub_count( &bdgr_stub.shows ) == 1 );
+    bdgr_nmc_mirror_stop();
+
+    shutdown( bdgr_stub.fd, SHUT_RDWR );
+    close( bdgr_stub.fd );
+    pthread_join( stub, NULL );
+    json_decref( bdgr_stub.names );
+    json_decref( bdgr_stub.filtered );
+    bdgr_free( encoded );
+    free( record );
+    bdgr_key_free( &key );
+    return bdgr_test_failed != 0;
+}
@@ -0,0 +1,246 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs peer fill across nodes forked to listen on 127.0.0.1, all with a
+  stub scheme counting its fetches in shared memory: the authority sees one
+  fetch per URL however often it is asked for, errors the owner got are
+  passed on, and the asking node goes to the authority itself when the
+  owner is down, doesn't fetch the scheme, or doesn't hold the peer key.
+  A request without a good tag is hung up on.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+#define BDGR_TEST_NODES 3
+#define BDGR_TEST_URLS  12
+
+/* Fetches made by each node, the asking node last */
+static int* bdgr_test_fetches;
+static int bdgr_test_node = BDGR_TEST_NODES;
+static char* bdgr_test_signed;
+
+static int bdgr_stub_start( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)ctx;
+    bdgr_test_fetches[ bdgr_test_node ]++;
+    if( strstr( bdgr_lookup_url( lookup ), "missing" ) != NULL ) {
+        bdgr_lookup_complete( lookup, bdgr_http_not_found_err );
+    } else {
+        bdgr_lookup_write( lookup, bdgr_test_signed,
+                           strlen( bdgr_test_signed ));
+        bdgr_lookup_complete( lookup, 0 );
+    }
+    return 0;
+}
+
+/* A port nothing listens on, for now */
+static int bdgr_test_port()
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof( addr );
+    int fd, port = -1;
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    fd = socket( AF_INET, SOCK_STREAM, 0 );
+    if( fd >= 0 &&
+        !bind( fd, (struct sockaddr*)&addr, sizeof( addr )) &&
+        !getsockname( fd, (struct sockaddr*)&addr, &addr_len )) {
+        port = ntohs( addr.sin_port );
+    }
+    close( fd );
+    return port;
+}
+
+/* Sends line to port, returning how many bytes came back before hang up */
+static long int bdgr_test_raw( const int port, const char* const line )
+{
+    struct sockaddr_in addr;
+    struct timeval timeout = { 2, 0 };
+    char reply[ 256 ];
+    long int got = -1;
+    int fd;
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port = htons( port );
+    fd = socket( AF_INET, SOCK_STREAM, 0 );
+    if( fd >= 0 &&
+        !setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                     sizeof( timeout )) &&
+        !connect( fd, (struct sockaddr*)&addr, sizeof( addr )) &&
+        write( fd, line, strlen( line )) == (ssize_t)strlen( line )) {
+        got = read( fd, reply, sizeof( reply ));
+    }
+    close( fd );
+    return got;
+}
+
+/* Fetches by the nodes, leaving out the asking one */
+static int bdgr_test_owned()
+{
+    int i, sum = 0;
+
+    for( i = 0; i < BDGR_TEST_NODES; i++ ) {
+        sum += bdgr_test_fetches[ i ];
+    }
+    return sum;
+}
+
+int main()
+{
+    static const unsigned char peer_key[] = "peer test key, the same on all";
+    static const unsigned char wrong_key[] = "peer test key, but another one";
+    static const char* const schemes[] = { "stub" };
+    char addresses[ BDGR_TEST_NODES ][ 32 ], id[ 64 ];
+    const char* peers[ BDGR_TEST_NODES ];
+    int ports[ BDGR_TEST_NODES ], owned[ BDGR_TEST_NODES ];
+    pid_t pids[ BDGR_TEST_NODES ];
+    int ready[ 2 ], down = 0, verified, before, err, i;
+    bdgr_key signer;
+    char started;
+
+    bdgr_test_fetches = mmap( NULL, sizeof( int ) * ( BDGR_TEST_NODES + 1 ),
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( !bdgr_test( bdgr_test_fetches != MAP_FAILED ) ||
+        !bdgr_test( pipe( ready ) == 0 ) ||
+        !bdgr_test( bdgr_key_generate( "peer test", &signer ) == 0 ) ||
+        !bdgr_test( ( bdgr_test_signed = bdgr_test_record(
+                          &signer )) != NULL ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "stub:", bdgr_stub_start,
+                                                   NULL, NULL ) == 0 ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "plain:", bdgr_stub_start,
+                                                   NULL, NULL ) == 0 )) {
+        return 1;
+    }
+    memset( bdgr_test_fetches, 0, sizeof( int ) * ( BDGR_TEST_NODES + 1 ));
+    for( i = 0; i < BDGR_TEST_NODES; i++ ) {
+        ports[ i ] = bdgr_test_port();
+        sprintf( addresses[ i ], "127.0.0.1:%d", ports[ i ] );
+        peers[ i ] = addresses[ i ];
+    }
+
+    /* Nobody listens or asks without the peer key */
+    bdgr_test( bdgr_peer_listen( addresses[ 0 ] ) == bdgr_peer_key_err );
+    bdgr_test( bdgr_peer_key_set( peer_key, 8 ) == bdgr_peer_key_err );
+    bdgr_test( bdgr_peer_key_set( peer_key, sizeof( peer_key )) == 0 );
+    bdgr_test( bdgr_peer_schemes( schemes, 1 ) == 0 );
+
+    for( i = 0; i < BDGR_TEST_NODES; i++ ) {
+        pids[ i ] = fork();
+        if( pids[ i ] == 0 ) {
+            bdgr_test_node = i;
+            started = bdgr_key_cache_open( NULL, 64, 0 ) == 0 &&
+                bdgr_peers_set( peers, BDGR_TEST_NODES, i ) == 0 &&
+                bdgr_peer_listen( addresses[ i ] ) == 0;
+            if( write( ready[ 1 ], &started, 1 ) != 1 || !started ) {
+                _exit( 1 );
+            }
+            while( 1 ) {
+                pause();
+            }
+        }
+        bdgr_test( pids[ i ] > 0 );
+    }
+    for( i = 0; i < BDGR_TEST_NODES; i++ ) {
+        if( !bdgr_test( read( ready[ 0 ], &started, 1 ) == 1 && started )) {
+            goto main_done;
+        }
+    }
+    bdgr_test( bdgr_peers_set( peers, BDGR_TEST_NODES, -1 ) == 0 );
+
+    /* One fetch per URL, by its owner, however often it is asked for */
+    for( i = 0; i < BDGR_TEST_URLS * 2; i++ ) {
+        sprintf( id, "stub:user-%d", i % BDGR_TEST_URLS );
+        bdgr_test( bdgr_test_verifies( id, NULL, &signer, -1, NULL ));
+    }
+    bdgr_test( bdgr_test_owned() == BDGR_TEST_URLS );
+    bdgr_test( bdgr_test_fetches[ BDGR_TEST_NODES ] == 0 );
+    for( i = 0; i < BDGR_TEST_NODES; i++ ) {
+        owned[ i ] = bdgr_test_fetches[ i ];
+        if( owned[ i ] > owned[ down ] ) {
+            down = i;
+        }
+    }
+
+    /* The error the owner got is passed on, not fetched again */
+    for( i = 0; i < 4; i++ ) {
+        sprintf( id, "stub:missing-%d", i );
+        bdgr_test( !bdgr_test_verifies( id, NULL, &signer, -1, &err ));
+        bdgr_test( err == bdgr_http_not_found_err );
+    }
+    bdgr_test( bdgr_test_owned() == BDGR_TEST_URLS + 4 );
+    bdgr_test( bdgr_test_fetches[ BDGR_TEST_NODES ] == 0 );
+
+    /* A scheme the nodes don't fetch for peers is fetched here */
+    bdgr_test( bdgr_test_verifies( "plain:user-0", NULL, &signer, -1, NULL ));
+    bdgr_test( bdgr_test_fetches[ BDGR_TEST_NODES ] == 1 );
+
+    /* Answers under another key aren't taken, and requests hung up on */
+    bdgr_test( bdgr_peer_key_set( wrong_key, sizeof( wrong_key )) == 0 );
+    bdgr_test( bdgr_test_verifies( "stub:user-0", NULL, &signer, -1, NULL ));
+    bdgr_test( bdgr_test_fetches[ BDGR_TEST_NODES ] == 2 );
+    bdgr_test( bdgr_peer_key_set( peer_key, sizeof( peer_key )) == 0 );
+    bdgr_test( bdgr_test_raw( ports[ 0 ], "GET 0 stub:user-0\n" ) == 0 );
+    bdgr_test( bdgr_test_owned() == BDGR_TEST_URLS + 4 );
+
+    /* With its owner down, a URL is fetched from the authority */
+    kill( pids[ down ], SIGKILL );
+    waitpid( pids[ down ], NULL, 0 );
+    pids[ down ] = 0;
+    before = bdgr_test_fetches[ BDGR_TEST_NODES ];
+    verified = 0;
+    for( i = 0; i < BDGR_TEST_URLS; i++ ) {
+        sprintf( id, "stub:user-%d", i );
+        verified += bdgr_test_verifies( id, NULL, &signer, -1, NULL );
+    }
+    bdgr_test( verified == BDGR_TEST_URLS );
+    bdgr_test( bdgr_test_fetches[ BDGR_TEST_NODES ] - before ==
+               owned[ down ] );
+    bdgr_test( bdgr_test_owned() == BDGR_TEST_URLS + 4 );
+
+ main_done:
+
+    for( i = 0; i < BDGR_TEST_NODES; i++ ) {
+        if( pids[ i ] > 0 ) {
+            kill( pids[ i ], SIGKILL );
+            waitpid( pids[ i ], NULL, 0 );
+        }
+    }
+    free( bdgr_test_signed );
+    bdgr_key_free( &signer );
+    return bdgr_test_failed != 0;
+}
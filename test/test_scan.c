@@ -0,0 +1,139 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs the streaming dsa scanner through a stub scheme that writes records
+  a few bytes at a time: the dsa member of the outer object is picked out
+  however the record is split, escapes included, while a second dsa member,
+  one that isn't a string, a truncated record or one over the record limit
+  fail the lookup.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+static struct {
+    const char*       record;
+    unsigned long int chunk;
+    int               refused;
+} bdgr_stub;
+
+/* Writes the record chunk bytes at a time, noting writes refused */
+static int bdgr_stub_start( bdgr_lookup* const lookup, void* const ctx )
+{
+    const unsigned long int size = strlen( bdgr_stub.record );
+    unsigned long int i, n;
+    (void)ctx;
+
+    bdgr_stub.refused = 0;
+    for( i = 0; i < size; i += n ) {
+        n = size - i < bdgr_stub.chunk ? size - i : bdgr_stub.chunk;
+        bdgr_stub.refused += bdgr_lookup_write( lookup, bdgr_stub.record + i,
+                                                n ) != 0;
+    }
+    bdgr_lookup_complete( lookup, 0 );
+    return 0;
+}
+
+/* Verifies a badge against record split into chunk byte writes */
+static int bdgr_test_scans(
+    const char* const record,
+    const unsigned long int chunk,
+    const bdgr_key* const key,
+    int* const err
+)
+{
+    bdgr_stub.record = record;
+    bdgr_stub.chunk = chunk;
+    return bdgr_test_verifies( "stub:scan", NULL, key, -1, err );
+}
+
+int main()
+{
+    bdgr_key key;
+    char* encoded, * escaped, record[ 4096 ];
+    unsigned long int i, j;
+    int err;
+
+    if( !bdgr_test( bdgr_key_generate( "scan test", &key ) == 0 ) ||
+        !bdgr_test( bdgr_key_encode_public( &key, &encoded ) == 0 ) ||
+        !bdgr_test( strlen( encoded ) < 1024 ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "stub:", bdgr_stub_start,
+                                                   NULL, NULL ) == 0 )) {
+        return 1;
+    }
+
+    /* Nested dsa members and trailing data are ignored, at any split */
+    sprintf( record, "{ \"id\": \"scan\", \"keys\": { \"dsa\": \"x\" },\n"
+             "  \"dsa\": \"%s\", \"more\": [ 1, { \"dsa\": 2 } ] } trailing",
+             encoded );
+    bdgr_test( bdgr_test_scans( record, strlen( record ), &key, NULL ));
+    bdgr_test( bdgr_test_scans( record, 1, &key, NULL ));
+    bdgr_test( bdgr_test_scans( record, 7, &key, NULL ));
+
+    /* Escapes, in the value and the name */
+    escaped = malloc( strlen( encoded ) * 2 + 1 );
+    for( i = j = 0; escaped != NULL && encoded[ i ] != '\0'; i++ ) {
+        if( encoded[ i ] == '/' ) {
+            escaped[ j++ ] = '\\';
+        }
+        escaped[ j++ ] = encoded[ i ];
+    }
+    if( bdgr_test( escaped != NULL )) {
+        escaped[ j ] = '\0';
+        sprintf( record, "{\"\\u0064sa\":\"%s\"}", escaped );
+        bdgr_test( bdgr_test_scans( record, 3, &key, NULL ));
+    }
+    free( escaped );
+
+    /* A second dsa member could be read either way, so it is refused */
+    sprintf( record, "{\"dsa\":\"%s\",\"dsa\":\"%s\"}", encoded, encoded );
+    bdgr_test( !bdgr_test_scans( record, 5, &key, &err ));
+    bdgr_test( err == bdgr_json_dsa_duplicate_err );
+
+    /* Not a string, missing, not an object, cut short */
+    bdgr_test( !bdgr_test_scans( "{\"dsa\":{\"p\":1}}", 1, &key, &err ));
+    bdgr_test( err == bdgr_json_dsa_not_string_err );
+    bdgr_test( !bdgr_test_scans( "{\"id\":\"scan\"}", 1, &key, &err ));
+    bdgr_test( err == bdgr_json_dsa_missing_err );
+    bdgr_test( !bdgr_test_scans( "[\"dsa\"]", 1, &key, &err ));
+    bdgr_test( err == bdgr_record_syntax_err );
+    sprintf( record, "{\"dsa\":\"%s\"", encoded );
+    bdgr_test( !bdgr_test_scans( record, 1, &key, &err ));
+    bdgr_test( err == bdgr_record_syntax_err );
+
+    /* The limit counts what was written, a byte over it fails the lookup */
+    sprintf( record, "{\"dsa\":\"%s\"}", encoded );
+    bdgr_test( bdgr_record_limit( strlen( record )) == 0 );
+    bdgr_test( bdgr_test_scans( record, 4, &key, NULL ));
+    bdgr_test( bdgr_stub.refused == 0 );
+    bdgr_test( bdgr_record_limit( strlen( record ) - 1 ) == 0 );
+    bdgr_test( !bdgr_test_scans( record, 4, &key, &err ));
+    bdgr_test( err == bdgr_record_too_large_err );
+    bdgr_test( bdgr_stub.refused > 0 );
+    bdgr_record_limit( 65536 );
+
+    bdgr_free( encoded );
+    bdgr_key_free( &key );
+    return bdgr_test_failed != 0;
+}
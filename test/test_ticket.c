@@ -0,0 +1,110 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs session tickets through issue and check: the Identity URL comes
+  back from a good ticket, any byte changed or cut off is refused, expired
+  tickets are refused, and a ticket checks for as long as its key is one of
+  the last four added, or is added again.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+/* Whether ticket checks as issued for id, or else its error */
+static int bdgr_test_ticket(
+    const unsigned char* const ticket,
+    const unsigned long int ticket_len,
+    const char* const id
+)
+{
+    char* checked = NULL;
+    int err;
+
+    err = bdgr_session_ticket_check( ticket, ticket_len, &checked );
+    if( !err && strcmp( checked, id )) {
+        err = -1;
+    }
+    bdgr_free( checked );
+    return err;
+}
+
+int main()
+{
+    static const char id[] = "https://example.com/alice";
+    unsigned char key[ 32 ], ticket[ 256 ], copy[ 256 ];
+    unsigned long int ticket_len, i;
+    int rotation;
+
+    /* A random key is made for the first ticket */
+    ticket_len = sizeof( ticket );
+    bdgr_test( bdgr_session_ticket_issue( id, 60, ticket, &ticket_len ) == 0 );
+    bdgr_test( bdgr_test_ticket( ticket, ticket_len, id ) == 0 );
+
+    /* Too small a buffer is told the size it needs */
+    i = 8;
+    bdgr_test( bdgr_session_ticket_issue( id, 60, copy, &i ) != 0 );
+    bdgr_test( i == ticket_len );
+
+    /* Every byte is covered, and nothing may be cut off */
+    for( i = 0; i < ticket_len; i++ ) {
+        memcpy( copy, ticket, ticket_len );
+        copy[ i ] ^= 0x01;
+        if( !bdgr_test( bdgr_test_ticket( copy, ticket_len, id ) ==
+                        bdgr_ticket_invalid_err )) {
+            fprintf( stderr, "  at byte %lu\n", i );
+        }
+    }
+    bdgr_test( bdgr_test_ticket( ticket, ticket_len - 1, id ) ==
+               bdgr_ticket_invalid_err );
+    bdgr_test( bdgr_test_ticket( ticket, 4, id ) == bdgr_ticket_invalid_err );
+
+    /* Expired as soon as its lifetime is up */
+    ticket_len = sizeof( ticket );
+    bdgr_test( bdgr_session_ticket_issue( id, 0, ticket, &ticket_len ) == 0 );
+    bdgr_test( bdgr_test_ticket( ticket, ticket_len, id ) ==
+               bdgr_ticket_expired_err );
+
+    /* AES key sizes only */
+    memset( key, 0x5a, sizeof( key ));
+    bdgr_test( bdgr_session_ticket_key_add( key, 20 ) ==
+               bdgr_ticket_key_err );
+
+    /* Good through three rotations, rotated out by the fourth */
+    bdgr_test( bdgr_session_ticket_key_add( key, sizeof( key )) == 0 );
+    ticket_len = sizeof( ticket );
+    bdgr_test( bdgr_session_ticket_issue( id, 60, ticket, &ticket_len ) == 0 );
+    for( rotation = 0; rotation < 3; rotation++ ) {
+        bdgr_test( bdgr_session_ticket_rotate() == 0 );
+        bdgr_test( bdgr_test_ticket( ticket, ticket_len, id ) == 0 );
+    }
+    bdgr_test( bdgr_session_ticket_rotate() == 0 );
+    bdgr_test( bdgr_test_ticket( ticket, ticket_len, id ) ==
+               bdgr_ticket_invalid_err );
+
+    /* A server given the key accepts it again */
+    bdgr_test( bdgr_session_ticket_key_add( key, sizeof( key )) == 0 );
+    bdgr_test( bdgr_test_ticket( ticket, ticket_len, id ) == 0 );
+
+    return bdgr_test_failed != 0;
+}
@@ -0,0 +1,180 @@
+/*
+  Copyright 2013 John Driscoll
+
+  This file is part of Badger.
+
+  Badger is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Badger is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Badger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Runs server tokens through make and check: a token checks for its own
+  audience until it is max_age old, any byte changed is refused, and its
+  key keeps checking through three rotations.  Once tokens are required,
+  a badge with a forged token is refused before its record is fetched.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <badger.h>
+#include "../src/badger_err.h"
+#include "test.h"
+
+static struct {
+    const char* record;
+    int         fetches;
+} bdgr_stub;
+
+static int bdgr_stub_start( bdgr_lookup* const lookup, void* const ctx )
+{
+    (void)ctx;
+    bdgr_stub.fetches++;
+    bdgr_lookup_write( lookup, bdgr_stub.record, strlen( bdgr_stub.record ));
+    bdgr_lookup_complete( lookup, 0 );
+    return 0;
+}
+
+/* Verifies a badge for id carrying token, signed by key */
+static int bdgr_test_admits(
+    const char* const id,
+    const unsigned char* const token,
+    const unsigned long int token_len,
+    const bdgr_key* const key,
+    int* const err
+)
+{
+    unsigned char signature[ 128 ];
+    unsigned long int signature_len = sizeof( signature );
+    bdgr_badge badge;
+    int verified = 0;
+
+    *err = bdgr_token_sign( token, token_len, key, signature,
+                            &signature_len );
+    if( !*err ) {
+        *err = bdgr_badge_make_kid( id, NULL, token, token_len, signature,
+                                    signature_len, &badge );
+    }
+    if( !*err ) {
+        *err = bdgr_badge_verify( &badge, &verified );
+        bdgr_badge_free( &badge );
+    }
+    return !*err && verified;
+}
+
+int main()
+{
+    static const char audience[] = "https://rp.example.com";
+    unsigned char key[ 32 ], token[ 512 ], copy[ 512 ];
+    char long_audience[ 512 ];
+    unsigned long int token_len, i;
+    bdgr_key signer;
+    char* record;
+    int rotation, err;
+
+    if( !bdgr_test( bdgr_key_generate( "token test", &signer ) == 0 ) ||
+        !bdgr_test( ( record = bdgr_test_record( &signer )) != NULL ) ||
+        !bdgr_test( bdgr_scheme_handler_add_async( "stub:", bdgr_stub_start,
+                                                   NULL, NULL ) == 0 )) {
+        return 1;
+    }
+    bdgr_stub.record = record;
+
+    /* A random key is made for the first token, which checks */
+    token_len = sizeof( token );
+    bdgr_test( bdgr_server_token_make( audience, token, &token_len ) == 0 );
+    bdgr_test( bdgr_server_token_check( token, token_len, 60,
+                                        audience ) == 0 );
+    bdgr_test( bdgr_server_token_check( token, token_len, 0, NULL ) == 0 );
+
+    /* Too small a buffer is told the size it needs */
+    i = 8;
+    bdgr_test( bdgr_server_token_make( audience, copy, &i ) != 0 );
+    bdgr_test( i == token_len );
+
+    /* Forged: any byte changed, cut short, or a tag that isn't ours */
+    for( i = 0; i < token_len; i++ ) {
+        memcpy( copy, token, token_len );
+        copy[ i ] ^= 0x01;
+        if( !bdgr_test( bdgr_server_token_check( copy, token_len, 60,
+                                                 NULL ) != 0 )) {
+            fprintf( stderr, "  at byte %lu\n", i );
+        }
+    }
+    copy[ token_len - 1 ] ^= 0x01;
+    copy[ token_len - 2 ] ^= 0x01;
+    bdgr_test( bdgr_server_token_check( copy, token_len, 60, NULL ) ==
+               bdgr_server_token_invalid_err );
+    bdgr_test( bdgr_server_token_check( token, token_len - 1, 60, NULL ) ==
+               bdgr_server_token_invalid_err );
+    bdgr_test( bdgr_server_token_check( token, 4, 60, NULL ) ==
+               bdgr_server_token_invalid_err );
+
+    /* Made for one audience, refused by another */
+    bdgr_test( bdgr_server_token_check( token, token_len, 60,
+                                        "https://other.example.com" ) ==
+               bdgr_server_token_invalid_err );
+    token_len = sizeof( token );
+    bdgr_test( bdgr_server_token_make( NULL, token, &token_len ) == 0 );
+    bdgr_test( bdgr_server_token_check( token, token_len, 60,
+                                        audience ) ==
+               bdgr_server_token_invalid_err );
+    memset( long_audience, 'a', sizeof( long_audience ) - 1 );
+    long_audience[ sizeof( long_audience ) - 1 ] = '\0';
+    bdgr_test( bdgr_server_token_require( 60, long_audience ) ==
+               bdgr_server_token_audience_err );
+
+    /* Stale once max_age has gone by */
+    bdgr_test( bdgr_server_token_check( token, token_len, 1, NULL ) == 0 );
+    sleep( 2 );
+    bdgr_test( bdgr_server_token_check( token, token_len, 1, NULL ) ==
+               bdgr_server_token_expired_err );
+    bdgr_test( bdgr_server_token_check( token, token_len, 60, NULL ) == 0 );
+
+    /* Good through three rotations, rotated out by the fourth */
+    memset( key, 0x3c, sizeof( key ));
+    bdgr_test( bdgr_server_token_key_add( key, 8 ) ==
+               bdgr_server_token_key_err );
+    bdgr_test( bdgr_server_token_key_add( key, sizeof( key )) == 0 );
+    token_len = sizeof( token );
+    bdgr_test( bdgr_server_token_make( audience, token, &token_len ) == 0 );
+    for( rotation = 0; rotation < 3; rotation++ ) {
+        bdgr_test( bdgr_server_token_rotate() == 0 );
+        bdgr_test( bdgr_server_token_check( token, token_len, 60,
+                                            audience ) == 0 );
+    }
+    bdgr_test( bdgr_server_token_rotate() == 0 );
+    bdgr_test( bdgr_server_token_check( token, token_len, 60, audience ) ==
+               bdgr_server_token_invalid_err );
+    bdgr_test( bdgr_server_token_key_add( key, sizeof( key )) == 0 );
+    bdgr_test( bdgr_server_token_check( token, token_len, 60,
+                                        audience ) == 0 );
+
+    /* Required: a forged token costs no fetch, a real one verifies */
+    bdgr_test( bdgr_server_token_require( 60, audience ) == 0 );
+    bdgr_test( !bdgr_test_verifies( "stub:alice", NULL, &signer, -1, &err ));
+    bdgr_test( err == bdgr_server_token_invalid_err );
+    bdgr_test( bdgr_stub.fetches == 0 );
+    bdgr_test( bdgr_test_admits( "stub:alice", token, token_len, &signer,
+                                 &err ));
+    bdgr_test( err == 0 && bdgr_stub.fetches == 1 );
+
+    /* No longer required */
+    bdgr_test( bdgr_server_token_require( 0, NULL ) == 0 );
+    bdgr_test( bdgr_test_verifies( "stub:alice", NULL, &signer, -1, NULL ));
+
+    free( record );
+    bdgr_key_free( &signer );
+    return bdgr_test_failed != 0;
+}